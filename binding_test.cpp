@@ -0,0 +1,93 @@
+/* Tests of the C++ binding (jsonparser.hpp) */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "jsonparser.hpp"
+
+using namespace json::literals;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (ok) {
+        std::printf("  PASS: %s\n", what);
+    } else {
+        std::printf("  FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/* Keys are prepared at compile time */
+static_assert("id"_key.size() == 2, "key length");
+static_assert("a_rather_long_key"_key.view() == "a_rather_long_key", "key text");
+static_assert(!std::is_copy_constructible<json::document>::value, "documents are move-only");
+static_assert(std::is_nothrow_move_constructible<json::document>::value, "documents move without throwing");
+
+static void test_lookups() {
+    std::printf("Test: Look up members and items\n");
+    json::document doc = json::document::parse(
+        "{\"user\": {\"name\": \"ann\", \"id\": 7, \"admin\": false, \"a_rather_long_key\": \"x\","
+        " \"a_rather_long_kez\": \"y\"}, \"tags\": [\"a\", \"b\"], \"\": null}");
+    check(bool(doc), "document parsed");
+
+    json::value user = doc["user"_key];
+    check(user.is_object() && user.size() == 5, "nested object");
+    check(user["name"_key].as_string() == "ann", "string through a key literal");
+    check(user["id"].as_number() == 7 && user[std::string("admin")].is_bool(), "runtime keys");
+    check(user["a_rather_long_key"_key].as_string() == "x" && user["a_rather_long_kez"_key].as_string() == "y",
+          "keys longer than eight bytes");
+    check(doc[""_key].is_null(), "empty key");
+    check(!user["nam"_key] && !user["names"_key] && !doc["user"_key]["name"_key]["x"_key], "missing keys are empty");
+    check(doc["tags"_key][1].as_string() == "b" && !doc["tags"_key][2] && !doc["tags"_key][-1], "array items");
+    check(doc["missing"_key]["deeper"_key].as_string("none") == "none", "fallback on a missing value");
+}
+
+static void test_iteration() {
+    std::printf("Test: Iterate with range-for\n");
+    json::document doc = json::document::parse("{\"b\": 1, \"a\": [true, \"x\", 3], \"n\": [1.5, 2.5, 3]}");
+    std::string keys;
+    for (json::member m : doc.root().members()) keys += m.key();
+    check(keys == "ban", "members in document order");
+
+    int items = 0;
+    for (json::value v : doc["a"_key].items()) items += v ? 1 : 0;
+    check(items == 3, "array items");
+
+    double sum = 0;
+    json::double_span numbers = doc["n"_key].numbers();
+    for (double d : numbers) sum += d;
+    check(numbers.size() == 3 && sum == 7 && doc["n"_key].size() == 3, "packed numbers as a span");
+    check(doc["a"_key].numbers().empty() && doc["b"_key].items().begin() == doc["b"_key].items().end(),
+          "no numbers or items where there are none");
+}
+
+static void test_ownership() {
+    std::printf("Test: Own documents and report errors\n");
+    json::document a = json::document::parse("[1, 2]");
+    json::document b = std::move(a);
+    check(!a && b && b[0].as_number() == 1, "moved document");
+    b = json::document::parse("{\"k\": \"v\"}");
+    check(b["k"_key].serialize() == "\"v\"", "assignment frees the previous tree");
+
+    json::document bad = json::document::parse("{\"k\" 1}");
+    check(!bad && json::last_error().code == JSON_ERROR_SYNTAX && json::last_error().offset == 5, "syntax error");
+
+    json_value *raw = b.release();
+    check(!b && raw != nullptr, "released tree");
+    json::document adopted(raw);
+    check(adopted["k"_key].as_string() == "v", "adopted tree");
+}
+
+int main() {
+    test_lookups();
+    std::printf("\n-------------------------\n\n");
+
+    test_iteration();
+    std::printf("\n-------------------------\n\n");
+
+    test_ownership();
+    std::printf("\nAll binding tests completed.\n");
+    return failures ? 1 : 0;
+}
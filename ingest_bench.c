@@ -0,0 +1,136 @@
+/* Benchmark of json_ingest against reading then parsing files one by one.
+ *
+ * Writes a set of files to a temporary directory, drops them from the page
+ * cache before each cold run, and reports:
+ *   read    reading every file, no parsing (cold)
+ *   parse   parsing every file from memory, no I/O
+ *   sync    read then parse, one file at a time (cold)
+ *   ingest  json_ingest (cold)
+ * With I/O and parsing fully overlapped, ingest takes max(read, parse)
+ * instead of read + parse.
+ *
+ * Usage: ./ingest_bench [files] [kilobytes per file] */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "jsonparser.h"
+#include "jsoningest.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) return NULL;
+    char *buf = malloc((size_t)st.st_size + 1);
+    size_t done = 0;
+    while (buf && done < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + done, (size_t)st.st_size - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    close(fd);
+    if (buf) buf[done] = '\0';
+    *size = done;
+    return buf;
+}
+
+/* Drops the files from the page cache */
+static void evict(char **paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void count_parsed(void *user, size_t i, const char *path, json_value *value, const char *error) {
+    (void)i;
+    (void)path;
+    (void)error;
+    if (value) ++*(size_t *)user;
+    json_free(value);
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 500;
+    size_t kilobytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    char dir[] = "/tmp/ingest_bench_XXXXXX";
+    if (!count || !mkdtemp(dir)) return 1;
+
+    char **paths = malloc(count * sizeof(char *));
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        paths[i] = malloc(strlen(dir) + 32);
+        sprintf(paths[i], "%s/%zu.json", dir, i);
+        FILE *f = fopen(paths[i], "w");
+        if (!f) return 1;
+        long n = fprintf(f, "{\"id\": %zu, \"events\": [", i);
+        for (size_t k = 0; n < (long)(kilobytes * 1024); k++) {
+            n += fprintf(f, "%s{\"t\": %zu, \"kind\": \"click\", \"x\": %.3f, \"ok\": true}", k ? ", " : "",
+                         k, (double)k / 7);
+        }
+        n += fprintf(f, "]}");
+        fclose(f);
+        total += (size_t)n;
+    }
+    printf("%zu files, %.1f MB\n", count, (double)total / 1e6);
+
+    evict(paths, count);
+    double t = now();
+    char **buffers = malloc(count * sizeof(char *));
+    for (size_t i = 0; i < count; i++) {
+        size_t size;
+        buffers[i] = read_file(paths[i], &size);
+    }
+    double t_read = now() - t;
+
+    t = now();
+    for (size_t i = 0; i < count; i++) json_free(json_parse(buffers[i]));
+    double t_parse = now() - t;
+    for (size_t i = 0; i < count; i++) free(buffers[i]);
+    free(buffers);
+
+    evict(paths, count);
+    t = now();
+    for (size_t i = 0; i < count; i++) {
+        size_t size;
+        char *buf = read_file(paths[i], &size);
+        json_free(json_parse(buf));
+        free(buf);
+    }
+    double t_sync = now() - t;
+
+    evict(paths, count);
+    size_t parsed = 0;
+    t = now();
+    long ok = json_ingest((const char *const *)paths, count, NULL, count_parsed, &parsed);
+    double t_ingest = now() - t;
+
+    double shorter = t_read < t_parse ? t_read : t_parse;
+    double overlap = shorter > 0 ? (t_read + t_parse - t_ingest) / shorter : 0;
+    if (overlap < 0) overlap = 0;
+    if (overlap > 1) overlap = 1;
+    printf("read   %8.3f s\n", t_read);
+    printf("parse  %8.3f s\n", t_parse);
+    printf("sync   %8.3f s\n", t_sync);
+    printf("ingest %8.3f s  %ld parsed, %.0f%% of the shorter stage hidden\n", t_ingest, ok, overlap * 100);
+
+    for (size_t i = 0; i < count; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(dir);
+    return ok == (long)count ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+#include "jsonalloc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/*====================CURRENT ALLOCATOR===================*/
+
+static void *system_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *system_realloc(void *ctx, void *ptr, size_t size) {
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void system_free(void *ctx, void *ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+static const json_allocator system_allocator = {system_alloc, system_realloc, system_free, NULL};
+static json_allocator current = {system_alloc, system_realloc, system_free, NULL};
+
+void json_set_allocator(const json_allocator *allocator) {
+    current = allocator ? *allocator : system_allocator;
+}
+
+const json_allocator *json_get_allocator(void) {
+    return &current;
+}
+
+void *json_malloc(size_t size) {
+    return current.alloc(current.ctx, size);
+}
+
+void *json_calloc(size_t count, size_t size) {
+    if (current.alloc == system_alloc) return calloc(count, size);
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = current.alloc(current.ctx, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *json_realloc(void *ptr, size_t size) {
+    return current.realloc(current.ctx, ptr, size);
+}
+
+void json_mfree(void *ptr) {
+    if (ptr) current.free(current.ctx, ptr);
+}
+
+/*====================POOL================================*/
+
+/* A block is an 8 byte header holding its size class, then the memory
+ * handed out. Class c blocks take (c + 1) * 16 bytes. Free blocks are
+ * linked through their first word. Large blocks come from malloc, with
+ * their size in front of the header. */
+#define POOL_SLAB_SIZE ((size_t)64 << 10)
+#define POOL_CLASSES 32
+#define POOL_HEADER 8
+#define POOL_MAX_SIZE (POOL_CLASSES * 16 - POOL_HEADER)
+#define POOL_LARGE UINT64_MAX
+#define POOL_CACHE_MAX 256  /* free blocks a thread keeps per class */
+#define POOL_BATCH 64       /* blocks moved at once to or from the shared lists */
+
+struct pool_block {
+    struct pool_block *next;
+};
+
+struct pool_cache {
+    struct pool_block *lists[POOL_CLASSES];
+    size_t counts[POOL_CLASSES];
+    int registered;
+};
+
+static _Thread_local struct pool_cache pool_cache;
+
+/* Free blocks given back by threads with too many, or that ended */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pool_block *pool_lists[POOL_CLASSES];
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static uint64_t *pool_header(void *ptr) {
+    return (uint64_t *)ptr - 1;
+}
+
+/* Moves n blocks of class c from the cache to the shared list */
+static void pool_drain(struct pool_cache *cache, size_t c, size_t n) {
+    struct pool_block *head = cache->lists[c], *tail = head;
+    for (size_t k = 1; k < n; k++) tail = tail->next;
+    cache->lists[c] = tail->next;
+    cache->counts[c] -= n;
+
+    pthread_mutex_lock(&pool_lock);
+    tail->next = pool_lists[c];
+    pool_lists[c] = head;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Gives the cache of an ending thread back */
+static void pool_thread_exit(void *arg) {
+    struct pool_cache *cache = arg;
+    for (size_t c = 0; c < POOL_CLASSES; c++) {
+        if (cache->counts[c]) pool_drain(cache, c, cache->counts[c]);
+    }
+}
+
+static void pool_init(void) {
+    pthread_key_create(&pool_key, pool_thread_exit);
+}
+
+/* Arranges for the cache to be given back when its thread ends */
+static void pool_register(struct pool_cache *cache) {
+    pthread_once(&pool_once, pool_init);
+    pthread_setspecific(pool_key, cache);
+    cache->registered = 1;
+}
+
+/* Fills an empty cache list from the shared one, or from a new slab whose
+ * blocks past the first batch go to the shared list */
+static int pool_refill(struct pool_cache *cache, size_t c) {
+    if (!cache->registered) pool_register(cache);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_lists[c] && cache->counts[c] < POOL_BATCH) {
+        struct pool_block *b = pool_lists[c];
+        pool_lists[c] = b->next;
+        b->next = cache->lists[c];
+        cache->lists[c] = b;
+        cache->counts[c]++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (cache->counts[c]) return 1;
+
+    char *slab = malloc(POOL_SLAB_SIZE);
+    if (!slab) return 0;
+    size_t stride = (c + 1) * 16;
+    for (size_t offset = 0; offset + stride <= POOL_SLAB_SIZE; offset += stride) {
+        struct pool_block *b = (struct pool_block *)(slab + offset + POOL_HEADER);
+        *pool_header(b) = c;
+        b->next = cache->lists[c];
+        cache->lists[c] = b;
+        cache->counts[c]++;
+    }
+    if (cache->counts[c] > POOL_BATCH) pool_drain(cache, c, cache->counts[c] - POOL_BATCH);
+    return 1;
+}
+
+static void *pool_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    if (size > POOL_MAX_SIZE) {
+        if (size > SIZE_MAX - 16) return NULL;
+        uint64_t *raw = malloc(size + 16);
+        if (!raw) return NULL;
+        raw[0] = size;
+        raw[1] = POOL_LARGE;
+        return raw + 2;
+    }
+
+    size_t c = (size + POOL_HEADER + 15) / 16 - 1;
+    struct pool_cache *cache = &pool_cache;
+    if (!cache->lists[c] && !pool_refill(cache, c)) return NULL;
+    struct pool_block *b = cache->lists[c];
+    cache->lists[c] = b->next;
+    cache->counts[c]--;
+    return b;
+}
+
+static void pool_free(void *ctx, void *ptr) {
+    (void)ctx;
+    uint64_t c = *pool_header(ptr);
+    if (c == POOL_LARGE) {
+        free((uint64_t *)ptr - 2);
+        return;
+    }
+    struct pool_cache *cache = &pool_cache;
+    if (!cache->registered) pool_register(cache);
+    struct pool_block *b = ptr;
+    b->next = cache->lists[c];
+    cache->lists[c] = b;
+    if (++cache->counts[c] > POOL_CACHE_MAX) pool_drain(cache, c, POOL_BATCH);
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t size) {
+    if (!ptr) return pool_alloc(ctx, size);
+    uint64_t c = *pool_header(ptr);
+    size_t usable;
+    if (c == POOL_LARGE) {
+        usable = (size_t)((uint64_t *)ptr)[-2];
+        if (size > POOL_MAX_SIZE && size <= SIZE_MAX - 16) {
+            uint64_t *raw = realloc((uint64_t *)ptr - 2, size + 16);
+            if (!raw) return NULL;
+            raw[0] = size;
+            return raw + 2;
+        }
+    } else {
+        usable = (size_t)(c + 1) * 16 - POOL_HEADER;
+        if (size <= usable) return ptr;
+    }
+
+    void *copy = pool_alloc(ctx, size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, usable < size ? usable : size);
+    pool_free(ctx, ptr);
+    return copy;
+}
+
+static const json_allocator pool_allocator = {pool_alloc, pool_realloc, pool_free, NULL};
+
+const json_allocator *json_pool_allocator(void) {
+    return &pool_allocator;
+}
@@ -0,0 +1,53 @@
+#ifndef JSONALLOC_H
+#define JSONALLOC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+/* Memory allocation of the library.
+ *
+ * Everything the library allocates goes through the current allocator,
+ * malloc by default: values, their strings and containers, the tokens of a
+ * parse, writers, indexes, projections, columns and the rest. The one
+ * exception is the text json_serialize returns, which is freed with free().
+ * Running out of memory is reported as an error of the call that needed it,
+ * never by ending the process.
+ *
+ * json_pool_allocator() is a built-in allocator for small blocks, such as
+ * nodes, keys and short strings. They are cut from 64 KB slabs by size
+ * class and kept on a free list per thread, so most allocations and frees
+ * take no lock. A block may be freed by any thread; it joins the list of
+ * that thread. Small blocks are aligned to 8 bytes, and above 504 bytes the
+ * pool falls back to malloc. Slabs are kept for reuse, not returned to the
+ * system. */
+
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);  /* ptr may be NULL */
+    void (*free)(void *ctx, void *ptr);                  /* ptr is never NULL */
+    void *ctx;
+} json_allocator;
+
+/* Makes allocator, which is copied, the allocator of the library; NULL
+ * restores malloc. A block must be freed by the allocator that made it, so
+ * call this before any value is created or after all are freed, and not
+ * while another thread uses the library. */
+void json_set_allocator(const json_allocator *allocator);
+const json_allocator *json_get_allocator(void);
+
+const json_allocator *json_pool_allocator(void);
+
+/* Allocation through the current allocator, as done by the library */
+void *json_malloc(size_t size);
+void *json_calloc(size_t count, size_t size);
+void *json_realloc(void *ptr, size_t size);
+void json_mfree(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONALLOC_H */
@@ -0,0 +1,619 @@
+#include "jsoncolumns.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+#include <stdio.h>
+
+/*====================FIELDS==============================*/
+
+/* The fields form a tree of member names. A node is a field when column
+ * is not -1; it may have children too ("/a" and "/a/b"). */
+struct field_node {
+    char *name;
+    size_t len;
+    long column;
+    size_t id;          /* index in the seen array of a table */
+    struct field_node *children;
+    size_t count;
+};
+
+/* What the caller does not see of a column */
+struct column_state {
+    size_t capacity;        /* rows */
+    size_t bytes_capacity;  /* string bytes */
+    size_t saved_nulls;     /* counters before the extraction in progress */
+    size_t saved_mismatches;
+};
+
+struct json_columns {
+    struct field_node *root;  /* shared with the tables of extraction threads */
+    int owns_root;
+    size_t nodes;       /* in the tree, the root included */
+    uint64_t *seen;     /* line on which each node was last found */
+    uint64_t line;
+    size_t count;
+    json_column *columns;
+    struct column_state *states;
+};
+
+static void node_clear(struct field_node *node) {
+    for (size_t i = 0; i < node->count; i++) node_clear(&node->children[i]);
+    json_mfree(node->children);
+    json_mfree(node->name);
+}
+
+/* Returns the child of node named name, adding it if needed */
+static struct field_node *node_child(struct field_node *node, const char *name, size_t len, size_t *nodes) {
+    for (size_t i = 0; i < node->count; i++) {
+        struct field_node *child = &node->children[i];
+        if (child->len == len && memcmp(child->name, name, len) == 0) return child;
+    }
+    struct field_node *children = json_realloc(node->children, (node->count + 1) * sizeof(*children));
+    if (!children) return NULL;
+    node->children = children;
+
+    struct field_node *child = &children[node->count];
+    child->name = json_malloc(len + 1);
+    if (!child->name) return NULL;
+    memcpy(child->name, name, len);
+    child->name[len] = '\0';
+    child->len = len;
+    child->column = -1;
+    child->id = (*nodes)++;
+    child->children = NULL;
+    child->count = 0;
+    node->count++;
+    return child;
+}
+
+/* Adds the field at path, decoding its reference tokens into token */
+static int field_add(struct field_node *root, const char *path, char *token, long column, size_t *nodes) {
+    if (!path || *path != '/') return 0;
+
+    struct field_node *node = root;
+    const char *p = path;
+    while (*p) {
+        size_t len = 0;
+        for (p++; *p && *p != '/'; p++) {
+            if (*p == '~') {
+                if (p[1] != '0' && p[1] != '1') return 0;
+                token[len++] = p[1] == '0' ? '~' : '/';
+                p++;
+            } else {
+                token[len++] = *p;
+            }
+        }
+        node = node_child(node, token, len, nodes);
+        if (!node) return 0;
+    }
+    if (node->column != -1) return 0;
+    node->column = column;
+    return 1;
+}
+
+/* A table with no rows for the fields of root */
+static json_columns *columns_alloc(struct field_node *root, size_t nodes, size_t count) {
+    json_columns *t = json_calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->root = root;
+    t->nodes = nodes;
+    t->count = count;
+    t->seen = json_calloc(nodes, sizeof(uint64_t));
+    t->columns = json_calloc(count ? count : 1, sizeof(json_column));
+    t->states = json_calloc(count ? count : 1, sizeof(struct column_state));
+    if (!t->seen || !t->columns || !t->states) {
+        json_mfree(t->seen);
+        json_mfree(t->columns);
+        json_mfree(t->states);
+        json_mfree(t);
+        return NULL;
+    }
+    return t;
+}
+
+json_columns *json_columns_new(const json_column_spec *specs, size_t count) {
+    if (!specs && count) {
+        json_set_last_error("json_columns_new: NULL fields\n");
+        return NULL;
+    }
+    struct field_node *root = json_calloc(1, sizeof(*root));
+    if (!root) return NULL;
+    root->column = -1;
+    size_t nodes = 1;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *path = specs[i].path;
+        char *token = path ? json_malloc(strlen(path) + 1) : NULL;
+        int ok = token && specs[i].type <= JSON_COLUMN_STRING && field_add(root, path, token, (long)i, &nodes);
+        json_mfree(token);
+        if (!ok) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "json_columns_new: invalid or repeated field \"%.64s\"\n",
+                     path ? path : "(null)");
+            json_set_last_error(msg);
+            node_clear(root);
+            json_mfree(root);
+            return NULL;
+        }
+    }
+
+    json_columns *t = columns_alloc(root, nodes, count);
+    if (!t) {
+        node_clear(root);
+        json_mfree(root);
+        return NULL;
+    }
+    t->owns_root = 1;
+    for (size_t i = 0; i < count; i++) t->columns[i].type = specs[i].type;
+    return t;
+}
+
+void json_columns_free(json_columns *t) {
+    if (!t) return;
+    for (size_t i = 0; i < t->count; i++) {
+        json_column *col = &t->columns[i];
+        json_mfree(col->validity);
+        json_mfree(col->doubles);
+        json_mfree(col->int64s);
+        json_mfree(col->booleans);
+        json_mfree(col->offsets);
+        json_mfree(col->bytes);
+    }
+    if (t->owns_root) {
+        node_clear(t->root);
+        json_mfree(t->root);
+    }
+    json_mfree(t->seen);
+    json_mfree(t->columns);
+    json_mfree(t->states);
+    json_mfree(t);
+}
+
+size_t json_columns_count(const json_columns *t) {
+    return t ? t->count : 0;
+}
+
+const json_column *json_columns_get(const json_columns *t, size_t i) {
+    return t && i < t->count ? &t->columns[i] : NULL;
+}
+
+void json_columns_clear(json_columns *t) {
+    if (!t) return;
+    for (size_t i = 0; i < t->count; i++) {
+        t->columns[i].rows = 0;
+        t->columns[i].nulls = 0;
+        t->columns[i].mismatches = 0;
+    }
+}
+
+/*====================COLUMN BUFFERS======================*/
+
+static int grow(void **buf, size_t size) {
+    void *grown = json_realloc(*buf, size);
+    if (!grown) return 0;
+    *buf = grown;
+    return 1;
+}
+
+/* Makes room for rows rows in total */
+static int column_reserve(json_column *col, struct column_state *state, size_t rows) {
+    if (rows <= state->capacity) return 1;
+    size_t capacity = state->capacity ? state->capacity * 2 : 1024;
+    while (capacity < rows) capacity *= 2;
+
+    int ok = grow((void **)&col->validity, (capacity + 7) / 8);
+    switch (col->type) {
+        case JSON_COLUMN_DOUBLE:
+            ok = ok && grow((void **)&col->doubles, capacity * sizeof(double));
+            break;
+        case JSON_COLUMN_INT64:
+            ok = ok && grow((void **)&col->int64s, capacity * sizeof(int64_t));
+            break;
+        case JSON_COLUMN_BOOLEAN:
+            ok = ok && grow((void **)&col->booleans, capacity);
+            break;
+        case JSON_COLUMN_STRING:
+            ok = ok && grow((void **)&col->offsets, (capacity + 1) * sizeof(uint64_t));
+            if (ok && !state->capacity) col->offsets[0] = 0;
+            break;
+    }
+    if (ok) state->capacity = capacity;
+    return ok;
+}
+
+static int column_reserve_bytes(json_column *col, struct column_state *state, size_t bytes) {
+    if (bytes <= state->bytes_capacity) return 1;
+    size_t capacity = state->bytes_capacity ? state->bytes_capacity * 2 : 4096;
+    while (capacity < bytes) capacity *= 2;
+    if (!grow((void **)&col->bytes, capacity)) return 0;
+    state->bytes_capacity = capacity;
+    return 1;
+}
+
+static void set_valid(json_column *col, size_t row, int valid) {
+    uint8_t bit = (uint8_t)(1u << (row & 7));
+    if (valid) col->validity[row >> 3] |= bit;
+    else col->validity[row >> 3] &= (uint8_t)~bit;
+}
+
+/* Ends the current row of col with a null */
+static void column_null(json_column *col, int mismatch) {
+    size_t row = col->rows++;
+    set_valid(col, row, 0);
+    col->nulls++;
+    col->mismatches += mismatch != 0;
+    switch (col->type) {
+        case JSON_COLUMN_DOUBLE:  col->doubles[row] = 0; break;
+        case JSON_COLUMN_INT64:   col->int64s[row] = 0; break;
+        case JSON_COLUMN_BOOLEAN: col->booleans[row] = 0; break;
+        case JSON_COLUMN_STRING:  col->offsets[row + 1] = col->offsets[row]; break;
+    }
+}
+
+/* Appends the rows of src to dst, which has the same fields */
+static int columns_append(json_columns *dst, const json_columns *src) {
+    for (size_t i = 0; i < dst->count; i++) {
+        json_column *d = &dst->columns[i];
+        const json_column *s = &src->columns[i];
+        struct column_state *state = &dst->states[i];
+        size_t base = d->rows;
+        if (!column_reserve(d, state, base + s->rows)) return 0;
+
+        for (size_t row = 0; row < s->rows; row++) set_valid(d, base + row, (s->validity[row >> 3] >> (row & 7)) & 1);
+        switch (d->type) {
+            case JSON_COLUMN_DOUBLE:
+                memcpy(d->doubles + base, s->doubles, s->rows * sizeof(double));
+                break;
+            case JSON_COLUMN_INT64:
+                memcpy(d->int64s + base, s->int64s, s->rows * sizeof(int64_t));
+                break;
+            case JSON_COLUMN_BOOLEAN:
+                memcpy(d->booleans + base, s->booleans, s->rows);
+                break;
+            case JSON_COLUMN_STRING: {
+                uint64_t start = d->offsets[base];
+                size_t bytes = s->rows ? (size_t)s->offsets[s->rows] : 0;
+                if (!column_reserve_bytes(d, state, (size_t)start + bytes)) return 0;
+                if (bytes) memcpy(d->bytes + start, s->bytes, bytes);
+                for (size_t row = 0; row < s->rows; row++) d->offsets[base + row + 1] = start + s->offsets[row + 1];
+                break;
+            }
+        }
+        d->rows += s->rows;
+        d->nulls += s->nulls;
+        d->mismatches += s->mismatches;
+    }
+    return 1;
+}
+
+/*====================EXTRACTION==========================*/
+
+struct extract_ctx {
+    json_columns *t;
+    const char *end;    /* end of the line */
+    size_t row;
+    const char *error;  /* static description of the first error */
+    const char *at;     /* where it was found */
+};
+
+static const char *fail(struct extract_ctx *c, const char *at, const char *error) {
+    c->error = error;
+    c->at = at;
+    return NULL;
+}
+
+static const char *skip_value(struct extract_ctx *c, const char *p, size_t depth) {
+    size_t value_depth;
+    const char *error = NULL;
+    const char *end = json_scan_value(p, c->end, &value_depth, &error);
+    if (error) return fail(c, end, error);
+    if (depth + value_depth > JSON_MAX_DEPTH) return fail(c, p, "Maximum nesting depth exceeded");
+    return end;
+}
+
+/* The child of node named by the raw key [raw, raw_end), or NULL */
+static const struct field_node *find_child(const struct field_node *node, const char *raw, const char *raw_end) {
+    size_t len = (size_t)(raw_end - raw);
+    int escaped = memchr(raw, '\\', len) != NULL;
+    for (size_t i = 0; i < node->count; i++) {
+        const struct field_node *child = &node->children[i];
+        if (escaped ? json_scan_key_equals(raw, raw_end, child->name, child->len)
+                    : child->len == len && memcmp(child->name, raw, len) == 0)
+            return child;
+    }
+    return NULL;
+}
+
+/* Converts the checked number [p, end), which is not NUL-terminated */
+static int number_value(const char *p, const char *end, double *out) {
+    char buf[64];
+    size_t len = (size_t)(end - p);
+    char *text = len < sizeof(buf) ? buf : json_malloc(len + 1);
+    if (!text) return 0;
+    memcpy(text, p, len);
+    text[len] = '\0';
+    *out = strtod(text, NULL);
+    if (text != buf) json_mfree(text);
+    return 1;
+}
+
+/* Converts the checked number [p, end) if it is an integer that fits */
+static int integer_value(const char *p, const char *end, int64_t *out) {
+    int negative = *p == '-';
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    uint64_t v = 0;
+    for (p += negative; p < end; p++) {
+        unsigned digit = (unsigned)(*p - '0');
+        if (digit > 9) return 0;  /* fraction or exponent */
+        if (v > (limit - digit) / 10) return 0;
+        v = v * 10 + digit;
+    }
+    *out = negative ? (int64_t)(0 - v) : (int64_t)v;
+    return 1;
+}
+
+/* Writes the scalar at p to col, or a null if it has another type */
+static const char *extract_scalar(struct extract_ctx *c, const char *p, json_column *col, struct column_state *state) {
+    const char *end = c->end;
+    const char *error = NULL;
+    size_t row = col->rows;
+
+    if (*p == '"') {
+        const char *q = json_scan_string_with(p + 1, end, &error, json_scan_string_plain_kernel);
+        if (error) return fail(c, q, error);
+        if (col->type != JSON_COLUMN_STRING) {
+            column_null(col, 1);
+            return q;
+        }
+        uint64_t start = col->offsets[row];
+        if (!column_reserve_bytes(col, state, (size_t)start + (size_t)(q - p))) return fail(c, p, "Out of memory");
+        size_t len = json_scan_decode(p + 1, q - 1, col->bytes + start);
+        col->offsets[row + 1] = start + len;
+        set_valid(col, row, 1);
+        col->rows++;
+        return q;
+    }
+
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        const char *q = json_scan_number(p, end, &error);
+        if (error) return fail(c, q, error);
+        int ok = 0;
+        if (col->type == JSON_COLUMN_DOUBLE) {
+            if (!number_value(p, q, &col->doubles[row])) return fail(c, p, "Out of memory");
+            ok = 1;
+        } else if (col->type == JSON_COLUMN_INT64) {
+            ok = integer_value(p, q, &col->int64s[row]);
+        }
+        if (!ok) {
+            column_null(col, 1);
+            return q;
+        }
+        set_valid(col, row, 1);
+        col->rows++;
+        return q;
+    }
+
+    size_t n = json_scan_literal(p, end);
+    if (!n) return fail(c, p, "Unexpected character");
+    if (*p == 'n') {
+        column_null(col, 0);
+    } else if (col->type == JSON_COLUMN_BOOLEAN) {
+        col->booleans[row] = *p == 't';
+        set_valid(col, row, 1);
+        col->rows++;
+    } else {
+        column_null(col, 1);
+    }
+    return p + n;
+}
+
+static const char *extract_object(struct extract_ctx *c, const char *p, const struct field_node *node,
+                                  size_t depth);
+static const char *extract_array(struct extract_ctx *c, const char *p, const struct field_node *node,
+                                 size_t depth);
+
+static const char *extract_value(struct extract_ctx *c, const char *p, const struct field_node *node,
+                                 size_t depth) {
+    /* a repeated key keeps its first value, even if the first is not an
+     * object and a later one holds the field */
+    if (c->t->seen[node->id] == c->t->line) return skip_value(c, p, depth);
+    c->t->seen[node->id] = c->t->line;
+    json_column *col = node->column >= 0 ? &c->t->columns[node->column] : NULL;
+
+    if (*p == '{' || *p == '[') {
+        if (col) column_null(col, 1);
+        if (*p == '{' && node->count) return extract_object(c, p, node, depth + 1);
+        if (*p == '[' && node->count) return extract_array(c, p, node, depth + 1);
+        return skip_value(c, p, depth);
+    }
+    if (!col) return skip_value(c, p, depth);
+    return extract_scalar(c, p, col, &c->t->states[node->column]);
+}
+
+/* Walks the object at p, extracting the fields below node */
+static const char *extract_object(struct extract_ctx *c, const char *p, const struct field_node *node,
+                                  size_t depth) {
+    const char *end = c->end;
+    if (depth > JSON_MAX_DEPTH) return fail(c, p, "Maximum nesting depth exceeded");
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == '}') return p + 1;
+    for (;;) {
+        if (p == end || *p != '"') return fail(c, p, "Expected a string key");
+        const char *error = NULL;
+        const char *key = p + 1;
+        p = json_scan_string(key, end, &error);
+        if (error) return fail(c, p, error);
+        const char *key_end = p - 1;
+
+        p = json_skip_whitespace(p, end);
+        if (p == end || *p != ':') return fail(c, p, "Expected ':' after key");
+        p = json_skip_whitespace(p + 1, end);
+        if (p == end) return fail(c, p, "Expected a value");
+
+        const struct field_node *child = find_child(node, key, key_end);
+        p = child ? extract_value(c, p, child, depth) : skip_value(c, p, depth);
+        if (!p) return NULL;
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == '}') {
+            return p + 1;
+        } else {
+            return fail(c, p, "Expected ',' or '}'");
+        }
+    }
+}
+
+/* Walks the array at p, extracting the fields below node whose token is
+ * the index of an item, as JSON Pointer reads "/list/0" */
+static const char *extract_array(struct extract_ctx *c, const char *p, const struct field_node *node,
+                                 size_t depth) {
+    const char *end = c->end;
+    if (depth > JSON_MAX_DEPTH) return fail(c, p, "Maximum nesting depth exceeded");
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == ']') return p + 1;
+    for (size_t i = 0;; i++) {
+        if (p == end) return fail(c, p, "Expected a value");
+        char index[24];
+        int len = snprintf(index, sizeof(index), "%zu", i);
+        const struct field_node *child = find_child(node, index, index + len);
+        p = child ? extract_value(c, p, child, depth) : skip_value(c, p, depth);
+        if (!p) return NULL;
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == ']') {
+            return p + 1;
+        } else {
+            return fail(c, p, "Expected ',' or ']'");
+        }
+    }
+}
+
+/* Fills one row from the line [p, end), p being its first non-blank byte */
+static int extract_line(struct extract_ctx *c, const char *p, const char *end) {
+    json_columns *t = c->t;
+    c->end = end;
+    c->row = t->count ? t->columns[0].rows : 0;
+    t->line++;
+    for (size_t i = 0; i < t->count; i++) {
+        if (!column_reserve(&t->columns[i], &t->states[i], c->row + 1)) return fail(c, p, "Out of memory"), 0;
+    }
+
+    if (*p != '{') return fail(c, p, "Expected an object"), 0;
+    p = extract_object(c, p, t->root, 1);
+    if (!p) return 0;
+    p = json_skip_whitespace(p, end);
+    if (p != end) return fail(c, p, "Unexpected data after the object"), 0;
+
+    /* fields not found are null */
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->columns[i].rows == c->row) column_null(&t->columns[i], 0);
+    }
+    return 1;
+}
+
+/* A range of lines extracted into its own table */
+struct extract_range {
+    struct json_scan_range span;
+    json_columns *t;
+    size_t lines;       /* lines read, the failing one included */
+    const char *error;
+    const char *at;
+};
+
+static void *extract_range_run(void *arg) {
+    struct extract_range *r = arg;
+    struct extract_ctx c = {r->t, NULL, 0, NULL, NULL};
+    const char *p = r->span.buf;
+    const char *end = r->span.buf + r->span.len;
+
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = newline ? newline : end;
+        r->lines++;
+        const char *first = json_skip_whitespace(p, line_end);
+        if (first < line_end && !extract_line(&c, first, line_end)) {
+            r->error = c.error;
+            r->at = c.at;
+            return NULL;
+        }
+        p = newline ? newline + 1 : end;
+    }
+    return NULL;
+}
+
+/* Puts every column back to its rows before the extraction */
+static void columns_rollback(json_columns *t, size_t rows) {
+    for (size_t i = 0; i < t->count; i++) {
+        t->columns[i].rows = rows;
+        t->columns[i].nulls = t->states[i].saved_nulls;
+        t->columns[i].mismatches = t->states[i].saved_mismatches;
+    }
+}
+
+int json_columns_extract(json_columns *t, const char *buf, size_t len, unsigned threads) {
+    if (!t || (!buf && len)) {
+        json_set_last_error("json_columns_extract: NULL argument\n");
+        return 0;
+    }
+    size_t rows = t->count ? t->columns[0].rows : 0;
+    for (size_t i = 0; i < t->count; i++) {
+        t->states[i].saved_nulls = t->columns[i].nulls;
+        t->states[i].saved_mismatches = t->columns[i].mismatches;
+    }
+
+    size_t n = json_scan_range_count(len, threads);
+    struct extract_range *ranges = json_calloc(n, sizeof(*ranges));
+    if (!ranges) {
+        json_set_last_error("json_columns_extract: out of memory\n");
+        return 0;
+    }
+
+    /* the first range fills t directly, the others tables of their own
+     * that are appended to it in order */
+    json_scan_split_lines(buf, len, ranges, sizeof(*ranges), n);
+    int ok = 1;
+    for (size_t k = 0; k < n; k++) {
+        ranges[k].t = k ? columns_alloc(t->root, t->nodes, t->count) : t;
+        for (size_t i = 0; k && ranges[k].t && i < t->count; i++) ranges[k].t->columns[i].type = t->columns[i].type;
+        if (!ranges[k].t) ok = 0;
+    }
+    if (ok) json_scan_run_ranges(extract_range_run, ranges, sizeof(*ranges), n);
+
+    /* rows and line numbers only count up to the first failing range */
+    size_t line = 0;
+    const char *error = ok ? NULL : "out of memory";
+    const char *at = buf;
+    for (size_t k = 0; ok && k < n; k++) {
+        if (ranges[k].error) {
+            error = ranges[k].error;
+            at = ranges[k].at;
+            line += ranges[k].lines;
+            ok = 0;
+            break;
+        }
+        line += ranges[k].lines;
+        if (k && !columns_append(t, ranges[k].t)) {
+            error = "out of memory";
+            ok = 0;
+        }
+    }
+
+    for (size_t k = 1; k < n; k++) json_columns_free(ranges[k].t);
+    json_mfree(ranges);
+
+    if (!ok) {
+        columns_rollback(t, rows);
+        char msg[256];
+        snprintf(msg, sizeof(msg), "json_columns_extract: %s at line %zu (offset %zu)\n", error, line,
+                 (size_t)(at - buf));
+        json_set_last_error(msg);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,79 @@
+#ifndef JSONCOLUMNS_H
+#define JSONCOLUMNS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Columnar extraction from NDJSON (one JSON object per line).
+ *
+ * A set of fields, each a JSON Pointer with the type expected there, is
+ * compiled once. Every non-blank line then becomes a row: the value of
+ * each field is written straight into the buffer of its column, without
+ * building json_value trees. The rest of the line is checked and skipped.
+ *
+ * Numbers go to arrays of doubles or int64_t, booleans to one byte per
+ * row, strings to a single byte buffer with the offset of each row (row i
+ * is bytes[offsets[i]..offsets[i + 1])). A row whose field is missing,
+ * null or of another type is null in that column: its bit in the validity
+ * bitmap is clear and its slot holds 0 or an empty string. A repeated key
+ * keeps its first value, as with json_parse. */
+
+typedef enum {
+    JSON_COLUMN_DOUBLE,
+    JSON_COLUMN_INT64,    /* integers only: no fraction or exponent, within int64_t */
+    JSON_COLUMN_BOOLEAN,
+    JSON_COLUMN_STRING
+} json_column_type;
+
+/* A token of path names a member of an object or, if it is an index
+ * such as 0 or 12, an item of an array: "/tags/0" is the first item of
+ * member tags. */
+typedef struct {
+    const char *path;  /* "/user/id": member id of member user of each line */
+    json_column_type type;
+} json_column_spec;
+
+/* A column. Only the buffers of its type are set. */
+typedef struct {
+    json_column_type type;
+    size_t rows;
+    size_t nulls;        /* rows without a value, mismatches included */
+    size_t mismatches;   /* rows whose value has another type */
+    uint8_t *validity;   /* bit i % 8 of byte i / 8 is set when row i has a value */
+    double *doubles;
+    int64_t *int64s;
+    uint8_t *booleans;
+    uint64_t *offsets;   /* rows + 1 entries */
+    char *bytes;
+} json_column;
+
+typedef struct json_columns json_columns;
+
+/* Compiles count fields; returns NULL if a path is not a valid, non-empty
+ * JSON Pointer or two fields have the same path */
+json_columns *json_columns_new(const json_column_spec *specs, size_t count);
+void json_columns_free(json_columns *columns);
+
+/* Appends a row per non-blank line of buf[0..len) to the columns. With
+ * threads > 1 the buffer is split at line boundaries into ranges extracted
+ * in parallel, then joined in order. Returns 1 on success; on failure
+ * (invalid JSON or a line that is not an object) no row is added and
+ * json_get_last_error() gives the line. Can be called again and again on
+ * consecutive chunks of a stream, each made of whole lines. */
+int json_columns_extract(json_columns *columns, const char *buf, size_t len, unsigned threads);
+
+size_t json_columns_count(const json_columns *columns);
+const json_column *json_columns_get(const json_columns *columns, size_t i);
+
+/* Drops every row, keeping the buffers for the next batch */
+void json_columns_clear(json_columns *columns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONCOLUMNS_H */
@@ -0,0 +1,134 @@
+#include "jsoncpu.h"
+#include "jsonscan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* String kernels, like json_scan_string_plain: each compares a whole
+ * vector against '"' and '\\' and, as signed bytes, below 0x20, which also
+ * catches everything from 0x80. The last bytes go to the SWAR version. */
+#ifdef JSON_SCAN_HAVE_SSE2
+static const char *string_plain_sse2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                       _mm_cmplt_epi8(v, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return json_scan_string_plain(p, end);
+}
+#endif
+
+#ifdef JSON_SCAN_HAVE_AVX2
+__attribute__((target("avx2")))
+static const char *string_plain_avx2(const char *p, const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                          _mm256_cmpgt_epi8(space, v));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(special);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return json_scan_string_plain(p, end);
+}
+#endif
+
+#ifdef JSON_SCAN_HAVE_AVX512
+__attribute__((target("avx512bw")))
+static const char *string_plain_avx512(const char *p, const char *end) {
+    const __m512i quote = _mm512_set1_epi8('"');
+    const __m512i backslash = _mm512_set1_epi8('\\');
+    const __m512i space = _mm512_set1_epi8(0x20);
+    while (end - p >= 64) {
+        __m512i v = _mm512_loadu_si512((const void *)p);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(v, quote) | _mm512_cmpeq_epi8_mask(v, backslash) |
+                        _mm512_cmplt_epi8_mask(v, space);
+        if (mask) return p + __builtin_ctzll(mask);
+        p += 64;
+    }
+    return json_scan_string_plain(p, end);
+}
+#endif
+
+/* Until the constructor below has run, the portable kernel */
+static json_kernel current = JSON_KERNEL_SCALAR;
+const char *(*json_scan_string_plain_kernel)(const char *p, const char *end) = json_scan_string_plain;
+
+static const char *const kernel_names[] = {"scalar", "sse2", "avx2", "avx512"};
+
+json_kernel json_get_kernel(void) {
+    return current;
+}
+
+int json_kernel_supported(json_kernel kernel) {
+    switch (kernel) {
+        case JSON_KERNEL_SCALAR:
+            return 1;
+#ifdef JSON_SCAN_HAVE_SSE2
+        case JSON_KERNEL_SSE2:
+            return 1;
+#endif
+#if defined(JSON_SCAN_HAVE_AVX2) && defined(JSON_SCAN_HAVE_AVX512)
+        case JSON_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case JSON_KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512bw");
+#endif
+        default:
+            return 0;
+    }
+}
+
+int json_set_kernel(json_kernel kernel) {
+    if (!json_kernel_supported(kernel)) return 0;
+    switch (kernel) {
+#ifdef JSON_SCAN_HAVE_SSE2
+        case JSON_KERNEL_SSE2:
+            json_scan_string_plain_kernel = string_plain_sse2;
+            break;
+#endif
+#if defined(JSON_SCAN_HAVE_AVX2) && defined(JSON_SCAN_HAVE_AVX512)
+        case JSON_KERNEL_AVX2:
+            json_scan_string_plain_kernel = string_plain_avx2;
+            break;
+        case JSON_KERNEL_AVX512:
+            json_scan_string_plain_kernel = string_plain_avx512;
+            break;
+#endif
+        default:
+            json_scan_string_plain_kernel = json_scan_string_plain;
+            break;
+    }
+    current = kernel;
+    return 1;
+}
+
+const char *json_kernel_name(json_kernel kernel) {
+    if ((unsigned)kernel >= sizeof(kernel_names) / sizeof(kernel_names[0])) return "unknown";
+    return kernel_names[kernel];
+}
+
+/* Picks the widest kernel the CPU runs, or the one CJSON_KERNEL names */
+__attribute__((constructor))
+static void choose_kernel(void) {
+#ifdef JSON_SCAN_HAVE_AVX2
+    __builtin_cpu_init();  /* constructors may run before the one of libgcc */
+#endif
+    json_kernel kernel = JSON_KERNEL_AVX512;
+    while (!json_kernel_supported(kernel)) kernel = (json_kernel)(kernel - 1);
+
+    const char *forced = getenv("CJSON_KERNEL");
+    for (unsigned i = 0; forced && i < sizeof(kernel_names) / sizeof(kernel_names[0]); i++) {
+        if (strcmp(forced, kernel_names[i]) == 0 && json_kernel_supported((json_kernel)i)) kernel = (json_kernel)i;
+    }
+    json_set_kernel(kernel);
+}
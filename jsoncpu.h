@@ -0,0 +1,40 @@
+#ifndef JSONCPU_H
+#define JSONCPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instruction sets of the scanning kernels.
+ *
+ * String scanning in the tokenizer and the block classifier of
+ * json_validate come in one version per instruction set. At startup the
+ * library picks the widest the CPU supports, checked with cpuid, unless
+ * the environment variable CJSON_KERNEL names another one (scalar, sse2,
+ * avx2 or avx512), which is then used if the CPU supports it. Results are
+ * the same whatever the kernel; only the speed differs, which is what the
+ * override is for. */
+
+typedef enum {
+    JSON_KERNEL_SCALAR,  /* portable C, eight bytes at a time */
+    JSON_KERNEL_SSE2,
+    JSON_KERNEL_AVX2,
+    JSON_KERNEL_AVX512   /* AVX-512BW */
+} json_kernel;
+
+json_kernel json_get_kernel(void);
+
+/* Uses kernel from now on. Returns 0, changing nothing, if the CPU does
+ * not support it. Not to be called while another thread uses the library. */
+int json_set_kernel(json_kernel kernel);
+
+int json_kernel_supported(json_kernel kernel);
+
+/* "scalar", "sse2", "avx2" or "avx512" */
+const char *json_kernel_name(json_kernel kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONCPU_H */
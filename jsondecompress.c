@@ -0,0 +1,405 @@
+#include "jsondecompress.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef JSON_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define DEFAULT_BUFFER_SIZE ((size_t)1 << 20)
+#define DEFAULT_BUFFERS 4
+#define INPUT_SIZE ((size_t)256 << 10)   /* compressed bytes read at once */
+
+/* A buffer of text, on the free list or the filled queue */
+struct block {
+    char *data;
+    size_t len;
+    struct block *next;
+};
+
+struct stream {
+    int fd;
+    json_compression compression;
+    size_t buffer_size;
+
+    /* input not decoded yet */
+    unsigned char *in;
+    size_t in_len, in_pos;
+    int in_eof;
+    int in_frame;           /* a gzip member or zstd frame is under way */
+    z_stream z;
+#ifdef JSON_HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct block *free;     /* for the decoder to fill */
+    struct block *filled, *filled_tail;
+    int done;               /* the decoder has queued its last block */
+    int stopped;            /* the parser wants no more */
+    json_error_code error;  /* of the decoder */
+    const char *error_detail;
+};
+
+/*====================DECODER THREAD======================*/
+
+static int decode_fail(struct stream *s, json_error_code code, const char *detail) {
+    s->error = code;
+    s->error_detail = detail;
+    return -1;
+}
+
+/* Reads the next input bytes, if the previous ones are used up */
+static int fill_input(struct stream *s) {
+    while (s->in_pos == s->in_len && !s->in_eof) {
+        ssize_t n = read(s->fd, s->in, INPUT_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        s->in_len = (size_t)n;
+        s->in_pos = 0;
+        s->in_eof = n == 0;
+    }
+    return 1;
+}
+
+/* Decodes into the room left in b. Returns 1 while more may come, 0 at
+ * the end of the input and -1 on error. */
+static int decode(struct stream *s, struct block *b) {
+    char *out = b->data + b->len;
+    size_t room = s->buffer_size - b->len;
+    if (room > UINT_MAX) room = UINT_MAX;  /* as much as zlib takes at once */
+    if (!fill_input(s)) return decode_fail(s, JSON_ERROR_OTHER, "failed to read the input");
+    if (s->in_pos == s->in_len) {
+        if (s->in_frame) return decode_fail(s, JSON_ERROR_OTHER, "compressed input ends in the middle of a frame");
+        return 0;
+    }
+
+    switch (s->compression) {
+        case JSON_COMPRESSION_GZIP: {
+            s->z.next_in = s->in + s->in_pos;
+            s->z.avail_in = (uInt)(s->in_len - s->in_pos);
+            s->z.next_out = (Bytef *)out;
+            s->z.avail_out = (uInt)room;
+            int r = inflate(&s->z, Z_NO_FLUSH);
+            s->in_pos = s->in_len - s->z.avail_in;
+            b->len += room - s->z.avail_out;
+            if (r == Z_STREAM_END) {
+                /* the next member, if there is one, starts afresh */
+                s->in_frame = 0;
+                inflateReset(&s->z);
+            } else if (r == Z_OK || r == Z_BUF_ERROR) {
+                s->in_frame = 1;
+            } else {
+                return decode_fail(s, r == Z_MEM_ERROR ? JSON_ERROR_OUT_OF_MEMORY : JSON_ERROR_OTHER,
+                                   "corrupt gzip input");
+            }
+            return 1;
+        }
+#ifdef JSON_HAVE_ZSTD
+        case JSON_COMPRESSION_ZSTD: {
+            ZSTD_inBuffer in = {s->in, s->in_len, s->in_pos};
+            ZSTD_outBuffer o = {out, room, 0};
+            size_t r = ZSTD_decompressStream(s->zstd, &o, &in);
+            if (ZSTD_isError(r)) return decode_fail(s, JSON_ERROR_OTHER, "corrupt zstd input");
+            s->in_pos = in.pos;
+            b->len += o.pos;
+            s->in_frame = r != 0;
+            return 1;
+        }
+#endif
+        default: {
+            size_t n = s->in_len - s->in_pos < room ? s->in_len - s->in_pos : room;
+            memcpy(out, s->in + s->in_pos, n);
+            s->in_pos += n;
+            b->len += n;
+            return 1;
+        }
+    }
+}
+
+/* Fills free blocks and queues them, in order, until the input ends or
+ * the parser stops */
+static void *decode_blocks(void *arg) {
+    struct stream *s = arg;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->free && !s->stopped) pthread_cond_wait(&s->changed, &s->lock);
+        struct block *b = s->stopped ? NULL : s->free;
+        if (b) s->free = b->next;
+        pthread_mutex_unlock(&s->lock);
+        if (!b) return NULL;
+
+        b->len = 0;
+        int more = 1;
+        while (b->len < s->buffer_size && (more = decode(s, b)) > 0) {}
+
+        pthread_mutex_lock(&s->lock);
+        b->next = NULL;
+        if (s->filled_tail) s->filled_tail->next = b;
+        else s->filled = b;
+        s->filled_tail = b;
+        s->done = more <= 0;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+        if (more <= 0) return NULL;
+    }
+}
+
+/*====================DOCUMENTS===========================*/
+
+struct reader {
+    json_document_callback callback;
+    void *user;
+    const json_parse_options *options;
+    long count;
+    int failed;             /* a document did not parse */
+    int stopped;            /* the callback asked to stop */
+
+    /* where the document under way is in the text */
+    size_t depth;
+    int in_string;
+    int escaped;
+    size_t base;            /* offset of the current block */
+    size_t start;           /* offset of the document */
+
+    /* the part of the document in earlier blocks */
+    char *carry;
+    size_t carry_len, carry_capacity;
+};
+
+/* The newline ending the document at p, outside its strings and
+ * containers, or NULL if it is not before end; the state is kept for the
+ * bytes that follow. Malformed text is cut somewhere and left to the
+ * parser. */
+static const char *document_end(struct reader *r, const char *p, const char *end) {
+    while (p < end) {
+        if (r->in_string) {
+            if (r->escaped) {
+                r->escaped = 0;
+                p++;
+                continue;
+            }
+            p = json_scan_string_plain_kernel(p, end);
+            if (p == end) break;
+            if (*p == '"') r->in_string = 0;
+            else if (*p == '\\') r->escaped = 1;
+            p++;
+            continue;
+        }
+        switch (*p) {
+            case '"': r->in_string = 1; break;
+            case '{': case '[': r->depth++; break;
+            case '}': case ']': if (r->depth) r->depth--; break;
+            case '\n': if (!r->depth) return p; break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static int carry_append(struct reader *r, const char *p, size_t len) {
+    if (len > r->carry_capacity - r->carry_len) {
+        size_t capacity = r->carry_capacity ? r->carry_capacity : 4096;
+        while (capacity - r->carry_len < len) capacity *= 2;
+        char *carry = json_realloc(r->carry, capacity);
+        if (!carry) {
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to hold a document");
+            r->failed = 1;
+            return 0;
+        }
+        r->carry = carry;
+        r->carry_capacity = capacity;
+    }
+    memcpy(r->carry + r->carry_len, p, len);
+    r->carry_len += len;
+    return 1;
+}
+
+/* Parses the document in text and hands it to the callback */
+static int emit(struct reader *r, const char *text, size_t len) {
+    if (json_skip_whitespace(text, text + len) == text + len) return 1;
+    json_value *v = json_parse_spans(text, len, r->options, NULL, NULL);
+    if (!v) {
+        /* offsets in the text as a whole */
+        json_error e = *json_get_error();
+        json_set_error(e.code, e.offset == JSON_NO_OFFSET ? e.offset : e.offset + r->start, e.detail);
+        json_set_error_tokens(e.expected, e.found);
+        r->failed = 1;
+        return 0;
+    }
+    if (r->callback(r->user, (size_t)r->count++, v)) return 1;
+    r->stopped = 1;
+    return 0;
+}
+
+/* Parses the documents that end in the len bytes at data, keeping the
+ * start of the next one */
+static int cut_documents(struct reader *r, const char *data, size_t len) {
+    const char *p = data, *end = data + len;
+    while (p < end) {
+        if (!r->carry_len) r->start = r->base + (size_t)(p - data);
+        const char *q = document_end(r, p, end);
+        if (!q) {
+            if (!carry_append(r, p, (size_t)(end - p))) return 0;
+            break;
+        }
+        int ok;
+        if (r->carry_len) {
+            ok = carry_append(r, p, (size_t)(q - p)) && emit(r, r->carry, r->carry_len);
+            r->carry_len = 0;
+        } else {
+            ok = emit(r, p, (size_t)(q - p));
+        }
+        if (!ok) return 0;
+        p = q + 1;
+    }
+    r->base += len;
+    return 1;
+}
+
+/*====================PIPELINE============================*/
+
+/* Sets up decoding of the input, guessing its format from its first
+ * bytes if asked to */
+static int start_decoder(struct stream *s) {
+    if (s->compression == JSON_COMPRESSION_AUTO) {
+        if (!fill_input(s)) {
+            json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "failed to read the input");
+            return 0;
+        }
+        const unsigned char *m = s->in;
+        size_t n = s->in_len;
+        if (n >= 2 && m[0] == 0x1f && m[1] == 0x8b) s->compression = JSON_COMPRESSION_GZIP;
+        else if (n >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd)
+            s->compression = JSON_COMPRESSION_ZSTD;
+        else s->compression = JSON_COMPRESSION_NONE;
+    }
+    switch (s->compression) {
+        case JSON_COMPRESSION_GZIP:
+            /* 15 + 32: the largest window, gzip or zlib header */
+            if (inflateInit2(&s->z, 15 + 32) == Z_OK) return 1;
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to start gzip decoding");
+            return 0;
+        case JSON_COMPRESSION_ZSTD:
+#ifdef JSON_HAVE_ZSTD
+            s->zstd = ZSTD_createDStream();
+            if (s->zstd) return 1;
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to start zstd decoding");
+#else
+            json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "zstd input needs a build with ZSTD=1");
+#endif
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void stop_decoder(struct stream *s) {
+    if (s->compression == JSON_COMPRESSION_GZIP) inflateEnd(&s->z);
+#ifdef JSON_HAVE_ZSTD
+    if (s->zstd) ZSTD_freeDStream(s->zstd);
+#endif
+}
+
+long json_parse_compressed_fd(int fd, const json_decompress_options *options, json_document_callback callback,
+                              void *user) {
+    if (fd < 0 || !callback) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "invalid file descriptor or NULL callback");
+        return -1;
+    }
+    json_decompress_options o;
+    memset(&o, 0, sizeof(o));
+    if (options) o = *options;
+    unsigned count = o.buffers ? o.buffers : DEFAULT_BUFFERS;
+
+    struct stream s;
+    memset(&s, 0, sizeof(s));
+    s.fd = fd;
+    s.compression = o.compression;
+    s.buffer_size = o.buffer_size ? o.buffer_size : DEFAULT_BUFFER_SIZE;
+    s.in = json_malloc(INPUT_SIZE);
+    struct block *blocks = json_calloc(count, sizeof(struct block));
+    int ok = s.in && blocks;
+    for (unsigned i = 0; ok && i < count; i++) {
+        blocks[i].data = json_malloc(s.buffer_size);
+        blocks[i].next = s.free;
+        s.free = &blocks[i];
+        ok = blocks[i].data != NULL;
+    }
+    if (!ok) json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate the buffers");
+
+    long result = -1;
+    pthread_t decoder;
+    if (ok && start_decoder(&s)) {
+        pthread_mutex_init(&s.lock, NULL);
+        pthread_cond_init(&s.changed, NULL);
+        if (pthread_create(&decoder, NULL, decode_blocks, &s) == 0) {
+            struct reader r;
+            memset(&r, 0, sizeof(r));
+            r.callback = callback;
+            r.user = user;
+            r.options = &o.parse;
+
+            for (;;) {
+                pthread_mutex_lock(&s.lock);
+                while (!s.filled && !s.done) pthread_cond_wait(&s.changed, &s.lock);
+                struct block *b = s.filled;
+                if (b && !(s.filled = b->next)) s.filled_tail = NULL;
+                pthread_mutex_unlock(&s.lock);
+                if (!b) break;
+
+                int more = cut_documents(&r, b->data, b->len);
+                pthread_mutex_lock(&s.lock);
+                b->next = s.free;
+                s.free = b;
+                pthread_cond_broadcast(&s.changed);
+                pthread_mutex_unlock(&s.lock);
+                if (!more) break;
+            }
+            /* the last document needs no newline */
+            if (!r.failed && !r.stopped && !s.error && r.carry_len) emit(&r, r.carry, r.carry_len);
+
+            pthread_mutex_lock(&s.lock);
+            s.stopped = 1;
+            pthread_cond_broadcast(&s.changed);
+            pthread_mutex_unlock(&s.lock);
+            pthread_join(decoder, NULL);
+
+            if (!r.failed && !r.stopped && s.error) json_set_error(s.error, JSON_NO_OFFSET, s.error_detail);
+            else if (!r.failed) result = r.count;
+            json_mfree(r.carry);
+        } else {
+            json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "failed to start the decoder thread");
+        }
+        pthread_cond_destroy(&s.changed);
+        pthread_mutex_destroy(&s.lock);
+        stop_decoder(&s);
+    }
+
+    for (unsigned i = 0; blocks && i < count; i++) json_mfree(blocks[i].data);
+    json_mfree(blocks);
+    json_mfree(s.in);
+    return result;
+}
+
+long json_parse_compressed_file(const char *path, const json_decompress_options *options,
+                                json_document_callback callback, void *user) {
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "failed to open the input file");
+        return -1;
+    }
+    long result = json_parse_compressed_fd(fd, options, callback, user);
+    close(fd);
+    return result;
+}
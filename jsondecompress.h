@@ -0,0 +1,58 @@
+#ifndef JSONDECOMPRESS_H
+#define JSONDECOMPRESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/* Parsing of compressed input while it is decompressed.
+ *
+ * A thread decompresses the input block by block into a small set of
+ * buffers, which go back and forth between it and the parsing thread
+ * through a bounded queue. The parsing thread cuts the text into
+ * documents as the buffers come in and parses each one as soon as it is
+ * complete, so decompression and parsing overlap and the whole text is
+ * never held in memory: only the buffers and the document being read.
+ *
+ * The text is NDJSON, a document per line, or a single document laid out
+ * in any way: a document ends at the first newline outside its strings
+ * and containers. Blank lines are skipped. gzip (and zlib) input is always
+ * supported, zstd when the library is built with it (make ZSTD=1). */
+
+typedef enum {
+    JSON_COMPRESSION_AUTO,  /* from the first bytes of the input */
+    JSON_COMPRESSION_NONE,
+    JSON_COMPRESSION_GZIP,  /* concatenated members are read one after the other */
+    JSON_COMPRESSION_ZSTD
+} json_compression;
+
+typedef struct {
+    json_compression compression;
+    size_t buffer_size;     /* bytes of text per buffer (default 1 MB) */
+    unsigned buffers;       /* buffers in flight (default 4) */
+    json_parse_options parse;
+} json_decompress_options;
+
+/* Called with each document, numbered from 0, in order; it owns value.
+ * Returns 0 to stop reading. */
+typedef int (*json_document_callback)(void *user, size_t index, json_value *value);
+
+/* Reads fd to its end, or until callback returns 0. options may be NULL
+ * for the defaults. Returns the number of documents parsed, or -1 if the
+ * input could not be read or decompressed or a document is not valid
+ * JSON, with the error recorded; offsets are then those of the
+ * decompressed text. */
+long json_parse_compressed_fd(int fd, const json_decompress_options *options, json_document_callback callback,
+                              void *user);
+
+/* Same, for the file at path */
+long json_parse_compressed_file(const char *path, const json_decompress_options *options,
+                                json_document_callback callback, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONDECOMPRESS_H */
@@ -0,0 +1,78 @@
+#include "jsonerror.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The last error of the thread. message holds the text of an error given
+ * as a message, or the formatted one once json_get_last_error asked. */
+static _Thread_local json_error last = {JSON_ERROR_NONE, JSON_NO_OFFSET, 0, 0, ""};
+static _Thread_local char message[256];
+static _Thread_local int formatted = 1;
+
+void json_set_error(json_error_code code, size_t offset, const char *detail) {
+    last.code = code;
+    last.offset = offset;
+    last.expected = 0;
+    last.found = 0;
+    last.detail = detail;
+    formatted = 0;
+}
+
+void json_set_error_tokens(unsigned expected, unsigned found) {
+    last.expected = expected;
+    last.found = found;
+}
+
+/* Records an error described by a message only */
+void json_set_last_error(const char *msg) {
+    strncpy(message, msg, sizeof(message) - 1);
+    message[sizeof(message) - 1] = '\0';
+    last.code = JSON_ERROR_OTHER;
+    last.offset = JSON_NO_OFFSET;
+    last.expected = 0;
+    last.found = 0;
+    last.detail = message;
+    formatted = 1;
+}
+
+const json_error *json_get_error(void) {
+    return &last;
+}
+
+const char *json_get_last_error(void) {
+    if (!formatted) {
+        json_error_format(&last, NULL, 0, message, sizeof(message));
+        formatted = 1;
+    }
+    return message;
+}
+
+int json_error_location(const json_error *error, const char *text, size_t len, size_t *line, size_t *column) {
+    if (!error || !text || error->offset == JSON_NO_OFFSET || error->offset > len) return 0;
+    size_t l = 1;
+    const char *line_start = text;
+    for (const char *p = text; (p = memchr(p, '\n', (size_t)(text + error->offset - p))); p++) {
+        l++;
+        line_start = p + 1;
+    }
+    *line = l;
+    *column = (size_t)(text + error->offset - line_start) + 1;
+    return 1;
+}
+
+size_t json_error_format(const json_error *error, const char *text, size_t len, char *buf, size_t size) {
+    const char *detail = error && error->detail ? error->detail : "";
+    size_t detail_len = strlen(detail);
+    /* messages recorded whole already end the line */
+    const char *newline = detail_len && detail[detail_len - 1] == '\n' ? "" : "\n";
+    size_t line, column;
+    int n;
+    if (json_error_location(error, text, len, &line, &column)) {
+        n = snprintf(buf, size, "%s at line %zu, column %zu%s", detail, line, column, newline);
+    } else if (error && error->offset != JSON_NO_OFFSET) {
+        n = snprintf(buf, size, "%s at offset %zu%s", detail, error->offset, newline);
+    } else {
+        n = snprintf(buf, size, "%s%s", detail, newline);
+    }
+    return n < 0 ? 0 : (size_t)n;
+}
@@ -0,0 +1,83 @@
+#ifndef JSONERROR_H
+#define JSONERROR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+/* Errors of the library.
+ *
+ * A call that fails records a json_error for the calling thread: a code,
+ * the byte offset in the input where reading stopped and, for syntax
+ * errors found by the tokenizer, the tokens that could have come there and
+ * the one that came instead. Recording it does no I/O and no formatting,
+ * so rejecting malformed input costs no more than finding the error. The
+ * message, line and column are worked out only when asked for. The
+ * library never writes to stderr. */
+
+typedef enum {
+    JSON_ERROR_NONE,
+    JSON_ERROR_SYNTAX,            /* malformed text: structure, string, number or literal */
+    JSON_ERROR_DUPLICATE_KEY,     /* rejected by JSON_DUPLICATE_REJECT */
+    JSON_ERROR_OUT_OF_MEMORY,
+    JSON_ERROR_INVALID_ARGUMENT,  /* NULL, or a bad path or index */
+    JSON_ERROR_TYPE,              /* the value is not of the type the call needs */
+    JSON_ERROR_NOT_FOUND,         /* no such key or index */
+    JSON_ERROR_LIMIT,             /* the input goes over a limit of json_parse_options */
+    JSON_ERROR_OTHER              /* described by the message only */
+} json_error_code;
+
+/* Token kinds, as bits so that the expected tokens fit in one field */
+#define JSON_TOKEN_LITERAL      (1u << 0)  /* number, true, false or null */
+#define JSON_TOKEN_STRING       (1u << 1)
+#define JSON_TOKEN_COLON        (1u << 2)
+#define JSON_TOKEN_COMMA        (1u << 3)
+#define JSON_TOKEN_OBJECT_START (1u << 4)
+#define JSON_TOKEN_OBJECT_END   (1u << 5)
+#define JSON_TOKEN_ARRAY_START  (1u << 6)
+#define JSON_TOKEN_ARRAY_END    (1u << 7)
+#define JSON_TOKEN_END          (1u << 8)  /* end of the input */
+#define JSON_TOKEN_VALUE \
+    (JSON_TOKEN_LITERAL | JSON_TOKEN_STRING | JSON_TOKEN_OBJECT_START | JSON_TOKEN_ARRAY_START)
+
+/* offset of an error that is not about a position in the input */
+#define JSON_NO_OFFSET ((size_t)-1)
+
+typedef struct {
+    json_error_code code;
+    size_t offset;       /* byte offset in the input, or JSON_NO_OFFSET */
+    unsigned expected;   /* JSON_TOKEN_* bits that could have come, 0 if not known */
+    unsigned found;      /* JSON_TOKEN_* bit of what came instead, 0 if not known */
+    const char *detail;  /* what went wrong, without the position */
+} json_error;
+
+/* The last error of the calling thread, overwritten by the next one */
+const json_error *json_get_error(void);
+
+/* The last error of the calling thread as a message, formatted on the
+ * first call after the error */
+const char *json_get_last_error(void);
+
+/* Line and column, both from 1, of the error offset in text, the len bytes
+ * the failed call read. Columns count bytes. Returns 0 if the error has no
+ * offset within text. */
+int json_error_location(const json_error *error, const char *text, size_t len, size_t *line, size_t *column);
+
+/* Writes a message naming the line and column of the error in text, or
+ * only its offset if text is NULL, like snprintf: at most size bytes,
+ * always terminated, returning the length of the whole message. */
+size_t json_error_format(const json_error *error, const char *text, size_t len, char *buf, size_t size);
+
+/* Recording an error, as done by the library. detail is not copied and
+ * must outlive the error, as a string literal does. */
+void json_set_error(json_error_code code, size_t offset, const char *detail);
+/* Adds the expected and found tokens to the error just recorded */
+void json_set_error_tokens(unsigned expected, unsigned found);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONERROR_H */
@@ -0,0 +1,174 @@
+/* jsonfilter: filters and aggregates NDJSON with a query of jsonquery.h.
+ *
+ * Usage: jsonfilter [-j threads] QUERY [FILE...]
+ *
+ * Reads each file in turn, or standard input, and writes what the query
+ * outputs to standard output. Files are mapped and read in chunks of whole
+ * lines, each evaluated by all threads at once. Exits with 0 if a record
+ * was selected, 1 if none was and 2 on an error, like grep. */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "jsonerror.h"
+#include "jsonquery.h"
+
+#define CHUNK ((size_t)64 << 20)
+
+static int write_output(json_query_run *run) {
+    size_t len;
+    const char *out = json_query_output(run, &len);
+    int ok = fwrite(out, 1, len, stdout) == len;
+    json_query_clear_output(run);
+    if (!ok) fprintf(stderr, "jsonfilter: failed to write the output\n");
+    return ok;
+}
+
+/* Feeds buf[0..len), whole lines, reporting an error at its offset from
+ * base in the input named name */
+static int feed(json_query_run *run, const char *buf, size_t len, unsigned threads, const char *name, size_t base) {
+    if (!json_query_feed(run, buf, len, threads)) {
+        const json_error *e = json_get_error();
+        if (e->offset == JSON_NO_OFFSET) fprintf(stderr, "jsonfilter: %s: %s\n", name, e->detail);
+        else fprintf(stderr, "jsonfilter: %s: %s at byte %zu\n", name, e->detail, base + e->offset);
+        return 0;
+    }
+    return write_output(run);
+}
+
+/* The last newline of [p, p + len), or NULL */
+static const char *last_newline(const char *p, size_t len) {
+    while (len && p[len - 1] != '\n') len--;
+    return len ? p + len - 1 : NULL;
+}
+
+/* Up to CHUNK bytes of [p, end), cut after the last newline in it */
+static size_t chunk_length(const char *p, const char *end) {
+    size_t len = (size_t)(end - p);
+    if (len <= CHUNK) return len;
+    const char *last = last_newline(p, CHUNK);
+    if (last) return (size_t)(last - p) + 1;
+    /* a line longer than a chunk */
+    const char *next = memchr(p + CHUNK, '\n', len - CHUNK);
+    return next ? (size_t)(next - p) + 1 : len;
+}
+
+static int filter_file(json_query_run *run, const char *path, unsigned threads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "jsonfilter: %s: cannot open\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    const char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "jsonfilter: %s: cannot map\n", path);
+        return 0;
+    }
+    madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const char *p = data, *end = data + st.st_size;
+    int ok = 1;
+    while (ok && p < end) {
+        size_t len = chunk_length(p, end);
+        ok = feed(run, p, len, threads, path, (size_t)(p - data));
+        /* the pages read are not needed again */
+        madvise((void *)data, (size_t)(p + len - data) & ~(size_t)4095, MADV_DONTNEED);
+        p += len;
+    }
+    munmap((void *)data, (size_t)st.st_size);
+    return ok;
+}
+
+/* Standard input, read into a buffer; the last, partial line of each read
+ * waits for the next one */
+static int filter_stdin(json_query_run *run, unsigned threads) {
+    size_t cap = CHUNK, len = 0, base = 0;
+    char *buf = malloc(cap);
+    int ok = buf != NULL;
+    for (;;) {
+        if (!ok) break;
+        if (len == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(0, buf + len, cap - len);
+        if (n < 0) {
+            fprintf(stderr, "jsonfilter: cannot read the standard input\n");
+            ok = 0;
+            break;
+        }
+        if (n == 0) {
+            ok = feed(run, buf, len, threads, "(standard input)", base);
+            break;
+        }
+        len += (size_t)n;
+        const char *last = last_newline(buf, len);
+        if (!last) continue;
+        size_t whole = (size_t)(last - buf) + 1;
+        ok = feed(run, buf, whole, threads, "(standard input)", base);
+        memmove(buf, buf + whole, len - whole);
+        len -= whole;
+        base += whole;
+    }
+    free(buf);
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: jsonfilter [-j threads] QUERY [FILE...]\n");
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? (unsigned)cpus : 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt == 'j' && atoi(optarg) > 0) {
+            threads = (unsigned)atoi(optarg);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 2;
+    }
+
+    json_query *query = json_query_compile(argv[optind]);
+    if (!query) {
+        const json_error *e = json_get_error();
+        fprintf(stderr, "jsonfilter: %s at offset %zu of the query\n", e->detail, e->offset);
+        return 2;
+    }
+    json_query_run *run = json_query_start(query);
+    int ok = run != NULL;
+    if (ok && optind + 1 == argc) ok = filter_stdin(run, threads);
+    for (int i = optind + 1; ok && i < argc; i++) ok = filter_file(run, argv[i], threads);
+    if (ok && !json_query_finish(run)) {
+        fprintf(stderr, "jsonfilter: %s\n", json_get_error()->detail);
+        ok = 0;
+    }
+    if (ok) ok = write_output(run);
+    ok = fflush(stdout) == 0 && ok;
+
+    int status = !ok ? 2 : json_query_matched(run) ? 0 : 1;
+    json_query_run_free(run);
+    json_query_free(query);
+    return status;
+}
@@ -0,0 +1,551 @@
+#include "jsonimage.h"
+#include "jsoninternal.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* An image is a header followed by the nodes, strings and keys of one
+ * tree. Every node has the same size, so the items of an array are a
+ * block of nodes and item i is found by arithmetic. The members of an
+ * object are a block of key and value pairs; an object of more than
+ * SCAN_MEMBERS members is followed by the positions of its members sorted
+ * by key, searched by bisection. Keys are stored once per image when
+ * they are short, as the objects of an array of records mostly repeat the
+ * same ones.
+ *
+ * A node refers to what it holds by its offset from the node itself, so
+ * nothing in the image depends on where it is mapped. */
+
+#define IMAGE_MAGIC "CJSNIMG1"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+#define SCAN_MEMBERS 8
+
+/* Keys up to this length are shared; looking one up gives up after so
+ * many probes, leaving a copy, so no set of keys makes publishing slow */
+#define SHARED_KEY_LENGTH 64
+#define KEY_PROBES 16
+
+struct json_image_value {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t data;  /* boolean, bits of the number, length of the string, items or members */
+    int64_t at;     /* string bytes, items or members, from this node */
+};
+
+struct image_member {
+    int64_t key;    /* from this member */
+    uint64_t key_len;
+    struct json_image_value value;
+};
+
+struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t generation;
+    uint64_t size;  /* of the whole file */
+    struct json_image_value root;
+};
+
+struct json_image {
+    const char *map;
+    size_t size;
+    char *path;
+    dev_t dev;
+    ino_t ino;
+};
+
+/*====================PUBLISHING==========================*/
+
+/* The image is laid out in memory, then written in one go. Nodes are
+ * filled in by offset as the buffer moves when it grows. */
+struct builder {
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t *keys;   /* offsets of shared keys + 1, 0 for an empty slot */
+    size_t key_mask;
+    size_t key_count;
+};
+
+/* Offset of bytes more at the end of the image, aligned to 8, or 0 if the
+ * buffer cannot grow (offset 0 is the header) */
+static size_t reserve(struct builder *b, size_t bytes) {
+    size_t at = (b->size + 7) & ~(size_t)7;
+    if (bytes > SIZE_MAX - at) return 0;
+    if (at + bytes > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (capacity < at + bytes) capacity = capacity > SIZE_MAX / 2 ? at + bytes : capacity * 2;
+        char *data = json_realloc(b->data, capacity);
+        if (!data) return 0;
+        b->data = data;
+        b->capacity = capacity;
+    }
+    memset(b->data + b->size, 0, at + bytes - b->size);
+    b->size = at + bytes;
+    return at;
+}
+
+/* Copies the len bytes at s, NUL-terminated, returning their offset */
+static size_t add_bytes(struct builder *b, const char *s, size_t len) {
+    size_t at = reserve(b, len + 1);
+    if (at) memcpy(b->data + at, s, len);
+    return at;
+}
+
+static size_t key_slot(const char *key, size_t len, size_t mask) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)key[i]) * 1099511628211ull;
+    return (size_t)(h ^ (h >> 32)) & mask;
+}
+
+/* Offset of a copy of key, shared with earlier members if possible */
+static size_t add_key(struct builder *b, const char *key, size_t len) {
+    if (len > SHARED_KEY_LENGTH || memchr(key, '\0', len)) return add_bytes(b, key, len);
+
+    if (b->key_count * 2 >= b->key_mask) {
+        size_t mask = b->key_mask ? b->key_mask * 2 + 1 : 1023;
+        size_t *keys = json_calloc(mask + 1, sizeof(size_t));
+        if (keys) {
+            for (size_t i = 0; b->keys && i <= b->key_mask; i++) {
+                if (!b->keys[i]) continue;
+                const char *k = b->data + b->keys[i] - 1;
+                size_t slot = key_slot(k, strlen(k), mask);
+                while (keys[slot]) slot = (slot + 1) & mask;
+                keys[slot] = b->keys[i];
+            }
+            json_mfree(b->keys);
+            b->keys = keys;
+            b->key_mask = mask;
+        }
+    }
+    if (!b->keys) return add_bytes(b, key, len);
+
+    size_t slot = key_slot(key, len, b->key_mask);
+    for (int probe = 0; probe < KEY_PROBES; probe++, slot = (slot + 1) & b->key_mask) {
+        size_t at = b->keys[slot];
+        if (!at) {
+            at = add_bytes(b, key, len);
+            if (at && b->key_count * 2 < b->key_mask) {
+                b->keys[slot] = at + 1;
+                b->key_count++;
+            }
+            return at;
+        }
+        if (strncmp(b->data + at - 1, key, len) == 0 && b->data[at - 1 + len] == '\0') return at - 1;
+    }
+    return add_bytes(b, key, len);
+}
+
+#define NODE(b, at) ((struct json_image_value *)((b)->data + (at)))
+#define MEMBER(b, at) ((struct image_member *)((b)->data + (at)))
+
+struct sort_key {
+    const char *key;
+    size_t len;
+    uint32_t position;
+};
+
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return c ? c : (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_sort_keys(const void *a, const void *b) {
+    const struct sort_key *x = a, *y = b;
+    int c = compare_keys(x->key, x->len, y->key, y->len);
+    return c ? c : (x->position > y->position) - (x->position < y->position);
+}
+
+static int add_value(struct builder *b, size_t node, const json_value *value);
+
+static int add_array(struct builder *b, size_t node, const json_value *array) {
+    size_t count = array->u.array.count;
+    NODE(b, node)->data = count;
+    if (!count) return 1;
+    if (count > SIZE_MAX / sizeof(struct json_image_value)) return 0;
+    size_t items = reserve(b, count * sizeof(struct json_image_value));
+    if (!items) return 0;
+    NODE(b, node)->at = (int64_t)(items - node);
+
+    /* packed numbers are copied without making nodes of them */
+    const double *numbers = json_array_get_doubles(array, NULL);
+    if (numbers) {
+        for (size_t i = 0; i < count; i++) {
+            struct json_image_value *item = NODE(b, items) + i;
+            item->type = JSON_NUMBER;
+            memcpy(&item->data, &numbers[i], sizeof(double));
+        }
+        return 1;
+    }
+    json_array_iter it = json_array_iter_begin(array);
+    if (json_array_iter_remaining(&it) != count) return 0;
+    for (size_t i = 0; i < count; i++)
+        if (!add_value(b, items + i * sizeof(struct json_image_value), json_array_iter_next(&it))) return 0;
+    return 1;
+}
+
+static int add_object(struct builder *b, size_t node, const json_value *object) {
+    size_t count = object->u.object.count;
+    NODE(b, node)->data = count;
+    if (!count) return 1;
+    if (count > UINT32_MAX) return 0;
+    size_t order_size = count > SCAN_MEMBERS ? count * sizeof(uint32_t) : 0;
+    size_t members = reserve(b, count * sizeof(struct image_member) + order_size);
+    if (!members) return 0;
+    NODE(b, node)->at = (int64_t)(members - node);
+
+    const json_member *m = object->u.object.members;
+    for (size_t i = 0; i < count; i++) {
+        size_t member = members + i * sizeof(struct image_member);
+        size_t key = add_key(b, m[i].key, m[i].key_len);
+        if (!key) return 0;
+        MEMBER(b, member)->key = (int64_t)(key - member);
+        MEMBER(b, member)->key_len = m[i].key_len;
+        if (!add_value(b, member + offsetof(struct image_member, value), m[i].value)) return 0;
+    }
+    if (!order_size) return 1;
+
+    struct sort_key *sorted = json_malloc(count * sizeof(struct sort_key));
+    if (!sorted) return 0;
+    for (size_t i = 0; i < count; i++) sorted[i] = (struct sort_key){m[i].key, m[i].key_len, (uint32_t)i};
+    qsort(sorted, count, sizeof(struct sort_key), compare_sort_keys);
+    uint32_t *order = (uint32_t *)(b->data + members + count * sizeof(struct image_member));
+    for (size_t i = 0; i < count; i++) order[i] = sorted[i].position;
+    json_mfree(sorted);
+    return 1;
+}
+
+/* Fills the node at offset node with value */
+static int add_value(struct builder *b, size_t node, const json_value *value) {
+    NODE(b, node)->type = (uint32_t)value->type;
+    switch (value->type) {
+        case JSON_BOOLEAN:
+            NODE(b, node)->data = (uint64_t)value->u.boolean;
+            return 1;
+        case JSON_NUMBER: {
+            double number = json_number_value(value);
+            memcpy(&NODE(b, node)->data, &number, sizeof(double));
+            return 1;
+        }
+        case JSON_STRING: {
+            size_t len = strlen(value->u.string);
+            size_t at = add_bytes(b, value->u.string, len);
+            if (!at) return 0;
+            NODE(b, node)->data = len;
+            NODE(b, node)->at = (int64_t)(at - node);
+            return 1;
+        }
+        case JSON_ARRAY:
+            return add_array(b, node, value);
+        case JSON_OBJECT:
+            return add_object(b, node, value);
+        default:
+            return 1;
+    }
+}
+
+/* Generation of the image now at path, 0 if there is none */
+static uint64_t current_generation(const char *path) {
+    struct image_header h;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t n = pread(fd, &h, sizeof(h), 0);
+    close(fd);
+    if (n != (ssize_t)sizeof(h) || memcmp(h.magic, IMAGE_MAGIC, sizeof(h.magic)) != 0) return 0;
+    return h.generation;
+}
+
+/* Writes the image to a temporary file next to path and renames it over
+ * path, so a reader never sees half of it */
+static int save_image(const struct builder *b, const char *path) {
+    size_t len = strlen(path);
+    char *tmp = json_malloc(len + 8);
+    if (!tmp) return 0;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", 8);
+
+    int fd = mkstemp(tmp);
+    int ok = fd >= 0;
+    if (ok) {
+        /* readable by the other processes, as a file created by open() */
+        ok = fchmod(fd, 0644) == 0;
+        for (size_t done = 0; ok && done < b->size;) {
+            ssize_t n = write(fd, b->data + done, b->size - done);
+            if (n <= 0) ok = 0;
+            else done += (size_t)n;
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) unlink(tmp);
+    }
+    json_mfree(tmp);
+    return ok;
+}
+
+uint64_t json_image_publish(const json_value *value, const char *path) {
+    if (!value || !path) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL value or path");
+        return 0;
+    }
+    struct builder b = {NULL, 0, 0, NULL, 0, 0};
+    uint64_t generation = current_generation(path) + 1;
+
+    /* the header is the first thing reserved, at offset 0 */
+    int ok = reserve(&b, sizeof(struct image_header)) == 0 && b.data &&
+             add_value(&b, offsetof(struct image_header, root), value);
+    json_mfree(b.keys);
+    if (ok) {
+        /* the file ends on a whole node, like everything in it */
+        ok = reserve(&b, 0) != 0;
+        struct image_header *h = (struct image_header *)b.data;
+        memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+        h->version = IMAGE_VERSION;
+        h->byte_order = IMAGE_BYTE_ORDER;
+        h->generation = generation;
+        h->size = b.size;
+    }
+    if (!ok) {
+        json_mfree(b.data);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to lay out the image");
+        return 0;
+    }
+    ok = save_image(&b, path);
+    json_mfree(b.data);
+    if (!ok) {
+        json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "failed to write the image");
+        return 0;
+    }
+    return generation;
+}
+
+/*====================ATTACHING===========================*/
+
+json_image *json_image_attach(const char *path) {
+    if (!path) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL path");
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "failed to open the image");
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(struct image_header))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "failed to map the image");
+        return NULL;
+    }
+
+    const struct image_header *h = map;
+    if (memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 || h->version != IMAGE_VERSION ||
+        h->byte_order != IMAGE_BYTE_ORDER || h->size != (uint64_t)st.st_size || h->root.type > JSON_OBJECT) {
+        munmap(map, (size_t)st.st_size);
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "not an image of this version");
+        return NULL;
+    }
+
+    json_image *image = json_malloc(sizeof(*image));
+    size_t len = strlen(path);
+    char *copy = json_malloc(len + 1);
+    if (!image || !copy) {
+        json_mfree(image);
+        json_mfree(copy);
+        munmap(map, (size_t)st.st_size);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return NULL;
+    }
+    memcpy(copy, path, len + 1);
+    image->map = map;
+    image->size = (size_t)st.st_size;
+    image->path = copy;
+    image->dev = st.st_dev;
+    image->ino = st.st_ino;
+    return image;
+}
+
+void json_image_detach(json_image *image) {
+    if (!image) return;
+    munmap((void *)image->map, image->size);
+    json_mfree(image->path);
+    json_mfree(image);
+}
+
+uint64_t json_image_generation(const json_image *image) {
+    return ((const struct image_header *)image->map)->generation;
+}
+
+int json_image_stale(const json_image *image) {
+    struct stat st;
+    return stat(image->path, &st) != 0 || st.st_dev != image->dev || st.st_ino != image->ino;
+}
+
+/*====================NAVIGATORS==========================*/
+
+#define AT(node) ((const char *)(node) + (node)->at)
+
+static const struct image_member *members_of(const json_image_value *object) {
+    return (const struct image_member *)AT(object);
+}
+
+static const char *key_of(const struct image_member *m) {
+    return (const char *)m + m->key;
+}
+
+const json_image_value *json_image_root(const json_image *image) {
+    return &((const struct image_header *)image->map)->root;
+}
+
+int json_image_get_type(const json_image_value *value) {
+    return (int)value->type;
+}
+
+double json_image_get_number(const json_image_value *value) {
+    if (value->type != JSON_NUMBER) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_NUMBER");
+        return 0;
+    }
+    double number;
+    memcpy(&number, &value->data, sizeof(double));
+    return number;
+}
+
+uint8_t json_image_get_boolean(const json_image_value *value) {
+    if (value->type != JSON_BOOLEAN) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_BOOLEAN");
+        return 0;
+    }
+    return (uint8_t)value->data;
+}
+
+const char *json_image_get_string(const json_image_value *value) {
+    if (value->type != JSON_STRING) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_STRING");
+        return NULL;
+    }
+    return AT(value);
+}
+
+size_t json_image_get_string_length(const json_image_value *value) {
+    if (value->type != JSON_STRING) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_STRING");
+        return 0;
+    }
+    return (size_t)value->data;
+}
+
+size_t json_image_size(const json_image_value *value) {
+    return value->type == JSON_ARRAY || value->type == JSON_OBJECT ? (size_t)value->data : 0;
+}
+
+const json_image_value *json_image_array_get(const json_image_value *array, size_t index) {
+    if (array->type != JSON_ARRAY) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "object is not of type JSON_ARRAY");
+        return NULL;
+    }
+    if (index >= array->data) {
+        json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "index of array out of bounds");
+        return NULL;
+    }
+    return (const json_image_value *)AT(array) + index;
+}
+
+const json_image_value *json_image_object_get(const json_image_value *object, const char *key) {
+    if (object->type != JSON_OBJECT) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_OBJECT");
+        return NULL;
+    }
+    size_t count = (size_t)object->data;
+    size_t len = strlen(key);
+    const struct image_member *m = members_of(object);
+
+    if (count <= SCAN_MEMBERS) {
+        for (size_t i = 0; i < count; i++)
+            if (m[i].key_len == len && memcmp(key_of(&m[i]), key, len) == 0) return &m[i].value;
+    } else {
+        /* the first of the sorted positions not below key */
+        const uint32_t *order = (const uint32_t *)(m + count);
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            const struct image_member *x = &m[order[mid]];
+            if (compare_keys(key_of(x), (size_t)x->key_len, key, len) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < count) {
+            const struct image_member *x = &m[order[lo]];
+            if (x->key_len == len && memcmp(key_of(x), key, len) == 0) return &x->value;
+        }
+    }
+    json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "json_image_object_get: key not found in object");
+    return NULL;
+}
+
+int json_image_object_at(const json_image_value *object, size_t index, json_image_member *out) {
+    if (object->type != JSON_OBJECT || index >= object->data) return 0;
+    const struct image_member *m = members_of(object) + index;
+    out->key = key_of(m);
+    out->key_len = (size_t)m->key_len;
+    out->value = &m->value;
+    return 1;
+}
+
+/*====================COPYING=============================*/
+
+json_value *json_image_copy(const json_image_value *value) {
+    switch (value->type) {
+        case JSON_NULL:
+            return json_new_null();
+        case JSON_BOOLEAN:
+            return json_new_boolean((int)value->data);
+        case JSON_NUMBER:
+            return json_new_number(json_image_get_number(value));
+        case JSON_STRING:
+            return json_new_string(AT(value));
+        case JSON_ARRAY: {
+            json_value *array = json_new_array();
+            const json_image_value *items = (const json_image_value *)AT(value);
+            for (size_t i = 0; array && i < value->data; i++) {
+                json_value *item = json_image_copy(&items[i]);
+                if (!item || !json_array_append(array, item)) {
+                    json_free(item);
+                    json_free(array);
+                    return NULL;
+                }
+            }
+            return array;
+        }
+        case JSON_OBJECT: {
+            json_value *object = json_new_object();
+            const struct image_member *m = members_of(value);
+            /* the keys are known to differ; the index keeps a large object linear to fill */
+            struct json_key_index index = JSON_KEY_INDEX_INIT;
+            for (size_t i = 0; object && i < value->data; i++) {
+                json_value *member = json_image_copy(&m[i].value);
+                if (!member || !json_object_add_member(object, &index, key_of(&m[i]), (size_t)m[i].key_len,
+                                                       member, JSON_DUPLICATE_KEEP_FIRST)) {
+                    json_free(member);
+                    json_free(object);
+                    object = NULL;
+                }
+            }
+            json_key_index_free(&index);
+            return object;
+        }
+        default:
+            return NULL;
+    }
+}
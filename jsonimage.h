@@ -0,0 +1,87 @@
+#ifndef JSONIMAGE_H
+#define JSONIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "jsonparser.h"
+
+/* Parsed documents shared between processes.
+ *
+ * json_image_publish lays a tree out as an image: a file holding every
+ * node, string and key of it, where nodes refer to their children by
+ * offsets from themselves instead of pointers. The image means the same
+ * wherever it is mapped, so any number of processes can attach it
+ * read-only and walk it in place: attaching maps the file and reads its
+ * header, nothing is parsed or copied, and the pages are those of the page
+ * cache, held once for all readers. A file under /dev/shm keeps the image
+ * in shared memory.
+ *
+ * Each publication writes a new file, with the next generation number,
+ * and renames it over the path. Readers attached to the previous
+ * generation keep it, unchanged, until they detach; json_image_stale
+ * tells them a newer one is there to attach. The file is written by one
+ * publisher at a time and is trusted: attaching checks its header and
+ * size, not every offset. */
+
+typedef struct json_image json_image;
+
+/* A value inside an attached image, valid until it is detached */
+typedef struct json_image_value json_image_value;
+
+/* A member of an object of an image, as stored in it */
+typedef struct {
+    const char *key;
+    size_t key_len;
+    const json_image_value *value;
+} json_image_member;
+
+/* Writes value as the next generation of the image at path. Returns that
+ * generation, from 1, or 0 if the file cannot be written, with the error
+ * recorded. */
+uint64_t json_image_publish(const json_value *value, const char *path);
+
+/* Maps the image at path read-only. Returns NULL if it cannot be read or
+ * is not an image. */
+json_image *json_image_attach(const char *path);
+void json_image_detach(json_image *image);
+
+uint64_t json_image_generation(const json_image *image);
+
+/* Whether the image at the path it was attached from has been replaced
+ * (or removed) since: one stat() call */
+int json_image_stale(const json_image *image);
+
+/*====================NAVIGATORS==========================*/
+
+/* As their json_value counterparts: a value of the wrong type gives NULL
+ * or 0, and a missing key or index NULL, with the error recorded. Objects
+ * of more than a few members are searched through a sorted index stored
+ * with them, in O(log n). */
+const json_image_value *json_image_root(const json_image *image);
+int json_image_get_type(const json_image_value *value);
+double json_image_get_number(const json_image_value *value);
+uint8_t json_image_get_boolean(const json_image_value *value);
+/* NUL-terminated, in the image */
+const char *json_image_get_string(const json_image_value *value);
+size_t json_image_get_string_length(const json_image_value *value);
+
+/* Items of an array or members of an object, 0 for other values */
+size_t json_image_size(const json_image_value *value);
+const json_image_value *json_image_array_get(const json_image_value *array, size_t index);
+const json_image_value *json_image_object_get(const json_image_value *object, const char *key);
+/* The member at position index, in the order of the published object.
+ * Returns 0 if there is none. */
+int json_image_object_at(const json_image_value *object, size_t index, json_image_member *out);
+
+/* Copies value and everything below it into a tree of its own, for code
+ * that takes a json_value or modifies it. NULL if that fails. */
+json_value *json_image_copy(const json_image_value *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONIMAGE_H */
@@ -0,0 +1,660 @@
+#include "jsonindex.h"
+#include "jsoninternal.h"
+#include "jsonproject.h"
+#include "jsonscan.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The index is three tables, saved one after the other behind a header:
+ *
+ *  - nodes: every container of at least min_container_size bytes, sorted
+ *    by offset, so the container starting at a given byte is found by a
+ *    binary search and stepped over in one go;
+ *  - keys: for each indexed object, one entry per member, sorted by the
+ *    hash of the key, so a member is found without scanning its siblings;
+ *  - checkpoints: for each indexed array, the offset of every stride-th
+ *    item, so an item is at most stride - 1 siblings away from one.
+ *
+ * Everything else is read from the mapped file. The file is checked while
+ * the index is built, so lookups can step over it without checking again. */
+
+#define INDEX_MAGIC "CJSNIDX1"
+#define INDEX_VERSION 1
+#define INDEX_BYTE_ORDER 0x01020304u
+
+#define DEFAULT_MIN_CONTAINER_SIZE 4096
+#define DEFAULT_ARRAY_STRIDE 64
+
+/* While building, pages already scanned are dropped from the mapping every
+ * so many bytes: reading the whole file once must not make it resident */
+#define DROP_INTERVAL ((size_t)64 << 20)
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    int64_t file_mtime_sec;
+    int64_t file_mtime_nsec;
+    uint64_t min_container_size;
+    uint64_t array_stride;
+    uint64_t nodes;
+    uint64_t keys;
+    uint64_t checkpoints;
+};
+
+/* An indexed container */
+struct index_node {
+    uint64_t start;  /* offset of its '{' or '[' */
+    uint64_t end;    /* offset past its '}' or ']' */
+    uint64_t first;  /* its first entry in keys (object) or checkpoints (array) */
+    uint64_t count;  /* members or items */
+};
+
+/* A member of an indexed object. Those of an object are sorted by hash,
+ * then by offset so that a repeated key finds its first occurrence. */
+struct index_key {
+    uint64_t hash;    /* of the decoded key */
+    uint64_t offset;  /* of the key's opening quote */
+};
+
+struct json_index {
+    const char *data;
+    uint64_t size;
+    uint64_t stride;
+    const struct index_node *nodes;
+    size_t node_count;
+    const struct index_key *keys;
+    const uint64_t *checkpoints;
+    void *map;          /* the mapped index file, NULL if the tables were built here */
+    size_t map_size;
+    json_projection *whole;
+};
+
+/*====================KEYS================================*/
+
+#define KEY_HASH_SEED  0xcbf29ce484222325ULL
+#define KEY_HASH_PRIME 0x100000001b3ULL
+
+static uint64_t key_hash_bytes(uint64_t h, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * KEY_HASH_PRIME;
+    return h;
+}
+
+/* Hash of the raw key body [raw, raw_end), as if it were decoded */
+static uint64_t raw_key_hash(const char *raw, const char *raw_end) {
+    uint64_t h = KEY_HASH_SEED;
+    while (raw < raw_end) {
+        const char *escape = memchr(raw, '\\', (size_t)(raw_end - raw));
+        const char *plain_end = escape ? escape : raw_end;
+        h = key_hash_bytes(h, raw, (size_t)(plain_end - raw));
+        if (!escape) break;
+
+        char decoded[4];
+        size_t written;
+        raw = escape + json_scan_unescape(escape, raw_end, decoded, &written);
+        h = key_hash_bytes(h, decoded, written);
+    }
+    return h;
+}
+
+/*====================BUILDING============================*/
+
+/* A growable array. The capacity is in bytes so that a buffer can be
+ * reused for elements of another size. */
+struct vec {
+    void *items;
+    size_t count;
+    size_t capacity;
+};
+
+static int vec_append(struct vec *v, const void *items, size_t count, size_t size) {
+    size_t needed = (v->count + count) * size;
+    if (needed > v->capacity) {
+        size_t capacity = v->capacity ? v->capacity : 256;
+        while (capacity < needed) capacity *= 2;
+        void *grown = json_realloc(v->items, capacity);
+        if (!grown) return 0;
+        v->items = grown;
+        v->capacity = capacity;
+    }
+    memcpy((char *)v->items + v->count * size, items, count * size);
+    v->count += count;
+    return 1;
+}
+
+/* A container open while building */
+struct build_frame {
+    uint64_t start;
+    uint64_t count;
+    int object;
+    struct vec entries;  /* index_key of an object, checkpoints of an array */
+};
+
+struct builder {
+    const char *data;
+    const char *end;
+    uint64_t min_size;
+    uint64_t stride;
+    struct vec nodes;
+    struct vec keys;
+    struct vec checkpoints;
+    struct build_frame frames[JSON_MAX_DEPTH];
+};
+
+static int compare_keys(const void *a, const void *b) {
+    const struct index_key *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+    const struct index_node *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Records a closed container if it is large enough */
+static int close_frame(struct builder *b, struct build_frame *frame, uint64_t end) {
+    if (end - frame->start < b->min_size) return 1;
+
+    struct index_node node = {frame->start, end, 0, frame->count};
+    if (frame->object) {
+        node.first = b->keys.count;
+        if (!vec_append(&b->keys, frame->entries.items, frame->entries.count, sizeof(struct index_key)))
+            return 0;
+        qsort((struct index_key *)b->keys.items + node.first, frame->entries.count, sizeof(struct index_key),
+              compare_keys);
+    } else {
+        node.first = b->checkpoints.count;
+        if (!vec_append(&b->checkpoints, frame->entries.items, frame->entries.count, sizeof(uint64_t)))
+            return 0;
+    }
+    return vec_append(&b->nodes, &node, 1, sizeof(node));
+}
+
+/* Lets the kernel reclaim the pages of [from, to) */
+static void drop_pages(const char *from, const char *to) {
+#ifdef MADV_DONTNEED
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)from + page - 1) & ~(page - 1);
+    uintptr_t stop = (uintptr_t)to & ~(page - 1);
+    if (start < stop) madvise((void *)start, stop - start, MADV_DONTNEED);
+#else
+    (void)from;
+    (void)to;
+#endif
+}
+
+/* Reads the whole file, checking it against the grammar and filling the
+ * tables. Returns NULL or the error, *at being set to where it was found. */
+static const char *build(struct builder *b, const char **at) {
+    struct json_grammar g;
+    json_grammar_init(&g);
+
+    const char *p = b->data;
+    const char *end = b->end;
+    const char *dropped = p;
+
+    for (;;) {
+        p = json_skip_whitespace(p, end);
+        if (p == end) break;
+        if ((size_t)(p - dropped) >= DROP_INTERVAL) {
+            drop_pages(dropped, p);
+            dropped = p;
+        }
+
+        uint64_t offset = (uint64_t)(p - b->data);
+        unsigned state = g.state;
+        struct build_frame *top = g.depth ? &b->frames[g.depth - 1] : NULL;
+        unsigned cls = json_grammar_classes[(unsigned char)*p];
+        const char *error = json_grammar_feed(&g, cls);
+        if (error) {
+            *at = p;
+            return error;
+        }
+
+        if ((state == JSON_GRAMMAR_ARRAY_FIRST || state == JSON_GRAMMAR_ARRAY_VALUE) &&
+            cls != JSON_CLASS_CLOSE_ARRAY) {
+            if (top->count % b->stride == 0 && !vec_append(&top->entries, &offset, 1, sizeof(offset)))
+                goto out_of_memory;
+            top->count++;
+        }
+
+        switch (cls) {
+            case JSON_CLASS_STRING:
+                p = json_scan_string(p + 1, end, &error);
+                if (error) break;
+                if (state == JSON_GRAMMAR_OBJECT_FIRST || state == JSON_GRAMMAR_OBJECT_KEY) {
+                    struct index_key key = {raw_key_hash(b->data + offset + 1, p - 1), offset};
+                    if (!vec_append(&top->entries, &key, 1, sizeof(key))) goto out_of_memory;
+                    top->count++;
+                }
+                break;
+            case JSON_CLASS_OPEN_OBJECT:
+            case JSON_CLASS_OPEN_ARRAY:
+                top = &b->frames[g.depth - 1];
+                top->start = offset;
+                top->count = 0;
+                top->object = cls == JSON_CLASS_OPEN_OBJECT;
+                top->entries.count = 0;
+                p++;
+                break;
+            case JSON_CLASS_CLOSE_OBJECT:
+            case JSON_CLASS_CLOSE_ARRAY:
+                p++;
+                if (!close_frame(b, top, offset + 1)) goto out_of_memory;
+                break;
+            case JSON_CLASS_COLON:
+            case JSON_CLASS_COMMA:
+                p++;
+                break;
+            default:
+                if (*p == '-' || (*p >= '0' && *p <= '9')) {
+                    p = json_scan_number(p, end, &error);
+                    if (!error && p < end && json_scan_is_scalar_char(*p)) error = "Invalid number";
+                } else {
+                    size_t n = json_scan_literal(p, end);
+                    if (!n) {
+                        error = "Unexpected character";
+                        break;
+                    }
+                    p += n;
+                    if (p < end && json_scan_is_scalar_char(*p)) error = "Invalid literal";
+                }
+        }
+        if (error) {
+            *at = p;
+            return error;
+        }
+    }
+
+    *at = end;
+    const char *error = json_grammar_end(&g);
+    if (!error && b->nodes.count)
+        qsort(b->nodes.items, b->nodes.count, sizeof(struct index_node), compare_nodes);
+    return error;
+
+out_of_memory:
+    *at = p;
+    return "Out of memory";
+}
+
+/*====================SAVING AND LOADING==================*/
+
+static void fill_header(struct index_header *h, const struct stat *st, uint64_t min_size, uint64_t stride) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+    h->version = INDEX_VERSION;
+    h->byte_order = INDEX_BYTE_ORDER;
+    h->file_size = (uint64_t)st->st_size;
+    h->file_mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    h->file_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    h->min_container_size = min_size;
+    h->array_stride = stride;
+}
+
+/* Writes the tables to a temporary file renamed over path, so a reader
+ * never sees half of an index */
+static int save_index(const json_index *index, const struct index_header *header, const char *path) {
+    size_t len = strlen(path);
+    char *tmp = json_malloc(len + 5);
+    if (!tmp) return 0;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    FILE *f = fopen(tmp, "wb");
+    int ok = f != NULL;
+    if (ok) {
+        ok = fwrite(header, sizeof(*header), 1, f) == 1 &&
+             (!header->nodes || fwrite(index->nodes, sizeof(struct index_node), header->nodes, f) == header->nodes) &&
+             (!header->keys || fwrite(index->keys, sizeof(struct index_key), header->keys, f) == header->keys) &&
+             (!header->checkpoints || fwrite(index->checkpoints, sizeof(uint64_t), header->checkpoints, f) == header->checkpoints) &&
+             fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) unlink(tmp);
+    }
+    json_mfree(tmp);
+    return ok;
+}
+
+/* Maps the index saved at path if it matches expected */
+static int load_index(json_index *index, const struct index_header *expected, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(struct index_header))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const struct index_header *h = map;
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t tables = size - sizeof(*h);
+    int ok = memcmp(h->magic, expected->magic, sizeof(h->magic)) == 0 && h->version == expected->version &&
+             h->byte_order == expected->byte_order && h->file_size == expected->file_size &&
+             h->file_mtime_sec == expected->file_mtime_sec && h->file_mtime_nsec == expected->file_mtime_nsec &&
+             h->min_container_size == expected->min_container_size &&
+             h->array_stride == expected->array_stride &&
+             h->nodes <= tables / sizeof(struct index_node) && h->keys <= tables / sizeof(struct index_key) &&
+             h->checkpoints <= tables / sizeof(uint64_t) &&
+             h->nodes * sizeof(struct index_node) + h->keys * sizeof(struct index_key) +
+                 h->checkpoints * sizeof(uint64_t) == tables;
+    if (!ok) {
+        munmap(map, (size_t)size);
+        return 0;
+    }
+
+    const char *tables_start = (const char *)map + sizeof(*h);
+    index->nodes = (const struct index_node *)tables_start;
+    index->node_count = (size_t)h->nodes;
+    index->keys = (const struct index_key *)(tables_start + h->nodes * sizeof(struct index_node));
+    index->checkpoints = (const uint64_t *)((const char *)index->keys + h->keys * sizeof(struct index_key));
+    index->map = map;
+    index->map_size = (size_t)size;
+    return 1;
+}
+
+/*====================OPENING=============================*/
+
+static json_index *open_failed(json_index *index, const char *error) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), "json_index_open: %s\n", error);
+    json_set_last_error(msg);
+    json_index_close(index);
+    return NULL;
+}
+
+json_index *json_index_open(const char *json_path, const char *index_path, const json_index_options *options) {
+    if (!json_path) {
+        json_set_last_error("json_index_open: NULL argument\n");
+        return NULL;
+    }
+    uint64_t min_size = options && options->min_container_size ? options->min_container_size
+                                                                : DEFAULT_MIN_CONTAINER_SIZE;
+    uint64_t stride = options && options->array_stride ? options->array_stride : DEFAULT_ARRAY_STRIDE;
+
+    json_index *index = json_calloc(1, sizeof(*index));
+    if (!index) return open_failed(NULL, "out of memory");
+    index->stride = stride;
+
+    const char *whole = "";
+    index->whole = json_projection_new(&whole, 1);
+    if (!index->whole) return open_failed(index, "out of memory");
+
+    int fd = open(json_path, O_RDONLY);
+    if (fd < 0) return open_failed(index, "cannot open the file");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return open_failed(index, "cannot read the file or it is empty");
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return open_failed(index, "cannot map the file");
+    index->data = data;
+    index->size = (uint64_t)st.st_size;
+
+    struct index_header header;
+    fill_header(&header, &st, min_size, stride);
+
+    if (!index_path || !load_index(index, &header, index_path)) {
+        struct builder *b = json_calloc(1, sizeof(*b));
+        if (!b) return open_failed(index, "out of memory");
+        b->data = index->data;
+        b->end = index->data + index->size;
+        b->min_size = min_size;
+        b->stride = stride;
+#ifdef MADV_SEQUENTIAL
+        madvise(data, (size_t)index->size, MADV_SEQUENTIAL);
+#endif
+        const char *at;
+        const char *error = build(b, &at);
+        for (size_t i = 0; i < JSON_MAX_DEPTH; i++) json_mfree(b->frames[i].entries.items);
+
+        index->nodes = b->nodes.items;
+        index->node_count = b->nodes.count;
+        index->keys = b->keys.items;
+        index->checkpoints = b->checkpoints.items;
+        header.nodes = b->nodes.count;
+        header.keys = b->keys.count;
+        header.checkpoints = b->checkpoints.count;
+        json_mfree(b);
+
+        if (error) {
+            char msg[200];
+            snprintf(msg, sizeof(msg), "%s at offset %llu", error, (unsigned long long)(at - index->data));
+            return open_failed(index, msg);
+        }
+        if (index_path && !save_index(index, &header, index_path))
+            return open_failed(index, "cannot save the index");
+    }
+    /* from now on the file is only read where lookups lead */
+#ifdef MADV_RANDOM
+    madvise(data, (size_t)index->size, MADV_RANDOM);
+#endif
+    return index;
+}
+
+void json_index_close(json_index *index) {
+    if (!index) return;
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    } else {
+        json_mfree((void *)index->nodes);
+        json_mfree((void *)index->keys);
+        json_mfree((void *)index->checkpoints);
+    }
+    if (index->data) munmap((void *)index->data, (size_t)index->size);
+    json_projection_free(index->whole);
+    json_mfree(index);
+}
+
+const char *json_index_data(const json_index *index) {
+    return index ? index->data : NULL;
+}
+
+uint64_t json_index_size(const json_index *index) {
+    return index ? index->size : 0;
+}
+
+/*====================LOOKUPS=============================*/
+
+/* The indexed container starting at offset, or NULL */
+static const struct index_node *node_at(const json_index *index, uint64_t offset) {
+    size_t lo = 0, hi = index->node_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->nodes[mid].start < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < index->node_count && index->nodes[lo].start == offset ? &index->nodes[lo] : NULL;
+}
+
+/* End of the string whose body starts at p */
+static const char *string_end(const json_index *index, const char *p) {
+    const char *error = NULL;
+    return json_scan_string(p, index->data + index->size, &error);
+}
+
+static const char *skip_whitespace(const json_index *index, const char *p) {
+    return json_skip_whitespace(p, index->data + index->size);
+}
+
+/* Steps over the value at p. Indexed containers are stepped over at once,
+ * the others are smaller than min_container_size and scanned. */
+static const char *skip_value(const json_index *index, const char *p) {
+    const char *end = index->data + index->size;
+    if (*p == '"') return string_end(index, p + 1);
+    if (*p != '{' && *p != '[') {
+        while (p < end && json_scan_is_scalar_char(*p)) p++;
+        return p;
+    }
+
+    const struct index_node *node = node_at(index, (uint64_t)(p - index->data));
+    if (node) return index->data + node->end;
+
+    size_t depth = 0;
+    for (;;) {
+        char c = *p++;
+        if (c == '"') {
+            p = string_end(index, p);
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+            return p;
+        }
+    }
+}
+
+static int span_of(const json_index *index, const char *p, json_index_span *out) {
+    out->offset = (uint64_t)(p - index->data);
+    out->length = (uint64_t)(skip_value(index, p) - p);
+    return 1;
+}
+
+/* The value following the key whose opening quote is at key */
+static const char *member_value(const json_index *index, const char *key) {
+    const char *p = skip_whitespace(index, string_end(index, key + 1));
+    return skip_whitespace(index, p + 1);
+}
+
+static const char *find_member(const json_index *index, const char *object, const char *key, size_t len) {
+    const struct index_node *node = node_at(index, (uint64_t)(object - index->data));
+    if (node) {
+        const struct index_key *keys = index->keys + node->first;
+        uint64_t hash = key_hash_bytes(KEY_HASH_SEED, key, len);
+        size_t lo = 0, hi = (size_t)node->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (keys[mid].hash < hash) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < node->count && keys[lo].hash == hash; lo++) {
+            const char *raw = index->data + keys[lo].offset;
+            if (json_scan_key_equals(raw + 1, string_end(index, raw + 1) - 1, key, len)) return member_value(index, raw);
+        }
+        return NULL;
+    }
+
+    const char *p = skip_whitespace(index, object + 1);
+    while (*p == '"') {
+        const char *raw_end = string_end(index, p + 1) - 1;
+        const char *value = member_value(index, p);
+        if (json_scan_key_equals(p + 1, raw_end, key, len)) return value;
+        p = skip_whitespace(index, skip_value(index, value));
+        if (*p == ',') p = skip_whitespace(index, p + 1);
+    }
+    return NULL;
+}
+
+static const char *find_item(const json_index *index, const char *array, uint64_t i) {
+    const struct index_node *node = node_at(index, (uint64_t)(array - index->data));
+    const char *p;
+    if (node) {
+        if (i >= node->count) return NULL;
+        p = index->data + index->checkpoints[node->first + i / index->stride];
+        i %= index->stride;
+    } else {
+        p = skip_whitespace(index, array + 1);
+        if (*p == ']') return NULL;
+    }
+    for (; i; i--) {
+        p = skip_whitespace(index, skip_value(index, p));
+        if (*p != ',') return NULL;
+        p = skip_whitespace(index, p + 1);
+    }
+    return p;
+}
+
+int json_index_root(const json_index *index, json_index_span *out) {
+    if (!index || !out) return 0;
+    return span_of(index, skip_whitespace(index, index->data), out);
+}
+
+int json_index_member(const json_index *index, const json_index_span *object, const char *key,
+                      json_index_span *out) {
+    if (!index || !object || !key || !out || object->offset >= index->size) return 0;
+    const char *p = index->data + object->offset;
+    if (*p != '{') return 0;
+    p = find_member(index, p, key, strlen(key));
+    return p ? span_of(index, p, out) : 0;
+}
+
+int json_index_item(const json_index *index, const json_index_span *array, uint64_t i, json_index_span *out) {
+    if (!index || !array || !out || array->offset >= index->size) return 0;
+    const char *p = index->data + array->offset;
+    if (*p != '[') return 0;
+    p = find_item(index, p, i);
+    return p ? span_of(index, p, out) : 0;
+}
+
+/* Parses an array index token: "0" or digits without a leading zero */
+static int parse_index(const char *token, size_t len, uint64_t *index) {
+    if (!len || (token[0] == '0' && len > 1)) return 0;
+    uint64_t i = 0;
+    for (size_t k = 0; k < len; k++) {
+        if (token[k] < '0' || token[k] > '9') return 0;
+        if (i > (UINT64_MAX - 9) / 10) return 0;
+        i = i * 10 + (uint64_t)(token[k] - '0');
+    }
+    *index = i;
+    return 1;
+}
+
+int json_index_find(const json_index *index, const char *pointer, json_index_span *out) {
+    if (!index || !pointer || !out) return 0;
+    if (*pointer && *pointer != '/') {
+        json_set_last_error("json_index_find: pointer must be empty or start with '/'\n");
+        return 0;
+    }
+    char *token = json_malloc(strlen(pointer) + 1);
+    if (!token) {
+        json_set_last_error("json_index_find: failed to allocate token buffer\n");
+        return 0;
+    }
+
+    const char *v = skip_whitespace(index, index->data);
+    const char *p = pointer;
+    while (v && *p) {
+        /* decode the next reference token, ~1 being '/' and ~0 '~' */
+        size_t len = 0;
+        for (p++; *p && *p != '/'; p++) {
+            if (*p == '~') {
+                if (p[1] != '0' && p[1] != '1') {
+                    v = NULL;
+                    break;
+                }
+                token[len++] = p[1] == '0' ? '~' : '/';
+                p++;
+            } else {
+                token[len++] = *p;
+            }
+        }
+        if (!v) break;
+
+        uint64_t i;
+        if (*v == '{') v = find_member(index, v, token, len);
+        else if (*v == '[' && parse_index(token, len, &i)) v = find_item(index, v, i);
+        else v = NULL;
+    }
+    json_mfree(token);
+
+    if (!v) {
+        json_set_last_error("json_index_find: location does not exist\n");
+        return 0;
+    }
+    return span_of(index, v, out);
+}
+
+json_value *json_index_get(const json_index *index, const char *pointer) {
+    json_index_span span;
+    if (!json_index_find(index, pointer, &span)) return NULL;
+    return json_parse_projected_n(index->data + span.offset, (size_t)span.length, index->whole);
+}
@@ -0,0 +1,69 @@
+#ifndef JSONINDEX_H
+#define JSONINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "jsonparser.h"
+
+/* Out-of-core access to JSON files larger than memory.
+ *
+ * json_index_open maps the file and reads it once, checking it and
+ * recording its large containers in a structural index: where each one
+ * starts and ends, where every member of a large object is (by a hash of
+ * its key) and where every stride-th item of a large array is. Lookups then
+ * go through the index and only read the parts of the file on the way to
+ * what they are after, so only those pages become resident.
+ *
+ * Containers smaller than min_container_size are left out of the index and
+ * scanned when a lookup goes through them: the index holds at most a few
+ * entries per min_container_size bytes of input. The index can be saved
+ * next to the file and is reused as long as the file and the options are
+ * unchanged. */
+
+typedef struct json_index json_index;
+
+typedef struct {
+    size_t min_container_size;  /* smallest container indexed, in bytes (default 4096) */
+    size_t array_stride;        /* one item recorded every stride items (default 64) */
+} json_index_options;
+
+/* A value of the file: bytes [offset, offset + length) of it */
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} json_index_span;
+
+/* Opens the JSON file at json_path. If index_path names a file holding an
+ * index of this version of json_path built with the same options, it is
+ * mapped and used as is; otherwise the index is built and, when index_path
+ * is not NULL, saved there. options may be NULL for the defaults. Returns
+ * NULL if the file cannot be read, is not valid JSON or the index cannot be
+ * saved. */
+json_index *json_index_open(const char *json_path, const char *index_path, const json_index_options *options);
+void json_index_close(json_index *index);
+
+/* The mapped file, valid until json_index_close */
+const char *json_index_data(const json_index *index);
+uint64_t json_index_size(const json_index *index);
+
+/* Navigation. Each returns 1 and fills *out if the value exists, 0
+ * otherwise. */
+int json_index_root(const json_index *index, json_index_span *out);
+int json_index_member(const json_index *index, const json_index_span *object, const char *key,
+                      json_index_span *out);
+int json_index_item(const json_index *index, const json_index_span *array, uint64_t i, json_index_span *out);
+
+/* Resolves a JSON Pointer (RFC 6901) from the root */
+int json_index_find(const json_index *index, const char *pointer, json_index_span *out);
+
+/* Parses the value a pointer refers to, or NULL if there is none */
+json_value *json_index_get(const json_index *index, const char *pointer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONINDEX_H */
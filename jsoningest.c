@@ -0,0 +1,438 @@
+#include "jsoningest.h"
+#include "jsoninternal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_READS 64
+#define DEFAULT_MAX_BYTES ((size_t)64 << 20)
+
+/* A file on its way through the pipeline: opened, read, then parsed */
+struct file {
+    char *buf;    /* size + 1 bytes */
+    size_t size;
+    size_t done;  /* bytes read so far */
+    size_t held;  /* bytes counted against max_bytes */
+    int fd;
+    int error;    /* errno of a failed open or read */
+};
+
+struct pipeline {
+    const char *const *paths;
+    struct file *files;
+    size_t count;
+    size_t max_bytes;
+    json_ingest_callback callback;
+    void *user;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;     /* a file was queued, or reading is over */
+    pthread_cond_t released;  /* bytes were released */
+    size_t *queue;            /* files read, in the order they were */
+    size_t head, tail;
+    int closed;
+    size_t bytes;             /* held by files read or being read */
+    size_t next;              /* next file to open, for reader threads */
+
+    pthread_mutex_t callback_lock;
+    long parsed;
+};
+
+/*====================BYTES AND QUEUE=====================*/
+
+/* Waits until size more bytes fit. A file larger than max_bytes gets in
+ * when nothing else is held. */
+static void acquire_bytes(struct pipeline *p, size_t size) {
+    pthread_mutex_lock(&p->lock);
+    while (p->bytes && p->bytes + size > p->max_bytes) pthread_cond_wait(&p->released, &p->lock);
+    p->bytes += size;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static int try_acquire_bytes(struct pipeline *p, size_t size) {
+    pthread_mutex_lock(&p->lock);
+    int ok = !p->bytes || p->bytes + size <= p->max_bytes;
+    if (ok) p->bytes += size;
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+static void release_bytes(struct pipeline *p, size_t size) {
+    pthread_mutex_lock(&p->lock);
+    p->bytes -= size;
+    pthread_cond_broadcast(&p->released);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Hands file i, read or failed, to the parser threads */
+static void queue_file(struct pipeline *p, size_t i) {
+    struct file *f = &p->files[i];
+    if (f->fd >= 0) close(f->fd);
+    f->fd = -1;
+    pthread_mutex_lock(&p->lock);
+    p->queue[p->tail++] = i;
+    pthread_cond_signal(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static int open_file(struct pipeline *p, size_t i) {
+    struct file *f = &p->files[i];
+    struct stat st;
+    f->fd = open(p->paths[i], O_RDONLY | O_CLOEXEC);
+    if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+        f->error = errno;
+        return 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        f->error = EISDIR;
+        return 0;
+    }
+    f->size = (size_t)st.st_size;
+    return 1;
+}
+
+/* Allocates the buffer of an opened file whose bytes are acquired */
+static int alloc_file(struct pipeline *p, size_t i) {
+    struct file *f = &p->files[i];
+    f->held = f->size;
+    f->buf = json_malloc(f->size + 1);
+    if (f->buf) return 1;
+    f->error = ENOMEM;
+    release_bytes(p, f->held);
+    f->held = 0;
+    return 0;
+}
+
+/*====================PARSER THREADS======================*/
+
+static void *parse_files(void *arg) {
+    struct pipeline *p = arg;
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (p->head == p->tail && !p->closed) pthread_cond_wait(&p->ready, &p->lock);
+        if (p->head == p->tail) {
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        size_t i = p->queue[p->head++];
+        pthread_mutex_unlock(&p->lock);
+
+        struct file *f = &p->files[i];
+        json_value *value = NULL;
+        char error[256];
+        if (f->error) {
+            snprintf(error, sizeof(error), "json_ingest: %s: %s\n", p->paths[i], strerror(f->error));
+        } else {
+            f->buf[f->size] = '\0';
+            value = json_parse(f->buf);
+            if (!value) snprintf(error, sizeof(error), "%s", json_get_last_error());
+        }
+        json_mfree(f->buf);
+        f->buf = NULL;
+        if (f->held) release_bytes(p, f->held);
+
+        pthread_mutex_lock(&p->callback_lock);
+        if (value) p->parsed++;
+        p->callback(p->user, i, p->paths[i], value, value ? NULL : error);
+        pthread_mutex_unlock(&p->callback_lock);
+    }
+}
+
+/*====================READER THREADS======================*/
+
+static void pread_file(struct file *f) {
+    while (f->done < f->size) {
+        ssize_t n = pread(f->fd, f->buf + f->done, f->size - f->done, (off_t)f->done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) f->error = errno;
+        if (n == 0) f->size = f->done;  /* the file shrank: parse what there is */
+        if (n <= 0) return;
+        f->done += (size_t)n;
+    }
+}
+
+static void *read_files(void *arg) {
+    struct pipeline *p = arg;
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        size_t i = p->next < p->count ? p->next++ : p->count;
+        pthread_mutex_unlock(&p->lock);
+        if (i == p->count) return NULL;
+
+        if (open_file(p, i)) {
+            acquire_bytes(p, p->files[i].size);
+            if (alloc_file(p, i)) pread_file(&p->files[i]);
+        }
+        queue_file(p, i);
+    }
+}
+
+/*====================IO_URING============================*/
+
+/* A ring set up with the raw system calls, without liburing */
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+};
+
+static void uring_close(struct uring *r) {
+    if (r->sqes) munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+    if (r->cq_ring && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+
+static int uring_setup(struct uring *r, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (r->fd < 0) return 0;
+    /* IORING_OP_READ came with this feature (Linux 5.6) */
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(r->fd);
+        return 0;
+    }
+
+    r->entries = params.sq_entries;
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) r->sq_ring = NULL;
+    r->cq_ring = single || !r->sq_ring ? r->sq_ring
+                                       : mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring == MAP_FAILED) r->cq_ring = NULL;
+    r->sqes = r->cq_ring ? mmap(NULL, r->entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES)
+                         : NULL;
+    if (r->sqes == MAP_FAILED) r->sqes = NULL;
+    if (!r->sqes) {
+        uring_close(r);
+        return 0;
+    }
+
+    char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+/* Queues a read of the rest of file i. There is always room: no more than
+ * entries reads are in flight. */
+static void uring_read(struct uring *r, const struct file *f, size_t i) {
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = f->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(f->buf + f->done);
+    sqe->len = (unsigned)(f->size - f->done > 1u << 30 ? 1u << 30 : f->size - f->done);
+    sqe->off = f->done;
+    sqe->user_data = i;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Submits the queued reads and waits for a completion. On an error other
+ * than an interruption, the reads not submitted are taken back and failed. */
+static int uring_wait(struct pipeline *p, struct uring *r, unsigned *in_flight) {
+    for (;;) {
+        unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        unsigned queued = *r->sq_tail - head;
+        if (syscall(__NR_io_uring_enter, r->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0) return 1;
+        if (errno == EINTR) continue;
+
+        int error = errno;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        for (unsigned k = head; k != *r->sq_tail; k++) {
+            size_t i = (size_t)r->sqes[r->sq_array[k & *r->sq_mask]].user_data;
+            p->files[i].error = error;
+            (*in_flight)--;
+            queue_file(p, i);
+        }
+        __atomic_store_n(r->sq_tail, head, __ATOMIC_RELEASE);
+        if (!*in_flight) return 1;
+        if (error != EAGAIN && error != EBUSY) return 0;
+    }
+}
+
+/* Handles the completed reads, queueing the rest of short ones */
+static void uring_reap(struct pipeline *p, struct uring *r, unsigned *in_flight) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        size_t i = (size_t)cqe->user_data;
+        struct file *f = &p->files[i];
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+            uring_read(r, f, i);
+            continue;
+        }
+        if (cqe->res < 0) f->error = -cqe->res;
+        if (cqe->res == 0) f->size = f->done;
+        if (cqe->res > 0) f->done += (size_t)cqe->res;
+        if (cqe->res > 0 && f->done < f->size) {
+            uring_read(r, f, i);
+            continue;
+        }
+        (*in_flight)--;
+        queue_file(p, i);
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Reads every file through the ring, from the calling thread */
+static void read_files_uring(struct pipeline *p, struct uring *r, unsigned max_reads) {
+    size_t next = 0;
+    unsigned in_flight = 0;
+    int waiting = 0;  /* file next - 1 is open, waiting for bytes */
+    if (max_reads > r->entries) max_reads = r->entries;
+
+    while (next < p->count || waiting || in_flight) {
+        while (in_flight < max_reads && (waiting || next < p->count)) {
+            size_t i = waiting ? next - 1 : next++;
+            struct file *f = &p->files[i];
+            if (!waiting && !open_file(p, i)) {
+                queue_file(p, i);
+                continue;
+            }
+            waiting = 0;
+            if (!try_acquire_bytes(p, f->size)) {
+                waiting = in_flight != 0;
+                if (waiting) break;
+                acquire_bytes(p, f->size);
+            }
+            if (!alloc_file(p, i) || !f->size) {
+                queue_file(p, i);
+                continue;
+            }
+            uring_read(r, f, i);
+            in_flight++;
+        }
+        if (!in_flight) continue;
+        if (!uring_wait(p, r, &in_flight)) break;
+        uring_reap(p, r, &in_flight);
+    }
+
+    if (in_flight) {
+        /* the ring failed with reads in flight: leave their buffers to the
+         * kernel, which may still write them, and report the files */
+        for (size_t i = 0; i < next; i++) {
+            struct file *f = &p->files[i];
+            if (f->fd < 0 || !f->buf) continue;
+            f->buf = NULL;
+            f->error = EIO;
+            queue_file(p, i);
+        }
+    }
+    for (size_t i = next; i < p->count; i++) {
+        p->files[i].error = EIO;
+        queue_file(p, i);
+    }
+}
+
+/*====================PIPELINE============================*/
+
+long json_ingest(const char *const *paths, size_t count, const json_ingest_options *options,
+                 json_ingest_callback callback, void *user) {
+    if (!callback || (!paths && count)) {
+        json_set_last_error("json_ingest: NULL argument\n");
+        return -1;
+    }
+    json_ingest_options o = options ? *options : (json_ingest_options){0, 0, 0, JSON_INGEST_AUTO};
+    if (!o.workers) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        o.workers = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (!o.max_reads) o.max_reads = DEFAULT_MAX_READS;
+    if (!o.max_bytes) o.max_bytes = DEFAULT_MAX_BYTES;
+    if (o.workers > count) o.workers = count ? (unsigned)count : 1;
+
+    struct uring ring;
+    int use_ring = o.backend != JSON_INGEST_THREADS && count && uring_setup(&ring, o.max_reads);
+    if (o.backend == JSON_INGEST_IO_URING && count && !use_ring) {
+        json_set_last_error("json_ingest: io_uring is not available\n");
+        return -1;
+    }
+
+    struct pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.paths = paths;
+    p.count = count;
+    p.max_bytes = o.max_bytes;
+    p.callback = callback;
+    p.user = user;
+    p.files = json_calloc(count ? count : 1, sizeof(struct file));
+    p.queue = json_malloc((count ? count : 1) * sizeof(size_t));
+    pthread_t *threads = json_malloc((o.workers + o.max_reads) * sizeof(pthread_t));
+    if (!p.files || !p.queue || !threads) {
+        json_mfree(p.files);
+        json_mfree(p.queue);
+        json_mfree(threads);
+        if (use_ring) uring_close(&ring);
+        json_set_last_error("json_ingest: out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) p.files[i].fd = -1;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_mutex_init(&p.callback_lock, NULL);
+    pthread_cond_init(&p.ready, NULL);
+    pthread_cond_init(&p.released, NULL);
+
+    unsigned workers = 0;
+    while (workers < o.workers && pthread_create(&threads[workers], NULL, parse_files, &p) == 0) workers++;
+
+    if (!workers) {
+        json_set_last_error("json_ingest: cannot start a parser thread\n");
+    } else if (use_ring) {
+        read_files_uring(&p, &ring, o.max_reads);
+    } else {
+        unsigned readers = 0;
+        unsigned wanted = o.max_reads < count ? o.max_reads : (unsigned)count;
+        while (readers < wanted && pthread_create(&threads[workers + readers], NULL, read_files, &p) == 0)
+            readers++;
+        if (!readers) read_files(&p);
+        for (unsigned k = 0; k < readers; k++) pthread_join(threads[workers + k], NULL);
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.closed = 1;
+    pthread_cond_broadcast(&p.ready);
+    pthread_mutex_unlock(&p.lock);
+    for (unsigned k = 0; k < workers; k++) pthread_join(threads[k], NULL);
+
+    if (use_ring) uring_close(&ring);
+    pthread_cond_destroy(&p.released);
+    pthread_cond_destroy(&p.ready);
+    pthread_mutex_destroy(&p.callback_lock);
+    pthread_mutex_destroy(&p.lock);
+    json_mfree(threads);
+    json_mfree(p.queue);
+    json_mfree(p.files);
+    return workers ? p.parsed : -1;
+}
@@ -0,0 +1,50 @@
+#ifndef JSONINGEST_H
+#define JSONINGEST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/* Bulk ingestion of JSON files, with reads and parsing overlapped.
+ *
+ * json_ingest reads a list of files and parses each one as soon as it is
+ * in memory. Reads go through io_uring when the kernel allows it, and
+ * through a pool of threads calling pread otherwise. The documents are
+ * parsed by worker threads while the next reads are in flight. Reads in
+ * flight and bytes held in memory, read but not parsed yet, are bounded. */
+
+typedef enum {
+    JSON_INGEST_AUTO,      /* io_uring if available, else threads */
+    JSON_INGEST_IO_URING,
+    JSON_INGEST_THREADS
+} json_ingest_backend;
+
+typedef struct {
+    unsigned workers;      /* parser threads (default: one per CPU) */
+    unsigned max_reads;    /* reads in flight (default 64) */
+    size_t max_bytes;      /* file bytes in memory at once (default 64 MB); a
+                            * larger file is read alone */
+    json_ingest_backend backend;
+} json_ingest_options;
+
+/* Called once per file, in the order in which they are parsed, from the
+ * parser threads but never twice at the same time. value is the document,
+ * now owned by the callback, or NULL, with error describing why the file
+ * could not be read or parsed. */
+typedef void (*json_ingest_callback)(void *user, size_t i, const char *path, json_value *value,
+                                     const char *error);
+
+/* Reads and parses the count files at paths. options may be NULL for the
+ * defaults. Returns the number of documents parsed, or -1 if the pipeline
+ * could not be started (no thread, or io_uring was asked for and is not
+ * available), in which case callback is not called. */
+long json_ingest(const char *const *paths, size_t count, const json_ingest_options *options,
+                 json_ingest_callback callback, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONINGEST_H */
@@ -0,0 +1,168 @@
+#ifndef JSONINTERNAL_H
+#define JSONINTERNAL_H
+
+/* Private definitions shared by the library's translation units.
+ * Nothing in here is part of the public API: applications only see the
+ * opaque json_value declared in jsonparser.h. */
+
+#include "jsonparser.h"
+#include "jsonalloc.h"
+
+/* Reference counts are plain integers unless the library is built with
+ * JSON_THREADSAFE_REFCOUNT (make THREADSAFE=1), in which case every update
+ * is atomic so documents sharing subtrees can live on different threads. */
+typedef unsigned int json_refcount;
+
+#ifdef JSON_THREADSAFE_REFCOUNT
+#define JSON_REF_INC(r)  __atomic_add_fetch(&(r), 1, __ATOMIC_RELAXED)
+#define JSON_REF_DEC(r)  __atomic_sub_fetch(&(r), 1, __ATOMIC_ACQ_REL)
+#define JSON_REF_LOAD(r) __atomic_load_n(&(r), __ATOMIC_ACQUIRE)
+#else
+#define JSON_REF_INC(r)  (++(r))
+#define JSON_REF_DEC(r)  (--(r))
+#define JSON_REF_LOAD(r) (r)
+#endif
+
+/* What readers fill in lazily (hashes, the nodes of packed arrays, the
+ * conversion of numbers) is atomic in every build, as threads may read the
+ * same document at once (see jsonpublish.h). Loads cost what plain ones do;
+ * only the first reader to fill something in pays for the exchange. */
+#define JSON_HASH_LOAD(h)     __atomic_load_n(&(h), __ATOMIC_RELAXED)
+#define JSON_HASH_STORE(h, v) __atomic_store_n(&(h), (v), __ATOMIC_RELAXED)
+#define JSON_PTR_LOAD(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define JSON_PTR_PUBLISH(p, expected, v) \
+    __atomic_compare_exchange_n(&(p), &(expected), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define JSON_FLAG_LOAD(f)     __atomic_load_n(&(f), __ATOMIC_ACQUIRE)
+#define JSON_FLAG_STORE(f, v) __atomic_store_n(&(f), (v), __ATOMIC_RELEASE)
+
+/* Full definition of the structure
+ *
+ * A node may be referenced from several parents (see json_clone), its
+ * refcount counts those references. The items of an array and the
+ * members of an object live in refcounted storage blocks that are shared
+ * between clones and copied on the first write. The iterators of
+ * jsonparser.h walk these blocks directly.
+ *
+ * hash caches json_hash() of a scalar, 0 meaning not computed yet.
+ * Containers cache theirs in their storage block instead, where it holds
+ * until the next write to any container; their hash field only tells
+ * that such a write has to invalidate it. Every write to a container goes
+ * through its copy-on-write check, which does that.
+ *
+ * An array of numbers may be packed: numbers is then a storage block of
+ * count doubles and there is no node per item. items stays NULL until
+ * something asks for the nodes (json_array_get, the iterators); they are
+ * built once from numbers and published atomically, as readers may share
+ * the array. The first write to the array drops numbers.
+ *
+ * A number parsed with lazy_numbers keeps its text as written in lazy:
+ * inline if it is short enough, otherwise as a pointer stored in text to
+ * a copy of its own, with len JSON_NUMBER_TEXT_OUTSIDE. value is the same
+ * double as number, valid once converted is set. Other numbers have len 0
+ * and converted set, so number is read as it is. */
+struct json_value {
+    int type;
+    json_refcount refcount;
+    uint64_t hash;
+    union {
+        int boolean;
+        double number;
+        struct {
+            double value;
+            uint8_t converted;
+            uint8_t len;
+            char text[22];  /* NUL-terminated */
+        } lazy;
+        char *string;
+        struct {
+            json_value **items;
+            size_t count;
+            size_t capacity;
+            double *numbers;
+        } array;
+        struct {
+            json_member *members;
+            size_t count;
+            size_t capacity;
+        } object; /* TODO IMPLEMENT OBJECT WITH HASH MAPS */
+    } u;
+};
+
+#define JSON_NUMBER_TEXT_INLINE  (sizeof(((json_value *)0)->u.lazy.text) - 1)
+#define JSON_NUMBER_TEXT_OUTSIDE 0xff
+
+/* The double of a number node, converted from its text on the first call */
+double json_number_convert(const json_value *number);
+
+static inline double json_number_value(const json_value *number) {
+    double value;
+    if (!JSON_FLAG_LOAD(number->u.lazy.converted)) return json_number_convert(number);
+    /* readers converting it at the same time store the same value */
+    __atomic_load(&number->u.number, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+/* The text of a number node as written and its length, NULL if it has
+ * none */
+const char *json_number_text(const json_value *number, size_t *len);
+
+/* The item nodes of an array, built first if it is packed. NULL if that
+ * fails or the array is empty. */
+json_value **json_array_items(const json_value *array);
+
+/* Records a message retrievable through json_get_last_error() */
+void json_set_last_error(const char *msg);
+
+/* In-place edits used by the patch engine. They return the value that was
+ * displaced (now owned by the caller) so an edit can be undone. */
+json_value *json_array_exchange(json_value *array, size_t index, json_value *value);
+json_value *json_object_exchange(json_value *object, const char *key, json_value *value);
+json_value *json_object_exchange_at(json_value *object, size_t position, json_value *value);
+/* json_object_get_mut by position */
+json_value *json_object_get_mut_at(json_value *object, size_t position);
+json_value *json_object_detach(json_value *object, const char *key, size_t *position);
+int json_object_insert_at(json_value *object, size_t position, const char *key, json_value *value);
+
+/* Finds repeated keys while an object is filled, in constant time per
+ * member: small objects are searched directly, larger ones through an
+ * open-addressing table of member positions hashed with SipHash under a
+ * per-process random key. */
+struct json_key_index {
+    uint32_t *slots;    /* member position + 1, 0 for an empty slot */
+    size_t mask;
+    size_t indexed;     /* members entered in the table */
+};
+
+#define JSON_KEY_INDEX_INIT {NULL, 0, 0}
+
+void json_key_index_free(struct json_key_index *index);
+
+/* Adds a member to object, which must not be shared, applying policy if
+ * key (of length len) is already there. The object takes ownership of value
+ * unless 0 is returned, for a rejected duplicate or a failed allocation. */
+int json_object_add_member(json_value *object, struct json_key_index *index, const char *key, size_t len,
+                           json_value *value, json_duplicate_policy policy);
+
+/* Position of key in object, or -1. The search starts at *cursor, where
+ * the caller expects the key when walking two objects with mostly the same
+ * member order, and *cursor is moved past the match. */
+long json_object_find_from(const json_value *object, const char *key, size_t *cursor);
+
+/* Receives every container json_parse_spans builds, once it is complete,
+ * with the offsets of its opening bracket and just past its closing one.
+ * Containers later dropped as repeated keys are reported too, and their
+ * memory may be reused by a later container: the last report for an
+ * address is the one that holds. Returns 0 to abort the parse as out of
+ * memory. */
+typedef int (*json_span_fn)(void *ctx, const json_value *container, size_t start, size_t end);
+
+/* Parses the len bytes at text, which need not be NUL-terminated,
+ * reporting the containers to fn if it is not NULL */
+json_value *json_parse_spans(const char *text, size_t len, const json_parse_options *options, json_span_fn fn,
+                             void *ctx);
+
+/* Whether the writer has written one whole top-level value, without error */
+struct json_writer;
+int json_writer_complete(const struct json_writer *w);
+
+#endif  /* JSONINTERNAL_H */
@@ -0,0 +1,406 @@
+#include "jsonlines.h"
+#include "jsoninternal.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINES_RING_SIZE 4096
+#define LINES_BATCH_BYTES ((size_t)1 << 20)
+#define LINES_BATCH_RECORDS 1024     /* segments per writev, within IOV_MAX */
+#define LINES_CHUNK_SIZE ((size_t)64 << 10)
+#define LINES_WRITER_BUFFER 4096
+#define LINES_SPINS 64               /* polls before sleeping */
+
+/*====================THREAD BUFFERS======================*/
+
+/* Records are written back to back into chunks owned by one thread. Each
+ * record in the ring holds a reference to its chunk, as does the thread
+ * while it writes into it; the last one to let go frees it. */
+struct lines_chunk {
+    size_t refs;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct lines_thread {
+    json_writer *writer;       /* its sink appends to chunk */
+    struct lines_chunk *chunk;
+    size_t start;              /* of the open record, in chunk */
+    int open;
+    int registered;
+};
+
+static _Thread_local struct lines_thread local;
+static pthread_key_t lines_key;
+static pthread_once_t lines_once = PTHREAD_ONCE_INIT;
+
+static void chunk_release(struct lines_chunk *c) {
+    if (c && __atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0) json_mfree(c);
+}
+
+/* json_write_fn of a thread's writer: appends to its chunk, moving the
+ * open record to a new chunk if it does not fit */
+static int chunk_append(void *ctx, const char *data, size_t len) {
+    struct lines_thread *t = ctx;
+    struct lines_chunk *c = t->chunk;
+    if (!c || len > c->size - c->used) {
+        size_t partial = c ? c->used - t->start : 0;
+        size_t size = LINES_CHUNK_SIZE;
+        while (size < 2 * (partial + len)) size *= 2;
+        struct lines_chunk *next = json_malloc(sizeof(struct lines_chunk) + size);
+        if (!next) return 0;
+        next->refs = 1;
+        next->size = size;
+        next->used = partial;
+        if (partial) memcpy(next->data, c->data + t->start, partial);
+        chunk_release(c);
+        t->chunk = c = next;
+        t->start = 0;
+    }
+    memcpy(c->data + c->used, data, len);
+    c->used += len;
+    return 1;
+}
+
+/* Drops the writer, and the open record if any */
+static void discard_record(struct lines_thread *t) {
+    json_writer_free(t->writer);  /* what it still buffers goes to the chunk */
+    t->writer = NULL;
+    if (t->open && t->chunk) t->chunk->used = t->start;
+    t->open = 0;
+}
+
+/* Lets go of the buffers of an ending thread */
+static void lines_thread_exit(void *arg) {
+    struct lines_thread *t = arg;
+    discard_record(t);
+    chunk_release(t->chunk);
+    t->chunk = NULL;
+}
+
+static void lines_init(void) {
+    pthread_key_create(&lines_key, lines_thread_exit);
+}
+
+/*====================RING================================*/
+
+/* A slot is free for position p when its sequence is p, and holds the
+ * record of position p once it is p + 1. Producers claim positions by
+ * moving tail; the flusher frees the slot for p + ring size. */
+struct lines_slot {
+    size_t sequence;
+    struct lines_chunk *chunk;
+    const char *data;
+    size_t len;
+};
+
+struct json_lines {
+    int fd;
+    int drop_when_full;
+    size_t batch_bytes;
+    struct lines_slot *ring;
+    size_t mask;
+    pthread_t flusher;
+
+    /* the flusher's view, kept off the line producers write */
+    char pad0[64];
+    size_t head;           /* next position to take */
+    size_t flushed;        /* positions before it are written or lost */
+    size_t bytes;
+    size_t writes;
+    int failed;
+    int sleeping;          /* the flusher waits on wake */
+    unsigned wake;         /* futex word, bumped to wake the flusher */
+    int closing;
+
+    char pad1[64];
+    size_t tail;           /* next position to claim */
+    size_t dropped;
+    char pad2[64];
+};
+
+static long futex(unsigned *word, int op, unsigned value) {
+    return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
+
+/* Waits a little, longer as the wait goes on */
+static void backoff(unsigned *spins) {
+    if (++*spins < LINES_SPINS) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void wake_flusher(json_lines *jl) {
+    __atomic_add_fetch(&jl->wake, 1, __ATOMIC_RELEASE);
+    futex(&jl->wake, FUTEX_WAKE_PRIVATE, 1);
+}
+
+/* Wakes the flusher if it sleeps. Pairs with flusher_sleep: either the
+ * flusher sees the record just published or this sees it asleep. */
+static void nudge_flusher(json_lines *jl) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&jl->sleeping, __ATOMIC_RELAXED)) wake_flusher(jl);
+}
+
+static int record_ready(const json_lines *jl, size_t position) {
+    const struct lines_slot *slot = &jl->ring[position & jl->mask];
+    return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == position + 1;
+}
+
+static void flusher_sleep(json_lines *jl) {
+    unsigned word = __atomic_load_n(&jl->wake, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&jl->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!record_ready(jl, jl->head) && !__atomic_load_n(&jl->closing, __ATOMIC_ACQUIRE)) {
+        futex(&jl->wake, FUTEX_WAIT_PRIVATE, word);
+    }
+    __atomic_store_n(&jl->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/* Publishes len bytes of chunk c at data as a record */
+static int lines_push(json_lines *jl, struct lines_chunk *c, const char *data, size_t len) {
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+    size_t position = __atomic_load_n(&jl->tail, __ATOMIC_RELAXED);
+    unsigned spins = 0;
+    for (;;) {
+        struct lines_slot *slot = &jl->ring[position & jl->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position) {
+            if (__atomic_compare_exchange_n(&jl->tail, &position, position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                slot->chunk = c;
+                slot->data = data;
+                slot->len = len;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+                nudge_flusher(jl);
+                return 1;
+            }
+            continue;  /* another producer took it: position is the new tail */
+        }
+        if (sequence < position) {
+            /* the slot still holds the record of the previous lap: full */
+            if (jl->drop_when_full) {
+                __atomic_sub_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&jl->dropped, 1, __ATOMIC_RELAXED);
+                json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "json_lines: ring full, record dropped");
+                return 0;
+            }
+            nudge_flusher(jl);
+            backoff(&spins);
+        }
+        position = __atomic_load_n(&jl->tail, __ATOMIC_RELAXED);
+    }
+}
+
+/*====================FLUSHER=============================*/
+
+/* Writes the n records of a batch, resuming after short writes. After a
+ * failure, records are counted as lost instead. */
+static void write_batch(json_lines *jl, struct iovec *iov, int n) {
+    int records = n;
+    while (n > 0 && !jl->failed) {
+        ssize_t written = writev(jl->fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            __atomic_store_n(&jl->failed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        __atomic_store_n(&jl->bytes, jl->bytes + (size_t)written, __ATOMIC_RELAXED);
+        __atomic_store_n(&jl->writes, jl->writes + 1, __ATOMIC_RELAXED);
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    if (jl->failed) __atomic_add_fetch(&jl->dropped, (size_t)records, __ATOMIC_RELAXED);
+}
+
+/* Takes the records ready in ring order, as many as one writev holds, and
+ * sleeps when there are none */
+static void *flush_records(void *arg) {
+    json_lines *jl = arg;
+    struct iovec iov[LINES_BATCH_RECORDS];
+    struct lines_chunk *chunks[LINES_BATCH_RECORDS];
+    unsigned idle = 0;
+    for (;;) {
+        int n = 0;
+        size_t bytes = 0;
+        while (n < LINES_BATCH_RECORDS && record_ready(jl, jl->head)) {
+            struct lines_slot *slot = &jl->ring[jl->head & jl->mask];
+            if (n && bytes + slot->len > jl->batch_bytes) break;
+            iov[n].iov_base = (void *)slot->data;
+            iov[n].iov_len = slot->len;
+            chunks[n++] = slot->chunk;
+            bytes += slot->len;
+            /* the chunk reference keeps the bytes: the slot can go */
+            __atomic_store_n(&slot->sequence, jl->head + jl->mask + 1, __ATOMIC_RELEASE);
+            jl->head++;
+        }
+        if (n) {
+            write_batch(jl, iov, n);
+            for (int i = 0; i < n; i++) chunk_release(chunks[i]);
+            __atomic_store_n(&jl->flushed, jl->head, __ATOMIC_RELEASE);
+            idle = 0;
+            continue;
+        }
+        /* closing comes after the last record is claimed */
+        if (__atomic_load_n(&jl->closing, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&jl->tail, __ATOMIC_ACQUIRE) == jl->head) {
+            return NULL;
+        }
+        if (++idle < LINES_SPINS) {
+            sched_yield();
+        } else {
+            flusher_sleep(jl);
+            idle = 0;
+        }
+    }
+}
+
+/*====================LINES===============================*/
+
+json_lines *json_lines_new(int fd, const json_lines_options *options) {
+    if (fd < 0) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "json_lines: invalid file descriptor");
+        return NULL;
+    }
+    json_lines_options o = {0};
+    if (options) o = *options;
+    size_t wanted = o.ring_size ? o.ring_size : LINES_RING_SIZE;
+    size_t size = 2;  /* with one slot, free and full look the same */
+    while (size < wanted) size *= 2;
+
+    json_lines *jl = json_calloc(1, sizeof(json_lines));
+    struct lines_slot *ring = json_malloc(size * sizeof(struct lines_slot));
+    if (!jl || !ring) {
+        json_mfree(jl);
+        json_mfree(ring);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "json_lines: failed to allocate the ring");
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) ring[i].sequence = i;
+    jl->fd = fd;
+    jl->drop_when_full = o.drop_when_full;
+    jl->batch_bytes = o.batch_bytes ? o.batch_bytes : LINES_BATCH_BYTES;
+    jl->ring = ring;
+    jl->mask = size - 1;
+    if (pthread_create(&jl->flusher, NULL, flush_records, jl) != 0) {
+        json_mfree(ring);
+        json_mfree(jl);
+        json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "json_lines: failed to start the flusher thread");
+        return NULL;
+    }
+    return jl;
+}
+
+static int lines_status(const json_lines *jl) {
+    if (!__atomic_load_n(&jl->failed, __ATOMIC_ACQUIRE)) return 1;
+    json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "json_lines: writev failed");
+    return 0;
+}
+
+int json_lines_close(json_lines *jl) {
+    if (!jl) return 0;
+    __atomic_store_n(&jl->closing, 1, __ATOMIC_RELEASE);
+    wake_flusher(jl);
+    pthread_join(jl->flusher, NULL);
+    int ok = lines_status(jl);
+    json_mfree(jl->ring);
+    json_mfree(jl);
+    return ok;
+}
+
+json_writer *json_lines_begin(json_lines *jl) {
+    if (!jl) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "json_lines: NULL writer provided");
+        return NULL;
+    }
+    struct lines_thread *t = &local;
+    if (!t->registered) {
+        pthread_once(&lines_once, lines_init);
+        pthread_setspecific(lines_key, t);
+        t->registered = 1;
+    }
+    if (t->open) discard_record(t);
+    if (t->writer) {
+        json_writer_reset(t->writer);
+    } else {
+        t->writer = json_writer_new_callback(chunk_append, t, LINES_WRITER_BUFFER);
+        if (!t->writer) return NULL;
+    }
+    t->start = t->chunk ? t->chunk->used : 0;
+    t->open = 1;
+    return t->writer;
+}
+
+int json_lines_commit(json_lines *jl) {
+    struct lines_thread *t = &local;
+    if (!jl || !t->open) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "json_lines: no record begun");
+        return 0;
+    }
+    /* a writer that failed has recorded why */
+    if (!json_writer_flush(t->writer)) {
+        discard_record(t);
+        return 0;
+    }
+    if (!json_writer_complete(t->writer)) {
+        discard_record(t);
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "json_lines: record is incomplete");
+        return 0;
+    }
+    if (!chunk_append(t, "\n", 1)) {
+        discard_record(t);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "json_lines: failed to allocate a buffer");
+        return 0;
+    }
+    t->open = 0;
+    struct lines_chunk *c = t->chunk;
+    if (lines_push(jl, c, c->data + t->start, c->used - t->start)) return 1;
+    c->used = t->start;
+    return 0;
+}
+
+int json_lines_write(json_lines *jl, const json_value *value) {
+    json_writer *w = json_lines_begin(jl);
+    if (!w) return 0;
+    json_writer_value(w, value);  /* a failure shows in commit */
+    return json_lines_commit(jl);
+}
+
+int json_lines_flush(json_lines *jl) {
+    if (!jl) return 0;
+    size_t target = __atomic_load_n(&jl->tail, __ATOMIC_ACQUIRE);
+    unsigned spins = 0;
+    while (__atomic_load_n(&jl->flushed, __ATOMIC_ACQUIRE) < target) {
+        nudge_flusher(jl);
+        backoff(&spins);
+    }
+    return lines_status(jl);
+}
+
+json_lines_stats json_lines_get_stats(const json_lines *jl) {
+    json_lines_stats s = {0, 0, 0, 0};
+    if (!jl) return s;
+    s.records = __atomic_load_n(&jl->tail, __ATOMIC_RELAXED);
+    s.dropped = __atomic_load_n(&jl->dropped, __ATOMIC_RELAXED);
+    s.bytes = __atomic_load_n(&jl->bytes, __ATOMIC_RELAXED);
+    s.writes = __atomic_load_n(&jl->writes, __ATOMIC_RELAXED);
+    return s;
+}
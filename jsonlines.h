@@ -0,0 +1,67 @@
+#ifndef JSONLINES_H
+#define JSONLINES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+#include "jsonwriter.h"
+
+/* JSON Lines output shared by many threads.
+ *
+ * Each thread serializes its records into buffers of its own, then
+ * publishes them into a bounded ring that producers claim slots of
+ * without a lock. A single flusher thread takes the records in ring
+ * order and hands as many as are ready to one writev. Records of one
+ * thread come out in the order it wrote them; records of different
+ * threads interleave, each on its own line.
+ *
+ * When the ring is full, producers either wait for the flusher to make
+ * room or drop the record, which is counted. */
+
+typedef struct json_lines json_lines;
+
+typedef struct {
+    size_t ring_size;      /* records in flight (default 4096), rounded up to a power of two */
+    size_t batch_bytes;    /* most bytes per write (default 1 MB) */
+    int drop_when_full;    /* drop records the ring has no room for instead of waiting */
+} json_lines_options;
+
+typedef struct {
+    size_t records;        /* published to the ring */
+    size_t dropped;        /* not published (ring full), or lost to a failed write */
+    size_t bytes;          /* written to the fd */
+    size_t writes;         /* writev calls */
+} json_lines_stats;
+
+/* Starts the flusher thread writing to fd, which is not closed at the end.
+ * options may be NULL for the defaults. */
+json_lines *json_lines_new(int fd, const json_lines_options *options);
+
+/* Writes everything published and stops the flusher. Not to be called
+ * while other threads still write. Returns 0 if a write failed, with the
+ * error recorded. */
+int json_lines_close(json_lines *lines);
+
+/* Serializes value as one record. Returns 0 if it could not be serialized
+ * or was dropped, with the error recorded. */
+int json_lines_write(json_lines *lines, const json_value *value);
+
+/* Events: json_lines_begin gives the calling thread's writer, ready for
+ * one top-level value; json_lines_commit publishes that value as a record,
+ * failing if it is incomplete. A thread has one record open at a time. */
+json_writer *json_lines_begin(json_lines *lines);
+int json_lines_commit(json_lines *lines);
+
+/* Waits until the records published so far by any thread are written.
+ * Returns 0 if a write failed. */
+int json_lines_flush(json_lines *lines);
+
+json_lines_stats json_lines_get_stats(const json_lines *lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONLINES_H */
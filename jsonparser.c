@@ -1,52 +1,215 @@
-#include "jsonparser.h"
+#include "jsoninternal.h"
+#include "jsonwriter.h"
+#include "jsonscan.h"
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
-static char last_error[256] = {0};
-
+/* The parse in progress is per thread, as is the last error, so that
+ * threads can parse documents of their own at the same time */
 /* keeping a reference to the current node of the list */
-static struct JSONTokenNode *curNode;
+static _Thread_local struct JSONTokenNode *curNode;
 
-/* forward declaration of parse_value */
-static int parse_value(json_value *v);
+/* options of the parse in progress */
+static _Thread_local json_parse_options parseOptions;
 
-/* Full definition of the structure */
-struct json_value {
-    int type;
-    union {
-        int boolean;
-        double number;
-        char *string;
-        struct {
-            json_value **items;
-            size_t count;
-            size_t capacity;
-        } array;
-        struct {
-            char **keys;
-            json_value **values;
-            size_t count;
-            size_t capacity;
-        } object; /* TODO IMPLEMENT OBJECT WITH HASH MAPS */
-    } u;
-};
+/* bytes the parse in progress holds, counted against max_bytes */
+static _Thread_local size_t parseBytes;
 
-/* Utility function to set the error message */
-static void json_set_last_error(const char *msg) {
-    strncpy(last_error, msg, sizeof(last_error) - 1);
-    last_error[sizeof(last_error) - 1] = '\0';
-}
+/* where json_parse_spans reports containers, and the text they are in */
+static _Thread_local json_span_fn parseSpanFn;
+static _Thread_local void *parseSpanCtx;
+static _Thread_local const char *parseText;
+
+/* forward declaration of parse_value */
+static int parse_value(json_value *v);
+static int object_reserve_member(json_value *object);
+static int array_reserve_item(json_value *array);
+static int object_grow(json_value *object, size_t capacity);
+static int array_grow(json_value *array, size_t capacity);
+static long object_find(const json_value *object, const char *key);
+static int object_append(json_value *object, const char *key, size_t len, json_value *value);
 
-/* Utility function to safe allocate the json_value */
+/* Allocates a null json_value, or returns NULL with the error set */
 static json_value* safeJsonMalloc() {
-    json_value *val = malloc(sizeof(json_value));
+    json_value *val = json_malloc(sizeof(json_value));
     if (!val) {
-        fprintf(stderr, "Failed to allocate json_value\n");
-        exit(EXIT_FAILURE);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return NULL;
     }
+    val->type = JSON_NULL;
+    val->refcount = 1;
+    val->hash = 0;
     return val;
 }
 
+/* Header in front of every container storage block (array items, packed
+ * numbers, object keys and values). Clones share a block until one of them
+ * writes to it, so they also share the json_hash() of the container cached
+ * here, valid while epoch is hash_epoch. */
+typedef struct {
+    json_refcount refs;
+    uint64_t hash;
+    uint64_t epoch;
+} storage_header;
+
+#define STORAGE_HEADER(data) ((storage_header *)(data) - 1)
+
+/* Size of a storage block for capacity entries of size bytes */
+static size_t storage_size(size_t capacity, size_t size) {
+    return capacity ? sizeof(storage_header) + capacity * size : 0;
+}
+
+/* Allocates a zeroed storage block owned by a single container */
+static void *storage_alloc(size_t size) {
+    storage_header *h = json_calloc(1, sizeof(storage_header) + size);
+    if (!h) return NULL;
+    h->refs = 1;
+    return h + 1;
+}
+
+/* Grows a block, which must not be shared */
+static void *storage_realloc(void *data, size_t size) {
+    storage_header *h = json_realloc(STORAGE_HEADER(data), sizeof(storage_header) + size);
+    return h ? h + 1 : NULL;
+}
+
+static int storage_shared(void *data) {
+    return data && JSON_REF_LOAD(STORAGE_HEADER(data)->refs) > 1;
+}
+
+static void storage_retain(void *data) {
+    if (data) JSON_REF_INC(STORAGE_HEADER(data)->refs);
+}
+
+/* Drops a reference, returns 1 when it was the last one. The caller then
+ * releases the contents and calls storage_free. */
+static int storage_release(void *data) {
+    return data && JSON_REF_DEC(STORAGE_HEADER(data)->refs) == 0;
+}
+
+static void storage_free(void *data) {
+    if (data) json_mfree(STORAGE_HEADER(data));
+}
+
+static void array_storage_release(json_value **items, size_t count) {
+    if (!storage_release(items)) return;
+    for (size_t i = 0; i < count; i++) {
+        json_free(items[i]);
+    }
+    storage_free(items);
+}
+
+static void numbers_release(double *numbers) {
+    if (storage_release(numbers)) storage_free(numbers);
+}
+
+static void object_storage_release(json_member *members, size_t count) {
+    if (!storage_release(members)) return;
+    for (size_t i = 0; i < count; i++) {
+        json_mfree((char *)members[i].key);
+        json_free(members[i].value);
+    }
+    storage_free(members);
+}
+
+/* Copies a key into a NUL-terminated string owned by an object */
+static char *key_copy(const char *key, size_t len) {
+    char *copy = json_malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Nodes do not know their parents, so a write to a container cannot clear
+ * the hashes cached above it. It moves on to a new epoch instead, which
+ * makes every container hash cached so far stale. Containers set their
+ * hash field while a hash of theirs may be in use, so only the first
+ * write after json_hash() pays for it. */
+static uint64_t hash_epoch = 1;
+
+static void hash_invalidate(json_value *container) {
+    if (!JSON_HASH_LOAD(container->hash)) return;
+    JSON_HASH_STORE(container->hash, 0);
+    __atomic_add_fetch(&hash_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/* Copy-on-write: gives the array a private copy of its items if they are
+ * shared with a clone. The items themselves are shared, not copied.
+ * Called before every write, so it also drops the cached hashes and the
+ * packed numbers, which writes would leave behind. */
+static int array_make_unique(json_value *array) {
+    hash_invalidate(array);
+    if (array->u.array.numbers) {
+        if (!json_array_items(array)) return 0;
+        numbers_release(array->u.array.numbers);
+        array->u.array.numbers = NULL;
+    }
+    if (!storage_shared(array->u.array.items)) return 1;
+
+    json_value **items = storage_alloc(array->u.array.capacity * sizeof(json_value *));
+    if (!items) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to copy shared array items");
+        return 0;
+    }
+    for (size_t i = 0; i < array->u.array.count; i++) {
+        items[i] = array->u.array.items[i];
+        JSON_REF_INC(items[i]->refcount);
+    }
+    array_storage_release(array->u.array.items, array->u.array.count);
+    array->u.array.items = items;
+    return 1;
+}
+
+/* Copy-on-write counterpart of array_make_unique for objects */
+static int object_make_unique(json_value *object) {
+    hash_invalidate(object);
+    if (!storage_shared(object->u.object.members)) return 1;
+
+    json_member *members = storage_alloc(object->u.object.capacity * sizeof(json_member));
+    if (!members) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to copy shared object members");
+        return 0;
+    }
+    for (size_t i = 0; i < object->u.object.count; i++) {
+        const json_member *m = &object->u.object.members[i];
+        members[i].key = key_copy(m->key, m->key_len);
+        if (!members[i].key) {
+            while (i--) {
+                json_mfree((char *)members[i].key);
+                json_free(members[i].value);
+            }
+            storage_free(members);
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to copy shared object members");
+            return 0;
+        }
+        members[i].key_len = m->key_len;
+        members[i].value = m->value;
+        JSON_REF_INC(m->value->refcount);
+    }
+    object_storage_release(object->u.object.members, object->u.object.count);
+    object->u.object.members = members;
+    return 1;
+}
+
+/* Makes the child stored in *slot safe to mutate: a container referenced
+ * from somewhere else is replaced by a clone sharing its storage, which
+ * will copy that storage on its first write. Scalars are never mutated in
+ * place, so they stay shared. */
+static json_value *unshare_child(json_value **slot) {
+    json_value *child = *slot;
+    if (JSON_REF_LOAD(child->refcount) == 1) return child;
+    if (child->type != JSON_ARRAY && child->type != JSON_OBJECT) return child;
+
+    json_value *copy = json_clone(child);
+    if (!copy) return NULL;
+    *slot = copy;
+    json_free(child);
+    return copy;
+}
+
 /** Consume a token of a specific type
  * return 1 if it is of the specified type
  * return 0 otherwise
@@ -66,15 +229,61 @@ static int consumeToken(enum JSONTokenType t) {
     return 0;
 }
 
+/* JSON_TOKEN_* bit of each token type, for errors */
+static const unsigned token_kinds[] = {
+    [OPEN_CURLY_BRACKET] = JSON_TOKEN_OBJECT_START, [CLOSE_CURLY_BRACKET] = JSON_TOKEN_OBJECT_END,
+    [OPEN_SQUARE_BRACKET] = JSON_TOKEN_ARRAY_START, [CLOSE_SQUARE_BRACKET] = JSON_TOKEN_ARRAY_END,
+    [COMMA] = JSON_TOKEN_COMMA, [COLON] = JSON_TOKEN_COLON, [NUMBER] = JSON_TOKEN_LITERAL,
+    [STRING] = JSON_TOKEN_STRING, [KEYWORD] = JSON_TOKEN_LITERAL, [END] = JSON_TOKEN_END
+};
+
+/* Records that the current token is not one of expected (JSON_TOKEN_* bits) */
+static int unexpectedToken(unsigned expected, const char *detail) {
+    json_set_error(JSON_ERROR_SYNTAX, curNode->token.offset, detail);
+    json_set_error_tokens(expected, token_kinds[curNode->token.type]);
+    return 0;
+}
+
 static int expectToken(enum JSONTokenType t) {
-    if(!consumeToken(t)) {
-        fprintf(stderr, "expectTokenError: token = \"%s\", expectedType:%d\n", curNode->token.value, t);
-        json_set_last_error("Unexpected token error\n");
-        return 0;
-    }
+    if(!consumeToken(t)) return unexpectedToken(token_kinds[t], "Unexpected token");
     return 1;
 }
 
+/* Records that the current token goes over a limit of the options */
+static int limitExceeded(const char *detail) {
+    json_set_error(JSON_ERROR_LIMIT, curNode->token.offset, detail);
+    return 0;
+}
+
+/* Whether bytes more fit within max_bytes */
+static int bytesFit(size_t bytes) {
+    return !parseOptions.max_bytes || parseOptions.max_bytes - parseBytes >= bytes;
+}
+
+/* Counts bytes allocated for the tree, failing once over max_bytes */
+static int chargeBytes(size_t bytes) {
+    if (!bytesFit(bytes)) return limitExceeded("Memory limit exceeded");
+    parseBytes += bytes;
+    return 1;
+}
+
+/* Whether a container holding count entries may take one more */
+static int containerHasRoom(size_t count) {
+    return !parseOptions.max_container_size || count < parseOptions.max_container_size ||
+           limitExceeded("Container size limit exceeded");
+}
+
+/* Children of the container whose first child is the current token, as
+ * the tokenizer counted them on its opening bracket, to allocate its
+ * storage at once. Over max_container_size, as many as the limit allows:
+ * the child going over it is rejected where it is. */
+static size_t childrenToReserve(const struct JSONTokenNode *open) {
+    size_t count = open->token.count;
+    if (parseOptions.max_container_size && count > parseOptions.max_container_size)
+        count = parseOptions.max_container_size;
+    return count;
+}
+
 static int parse_keyword(json_value *v) {
     if (curNode->token.type != KEYWORD) return 0;
 
@@ -84,6 +293,9 @@ static int parse_keyword(json_value *v) {
         v->u.boolean = strcmp(curNode->token.value, "true") == 0 ? 1 : 0;
     } else if (strcmp(curNode->token.value, "null") == 0) {
         v->type = JSON_NULL;
+    } else {
+        json_set_error(JSON_ERROR_SYNTAX, curNode->token.offset, "Invalid keyword");
+        return 0;
     }
 
     curNode = nextToken(curNode);
@@ -93,26 +305,52 @@ static int parse_keyword(json_value *v) {
 static int parse_string(json_value *v) {
     if (curNode->token.type != STRING) return 0;
 
-    if (strcmp(curNode->token.value, "true") == 0 || 
-        strcmp(curNode->token.value, "false") == 0) {
-        v->type = JSON_BOOLEAN;
-        v->u.boolean = strcmp(curNode->token.value, "true") == 0 ? 1 : 0;
-    } else if (strcmp(curNode->token.value, "null") == 0) {
-        v->type = JSON_NULL;
-    } else {
-        v->type = JSON_STRING;
-        v->u.string = malloc(strlen(curNode->token.value)+1);
-        strcpy(v->u.string, curNode->token.value);
+    size_t size = strlen(curNode->token.value) + 1;
+    if (!chargeBytes(size)) return 0;
+    char *string = json_malloc(size);
+    if (!string) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return 0;
     }
+    strcpy(string, curNode->token.value);
+    v->type = JSON_STRING;
+    v->u.string = string;
 
     curNode = nextToken(curNode);
     return 1;
 }
 
+/* Keeps the text of a number for json_number_convert, inline if it fits
+ * in the node */
+static int number_keep_text(json_value *v, const char *text) {
+    size_t len = strlen(text);
+    if (len <= JSON_NUMBER_TEXT_INLINE) {
+        memcpy(v->u.lazy.text, text, len + 1);
+        v->u.lazy.len = (uint8_t)len;
+    } else {
+        if (!chargeBytes(len + 1)) return 0;
+        char *copy = key_copy(text, len);
+        if (!copy) {
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+            return 0;
+        }
+        memcpy(v->u.lazy.text, &copy, sizeof(copy));
+        v->u.lazy.len = JSON_NUMBER_TEXT_OUTSIDE;
+    }
+    v->u.lazy.converted = 0;
+    return 1;
+}
+
 static int parse_number(json_value *v) {
     if (curNode->token.type != NUMBER) return 0;
+    if (parseOptions.lazy_numbers) {
+        if (!number_keep_text(v, curNode->token.value)) return 0;
+    } else {
+        v->u.number = atof(curNode->token.value);
+        v->u.lazy.converted = 1;
+        v->u.lazy.len = 0;
+    }
     v->type = JSON_NUMBER;
-    v->u.number = atof(curNode->token.value);
 
     curNode = nextToken(curNode);
     return 1;
@@ -125,49 +363,110 @@ static int parse_number(json_value *v) {
  * member -> string ':' value */
 static int parse_object(json_value *v) {
     /* expect '{' at the start of an object */
+    struct JSONTokenNode *open = curNode;
     if (!consumeToken(OPEN_CURLY_BRACKET)) return 0;
     
     v->type = JSON_OBJECT;
+    v->u.object.members = NULL;
     v->u.object.count = 0;
+    v->u.object.capacity = 0;
 
     /* object with no elements */
     if (consumeToken(CLOSE_CURLY_BRACKET)) return 1;
 
+    size_t reserve = childrenToReserve(open);
+    if (!chargeBytes(storage_size(reserve, sizeof(json_member))) || !object_grow(v, reserve)) return 0;
+
+    /* repeated keys are looked up through the index once the object grows */
+    struct json_key_index index = JSON_KEY_INDEX_INIT;
+    int ok = 1;
+
     /* iterate at least one time for a single object */
     do {
-        /* parse the key */
-        char *key;
-        if (curNode->token.type != STRING) return 0; 
-
-        /* the key exists */
-        key = malloc(strlen(curNode->token.value)+1);
-        if (!key) {
-            fprintf(stderr, "Failed to allocate key object\n");
-            exit(EXIT_FAILURE);
+        /* parse the key, which stays in the token list until the end */
+        if (curNode->token.type != STRING) {
+            ok = unexpectedToken(JSON_TOKEN_STRING, "Expected a string key");
+            break;
         }
-        strcpy(key, curNode->token.value);
+        if (!containerHasRoom(v->u.object.count)) {
+            ok = 0;
+            break;
+        }
+        const char *key = curNode->token.value;
+        size_t keyOffset = curNode->token.offset;
         curNode = nextToken(curNode);
         
         /* expect ':' */
         if(!expectToken(COLON)) {
-            free(key);
-            return 0;
+            ok = 0;
+            break;
         }
 
         /* parse the object value */
         json_value *obj_val = safeJsonMalloc(); 
+        if (!obj_val) {
+            ok = 0;
+            break;
+        }
         if (!parse_value(obj_val)) {
-            fprintf(stderr, "failed to parse value for key \"%s\"\n", key);
-            return 0;
+            json_free(obj_val);
+            ok = 0;
+            break;
         }
-        if (!json_object_set(v, key, obj_val)) {
-            fprintf(stderr, "failed to allocate object value for key \"%s\"\n", key);
-            return 0;
+        size_t keyLen = strlen(key);
+        size_t count = v->u.object.count;
+        size_t storage = storage_size(v->u.object.capacity, sizeof(json_member));
+        if (!json_object_add_member(v, &index, key, keyLen, obj_val, parseOptions.duplicate_keys)) {
+            /* a rejected key is reported where it starts */
+            const json_error *e = json_get_error();
+            if (e->code == JSON_ERROR_DUPLICATE_KEY) json_set_error(e->code, keyOffset, e->detail);
+            json_free(obj_val);
+            ok = 0;
+            break;
+        }
+        /* the key copy and any growth of the members, once they exist */
+        size_t added = storage_size(v->u.object.capacity, sizeof(json_member)) - storage;
+        if (v->u.object.count > count) added += keyLen + 1;
+        if (!chargeBytes(added)) {
+            ok = 0;
+            break;
         }
     } while (consumeToken(COMMA));
+    json_key_index_free(&index);
 
     /* expect '}' at the end of the object */
-    if (!expectToken(CLOSE_CURLY_BRACKET)) return 0;
+    return ok && expectToken(CLOSE_CURLY_BRACKET);
+}
+
+/* Stores an array made only of numbers packed, without a node per item.
+ * Returns 0, consuming nothing, if the array holds anything else. */
+static int parse_number_array(json_value *v) {
+    size_t count = 0;
+    struct JSONTokenNode *t = curNode;
+    while (t->token.type == NUMBER) {
+        count++;
+        t = nextToken(t);
+        if (t->token.type != COMMA) break;
+        t = nextToken(t);
+    }
+    if (!count || t->token.type != CLOSE_SQUARE_BRACKET) return 0;
+
+    /* over a limit, the item by item parse finds where */
+    if (parseOptions.max_container_size && count > parseOptions.max_container_size) return 0;
+    size_t size = storage_size(count, sizeof(double));
+    if (!bytesFit(size)) return 0;
+
+    double *numbers = storage_alloc(count * sizeof(double));
+    if (!numbers) return 0;
+    for (size_t i = 0; i < count; i++) {
+        numbers[i] = atof(curNode->token.value);
+        curNode = nextToken(curNode);
+        curNode = nextToken(curNode);  /* ',' or ']' */
+    }
+    v->u.array.numbers = numbers;
+    v->u.array.count = count;
+    v->u.array.capacity = count;
+    parseBytes += size;
     return 1;
 }
 
@@ -177,19 +476,35 @@ static int parse_object(json_value *v) {
  * elements -> value | value ',' elements */
 static int parse_array(json_value *v) {
     /* array starts with '[' */
+    struct JSONTokenNode *open = curNode;
     if(!consumeToken(OPEN_SQUARE_BRACKET)) return 0;
 
     v->type = JSON_ARRAY;
+    v->u.array.items = NULL;
     v->u.array.count = 0;
+    v->u.array.capacity = 0;
+    v->u.array.numbers = NULL;
 
     /* array with no elements */
     if(consumeToken(CLOSE_SQUARE_BRACKET)) return 1;
 
+    /* packing would only keep the doubles */
+    if (!parseOptions.lazy_numbers && parse_number_array(v)) return 1;
+
+    size_t reserve = childrenToReserve(open);
+    if (!chargeBytes(storage_size(reserve, sizeof(json_value *))) || !array_grow(v, reserve)) return 0;
+
     /* iterate for at least one element */
     do {
+       if (!containerHasRoom(v->u.array.count)) return 0;
        json_value *item = safeJsonMalloc();
-       if(!parse_value(item)) return 0;
-       if(!json_array_append(v, item)) return 0;
+       if (!item) return 0;
+       size_t storage = storage_size(v->u.array.capacity, sizeof(json_value *));
+       if(!parse_value(item) || !json_array_append(v, item)) {
+           json_free(item);
+           return 0;
+       }
+       if (!chargeBytes(storage_size(v->u.array.capacity, sizeof(json_value *)) - storage)) return 0;
     } while (consumeToken(COMMA));
 
     if (!expectToken(CLOSE_SQUARE_BRACKET)) return 0;
@@ -197,35 +512,123 @@ static int parse_array(json_value *v) {
     return 1;
 }
 
-static int parse_value(json_value *v) {
-    if (parse_object(v) || parse_array(v) || parse_string(v) || parse_number(v) || parse_keyword(v)) 
-        return 1;
-    json_set_last_error("parse_value: not defined object\n");
+/* Reports the container v, which opened at start, to the span callback.
+ * Only whitespace separates its closing bracket from the current token. */
+static int reportSpan(const json_value *v, size_t start) {
+    size_t end = curNode->token.offset;
+    while (json_scan_is_whitespace(parseText[end - 1])) end--;
+    if (parseSpanFn(parseSpanCtx, v, start, end)) return 1;
+    json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to record a container");
     return 0;
 }
 
+/* The first token decides the production, so an error reported while
+ * parsing a container is not overwritten by trying the others */
+static int parse_value(json_value *v) {
+    if (!chargeBytes(sizeof(json_value))) return 0;
+    size_t start = curNode->token.offset;
+    switch (curNode->token.type) {
+        case OPEN_CURLY_BRACKET:  return parse_object(v) && (!parseSpanFn || reportSpan(v, start));
+        case OPEN_SQUARE_BRACKET: return parse_array(v) && (!parseSpanFn || reportSpan(v, start));
+        case STRING:              return parse_string(v);
+        case NUMBER:              return parse_number(v);
+        case KEYWORD:             return parse_keyword(v);
+        default:                  break;
+    }
+    return unexpectedToken(JSON_TOKEN_VALUE, "Expected a value");
+}
+
 
 /* Parses a JSON-formatted string and returns a pointer to a json_value tree.
  * Returns NULL if parsing fails.
  */
 json_value *json_parse(const char *json_text) {
-    struct JSONTokenList *l = buildTokenList(json_text, strlen(json_text)); 
+    return json_parse_with_options(json_text, NULL);
+}
+
+/* Parses the len bytes at text */
+static json_value *parse_text(const char *json_text, size_t len, const json_parse_options *options) {
+    static const json_parse_options defaults;
+    parseOptions = options ? *options : defaults;
+
+    /* the tokenizer checks what it can see token by token */
+    struct JSONTokenLimits limits = {parseOptions.max_depth, parseOptions.max_string_length, parseOptions.max_nodes,
+                                     parseOptions.max_bytes};
+    struct JSONTokenList *l = buildTokenListWithLimits(json_text, len, &limits);
+    if (!l) return NULL;  /* the tokenizer recorded why */
     curNode = l->head;
+    parseBytes = l->bytes;
 
     json_value *v = safeJsonMalloc();
-    if(!parse_value(v)) {
+    if(!v || !parse_value(v) || !expectToken(END)) {
         json_free(v);
+        freeTokenList(l);
         return NULL;
     }
 
+    freeTokenList(l);
     return v; 
 }
 
+json_value *json_parse_with_options(const char *json_text, const json_parse_options *options) {
+    if (!json_text) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL input string provided");
+        return NULL;
+    }
+    return parse_text(json_text, strlen(json_text), options);
+}
+
+json_value *json_parse_spans(const char *text, size_t len, const json_parse_options *options, json_span_fn fn,
+                             void *ctx) {
+    parseSpanFn = fn;
+    parseSpanCtx = ctx;
+    parseText = text;
+    json_value *v = parse_text(text, len, options);
+    parseSpanFn = NULL;
+    return v;
+}
+
+/* Sink used by json_serialize: appends every flushed chunk to a growing string */
+struct serialize_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static int serialize_append(void *ctx, const char *data, size_t len) {
+    struct serialize_buffer *sb = ctx;
+    if (sb->len + len + 1 > sb->capacity) {
+        size_t capacity = sb->capacity ? sb->capacity : 256;
+        while (sb->len + len + 1 > capacity) capacity *= 2;
+        char *tmp = realloc(sb->data, capacity);
+        if (!tmp) return 0;
+        sb->data = tmp;
+        sb->capacity = capacity;
+    }
+    memcpy(sb->data + sb->len, data, len);
+    sb->len += len;
+    sb->data[sb->len] = '\0';
+    return 1;
+}
+
 /**
  * Serializes a json_value into a JSON string.
  * The caller is responsible for freeing the returned string.
  */
 char *json_serialize(const json_value *value) {
+    struct serialize_buffer sb = {NULL, 0, 0};
+    json_writer *w = json_writer_new_callback(serialize_append, &sb, 4096);
+    if (!w) return NULL;
+
+    int ok = json_writer_value(w, value) && json_writer_flush(w);
+    json_writer_free(w);
+    if (!ok) {
+        free(sb.data);
+        return NULL;
+    }
+    /* an empty document still yields a valid, empty C string */
+    if (!sb.data) return calloc(1, 1);
+    return sb.data;
 }
 
 /**
@@ -234,36 +637,99 @@ char *json_serialize(const json_value *value) {
 void json_free(json_value *value) {
     if(!value) return;
 
+    /* still referenced from another document */
+    if (JSON_REF_DEC(value->refcount) != 0) return;
+
     switch (value->type) {
+        case JSON_NUMBER:
+            if (value->u.lazy.len == JSON_NUMBER_TEXT_OUTSIDE) json_mfree((char *)json_number_text(value, NULL));
+            break;
         case JSON_STRING:
-            free(value->u.string);
+            json_mfree(value->u.string);
             break;
         case JSON_ARRAY:
-            for (int i = 0; i < value->u.array.count; i++) {
-                json_free(value->u.array.items[i]);
+            array_storage_release(value->u.array.items, value->u.array.count);
+            numbers_release(value->u.array.numbers);
+            break;
+        case JSON_OBJECT:
+            object_storage_release(value->u.object.members, value->u.object.count);
+            break;
+    }
+    json_mfree(value);
+}
+
+/* Adds up what the tree holds the way chargeBytes counts it during a parse:
+ * nodes, string and key copies, number text kept outside the node, and
+ * container storage at its capacity */
+size_t json_memory_usage(const json_value *value) {
+    if (!value) return 0;
+    size_t bytes = sizeof(json_value);
+    switch (value->type) {
+        case JSON_NUMBER:
+            if (value->u.lazy.len == JSON_NUMBER_TEXT_OUTSIDE) bytes += strlen(json_number_text(value, NULL)) + 1;
+            break;
+        case JSON_STRING:
+            bytes += strlen(value->u.string) + 1;
+            break;
+        case JSON_ARRAY: {
+            json_value **items = JSON_PTR_LOAD(value->u.array.items);
+            if (value->u.array.numbers) bytes += storage_size(value->u.array.capacity, sizeof(double));
+            /* a packed array may also have had its nodes built */
+            if (items) {
+                bytes += storage_size(value->u.array.capacity, sizeof(json_value *));
+                for (size_t i = 0; i < value->u.array.count; i++) bytes += json_memory_usage(items[i]);
             }
-            free(value->u.array.items);
             break;
+        }
         case JSON_OBJECT:
-            for (int i = 0; i < value->u.object.count; i++) {
-                free(value->u.object.keys[i]);
-                json_free(value->u.object.values[i]);
+            bytes += storage_size(value->u.object.capacity, sizeof(json_member));
+            for (size_t i = 0; i < value->u.object.count; i++) {
+                bytes += value->u.object.members[i].key_len + 1 + json_memory_usage(value->u.object.members[i].value);
             }
-            free(value->u.object.keys);
-            free(value->u.object.values);
             break;
     }
-    free(value);
+    return bytes;
+}
+
+/**
+ * Returns a copy of value in O(1). Scalars are shared by reference count,
+ * arrays and objects get a new node sharing their members until either side
+ * is modified. Both the original and the clone must be freed.
+ */
+json_value *json_clone(const json_value *value) {
+    if (!value) return NULL;
+    json_value *v = (json_value *)value;
+
+    if (v->type != JSON_ARRAY && v->type != JSON_OBJECT) {
+        JSON_REF_INC(v->refcount);
+        return v;
+    }
+
+    json_value *c = json_malloc(sizeof(json_value));
+    if (!c) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "json_clone: failed to allocate json_value");
+        return NULL;
+    }
+    *c = *v;
+    c->refcount = 1;
+    if (v->type == JSON_ARRAY) {
+        /* the nodes of a packed array may be being built by another reader */
+        c->u.array.items = JSON_PTR_LOAD(v->u.array.items);
+        storage_retain(c->u.array.items);
+        storage_retain(v->u.array.numbers);
+    } else {
+        storage_retain(v->u.object.members);
+    }
+    return c;
 }
 
 json_value *json_new_null() {
-    json_value *val = safeJsonMalloc();
-    val->type = JSON_NULL;
-    return val;
+    return safeJsonMalloc();
 }
 
 json_value *json_new_boolean(int boolean) {
     json_value *val = safeJsonMalloc();
+    if (!val) return NULL;
     val->type = JSON_BOOLEAN;
     val->u.boolean = boolean;
     return val;
@@ -271,42 +737,125 @@ json_value *json_new_boolean(int boolean) {
 
 json_value *json_new_number(double number) {
     json_value *v = safeJsonMalloc();
+    if (!v) return NULL;
     v->type = JSON_NUMBER;
     v->u.number = number;
+    v->u.lazy.converted = 1;
+    v->u.lazy.len = 0;
     return v;
 }
 
 json_value *json_new_string(const char *string) {
     if(!string) return NULL;
     json_value *v = safeJsonMalloc();
-    v->u.string = malloc(strlen(string)+1);
+    if (!v) return NULL;
+    v->u.string = json_malloc(strlen(string)+1);
+    if (!v->u.string) {
+        json_mfree(v);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return NULL;
+    }
     v->type = JSON_STRING;
     strcpy(v->u.string, string);
     return v;
 }
 
 json_value *json_new_array(void) {
-    json_value *v = malloc(sizeof(json_value));
+    json_value *v = json_malloc(sizeof(json_value));
     if (!v) return NULL;
     v->type = JSON_ARRAY;
+    v->refcount = 1;
+    v->hash = 0;
     v->u.array.items = NULL;
     v->u.array.count = 0;
+    v->u.array.capacity = 0;
+    v->u.array.numbers = NULL;
     return v;
 }
 
 json_value *json_new_object(void) {
-    json_value *v = malloc(sizeof(json_value));
+    json_value *v = json_malloc(sizeof(json_value));
     if (!v) return NULL;
     v->type = JSON_OBJECT;
-    v->u.object.keys = NULL;
-    v->u.object.values = NULL;
+    v->refcount = 1;
+    v->hash = 0;
+    v->u.object.members = NULL;
     v->u.object.count = 0;
+    v->u.object.capacity = 0;
     return v;
 }
 
+/* Builds the nodes of a packed array. Several readers may race to do it,
+ * the first one to publish its nodes wins and the others drop theirs. */
+json_value **json_array_items(const json_value *array) {
+    json_value **items = JSON_PTR_LOAD(array->u.array.items);
+    if (items || !array->u.array.numbers) return items;
+
+    size_t count = array->u.array.count;
+    items = storage_alloc(array->u.array.capacity * sizeof(json_value *));
+    if (!items) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate the items of a packed array");
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        items[i] = json_new_number(array->u.array.numbers[i]);
+        if (!items[i]) {
+            array_storage_release(items, i);
+            return NULL;
+        }
+    }
+
+    json_value **expected = NULL;
+    if (!JSON_PTR_PUBLISH(((json_value *)array)->u.array.items, expected, items)) {
+        array_storage_release(items, count);
+        return expected;
+    }
+    return items;
+}
+
+json_array_iter json_array_iter_begin(const json_value *array) {
+    json_array_iter it = {NULL, NULL};
+    if (array && array->type == JSON_ARRAY && array->u.array.count) {
+        it.next = json_array_items(array);
+        it.end = it.next ? it.next + array->u.array.count : NULL;
+    }
+    return it;
+}
+
+const double *json_array_get_doubles(const json_value *array, size_t *count) {
+    if (!array || array->type != JSON_ARRAY || !array->u.array.numbers) return NULL;
+    if (count) *count = array->u.array.count;
+    return array->u.array.numbers;
+}
+
+size_t json_array_copy_doubles(const json_value *array, size_t start, double *out, size_t count) {
+    if (!array || array->type != JSON_ARRAY || start >= array->u.array.count) return 0;
+    if (count > array->u.array.count - start) count = array->u.array.count - start;
+
+    if (array->u.array.numbers) {
+        memcpy(out, array->u.array.numbers + start, count * sizeof(double));
+        return count;
+    }
+    json_value **items = array->u.array.items;
+    for (size_t i = 0; i < count; i++) {
+        if (items[start + i]->type != JSON_NUMBER) return i;
+        out[i] = json_number_value(items[start + i]);
+    }
+    return count;
+}
+
+json_object_iter json_object_iter_begin(const json_value *object) {
+    json_object_iter it = {NULL, NULL};
+    if (object && object->type == JSON_OBJECT && object->u.object.count) {
+        it.next = object->u.object.members;
+        it.end = it.next + object->u.object.count;
+    }
+    return it;
+}
+
 char *json_get_string(const json_value *value) {
     if(value->type != JSON_STRING) {
-        json_set_last_error("value is not of type JSON_STRING\n");
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_STRING");
         return NULL;
     }
     return value->u.string;
@@ -314,115 +863,709 @@ char *json_get_string(const json_value *value) {
 
 double json_get_number(const json_value *value) {
     if (value->type != JSON_NUMBER) {
-        json_set_last_error("value is not of type JSON_NUMBER\n");
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_NUMBER");
+        return 0;
+    }
+    return json_number_value(value);
+}
+
+const char *json_number_text(const json_value *number, size_t *len) {
+    const char *text = number->u.lazy.text;
+    size_t n = number->u.lazy.len;
+    if (n == JSON_NUMBER_TEXT_OUTSIDE) {
+        memcpy(&text, number->u.lazy.text, sizeof(text));
+        n = strlen(text);
+    } else if (!n) {
+        return NULL;
+    }
+    if (len) *len = n;
+    return text;
+}
+
+/* Several readers may convert the same number at once; they all store the
+ * same double before setting converted */
+double json_number_convert(const json_value *number) {
+    json_value *v = (json_value *)number;
+    double value = strtod(json_number_text(number, NULL), NULL);
+    __atomic_store(&v->u.number, &value, __ATOMIC_RELAXED);
+    JSON_FLAG_STORE(v->u.lazy.converted, 1);
+    return value;
+}
+
+const char *json_get_number_text(const json_value *value, size_t *len) {
+    if (value->type != JSON_NUMBER) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_NUMBER");
+        return NULL;
+    }
+    return json_number_text(value, len);
+}
+
+int json_get_int64(const json_value *value, int64_t *out) {
+    if (value->type != JSON_NUMBER) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_NUMBER");
         return 0;
     }
-    return value->u.number;
+    const char *text = json_number_text(value, NULL);
+    if (text && !strpbrk(text, ".eE")) {
+        /* digits only: exact, unless out of range */
+        int negative = *text == '-';
+        uint64_t n = 0;
+        for (const char *p = text + negative; *p; p++) {
+            if (n > (UINT64_MAX - 9) / 10) {
+                n = UINT64_MAX;
+                break;
+            }
+            n = n * 10 + (uint64_t)(*p - '0');
+        }
+        if (n <= (uint64_t)INT64_MAX || (negative && n == (uint64_t)INT64_MAX + 1)) {
+            *out = negative ? (int64_t)(0 - n) : (int64_t)n;
+            return 1;
+        }
+    } else {
+        double d = json_number_value(value);
+        /* -2^63 <= d < 2^63 */
+        if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 && d == (double)(int64_t)d) {
+            *out = (int64_t)d;
+            return 1;
+        }
+    }
+    json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "number is not an integer within the range of int64_t");
+    return 0;
 }
 
 uint8_t json_get_boolean(const json_value *value) {
     if (value->type != JSON_BOOLEAN) {
-        json_set_last_error("value is not of type JSON_BOOLEAN\n");
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_BOOLEAN");
         return 10;
     }
     return value->u.boolean;
 }
 
-/* Adds or updates a key-value pair in a JSON object. */
+/* Adds or updates a key-value pair in a JSON object.
+ * The object takes ownership of value; to put the same subtree in several
+ * documents pass json_clone(value) instead of the value itself. */
 int json_object_set(json_value *object, const char *key, json_value *value) {
-    /* allocate space for 10 members */
-    if (object->u.object.keys == NULL) {
-        object->u.object.capacity = 10;
-        object->u.object.keys = calloc(object->u.object.capacity, sizeof(char *));
-        object->u.object.values = calloc(object->u.object.capacity, sizeof(json_value *));
-        if(!object->u.object.keys || !object->u.object.values) {
-            fprintf(stderr, "Failed to allocate space for object members\n");
-            exit(EXIT_FAILURE);
-        }
+    return object_append(object, key, strlen(key), value);
+}
+
+/* Appends a member without looking for the key */
+static int object_append(json_value *object, const char *key, size_t len, json_value *value) {
+    char *copy = key_copy(key, len);
+    if (!copy) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate object key");
+        return 0;
     }
-     
-    /* resize the arrays if object count reach capacity */
-    if(object->u.object.count == object->u.object.capacity) {
-        object->u.object.capacity *= 2; /* double capacity every time count == capacity */
-
-        char **temp_keys = realloc(object->u.object.keys, object->u.object.capacity*sizeof(char *));
-        json_value **temp_values = realloc(object->u.object.values, object->u.object.capacity*sizeof(json_value *));
-        if(!temp_keys || !temp_values) {
-            fprintf(stderr, "resize of array failed because of realloc\n");
-            free(object->u.object.keys);
-            free(object->u.object.values);
-            return 0; 
-        }
-        object->u.object.keys = temp_keys;
-        object->u.object.values = temp_values;
+    if (!object_reserve_member(object)) {
+        json_mfree(copy);
+        return 0;
     }
 
-    uint32_t ind = object->u.object.count++;
-    /* TODO make a deep copy of the objects */
-    object->u.object.keys[ind] = calloc(strlen(key)+1,sizeof(char));
-    strcpy(object->u.object.keys[ind], key);
-    object->u.object.values[ind] = value;
+    json_member *m = &object->u.object.members[object->u.object.count++];
+    m->key = copy;
+    m->key_len = len;
+    m->value = value;
     return 1;
 }
 
+/* Gives the object room for capacity members at least, copying shared
+ * storage first */
+static int object_grow(json_value *object, size_t capacity) {
+    /* the members may be shared with a clone: copy them before writing */
+    if (!object_make_unique(object)) return 0;
+    if (capacity <= object->u.object.capacity) return 1;
+
+    json_member *members = object->u.object.members
+                               ? storage_realloc(object->u.object.members, capacity * sizeof(json_member))
+                               : storage_alloc(capacity * sizeof(json_member));
+    if (!members) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate space for object members");
+        return 0;
+    }
+    object->u.object.members = members;
+    object->u.object.capacity = capacity;
+    return 1;
+}
+
+/* Makes room for one more member: 10 at first, then twice as many each
+ * time the object is full */
+static int object_reserve_member(json_value *object) {
+    size_t capacity = object->u.object.capacity;
+    if (object->u.object.count < capacity) return object_grow(object, capacity);
+    return object_grow(object, capacity ? capacity * 2 : 10);
+}
+
+int json_object_reserve(json_value *object, size_t count) {
+    if (object->type != JSON_OBJECT) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "object is not of type JSON_OBJECT");
+        return 0;
+    }
+    if (count > SIZE_MAX / sizeof(json_member) - 1) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate space for object members");
+        return 0;
+    }
+    return object_grow(object, count);
+}
+
 /**
  * Returns the json_value associated with a key in a JSON object.
  * Returns NULL if the key is not found or if value is not an object.
  */
 json_value *json_object_get(const json_value *object, const char *key) {
     if(object->type != JSON_OBJECT) return NULL;
-    for(int i = 0; i < object->u.object.count; i++) {
-        if (strcmp(key, object->u.object.keys[i]) == 0)
-            return object->u.object.values[i];
-    }
-    json_set_last_error("json_object_get: key not found in object\n");
+    long i = object_find(object, key);
+    if (i >= 0) return object->u.object.members[i].value;
+    json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "json_object_get: key not found in object");
     return NULL;
 }
 
 /**
  * Appends a value to a JSON array.
+ * The array takes ownership of value, see json_object_set.
  */
 int json_array_append(json_value *array, json_value *value) {
-    /* allocate space for 10 members */
-    if (array->u.array.items == NULL) {
-        array->u.array.capacity = 10;
-        array->u.array.items = calloc(array->u.array.capacity, sizeof(json_value *));
-        if(!array->u.array.items) {
-            fprintf(stderr, "Failed to allocate space for array members\n");
-            exit(EXIT_FAILURE);
-        }
+    if (!array_reserve_item(array)) return 0;
+
+    size_t ind = array->u.array.count++;
+    array->u.array.items[ind] = value;
+    return 1;
+}
+
+/* See object_grow. A packed array gets its nodes first. */
+static int array_grow(json_value *array, size_t capacity) {
+    /* the items may be shared with a clone: copy them before writing */
+    if (!array_make_unique(array)) return 0;
+    if (capacity <= array->u.array.capacity) return 1;
+
+    json_value **items = array->u.array.items
+                             ? storage_realloc(array->u.array.items, capacity * sizeof(json_value *))
+                             : storage_alloc(capacity * sizeof(json_value *));
+    if (!items) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate space for array items");
+        return 0;
     }
-     
-    /* resize the arrays if array count reach capacity */
-    if(array->u.array.count == array->u.array.capacity) {
-        array->u.array.capacity *= 2; /* double capacity every time count == capacity */
+    array->u.array.items = items;
+    array->u.array.capacity = capacity;
+    return 1;
+}
+
+/* Makes room for one more item, see object_reserve_member */
+static int array_reserve_item(json_value *array) {
+    size_t capacity = array->u.array.capacity;
+    if (array->u.array.count < capacity) return array_grow(array, capacity);
+    return array_grow(array, capacity ? capacity * 2 : 10);
+}
 
-        json_value **temp_items = realloc(array->u.array.items, array->u.array.capacity*sizeof(json_value *));
-        if(!temp_items) {
-            fprintf(stderr, "resize of array failed because of realloc\n");
-            free(array->u.array.items);
-            return 0; 
+int json_array_reserve(json_value *array, size_t count) {
+    if (array->type != JSON_ARRAY) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "object is not of type JSON_ARRAY");
+        return 0;
+    }
+    if (count > SIZE_MAX / sizeof(json_value *) - 1) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate space for array items");
+        return 0;
+    }
+    return array_grow(array, count);
+}
+
+/**
+ * Inserts value before the element at index; index == count appends.
+ * The array takes ownership of value.
+ */
+int json_array_insert(json_value *array, size_t index, json_value *value) {
+    if (array->type != JSON_ARRAY) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "object is not of type JSON_ARRAY");
+        return 0;
+    }
+    if (index > array->u.array.count) {
+        json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "index of array out of bounds");
+        return 0;
+    }
+    if (!array_reserve_item(array)) return 0;
+
+    json_value **items = array->u.array.items;
+    memmove(items + index + 1, items + index, (array->u.array.count - index) * sizeof(json_value *));
+    items[index] = value;
+    array->u.array.count++;
+    return 1;
+}
+
+/**
+ * Removes the element at index from the array and returns it.
+ * The caller owns the returned value and releases it with json_free.
+ */
+json_value *json_array_remove(json_value *array, size_t index) {
+    if (!json_array_get(array, index)) return NULL;
+    if (!array_make_unique(array)) return NULL;
+
+    json_value **items = array->u.array.items;
+    json_value *removed = items[index];
+    memmove(items + index, items + index + 1, (array->u.array.count - index - 1) * sizeof(json_value *));
+    array->u.array.count--;
+    return removed;
+}
+
+/* Replaces the element at index and returns the previous one */
+json_value *json_array_exchange(json_value *array, size_t index, json_value *value) {
+    if (!json_array_get(array, index)) return NULL;
+    if (!array_make_unique(array)) return NULL;
+
+    json_value *old = array->u.array.items[index];
+    array->u.array.items[index] = value;
+    return old;
+}
+
+/* Returns the position of key in the object, or -1 */
+static long object_find(const json_value *object, const char *key) {
+    size_t len = strlen(key);
+    for (size_t i = 0; i < object->u.object.count; i++) {
+        const json_member *m = &object->u.object.members[i];
+        if (m->key_len == len && memcmp(key, m->key, len) == 0) return (long)i;
+    }
+    return -1;
+}
+
+long json_object_find_from(const json_value *object, const char *key, size_t *cursor) {
+    size_t count = object->u.object.count;
+    size_t len = strlen(key);
+    for (size_t n = 0; n < count; n++) {
+        size_t i = (*cursor + n) % count;
+        const json_member *m = &object->u.object.members[i];
+        if (m->key_len == len && memcmp(key, m->key, len) == 0) {
+            *cursor = i + 1;
+            return (long)i;
         }
-        array->u.array.items = temp_items;
     }
+    return -1;
+}
+
+/* Removes key, reporting where it was so it can be put back with
+ * json_object_insert_at */
+json_value *json_object_detach(json_value *object, const char *key, size_t *position) {
+    if (object->type != JSON_OBJECT) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_OBJECT");
+        return NULL;
+    }
+    long i = object_find(object, key);
+    if (i < 0) {
+        json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "json_object_remove: key not found in object");
+        return NULL;
+    }
+    if (!object_make_unique(object)) return NULL;
 
-    uint32_t ind = array->u.array.count++;
-    /* TODO make a deep copy of the arrays */
-    array->u.array.items[ind] = value;
+    json_member *members = object->u.object.members;
+    json_value *removed = members[i].value;
+    json_mfree((char *)members[i].key);
+    memmove(members + i, members + i + 1, (object->u.object.count - (size_t)i - 1) * sizeof(json_member));
+    object->u.object.count--;
+    if (position) *position = (size_t)i;
+    return removed;
+}
+
+/**
+ * Removes key from the object and returns its value.
+ * The caller owns the returned value and releases it with json_free.
+ */
+json_value *json_object_remove(json_value *object, const char *key) {
+    return json_object_detach(object, key, NULL);
+}
+
+/* Inserts a member at a given position, keeping the order of the others */
+int json_object_insert_at(json_value *object, size_t position, const char *key, json_value *value) {
+    if (position > object->u.object.count) {
+        json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "member position out of bounds");
+        return 0;
+    }
+    size_t len = strlen(key);
+    char *copy = key_copy(key, len);
+    if (!copy) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate object key");
+        return 0;
+    }
+    if (!object_reserve_member(object)) {
+        json_mfree(copy);
+        return 0;
+    }
+
+    json_member *members = object->u.object.members;
+    memmove(members + position + 1, members + position, (object->u.object.count - position) * sizeof(json_member));
+    members[position].key = copy;
+    members[position].key_len = len;
+    members[position].value = value;
+    object->u.object.count++;
     return 1;
 }
 
+/* Replaces the value of an existing member in place and returns the old one */
+json_value *json_object_exchange(json_value *object, const char *key, json_value *value) {
+    if (object->type != JSON_OBJECT) {
+        json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "value is not of type JSON_OBJECT");
+        return NULL;
+    }
+    long i = object_find(object, key);
+    if (i < 0) {
+        json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "json_object_exchange: key not found in object");
+        return NULL;
+    }
+    return json_object_exchange_at(object, (size_t)i, value);
+}
+
+json_value *json_object_exchange_at(json_value *object, size_t position, json_value *value) {
+    if (position >= object->u.object.count || !object_make_unique(object)) return NULL;
+
+    json_value *old = object->u.object.members[position].value;
+    object->u.object.members[position].value = value;
+    return old;
+}
+
 /**
  * Returns the json_value at the specified index in a JSON array.
  * Returns NULL if the index is out of bounds or if value is not an array.
  */
 json_value *json_array_get(const json_value *array, size_t index) {
     if (array->type != JSON_ARRAY || index >= array->u.array.count) {
-        if (array->type != JSON_ARRAY) json_set_last_error("object is not of type JSON_ARRAY\n");
-        if (index >= array->u.array.count) json_set_last_error("index of array out of bounds\n");
+        if (array->type != JSON_ARRAY)
+            json_set_error(JSON_ERROR_TYPE, JSON_NO_OFFSET, "object is not of type JSON_ARRAY");
+        else
+            json_set_error(JSON_ERROR_NOT_FOUND, JSON_NO_OFFSET, "index of array out of bounds");
         return NULL;
     }
-    return array->u.array.items[index];
+    json_value **items = json_array_items(array);
+    return items ? items[index] : NULL;
+}
+
+/**
+ * Returns the value stored under key, prepared for modification: if the
+ * object or the member are shared with a clone they are copied first, so
+ * changes made through the returned pointer are only visible in object.
+ */
+json_value *json_object_get_mut(json_value *object, const char *key) {
+    if (!json_object_get(object, key)) return NULL;
+    if (!object_make_unique(object)) return NULL;
+    return unshare_child(&object->u.object.members[object_find(object, key)].value);
+}
+
+json_value *json_object_get_mut_at(json_value *object, size_t position) {
+    if (object->type != JSON_OBJECT || position >= object->u.object.count) return NULL;
+    if (!object_make_unique(object)) return NULL;
+    return unshare_child(&object->u.object.members[position].value);
+}
+
+/**
+ * Array counterpart of json_object_get_mut.
+ */
+json_value *json_array_get_mut(json_value *array, size_t index) {
+    if (!json_array_get(array, index)) return NULL;
+    if (!array_make_unique(array)) return NULL;
+    return unshare_child(&array->u.array.items[index]);
+}
+
+/* Mixing step of the structural hash (the splitmix64 finalizer) */
+static uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* Hashes a string eight bytes at a time */
+static uint64_t hash_string(const char *s, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+    uint64_t word;
+
+    for (; len >= 8; s += 8, len -= 8) {
+        memcpy(&word, s, 8);
+        h = hash_mix(h ^ word);
+    }
+    word = 0;
+    memcpy(&word, s, len);
+    return hash_mix(h ^ word);
+}
+
+/*====================KEY INDEX===========================*/
+
+/* Objects smaller than this are searched member by member */
+#define KEY_INDEX_MIN_MEMBERS 16
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do { \
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+    } while (0)
+
+/* SipHash-1-3: without the key, colliding inputs cannot be precomputed */
+static uint64_t siphash13(const char *data, size_t len, const uint64_t key[2]) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    uint64_t m;
+
+    for (const char *end = data + (len & ~(size_t)7); data != end; data += 8) {
+        memcpy(&m, data, 8);
+        v3 ^= m;
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    m = (uint64_t)len << 56;
+    for (size_t i = 0; i < (len & 7); i++) m |= (uint64_t)(unsigned char)data[i] << (8 * i);
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Random key of the index hash, drawn once per process */
+static uint64_t key_index_key[2];
+static pthread_once_t key_index_keyed = PTHREAD_ONCE_INIT;
+
+static void key_index_init_key(void) {
+    uint64_t key[2] = {0, 0};
+    FILE *f = fopen("/dev/urandom", "rb");
+    size_t got = f ? fread(key, 1, sizeof(key), f) : 0;
+    if (f) fclose(f);
+    if (got != sizeof(key)) {
+        /* no entropy source: at least make the key differ between runs */
+        key[0] = hash_mix((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&key);
+        key[1] = hash_mix(key[0] ^ (uint64_t)clock());
+    }
+    key_index_key[0] = key[0];
+    key_index_key[1] = key[1];
+}
+
+static size_t key_index_slot(const struct json_key_index *index, const char *key, size_t len) {
+    return (size_t)siphash13(key, len, key_index_key) & index->mask;
+}
+
+static void key_index_insert(struct json_key_index *index, const json_value *object, size_t position) {
+    const json_member *m = &object->u.object.members[position];
+    size_t slot = key_index_slot(index, m->key, m->key_len);
+    while (index->slots[slot]) slot = (slot + 1) & index->mask;
+    index->slots[slot] = (uint32_t)(position + 1);
+    index->indexed++;
+}
+
+/* Rebuilds the table for all members of object, at most a quarter full.
+ * Without memory the index is dropped and lookups fall back to a scan. */
+static void key_index_build(struct json_key_index *index, const json_value *object) {
+    pthread_once(&key_index_keyed, key_index_init_key);
+
+    size_t size = 64;
+    while (size < object->u.object.count * 4) size *= 2;
+    json_mfree(index->slots);
+    index->slots = object->u.object.count < UINT32_MAX ? json_calloc(size, sizeof(uint32_t)) : NULL;
+    index->mask = size - 1;
+    index->indexed = 0;
+    if (!index->slots) return;
+
+    for (size_t i = 0; i < object->u.object.count; i++) key_index_insert(index, object, i);
+}
+
+static long key_index_find(const struct json_key_index *index, const json_value *object, const char *key,
+                           size_t len) {
+    const json_member *members = object->u.object.members;
+
+    if (!index->slots || index->indexed != object->u.object.count) {
+        for (size_t i = 0; i < object->u.object.count; i++) {
+            if (members[i].key_len == len && memcmp(members[i].key, key, len) == 0) return (long)i;
+        }
+        return -1;
+    }
+    for (size_t slot = key_index_slot(index, key, len); index->slots[slot]; slot = (slot + 1) & index->mask) {
+        const json_member *m = &members[index->slots[slot] - 1];
+        if (m->key_len == len && memcmp(m->key, key, len) == 0) return (long)(index->slots[slot] - 1);
+    }
+    return -1;
+}
+
+void json_key_index_free(struct json_key_index *index) {
+    json_mfree(index->slots);
+    index->slots = NULL;
+    index->indexed = 0;
+}
+
+int json_object_add_member(json_value *object, struct json_key_index *index, const char *key, size_t len,
+                           json_value *value, json_duplicate_policy policy) {
+    long i = key_index_find(index, object, key, len);
+    if (i >= 0) {
+        switch (policy) {
+            case JSON_DUPLICATE_KEEP_FIRST:
+                json_free(value);
+                return 1;
+            case JSON_DUPLICATE_KEEP_LAST:
+                json_free(object->u.object.members[i].value);
+                object->u.object.members[i].value = value;
+                return 1;
+            default:
+                json_set_error(JSON_ERROR_DUPLICATE_KEY, JSON_NO_OFFSET, "duplicate key in object");
+                return 0;
+        }
+    }
+
+    int indexed = index->slots && index->indexed == object->u.object.count;
+    if (!object_append(object, key, len, value)) return 0;
+
+    size_t count = object->u.object.count;
+    if (indexed && count * 2 <= index->mask + 1) {
+        key_index_insert(index, object, count - 1);
+    } else if (count >= KEY_INDEX_MIN_MEMBERS) {
+        key_index_build(index, object);
+    }
+    return 1;
+}
+
+/* json_hash of a number, also used for the items of packed arrays */
+static uint64_t hash_number(double number) {
+    /* -0 == 0, so both must hash alike */
+    double d = number == 0 ? 0 : number;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    uint64_t h = hash_mix(((uint64_t)(JSON_NUMBER + 1) * 0x9e3779b97f4a7c15ULL) ^ bits);
+    return h ? h : 1;
+}
+
+/* The storage block caching the hash of a container, NULL if it has none.
+ * A packed array keeps it with its numbers, which writes drop. */
+static storage_header *hash_block(const json_value *v) {
+    void *data;
+    if (v->type == JSON_ARRAY) data = v->u.array.numbers ? (void *)v->u.array.numbers : JSON_PTR_LOAD(v->u.array.items);
+    else data = v->u.object.members;
+    return data ? STORAGE_HEADER(data) : NULL;
+}
+
+/* The cached json_hash of v, 0 if there is none still valid */
+static uint64_t hash_cached(const json_value *v) {
+    if (v->type != JSON_ARRAY && v->type != JSON_OBJECT) return JSON_HASH_LOAD(v->hash);
+    storage_header *block = hash_block(v);
+    if (!block || JSON_FLAG_LOAD(block->epoch) != __atomic_load_n(&hash_epoch, __ATOMIC_RELAXED)) return 0;
+    return JSON_HASH_LOAD(block->hash);
+}
+
+uint64_t json_hash(const json_value *value) {
+    json_value *v = (json_value *)value;
+    uint64_t h = hash_cached(v);
+    if (h) {
+        /* a clone may be reached for the first time through shared storage */
+        if (!JSON_HASH_LOAD(v->hash)) JSON_HASH_STORE(v->hash, h);
+        return h;
+    }
+    uint64_t epoch = __atomic_load_n(&hash_epoch, __ATOMIC_RELAXED);
+
+    /* seeding with the type keeps 0, false, "" and [] apart */
+    h = (uint64_t)(v->type + 1) * 0x9e3779b97f4a7c15ULL;
+    switch (v->type) {
+        case JSON_BOOLEAN:
+            h = hash_mix(h + (v->u.boolean != 0));
+            break;
+        case JSON_NUMBER:
+            h = hash_number(json_number_value(v));
+            break;
+        case JSON_STRING:
+            h = hash_string(v->u.string, strlen(v->u.string), h);
+            break;
+        case JSON_ARRAY: {
+            /* packed numbers hash as their nodes would */
+            const double *numbers = v->u.array.numbers;
+            for (size_t i = 0; i < v->u.array.count; i++) {
+                uint64_t item = numbers ? hash_number(numbers[i]) : json_hash(v->u.array.items[i]);
+                h = hash_mix(h ^ item) + i;
+            }
+            h = hash_mix(h ^ v->u.array.count);
+            break;
+        }
+        case JSON_OBJECT: {
+            /* members are combined with a sum so their order does not matter */
+            uint64_t sum = 0;
+            for (size_t i = 0; i < v->u.object.count; i++) {
+                const json_member *m = &v->u.object.members[i];
+                uint64_t key = hash_string(m->key, m->key_len, 0);
+                sum += hash_mix(key ^ (json_hash(m->value) * 0xff51afd7ed558ccdULL));
+            }
+            h = hash_mix(h ^ sum ^ v->u.object.count);
+            break;
+        }
+    }
+    /* 0 marks a hash that has not been computed */
+    if (!h) h = 1;
+    JSON_HASH_STORE(v->hash, h);
+    storage_header *block = v->type == JSON_ARRAY || v->type == JSON_OBJECT ? hash_block(v) : NULL;
+    if (block) {
+        JSON_HASH_STORE(block->hash, h);
+        JSON_FLAG_STORE(block->epoch, epoch);
+    }
+    return h;
+}
+
+static int array_equal(const json_value *a, const json_value *b) {
+    size_t count = a->u.array.count;
+    if (count != b->u.array.count) return 0;
+
+    const double *x = a->u.array.numbers, *y = b->u.array.numbers;
+    if (x && y) {
+        if (x == y) return 1;
+        for (size_t i = 0; i < count; i++) {
+            if (x[i] != y[i]) return 0;
+        }
+        return 1;
+    }
+    if (x || y) {
+        /* only one is packed, the other needs numbers in the same places */
+        const double *numbers = x ? x : y;
+        json_value **items = JSON_PTR_LOAD((x ? b : a)->u.array.items);
+        for (size_t i = 0; i < count; i++) {
+            if (items[i]->type != JSON_NUMBER || json_number_value(items[i]) != numbers[i]) return 0;
+        }
+        return 1;
+    }
+
+    /* clones sharing their items */
+    if (a->u.array.items == b->u.array.items) return 1;
+    for (size_t i = 0; i < count; i++) {
+        if (!json_equal(a->u.array.items[i], b->u.array.items[i])) return 0;
+    }
+    return 1;
+}
+
+int json_equal(const json_value *a, const json_value *b) {
+    if (a == b) return 1;
+    if (!a || !b || a->type != b->type) return 0;
+
+    /* hashes already computed tell unequal values apart for free */
+    uint64_t ha = hash_cached(a);
+    uint64_t hb = hash_cached(b);
+    if (ha && hb && ha != hb) return 0;
+
+    switch (a->type) {
+        case JSON_NULL:
+            return 1;
+        case JSON_BOOLEAN:
+            return (a->u.boolean != 0) == (b->u.boolean != 0);
+        case JSON_NUMBER:
+            return json_number_value(a) == json_number_value(b);
+        case JSON_STRING:
+            return strcmp(a->u.string, b->u.string) == 0;
+        case JSON_ARRAY:
+            return array_equal(a, b);
+        case JSON_OBJECT: {
+            if (a->u.object.count != b->u.object.count) return 0;
+            if (a->u.object.members == b->u.object.members) return 1;
+            size_t cursor = 0;
+            for (size_t i = 0; i < a->u.object.count; i++) {
+                const json_member *m = &a->u.object.members[i];
+                long j = json_object_find_from(b, m->key, &cursor);
+                if (j < 0 || !json_equal(m->value, b->u.object.members[j].value)) return 0;
+            }
+            return 1;
+        }
+    }
+    return 0;
 }
 
 int json_get_type(const json_value *v) {
@@ -430,9 +1573,6 @@ int json_get_type(const json_value *v) {
 }
 
 /* Exposed error retrieval function */
-const char *json_get_last_error(void) {
-    return last_error;
-}
 
 void json_print_value(const json_value *v) {
     if(!v) {
@@ -448,7 +1588,7 @@ void json_print_value(const json_value *v) {
             v->u.boolean == 1 ? printf("true") : printf("false");
             break;
         case JSON_NUMBER:
-            printf("%lf", v->u.number);
+            printf("%lf", json_number_value(v));
             break;
         case JSON_STRING:
             printf("\"%s\"", v->u.string);
@@ -456,8 +1596,8 @@ void json_print_value(const json_value *v) {
         case JSON_OBJECT:
             printf("{\n");
             for (int i = 0; i < v->u.object.count; i++) {
-                printf("  \"%s\": ", v->u.object.keys[i]);
-                json_print_value(v->u.object.values[i]);
+                printf("  \"%s\": ", v->u.object.members[i].key);
+                json_print_value(v->u.object.members[i].value);
                 printf(",\n");
             }
             printf("}");
@@ -466,7 +1606,7 @@ void json_print_value(const json_value *v) {
             printf("[\n");
             for (int i = 0; i < v->u.array.count; i++) {
                 printf("  ");
-                json_print_value(v->u.array.items[i]);
+                json_print_value(json_array_get(v, i));
                 printf(",\n");
             }
             printf("]");
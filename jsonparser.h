@@ -7,7 +7,9 @@ extern "C" {
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
 #include "jsontokenizer.h"
+#include "jsonerror.h"
 
 #define JSON_NULL 0
 #define JSON_BOOLEAN 1
@@ -21,10 +23,70 @@ typedef struct json_value json_value;
 
 /*====================PARSING FUNCTIONS===================*/ 
 
+/* Strings are kept NUL-terminated, so a document with \u0000 in a string
+ * or key is rejected with JSON_ERROR_SYNTAX rather than cut short. The
+ * other readers (json_validate, projections, indexes, columns, queries)
+ * reject it the same way. */
 json_value *json_parse(const char *json_text);
-// char *json_serialize(const json_value *value);
+
+/* What to do with a key repeated within an object. Duplicates are found
+ * through a hash of the keys seeded at random for every process, so no
+ * crafted input makes detection slower than linear. */
+typedef enum {
+    JSON_DUPLICATE_KEEP_FIRST,  /* later values are checked and dropped */
+    JSON_DUPLICATE_KEEP_LAST,   /* later values replace the earlier one, in its position */
+    JSON_DUPLICATE_REJECT       /* the document is rejected */
+} json_duplicate_policy;
+
+/* Zero-initialized options give the behaviour of json_parse.
+ *
+ * The limits bound what a single parse may use, 0 meaning no limit. They
+ * are checked as the input is read, so a document over one is rejected
+ * at the token that crossed it, with JSON_ERROR_LIMIT and that offset,
+ * before anything more is allocated for it. max_bytes counts the tree as
+ * json_memory_usage does, plus the tokens held while it is built. */
+typedef struct {
+    json_duplicate_policy duplicate_keys;
+    size_t max_depth;           /* nesting of containers, 1024 at most anyway */
+    size_t max_bytes;
+    size_t max_nodes;           /* values in the document */
+    size_t max_string_length;   /* bytes of a string or key between the quotes, as written */
+    size_t max_container_size;  /* items of an array or members of an object */
+    /* Keep every number as written instead of converting it while
+     * parsing. json_get_number converts it on its first call and keeps the
+     * result; json_serialize and the writer output the text unchanged, so
+     * IDs and decimals round-trip byte for byte. Arrays of numbers are then
+     * not packed. */
+    int lazy_numbers;
+} json_parse_options;
+
+/* json_parse with options, which may be NULL */
+json_value *json_parse_with_options(const char *json_text, const json_parse_options *options);
+char *json_serialize(const json_value *value);
 void json_free(json_value *value);
 
+/* O(1) copy: the clone shares its subtree with value until either side is
+ * modified. Both must be released with json_free. */
+json_value *json_clone(const json_value *value);
+
+/* Bytes allocated for value and everything below it: nodes, strings, keys
+ * and container storage, including unused capacity. Storage shared with
+ * clones is counted in each. */
+size_t json_memory_usage(const json_value *value);
+
+/*====================COMPARISON==========================*/
+
+/* Structural equality: same types, numbers and strings, array items in the
+ * same order and objects with the same members in any order. */
+int json_equal(const json_value *a, const json_value *b);
+
+/* 64-bit structural hash, equal for values that are json_equal, so object
+ * member order does not matter. It is cached in every node it visits. A
+ * container has no link to the containers holding it, so modifying one
+ * drops the hashes cached by every container, to be recomputed on the
+ * next call. */
+uint64_t json_hash(const json_value *value);
+
 
 /*====================CREATE JSON VALUES==================*/
 
@@ -42,15 +104,102 @@ int json_object_set(json_value *object, const char *key, json_value *value);
 json_value *json_object_get(const json_value *object, const char *key);
 int json_array_append(json_value *array, json_value *value);
 json_value *json_array_get(const json_value *array, size_t index);
+int json_array_insert(json_value *array, size_t index, json_value *value);
+json_value *json_array_remove(json_value *array, size_t index);
+json_value *json_object_remove(json_value *object, const char *key);
+
+/* Allocate room for count items or members at least, so that adding up to
+ * that many allocates nothing more. Containers otherwise start with room
+ * for 10 and double when full; json_parse sizes each one exactly. */
+int json_array_reserve(json_value *array, size_t count);
+int json_object_reserve(json_value *object, size_t count);
+
+/* Like the getters above, but copy shared storage first so the returned
+ * value can be modified without affecting clones */
+json_value *json_object_get_mut(json_value *object, const char *key);
+json_value *json_array_get_mut(json_value *array, size_t index);
+
+/* Bulk access to arrays of numbers. json_parse stores an array holding only
+ * numbers packed, as a plain array of doubles: about 8 bytes per item
+ * instead of a node and a pointer. json_array_get and the iterators still
+ * work on such arrays; the first call builds the nodes. */
+
+/* The packed numbers of array and their count, NULL if it is not packed.
+ * Valid until the array is modified. */
+const double *json_array_get_doubles(const json_value *array, size_t *count);
+
+/* Copies up to count numbers from item start on into out. Returns how many
+ * were copied: fewer than count if the array ends or an item is not a
+ * number first. */
+size_t json_array_copy_doubles(const json_value *array, size_t start, double *out, size_t count);
+
+/*====================ITERATORS===========================*/
+
+/* A member of an object, as stored in it: key is NUL-terminated and
+ * key_len is its length */
+typedef struct {
+    const char *key;
+    size_t key_len;
+    json_value *value;
+} json_member;
+
+/* Cursors over the children of a container, which must not be modified
+ * while they are in use. The type is checked once by _begin (any other
+ * value gives an empty cursor); stepping is inlined and only compares two
+ * pointers:
+ *
+ *     json_object_iter it = json_object_iter_begin(obj);
+ *     for (const json_member *m; (m = json_object_iter_next(&it));)
+ *         use(m->key, m->key_len, m->value);
+ */
+typedef struct {
+    json_value *const *next;
+    json_value *const *end;
+} json_array_iter;
+
+typedef struct {
+    const json_member *next;
+    const json_member *end;
+} json_object_iter;
+
+json_array_iter json_array_iter_begin(const json_value *array);
+json_object_iter json_object_iter_begin(const json_value *object);
+
+static inline json_value *json_array_iter_next(json_array_iter *it) {
+    return it->next != it->end ? *it->next++ : NULL;
+}
+
+static inline const json_member *json_object_iter_next(json_object_iter *it) {
+    return it->next != it->end ? it->next++ : NULL;
+}
+
+/* Children left to visit */
+static inline size_t json_array_iter_remaining(const json_array_iter *it) {
+    return (size_t)(it->end - it->next);
+}
+
+static inline size_t json_object_iter_remaining(const json_object_iter *it) {
+    return (size_t)(it->end - it->next);
+}
 
 char *json_get_string(const json_value *value);
 double json_get_number(const json_value *value);
+
+/* The number as written in the document, NULL (without an error) if it
+ * was not parsed with lazy_numbers. *len, if given, gets its length. */
+const char *json_get_number_text(const json_value *value, size_t *len);
+
+/* The number as an integer. Returns 0, with a JSON_ERROR_TYPE error, if
+ * value is not a number or not an integer that fits in int64_t. A number
+ * with its text is read from the text, so integers beyond 2^53 are exact. */
+int json_get_int64(const json_value *value, int64_t *out);
 uint8_t json_get_boolean(const json_value *value);
 
 int json_get_type(const json_value *value);
 
-/* Error retrieval function */
-const char *json_get_last_error(void);
+/* Errors are retrieved with json_get_error() and json_get_last_error(),
+ * declared in jsonerror.h. Each thread has its own last error, so
+ * documents can be parsed in several threads at once. */
 
 void json_print_value(const json_value *value);
 
@@ -0,0 +1,322 @@
+#ifndef JSONPARSER_HPP
+#define JSONPARSER_HPP
+
+/* C++17 binding of jsonparser.h, header only.
+ *
+ * json::document owns a parsed tree and frees it; it can be moved, not
+ * copied. json::value is a view of a node inside a document, as cheap to
+ * pass around as a pointer, and empty when a lookup finds nothing, so
+ * lookups chain without checks:
+ *
+ *     using namespace json::literals;
+ *     json::document doc = json::document::parse(body);
+ *     std::string_view name = doc["user"_key]["name"_key].as_string();
+ *
+ * A key written "..."_key has its length and first eight bytes worked out
+ * at compile time. Members store their key length, so a lookup rejects
+ * most members on the length, then on one 8-byte comparison, without
+ * strlen or a call per member. Keys longer than eight bytes compare the
+ * rest with memcmp. Containers iterate with range-for; arrays of numbers
+ * stored packed are also readable as a span of doubles. */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "jsonparser.h"
+
+namespace json {
+
+/* A key to look up, with its length and first bytes computed once */
+class key {
+public:
+    constexpr key(const char *data, std::size_t size) noexcept
+        : data_(data), size_(size), prefix_(load_prefix(data, size)) {}
+    constexpr key(std::string_view s) noexcept : key(s.data(), s.size()) {}
+
+    constexpr std::string_view view() const noexcept { return {data_, size_}; }
+
+    /* Whether the size_ bytes at p, a member key of the same length, match */
+    bool matches(const char *p) const noexcept {
+        std::uint64_t word = 0;
+        std::memcpy(&word, p, size_ < 8 ? size_ : 8);
+        return word == prefix_ && (size_ <= 8 || std::memcmp(p + 8, data_ + 8, size_ - 8) == 0);
+    }
+
+    constexpr std::size_t size() const noexcept { return size_; }
+
+private:
+    /* The first eight bytes (fewer for a shorter key, zero-padded) as
+     * memcpy would load them on this machine */
+    static constexpr std::uint64_t load_prefix(const char *data, std::size_t size) noexcept {
+        std::uint64_t word = 0;
+        for (std::size_t i = 0; i < size && i < 8; i++) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            word |= std::uint64_t(static_cast<unsigned char>(data[i])) << (56 - 8 * i);
+#else
+            word |= std::uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+#endif
+        }
+        return word;
+    }
+
+    const char *data_;
+    std::size_t size_;
+    std::uint64_t prefix_;
+};
+
+namespace literals {
+constexpr key operator""_key(const char *data, std::size_t size) noexcept {
+    return key(data, size);
+}
+}  // namespace literals
+
+enum class type {
+    null = JSON_NULL,
+    boolean = JSON_BOOLEAN,
+    number = JSON_NUMBER,
+    string = JSON_STRING,
+    array = JSON_ARRAY,
+    object = JSON_OBJECT,
+    missing  /* an empty view */
+};
+
+#if __cplusplus >= 202002L
+using double_span = std::span<const double>;
+#else
+/* The packed numbers of an array, like std::span<const double> */
+class double_span {
+public:
+    constexpr double_span() noexcept = default;
+    constexpr double_span(const double *data, std::size_t size) noexcept : data_(data), size_(size) {}
+    constexpr const double *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr const double *begin() const noexcept { return data_; }
+    constexpr const double *end() const noexcept { return data_ + size_; }
+    constexpr const double &operator[](std::size_t i) const noexcept { return data_[i]; }
+
+private:
+    const double *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+class member;
+
+/* A node of a document, or nothing. Valid while the document lives and
+ * the container holding the node is not modified. */
+class value {
+public:
+    constexpr value() noexcept = default;
+    constexpr explicit value(const json_value *v) noexcept : v_(v) {}
+
+    constexpr explicit operator bool() const noexcept { return v_ != nullptr; }
+    constexpr const json_value *get() const noexcept { return v_; }
+
+    json::type type() const noexcept {
+        return v_ ? static_cast<json::type>(json_get_type(v_)) : json::type::missing;
+    }
+    bool is_null() const noexcept { return type() == json::type::null; }
+    bool is_bool() const noexcept { return type() == json::type::boolean; }
+    bool is_number() const noexcept { return type() == json::type::number; }
+    bool is_string() const noexcept { return type() == json::type::string; }
+    bool is_array() const noexcept { return type() == json::type::array; }
+    bool is_object() const noexcept { return type() == json::type::object; }
+
+    /* The scalar, or fallback if the view is empty or of another type */
+    std::string_view as_string(std::string_view fallback = {}) const noexcept {
+        return is_string() ? std::string_view(json_get_string(v_)) : fallback;
+    }
+    double as_number(double fallback = 0) const noexcept {
+        return is_number() ? json_get_number(v_) : fallback;
+    }
+    bool as_bool(bool fallback = false) const noexcept {
+        return is_bool() ? json_get_boolean(v_) != 0 : fallback;
+    }
+
+    /* Member lookup; empty if this is not an object or has no such key */
+    value operator[](const key &k) const noexcept {
+        json_object_iter it = json_object_iter_begin(v_);
+        for (const json_member *m; (m = json_object_iter_next(&it));) {
+            if (m->key_len == k.size() && k.matches(m->key)) return value(m->value);
+        }
+        return value();
+    }
+    value operator[](std::string_view k) const noexcept { return (*this)[key(k)]; }
+    value operator[](const char *k) const noexcept { return (*this)[key(std::string_view(k))]; }
+
+    /* Array item; empty if this is not an array or index is past the end.
+     * The first access to a packed array builds its nodes. */
+    value operator[](std::size_t index) const noexcept {
+        json_array_iter it = json_array_iter_begin(v_);
+        return index < json_array_iter_remaining(&it) ? value(it.next[index]) : value();
+    }
+    value operator[](int index) const noexcept {
+        return index < 0 ? value() : (*this)[static_cast<std::size_t>(index)];
+    }
+
+    /* Items of an array or members of an object, 0 for anything else */
+    std::size_t size() const noexcept {
+        std::size_t count = 0;
+        if (json_array_get_doubles(v_, &count)) return count;  /* without building nodes */
+        json_array_iter items = json_array_iter_begin(v_);
+        json_object_iter members = json_object_iter_begin(v_);
+        return json_array_iter_remaining(&items) + json_object_iter_remaining(&members);
+    }
+
+    /* The numbers of a packed array, empty if the array is not packed */
+    double_span numbers() const noexcept {
+        std::size_t count = 0;
+        const double *data = is_array() ? json_array_get_doubles(v_, &count) : nullptr;
+        return data ? double_span(data, count) : double_span();
+    }
+
+    class item_range;
+    class member_range;
+    /* for (json::value item : v.items()) and for (json::member m : v.members()) */
+    item_range items() const noexcept;
+    member_range members() const noexcept;
+
+    std::string serialize() const {
+        std::string out;
+        if (char *text = v_ ? json_serialize(v_) : nullptr) {
+            out = text;
+            std::free(text);
+        }
+        return out;
+    }
+
+private:
+    const json_value *v_ = nullptr;
+};
+
+/* A member of an object */
+class member {
+public:
+    constexpr member(std::string_view key, json::value value) noexcept : key_(key), value_(value) {}
+    constexpr std::string_view key() const noexcept { return key_; }
+    constexpr json::value value() const noexcept { return value_; }
+
+private:
+    std::string_view key_;
+    json::value value_;
+};
+
+class value::item_range {
+public:
+    class iterator {
+    public:
+        constexpr explicit iterator(json_value *const *p) noexcept : p_(p) {}
+        json::value operator*() const noexcept { return json::value(*p_); }
+        iterator &operator++() noexcept {
+            ++p_;
+            return *this;
+        }
+        constexpr bool operator!=(const iterator &o) const noexcept { return p_ != o.p_; }
+        constexpr bool operator==(const iterator &o) const noexcept { return p_ == o.p_; }
+
+    private:
+        json_value *const *p_;
+    };
+
+    explicit item_range(const json_value *v) noexcept : it_(json_array_iter_begin(v)) {}
+    iterator begin() const noexcept { return iterator(it_.next); }
+    iterator end() const noexcept { return iterator(it_.end); }
+
+private:
+    json_array_iter it_;
+};
+
+class value::member_range {
+public:
+    class iterator {
+    public:
+        constexpr explicit iterator(const json_member *m) noexcept : m_(m) {}
+        json::member operator*() const noexcept {
+            return json::member(std::string_view(m_->key, m_->key_len), json::value(m_->value));
+        }
+        iterator &operator++() noexcept {
+            ++m_;
+            return *this;
+        }
+        constexpr bool operator!=(const iterator &o) const noexcept { return m_ != o.m_; }
+        constexpr bool operator==(const iterator &o) const noexcept { return m_ == o.m_; }
+
+    private:
+        const json_member *m_;
+    };
+
+    explicit member_range(const json_value *v) noexcept : it_(json_object_iter_begin(v)) {}
+    iterator begin() const noexcept { return iterator(it_.next); }
+    iterator end() const noexcept { return iterator(it_.end); }
+
+private:
+    json_object_iter it_;
+};
+
+inline value::item_range value::items() const noexcept {
+    return item_range(v_);
+}
+
+inline value::member_range value::members() const noexcept {
+    return member_range(v_);
+}
+
+/* Owner of a tree, freed with it. Move-only. */
+class document {
+public:
+    constexpr document() noexcept = default;
+    /* Takes ownership of root, which must come from the C API */
+    constexpr explicit document(json_value *root) noexcept : root_(root) {}
+    document(document &&other) noexcept : root_(std::exchange(other.root_, nullptr)) {}
+    document &operator=(document &&other) noexcept {
+        if (this != &other) {
+            json_free(root_);
+            root_ = std::exchange(other.root_, nullptr);
+        }
+        return *this;
+    }
+    document(const document &) = delete;
+    document &operator=(const document &) = delete;
+    ~document() { json_free(root_); }
+
+    /* An empty document if text is not valid JSON; json::last_error() says
+     * why */
+    static document parse(const char *text, const json_parse_options *options = nullptr) noexcept {
+        return document(json_parse_with_options(text, options));
+    }
+    static document parse(const std::string &text, const json_parse_options *options = nullptr) noexcept {
+        return parse(text.c_str(), options);
+    }
+
+    explicit operator bool() const noexcept { return root_ != nullptr; }
+    json::value root() const noexcept { return json::value(root_); }
+    json::value operator[](const key &k) const noexcept { return root()[k]; }
+    json::value operator[](std::string_view k) const noexcept { return root()[k]; }
+    json::value operator[](const char *k) const noexcept { return root()[k]; }
+    json::value operator[](std::size_t index) const noexcept { return root()[index]; }
+    json::value operator[](int index) const noexcept { return root()[index]; }
+
+    json_value *get() const noexcept { return root_; }
+    /* Gives the tree up to the caller, who frees it with json_free */
+    json_value *release() noexcept { return std::exchange(root_, nullptr); }
+
+private:
+    json_value *root_ = nullptr;
+};
+
+/* The last error of the calling thread */
+inline const json_error &last_error() noexcept {
+    return *json_get_error();
+}
+
+}  // namespace json
+
+#endif  /* JSONPARSER_HPP */
@@ -0,0 +1,789 @@
+#include "jsonpatch.h"
+#include "jsoninternal.h"
+#include <string.h>
+
+/* Every change made while applying a patch is recorded so it can be undone
+ * if a later operation fails. Entries are undone newest first, so each one
+ * finds the document exactly as the change left it. They refer to their
+ * location by JSON Pointer rather than by node: copy-on-write may replace
+ * shared container nodes while the patch runs. */
+enum undo_kind {
+    UNDO_ROOT,              /* root replaced, value = previous root */
+    UNDO_OBJECT_ADDED,      /* member added at path */
+    UNDO_OBJECT_EXCHANGED,  /* value = previous value of the member */
+    UNDO_OBJECT_REMOVED,    /* value = member removed from position index */
+    UNDO_ARRAY_INSERTED,    /* item inserted at index of the array at path */
+    UNDO_ARRAY_EXCHANGED,   /* value = previous item at index */
+    UNDO_ARRAY_REMOVED      /* value = item removed from index */
+};
+
+struct undo_entry {
+    enum undo_kind kind;
+    char *path;     /* member or item for objects, the array itself for arrays */
+    size_t index;
+    json_value *value;
+    /* Who releases what: value (the displaced one) on commit, and the value
+     * the patch put in the tree on rollback. Both are cleared for the two
+     * halves of a move, where the node stays in the tree either way. */
+    int free_on_commit;
+    int free_on_rollback;
+};
+
+struct patch_ctx {
+    json_value **doc;
+    struct undo_entry *log;
+    size_t count;
+    size_t capacity;
+};
+
+static json_value *child_of(json_value *v, const char *token, int mutable);
+static json_value *resolve_parent(json_value *root, const char *path, char *token, int mutable);
+
+/* Formats the message describing why operation op failed */
+static int patch_fail(size_t op, const char *name, const char *reason) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), "json_patch: operation %zu (%s) failed: %s\n", op, name, reason);
+    json_set_last_error(msg);
+    return 0;
+}
+
+/* Appends an entry to the undo log. Returns 1, or 0 on allocation failure */
+static int log_push(struct patch_ctx *ctx, enum undo_kind kind, const char *path, size_t index,
+                    json_value *value) {
+    if (ctx->count == ctx->capacity) {
+        size_t capacity = ctx->capacity ? ctx->capacity * 2 : 16;
+        struct undo_entry *tmp = json_realloc(ctx->log, capacity * sizeof(struct undo_entry));
+        if (!tmp) return 0;
+        ctx->log = tmp;
+        ctx->capacity = capacity;
+    }
+
+    struct undo_entry *e = &ctx->log[ctx->count];
+    e->path = json_malloc(strlen(path) + 1);
+    if (!e->path) return 0;
+    strcpy(e->path, path);
+    e->kind = kind;
+    e->index = index;
+    e->value = value;
+    e->free_on_commit = 1;
+    e->free_on_rollback = 1;
+    ctx->count++;
+    return 1;
+}
+
+/* Drops the newest entry when the change it was recorded for failed */
+static void log_pop(struct patch_ctx *ctx) {
+    json_mfree(ctx->log[--ctx->count].path);
+}
+
+/* Keeps the changes, releasing the values the patch displaced */
+static void log_commit(struct patch_ctx *ctx) {
+    for (size_t i = 0; i < ctx->count; i++) {
+        struct undo_entry *e = &ctx->log[i];
+        if (e->free_on_commit) json_free(e->value);
+        json_mfree(e->path);
+    }
+    json_mfree(ctx->log);
+}
+
+/* Undoes every recorded change, newest first */
+static void log_rollback(struct patch_ctx *ctx) {
+    while (ctx->count > 0) {
+        struct undo_entry *e = &ctx->log[--ctx->count];
+        json_value *v = NULL;
+
+        if (e->kind == UNDO_ROOT) {
+            v = *ctx->doc;
+            *ctx->doc = e->value;
+        } else {
+            char *token = json_malloc(strlen(e->path) + 1);
+            json_value *parent = NULL;
+            if (e->kind == UNDO_ARRAY_INSERTED || e->kind == UNDO_ARRAY_EXCHANGED ||
+                e->kind == UNDO_ARRAY_REMOVED) {
+                /* array entries name the array itself */
+                parent = *ctx->doc;
+                if (token && *e->path) {
+                    parent = resolve_parent(*ctx->doc, e->path, token, 1);
+                    if (parent) parent = child_of(parent, token, 1);
+                }
+            } else if (token) {
+                parent = resolve_parent(*ctx->doc, e->path, token, 1);
+            }
+            if (parent) {
+                switch (e->kind) {
+                    case UNDO_OBJECT_ADDED:
+                        v = json_object_remove(parent, token);
+                        break;
+                    case UNDO_OBJECT_EXCHANGED:
+                        v = json_object_exchange(parent, token, e->value);
+                        break;
+                    case UNDO_OBJECT_REMOVED:
+                        if (json_object_insert_at(parent, e->index, token, e->value)) e->value = NULL;
+                        break;
+                    case UNDO_ARRAY_INSERTED:
+                        v = json_array_remove(parent, e->index);
+                        break;
+                    case UNDO_ARRAY_EXCHANGED:
+                        v = json_array_exchange(parent, e->index, e->value);
+                        break;
+                    case UNDO_ARRAY_REMOVED:
+                        if (json_array_insert(parent, e->index, e->value)) e->value = NULL;
+                        break;
+                    case UNDO_ROOT:
+                        break;
+                }
+            }
+            json_mfree(token);
+        }
+
+        /* v is the value the patch had put in the tree */
+        if (e->free_on_rollback) json_free(v);
+        /* the second half of a move: the remove before it owns the value again */
+        else if (v && ctx->count > 0) ctx->log[ctx->count - 1].free_on_commit = 1;
+        /* a removed value that could not be put back, for lack of memory */
+        if ((e->kind == UNDO_OBJECT_REMOVED || e->kind == UNDO_ARRAY_REMOVED) && e->free_on_commit)
+            json_free(e->value);
+        json_mfree(e->path);
+    }
+    json_mfree(ctx->log);
+}
+
+/* Decodes the reference token starting after the '/' at p into token,
+ * turning ~1 into '/' and ~0 into '~'. Returns a pointer to the next '/'
+ * or to the end of the pointer, NULL for an invalid escape. */
+static const char *pointer_next(const char *p, char *token) {
+    p++;
+    while (*p && *p != '/') {
+        if (*p == '~') {
+            if (p[1] == '0') *token++ = '~';
+            else if (p[1] == '1') *token++ = '/';
+            else return NULL;
+            p += 2;
+        } else {
+            *token++ = *p++;
+        }
+    }
+    *token = '\0';
+    return p;
+}
+
+/* Parses an array index token: "0" or digits without a leading zero.
+ * "-" means one past the last item and is accepted only when allow_end. */
+static int parse_index(const char *token, size_t count, int allow_end, size_t *index) {
+    if (allow_end && strcmp(token, "-") == 0) {
+        *index = count;
+        return 1;
+    }
+    if (!*token || (token[0] == '0' && token[1])) return 0;
+
+    size_t i = 0;
+    for (const char *c = token; *c; c++) {
+        if (*c < '0' || *c > '9') return 0;
+        if (i > (SIZE_MAX - 9) / 10) return 0;
+        i = i * 10 + (size_t)(*c - '0');
+    }
+    *index = i;
+    return 1;
+}
+
+/* Returns the child named by token, prepared for modification if mutable */
+static json_value *child_of(json_value *v, const char *token, int mutable) {
+    size_t index;
+    switch (json_get_type(v)) {
+        case JSON_OBJECT:
+            return mutable ? json_object_get_mut(v, token) : json_object_get(v, token);
+        case JSON_ARRAY:
+            if (!parse_index(token, v->u.array.count, 0, &index)) return NULL;
+            if (index >= v->u.array.count) return NULL;
+            return mutable ? json_array_get_mut(v, index) : json_array_get(v, index);
+    }
+    return NULL;
+}
+
+/* Walks every reference token but the last, which is left in token.
+ * Returns the container the last token applies to, or NULL. */
+static json_value *resolve_parent(json_value *root, const char *path, char *token, int mutable) {
+    json_value *cur = root;
+    const char *p = path;
+
+    for (;;) {
+        const char *next = pointer_next(p, token);
+        if (!next) return NULL;
+        if (!*next) return cur;
+        cur = child_of(cur, token, mutable);
+        if (!cur) return NULL;
+        p = next;
+    }
+}
+
+json_value *json_pointer_get(const json_value *root, const char *pointer) {
+    if (!root || !pointer) return NULL;
+    if (!*pointer) return (json_value *)root;
+    if (*pointer != '/') {
+        json_set_last_error("json_pointer: pointer must be empty or start with '/'\n");
+        return NULL;
+    }
+
+    char *token = json_malloc(strlen(pointer) + 1);
+    if (!token) {
+        json_set_last_error("json_pointer: failed to allocate token buffer\n");
+        return NULL;
+    }
+    json_value *v = NULL;
+    json_value *parent = resolve_parent((json_value *)root, pointer, token, 0);
+    if (parent) v = child_of(parent, token, 0);
+    json_mfree(token);
+
+    if (!v) json_set_last_error("json_pointer: location does not exist\n");
+    return v;
+}
+
+/* Length of the pointer to the container holding the last token */
+static size_t parent_length(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+/* Records an array change under the pointer of the array */
+static int log_push_array(struct patch_ctx *ctx, enum undo_kind kind, const char *path, size_t index,
+                          json_value *value) {
+    size_t len = parent_length(path);
+    char *array_path = json_malloc(len + 1);
+    if (!array_path) return 0;
+    memcpy(array_path, path, len);
+    array_path[len] = '\0';
+    int ok = log_push(ctx, kind, array_path, index, value);
+    json_mfree(array_path);
+    return ok;
+}
+
+/* Puts value (owned by the caller until this succeeds) at path. Existing
+ * object members are replaced, array items are shifted right. */
+static int patch_add(struct patch_ctx *ctx, const char *path, char *token, json_value *value,
+                     const char **reason) {
+    if (!*path) {
+        if (!log_push(ctx, UNDO_ROOT, path, 0, *ctx->doc)) return 0;
+        *ctx->doc = value;
+        return 1;
+    }
+
+    json_value *parent = resolve_parent(*ctx->doc, path, token, 1);
+    if (!parent) {
+        *reason = "path does not exist";
+        return 0;
+    }
+
+    if (json_get_type(parent) == JSON_OBJECT) {
+        if (json_object_get(parent, token)) {
+            if (!log_push(ctx, UNDO_OBJECT_EXCHANGED, path, 0, NULL)) return 0;
+            ctx->log[ctx->count - 1].value = json_object_exchange(parent, token, value);
+            if (!ctx->log[ctx->count - 1].value) {
+                log_pop(ctx);
+                return 0;
+            }
+            return 1;
+        }
+        if (!log_push(ctx, UNDO_OBJECT_ADDED, path, 0, NULL)) return 0;
+        if (!json_object_set(parent, token, value)) {
+            log_pop(ctx);
+            return 0;
+        }
+        return 1;
+    }
+
+    if (json_get_type(parent) == JSON_ARRAY) {
+        size_t index;
+        if (!parse_index(token, parent->u.array.count, 1, &index) || index > parent->u.array.count) {
+            *reason = "invalid array index";
+            return 0;
+        }
+        if (!log_push_array(ctx, UNDO_ARRAY_INSERTED, path, index, NULL)) return 0;
+        if (!json_array_insert(parent, index, value)) {
+            log_pop(ctx);
+            return 0;
+        }
+        return 1;
+    }
+
+    *reason = "parent is not a container";
+    return 0;
+}
+
+/* Removes the value at path; the undo entry keeps it alive until commit */
+static int patch_remove(struct patch_ctx *ctx, const char *path, char *token, const char **reason) {
+    if (!*path) {
+        *reason = "cannot remove the root";
+        return 0;
+    }
+
+    json_value *parent = resolve_parent(*ctx->doc, path, token, 1);
+    if (parent && json_get_type(parent) == JSON_OBJECT && json_object_get(parent, token)) {
+        if (!log_push(ctx, UNDO_OBJECT_REMOVED, path, 0, NULL)) return 0;
+        struct undo_entry *e = &ctx->log[ctx->count - 1];
+        e->value = json_object_detach(parent, token, &e->index);
+        if (!e->value) {
+            log_pop(ctx);
+            return 0;
+        }
+        return 1;
+    }
+
+    size_t index;
+    if (parent && json_get_type(parent) == JSON_ARRAY &&
+        parse_index(token, parent->u.array.count, 0, &index) && index < parent->u.array.count) {
+        if (!log_push_array(ctx, UNDO_ARRAY_REMOVED, path, index, NULL)) return 0;
+        ctx->log[ctx->count - 1].value = json_array_remove(parent, index);
+        if (!ctx->log[ctx->count - 1].value) {
+            log_pop(ctx);
+            return 0;
+        }
+        return 1;
+    }
+
+    *reason = "path does not exist";
+    return 0;
+}
+
+/* Replaces the existing value at path with value */
+static int patch_replace(struct patch_ctx *ctx, const char *path, char *token, json_value *value,
+                         const char **reason) {
+    if (!*path) return patch_add(ctx, path, token, value, reason);
+
+    json_value *parent = resolve_parent(*ctx->doc, path, token, 1);
+    if (parent && json_get_type(parent) == JSON_OBJECT && json_object_get(parent, token))
+        return patch_add(ctx, path, token, value, reason);
+
+    size_t index;
+    if (parent && json_get_type(parent) == JSON_ARRAY &&
+        parse_index(token, parent->u.array.count, 0, &index) && index < parent->u.array.count) {
+        if (!log_push_array(ctx, UNDO_ARRAY_EXCHANGED, path, index, NULL)) return 0;
+        ctx->log[ctx->count - 1].value = json_array_exchange(parent, index, value);
+        if (!ctx->log[ctx->count - 1].value) {
+            log_pop(ctx);
+            return 0;
+        }
+        return 1;
+    }
+
+    *reason = "path does not exist";
+    return 0;
+}
+
+/* Member of an operation object that must be a string */
+static const char *op_string(const json_value *op, const char *key) {
+    json_value *v = json_object_get(op, key);
+    if (!v || json_get_type(v) != JSON_STRING) return NULL;
+    return v->u.string;
+}
+
+/* Applies one operation; returns 1 on success */
+static int apply_operation(struct patch_ctx *ctx, const json_value *op, size_t n) {
+    if (json_get_type(op) != JSON_OBJECT)
+        return patch_fail(n, "?", "operation is not an object");
+
+    const char *name = op_string(op, "op");
+    const char *path = op_string(op, "path");
+    if (!name) return patch_fail(n, "?", "missing \"op\"");
+    if (!path) return patch_fail(n, name, "missing \"path\"");
+    if (*path && *path != '/') return patch_fail(n, name, "path must start with '/'");
+
+    const char *from = NULL;
+    if (strcmp(name, "move") == 0 || strcmp(name, "copy") == 0) {
+        from = op_string(op, "from");
+        if (!from) return patch_fail(n, name, "missing \"from\"");
+        if (*from && *from != '/') return patch_fail(n, name, "from must start with '/'");
+    }
+
+    json_value *operand = json_object_get(op, "value");
+    int needs_value = strcmp(name, "add") == 0 || strcmp(name, "replace") == 0 || strcmp(name, "test") == 0;
+    if (needs_value && !operand) return patch_fail(n, name, "missing \"value\"");
+
+    size_t token_len = strlen(path) + (from ? strlen(from) : 0) + 1;
+    char *token = json_malloc(token_len);
+    if (!token) return patch_fail(n, name, "out of memory");
+
+    const char *reason = "out of memory";
+    int ok = 0;
+
+    if (strcmp(name, "add") == 0 || strcmp(name, "replace") == 0) {
+        json_value *value = json_clone(operand);
+        if (value) {
+            ok = name[0] == 'a' ? patch_add(ctx, path, token, value, &reason)
+                                : patch_replace(ctx, path, token, value, &reason);
+            if (!ok) json_free(value);
+        }
+    } else if (strcmp(name, "remove") == 0) {
+        ok = patch_remove(ctx, path, token, &reason);
+    } else if (strcmp(name, "move") == 0) {
+        size_t from_len = strlen(from);
+        if (strcmp(from, path) == 0) {
+            ok = json_pointer_get(*ctx->doc, from) != NULL;
+            reason = "from does not exist";
+        } else if (strncmp(from, path, from_len) == 0 && path[from_len] == '/') {
+            reason = "cannot move a value into one of its children";
+        } else if (patch_remove(ctx, from, token, &reason)) {
+            /* the node changes place: neither half of the move owns it */
+            size_t removed = ctx->count - 1;
+            if (patch_add(ctx, path, token, ctx->log[removed].value, &reason)) {
+                ctx->log[removed].free_on_commit = 0;
+                ctx->log[ctx->count - 1].free_on_rollback = 0;
+                ok = 1;
+            }
+        }
+    } else if (strcmp(name, "copy") == 0) {
+        json_value *source = json_pointer_get(*ctx->doc, from);
+        json_value *value = source ? json_clone(source) : NULL;
+        if (!source) reason = "from does not exist";
+        if (value) {
+            ok = patch_add(ctx, path, token, value, &reason);
+            if (!ok) json_free(value);
+        }
+    } else if (strcmp(name, "test") == 0) {
+        json_value *target = json_pointer_get(*ctx->doc, path);
+        ok = target && json_equal(target, operand);
+        reason = target ? "values differ" : "path does not exist";
+    } else {
+        reason = "unknown operation";
+    }
+
+    json_mfree(token);
+    return ok ? 1 : patch_fail(n, name, reason);
+}
+
+int json_patch_apply(json_value **doc, const json_value *patch) {
+    if (!doc || !*doc || !patch) {
+        json_set_last_error("json_patch: NULL document or patch\n");
+        return 0;
+    }
+    if (json_get_type(patch) != JSON_ARRAY) {
+        json_set_last_error("json_patch: patch must be an array of operations\n");
+        return 0;
+    }
+
+    struct patch_ctx ctx = {doc, NULL, 0, 0};
+    for (size_t i = 0; i < patch->u.array.count; i++) {
+        if (!apply_operation(&ctx, json_array_get(patch, i), i)) {
+            log_rollback(&ctx);
+            return 0;
+        }
+    }
+    log_commit(&ctx);
+    return 1;
+}
+
+/* Growable JSON Pointer used to name the members visited by a merge */
+struct pointer_buf {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+/* Appends "/" and key, escaping '~' and '/' */
+static int pointer_push(struct pointer_buf *p, const char *key) {
+    size_t need = p->len + 2 * strlen(key) + 2;
+    if (need > p->capacity) {
+        size_t capacity = p->capacity ? p->capacity : 64;
+        while (capacity < need) capacity *= 2;
+        char *tmp = json_realloc(p->data, capacity);
+        if (!tmp) return 0;
+        p->data = tmp;
+        p->capacity = capacity;
+    }
+    p->data[p->len++] = '/';
+    for (const char *c = key; *c; c++) {
+        if (*c == '~' || *c == '/') {
+            p->data[p->len++] = '~';
+            p->data[p->len++] = *c == '~' ? '0' : '1';
+        } else {
+            p->data[p->len++] = *c;
+        }
+    }
+    p->data[p->len] = '\0';
+    return 1;
+}
+
+/* Merges patch (an object) into target (an object that may be modified).
+ * ctx is NULL while filling a freshly created object, which nothing else
+ * references yet and therefore needs no undo entries. */
+static int merge_object(struct patch_ctx *ctx, struct pointer_buf *path, json_value *target,
+                        const json_value *patch) {
+    json_object_iter it = json_object_iter_begin(patch);
+    for (const json_member *m; (m = json_object_iter_next(&it));) {
+        const char *key = m->key;
+        const json_value *pv = m->value;
+        json_value *current = json_object_get(target, key);
+        size_t mark = path ? path->len : 0;
+        if (ctx && !pointer_push(path, key)) return 0;
+
+        if (json_get_type(pv) == JSON_NULL) {
+            if (current && !ctx) {
+                json_free(json_object_remove(target, key));
+            } else if (current) {
+                if (!log_push(ctx, UNDO_OBJECT_REMOVED, path->data, 0, NULL)) return 0;
+                struct undo_entry *e = &ctx->log[ctx->count - 1];
+                e->value = json_object_detach(target, key, &e->index);
+                if (!e->value) {
+                    log_pop(ctx);
+                    return 0;
+                }
+            }
+        } else if (json_get_type(pv) == JSON_OBJECT && current && json_get_type(current) == JSON_OBJECT) {
+            json_value *child = ctx ? json_object_get_mut(target, key) : current;
+            if (!child || !merge_object(ctx, path, child, pv)) return 0;
+        } else {
+            json_value *value;
+            if (json_get_type(pv) == JSON_OBJECT) {
+                value = json_new_object();
+                if (value && !merge_object(NULL, NULL, value, pv)) {
+                    json_free(value);
+                    value = NULL;
+                }
+            } else {
+                value = json_clone(pv);
+            }
+            if (!value) return 0;
+
+            int ok;
+            if (!ctx) {
+                json_value *old = current ? json_object_exchange(target, key, value) : NULL;
+                ok = current ? old != NULL : json_object_set(target, key, value);
+                json_free(old);
+            } else if (current) {
+                ok = log_push(ctx, UNDO_OBJECT_EXCHANGED, path->data, 0, NULL);
+                if (ok) {
+                    ctx->log[ctx->count - 1].value = json_object_exchange(target, key, value);
+                    ok = ctx->log[ctx->count - 1].value != NULL;
+                    if (!ok) log_pop(ctx);
+                }
+            } else {
+                ok = log_push(ctx, UNDO_OBJECT_ADDED, path->data, 0, NULL);
+                if (ok && !json_object_set(target, key, value)) {
+                    log_pop(ctx);
+                    ok = 0;
+                }
+            }
+            if (!ok) {
+                json_free(value);
+                return 0;
+            }
+        }
+
+        if (ctx) {
+            path->len = mark;
+            path->data[mark] = '\0';
+        }
+    }
+    return 1;
+}
+
+int json_merge_patch(json_value **doc, const json_value *patch) {
+    if (!doc || !*doc || !patch) {
+        json_set_last_error("json_merge_patch: NULL document or patch\n");
+        return 0;
+    }
+
+    /* anything but an object replaces the whole document */
+    if (json_get_type(patch) != JSON_OBJECT || json_get_type(*doc) != JSON_OBJECT) {
+        json_value *value;
+        if (json_get_type(patch) == JSON_OBJECT) {
+            value = json_new_object();
+            if (value && !merge_object(NULL, NULL, value, patch)) {
+                json_free(value);
+                value = NULL;
+            }
+        } else {
+            value = json_clone(patch);
+        }
+        if (!value) {
+            json_set_last_error("json_merge_patch: out of memory\n");
+            return 0;
+        }
+        json_free(*doc);
+        *doc = value;
+        return 1;
+    }
+
+    struct patch_ctx ctx = {doc, NULL, 0, 0};
+    struct pointer_buf path = {NULL, 0, 0};
+    int ok = merge_object(&ctx, &path, *doc, patch);
+    json_mfree(path.data);
+    if (!ok) {
+        log_rollback(&ctx);
+        json_set_last_error("json_merge_patch: out of memory\n");
+        return 0;
+    }
+    log_commit(&ctx);
+    return 1;
+}
+
+/* Arrays whose differing middle part needs a longest common subsequence
+ * table larger than this many cells are compared item by item instead */
+#define DIFF_LCS_LIMIT ((size_t)1 << 20)
+
+struct diff_ctx {
+    json_value *ops;
+    struct pointer_buf path;
+};
+
+static int diff_value(struct diff_ctx *d, const json_value *a, const json_value *b);
+
+/* Sets a member of an operation, releasing value if that fails */
+static int diff_member(json_value *op, const char *key, json_value *value) {
+    if (value && json_object_set(op, key, value)) return 1;
+    json_free(value);
+    return 0;
+}
+
+/* Appends {"op", "path"[, "value"]} for the current path. The value is
+ * shared with the target document through json_clone. */
+static int diff_emit(struct diff_ctx *d, const char *name, const json_value *value) {
+    json_value *op = json_new_object();
+    if (!op) return 0;
+    if (!diff_member(op, "op", json_new_string(name)) ||
+        !diff_member(op, "path", json_new_string(d->path.len ? d->path.data : "")) ||
+        (value && !diff_member(op, "value", json_clone(value))) ||
+        !json_array_append(d->ops, op)) {
+        json_free(op);
+        return 0;
+    }
+    return 1;
+}
+
+static void pointer_pop(struct pointer_buf *p, size_t mark) {
+    p->len = mark;
+    if (p->data) p->data[mark] = '\0';
+}
+
+static int pointer_push_index(struct pointer_buf *p, size_t index) {
+    char token[32];
+    snprintf(token, sizeof(token), "%zu", index);
+    return pointer_push(p, token);
+}
+
+/* Emits the operations turning the p items of a starting at ai into the q
+ * items of b starting at bj, the first of them currently at *pos: items
+ * paired up are diffed in place, the rest removed or added */
+static int diff_gap(struct diff_ctx *d, const json_value *a, size_t ai, size_t p,
+                    const json_value *b, size_t bj, size_t q, size_t *pos) {
+    size_t mark = d->path.len;
+    size_t common = p < q ? p : q;
+    int ok = 1;
+    json_value **a_items = json_array_items(a), **b_items = json_array_items(b);
+
+    for (size_t k = 0; ok && k < common; k++) {
+        ok = pointer_push_index(&d->path, (*pos)++) &&
+             diff_value(d, a_items[ai + k], b_items[bj + k]);
+        pointer_pop(&d->path, mark);
+    }
+    for (size_t k = common; ok && k < p; k++) {
+        ok = pointer_push_index(&d->path, *pos) && diff_emit(d, "remove", NULL);
+        pointer_pop(&d->path, mark);
+    }
+    for (size_t k = common; ok && k < q; k++) {
+        ok = pointer_push_index(&d->path, (*pos)++) && diff_emit(d, "add", b_items[bj + k]);
+        pointer_pop(&d->path, mark);
+    }
+    return ok;
+}
+
+/* Items are matched by hash: the common prefix and suffix are skipped, the
+ * rest is aligned on its longest common subsequence when that is affordable */
+static int diff_array(struct diff_ctx *d, const json_value *a, const json_value *b) {
+    json_value **ai = json_array_items(a), **bi = json_array_items(b);
+    size_t n = a->u.array.count, m = b->u.array.count;
+    if ((n && !ai) || (m && !bi)) return 0;
+
+    size_t pre = 0;
+    while (pre < n && pre < m && json_hash(ai[pre]) == json_hash(bi[pre])) pre++;
+    size_t suf = 0;
+    while (suf < n - pre && suf < m - pre && json_hash(ai[n - 1 - suf]) == json_hash(bi[m - 1 - suf])) suf++;
+
+    size_t an = n - pre - suf, bn = m - pre - suf;
+    size_t pos = pre;
+    uint32_t *lcs = NULL;
+    if (an && bn && an < DIFF_LCS_LIMIT && bn < DIFF_LCS_LIMIT && (an + 1) * (bn + 1) <= DIFF_LCS_LIMIT)
+        lcs = json_malloc((an + 1) * (bn + 1) * sizeof(uint32_t));
+    if (!lcs) return diff_gap(d, a, pre, an, b, pre, bn, &pos);
+
+    /* lcs[i][j]: length of the common subsequence of the suffixes a[i..], b[j..] */
+    size_t w = bn + 1;
+    for (size_t i = an + 1; i-- > 0;) {
+        for (size_t j = bn + 1; j-- > 0;) {
+            if (i == an || j == bn)
+                lcs[i * w + j] = 0;
+            else if (json_hash(ai[pre + i]) == json_hash(bi[pre + j]))
+                lcs[i * w + j] = lcs[(i + 1) * w + j + 1] + 1;
+            else
+                lcs[i * w + j] = lcs[(i + 1) * w + j] > lcs[i * w + j + 1] ? lcs[(i + 1) * w + j] : lcs[i * w + j + 1];
+        }
+    }
+
+    size_t i = 0, j = 0, gi = 0, gj = 0;
+    int ok = 1;
+    while (ok && (i < an || j < bn)) {
+        if (i < an && j < bn && json_hash(ai[pre + i]) == json_hash(bi[pre + j]) &&
+            lcs[i * w + j] == lcs[(i + 1) * w + j + 1] + 1) {
+            ok = diff_gap(d, a, pre + gi, i - gi, b, pre + gj, j - gj, &pos);
+            pos++;
+            gi = ++i;
+            gj = ++j;
+        } else if (j < bn && (i == an || lcs[i * w + j + 1] >= lcs[(i + 1) * w + j])) {
+            j++;
+        } else {
+            i++;
+        }
+    }
+    if (ok) ok = diff_gap(d, a, pre + gi, an - gi, b, pre + gj, bn - gj, &pos);
+    json_mfree(lcs);
+    return ok;
+}
+
+static int diff_object(struct diff_ctx *d, const json_value *a, const json_value *b) {
+    size_t mark = d->path.len;
+    size_t cursor = 0;
+    int ok = 1;
+
+    json_object_iter it = json_object_iter_begin(a);
+    for (const json_member *m; ok && (m = json_object_iter_next(&it));) {
+        long j = json_object_find_from(b, m->key, &cursor);
+        ok = pointer_push(&d->path, m->key) &&
+             (j < 0 ? diff_emit(d, "remove", NULL) : diff_value(d, m->value, b->u.object.members[j].value));
+        pointer_pop(&d->path, mark);
+    }
+    cursor = 0;
+    it = json_object_iter_begin(b);
+    for (const json_member *m; ok && (m = json_object_iter_next(&it));) {
+        if (json_object_find_from(a, m->key, &cursor) >= 0) continue;
+        ok = pointer_push(&d->path, m->key) && diff_emit(d, "add", m->value);
+        pointer_pop(&d->path, mark);
+    }
+    return ok;
+}
+
+/* Subtrees with the same hash are taken as equal and never entered */
+static int diff_value(struct diff_ctx *d, const json_value *a, const json_value *b) {
+    if (a == b || json_hash(a) == json_hash(b)) return 1;
+    if (json_get_type(a) == JSON_OBJECT && json_get_type(b) == JSON_OBJECT) return diff_object(d, a, b);
+    if (json_get_type(a) == JSON_ARRAY && json_get_type(b) == JSON_ARRAY) return diff_array(d, a, b);
+    return diff_emit(d, "replace", b);
+}
+
+json_value *json_diff(const json_value *from, const json_value *to) {
+    if (!from || !to) {
+        json_set_last_error("json_diff: NULL document\n");
+        return NULL;
+    }
+    struct diff_ctx d = {json_new_array(), {NULL, 0, 0}};
+    if (!d.ops) {
+        json_set_last_error("json_diff: out of memory\n");
+        return NULL;
+    }
+    int ok = diff_value(&d, from, to);
+    json_mfree(d.path.data);
+    if (!ok) {
+        json_free(d.ops);
+        json_set_last_error("json_diff: out of memory\n");
+        return NULL;
+    }
+    return d.ops;
+}
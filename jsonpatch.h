@@ -0,0 +1,49 @@
+#ifndef JSONPATCH_H
+#define JSONPATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/*====================JSON POINTER (RFC 6901)=============*/
+
+/* Returns the value the pointer refers to ("" is the whole document,
+ * "/a/0" the first item of member a), or NULL if it does not exist */
+json_value *json_pointer_get(const json_value *root, const char *pointer);
+
+/*====================PATCHING============================*/
+
+/* Applies an RFC 6902 JSON Patch, an array of add/remove/replace/move/copy/
+ * test operations, to *doc in place. Only the locations named by the patch
+ * are visited, so the cost depends on the patch rather than the document.
+ *
+ * Values taken from the patch are shared with it through json_clone, the
+ * patch itself is never modified.
+ *
+ * Returns 1 on success. On failure every operation already applied is rolled
+ * back, *doc is left as it was and json_get_last_error() names the failing
+ * operation. *doc is replaced when an operation targets the root. */
+int json_patch_apply(json_value **doc, const json_value *patch);
+
+/* Applies an RFC 7386 JSON Merge Patch to *doc, with the same sharing and
+ * rollback guarantees as json_patch_apply. */
+int json_merge_patch(json_value **doc, const json_value *patch);
+
+/*====================DIFF================================*/
+
+/* Returns the JSON Patch turning from into to, an empty array when they are
+ * equal. Subtrees whose json_hash matches are skipped without being
+ * visited. Hashes stay cached in the nodes, so a document diffed again and
+ * again (a running configuration) is hashed only once. Array items are
+ * aligned on their longest common subsequence so insertions and removals
+ * produce add/remove operations instead of a replace per shifted item.
+ * Values in the patch are shared with to. Returns NULL on failure. */
+json_value *json_diff(const json_value *from, const json_value *to);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONPATCH_H */
@@ -0,0 +1,430 @@
+#include "jsonproject.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+/* The paths of a projection form a tree, one node per reference token.
+ * A leaf keeps the whole value it names; an inner node keeps only the
+ * members named by its children, found through a small open-addressing
+ * table since every key of the document is looked up. */
+struct projection_node {
+    char *name;
+    size_t len;
+    int leaf;
+    struct projection_node *children;
+    size_t count;
+    size_t capacity;
+    uint32_t *index;    /* child position + 1, 0 for an empty slot */
+    size_t index_mask;
+};
+
+#define NAME_HASH_SEED 2166136261u
+
+static inline uint32_t name_hash_step(uint32_t h, char c) {
+    return (h ^ (unsigned char)c) * 16777619u;
+}
+
+static uint32_t name_hash(const char *name, size_t len) {
+    uint32_t h = NAME_HASH_SEED;
+    for (size_t i = 0; i < len; i++) h = name_hash_step(h, name[i]);
+    return h;
+}
+
+struct json_projection {
+    struct projection_node root;
+};
+
+static void node_clear(struct projection_node *node) {
+    for (size_t i = 0; i < node->count; i++) {
+        node_clear(&node->children[i]);
+        json_mfree(node->children[i].name);
+    }
+    json_mfree(node->children);
+    json_mfree(node->index);
+    node->children = NULL;
+    node->index = NULL;
+    node->count = node->capacity = 0;
+}
+
+/* Builds the lookup tables once all paths are in */
+static int node_index(struct projection_node *node) {
+    if (!node->count) return 1;
+
+    size_t size = 4;
+    while (size < node->count * 2) size *= 2;
+    node->index = json_calloc(size, sizeof(uint32_t));
+    if (!node->index) return 0;
+    node->index_mask = size - 1;
+
+    for (size_t i = 0; i < node->count; i++) {
+        size_t slot = name_hash(node->children[i].name, node->children[i].len) & node->index_mask;
+        while (node->index[slot]) slot = (slot + 1) & node->index_mask;
+        node->index[slot] = (uint32_t)(i + 1);
+        if (!node_index(&node->children[i])) return 0;
+    }
+    return 1;
+}
+
+/* Returns the child of node named token, adding it if needed */
+static struct projection_node *node_child(struct projection_node *node, const char *token, size_t len) {
+    for (size_t i = 0; i < node->count; i++) {
+        if (node->children[i].len == len && memcmp(node->children[i].name, token, len) == 0)
+            return &node->children[i];
+    }
+    if (node->count == node->capacity) {
+        size_t capacity = node->capacity ? node->capacity * 2 : 4;
+        struct projection_node *children = json_realloc(node->children, capacity * sizeof(*children));
+        if (!children) return NULL;
+        node->children = children;
+        node->capacity = capacity;
+    }
+    char *name = json_malloc(len + 1);
+    if (!name) return NULL;
+    memcpy(name, token, len);
+    name[len] = '\0';
+
+    struct projection_node *child = &node->children[node->count++];
+    memset(child, 0, sizeof(*child));
+    child->name = name;
+    child->len = len;
+    return child;
+}
+
+/* Adds one JSON Pointer to the tree, token being scratch space as long as
+ * the pointer */
+static int projection_add(struct json_projection *projection, const char *path, char *token) {
+    struct projection_node *node = &projection->root;
+
+    if (*path && *path != '/') {
+        json_set_last_error("json_projection_new: path must be empty or start with '/'\n");
+        return 0;
+    }
+    while (*path && !node->leaf) {
+        size_t len = 0;
+        for (path++; *path && *path != '/'; path++) {
+            if (*path == '~') {
+                if (path[1] != '0' && path[1] != '1') {
+                    json_set_last_error("json_projection_new: invalid escape in path\n");
+                    return 0;
+                }
+                token[len++] = path[1] == '0' ? '~' : '/';
+                path++;
+            } else {
+                token[len++] = *path;
+            }
+        }
+        node = node_child(node, token, len);
+        if (!node) {
+            json_set_last_error("json_projection_new: failed to allocate path\n");
+            return 0;
+        }
+    }
+    /* a shorter path keeps everything the longer ones would */
+    node->leaf = 1;
+    node_clear(node);
+    return 1;
+}
+
+json_projection *json_projection_new(const char *const *paths, size_t count) {
+    json_projection *projection = json_calloc(1, sizeof(*projection));
+    if (!projection) {
+        json_set_last_error("json_projection_new: failed to allocate projection\n");
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char *token = paths[i] ? json_malloc(strlen(paths[i]) + 1) : NULL;
+        int ok = token && projection_add(projection, paths[i], token);
+        if (!paths[i]) json_set_last_error("json_projection_new: NULL path\n");
+        else if (!token) json_set_last_error("json_projection_new: failed to allocate path\n");
+        json_mfree(token);
+        if (!ok) {
+            json_projection_free(projection);
+            return NULL;
+        }
+    }
+    if (!node_index(&projection->root)) {
+        json_set_last_error("json_projection_new: failed to allocate projection\n");
+        json_projection_free(projection);
+        return NULL;
+    }
+    return projection;
+}
+
+void json_projection_free(json_projection *projection) {
+    if (!projection) return;
+    node_clear(&projection->root);
+    json_mfree(projection);
+}
+
+/*====================PARSING=============================*/
+
+struct project_ctx {
+    const char *end;
+    const char *error;  /* static description of the first error */
+    const char *at;     /* where it was found */
+    size_t depth;       /* containers open around the current value */
+    json_error_code code;
+};
+
+static const char *fail(struct project_ctx *c, const char *at, const char *error) {
+    c->error = error;
+    c->at = at;
+    c->code = JSON_ERROR_SYNTAX;
+    return NULL;
+}
+
+static const char *fail_memory(struct project_ctx *c, const char *at, const char *error) {
+    fail(c, at, error);
+    c->code = JSON_ERROR_OUT_OF_MEMORY;
+    return NULL;
+}
+
+/* Returns the child of node named by the raw key [raw, raw_end), or NULL.
+ * Under a leaf every member is kept. */
+static const struct projection_node *find_child(const struct projection_node *node, const char *raw,
+                                                const char *raw_end) {
+    if (node->leaf) return node;
+    if (!node->count) return NULL;
+
+    size_t len = (size_t)(raw_end - raw);
+    uint32_t h = NAME_HASH_SEED;
+    for (size_t i = 0; i < len; i++) {
+        if (raw[i] == '\\') {
+            /* rare enough to compare with every child */
+            for (size_t j = 0; j < node->count; j++) {
+                const struct projection_node *child = &node->children[j];
+                if (json_scan_key_equals(raw, raw_end, child->name, child->len)) return child;
+            }
+            return NULL;
+        }
+        h = name_hash_step(h, raw[i]);
+    }
+    for (size_t slot = h & node->index_mask; node->index[slot]; slot = (slot + 1) & node->index_mask) {
+        const struct projection_node *child = &node->children[node->index[slot] - 1];
+        if (child->len == len && memcmp(child->name, raw, len) == 0) return child;
+    }
+    return NULL;
+}
+
+/* Decodes the raw body of a string into a NUL-terminated buffer, which is
+ * never longer than the raw text. Returns the decoded length. */
+static size_t unescape(const char *raw, const char *raw_end, char *out) {
+    size_t len = json_scan_decode(raw, raw_end, out);
+    out[len] = '\0';
+    return len;
+}
+
+/* Steps over the value at p, checking it against the grammar without
+ * building anything. Returns a pointer past it. */
+static const char *skip_value(struct project_ctx *c, const char *p) {
+    size_t depth;
+    const char *error = NULL;
+    const char *end = json_scan_value(p, c->end, &depth, &error);
+    if (error) return fail(c, end, error);
+    if (c->depth + depth > JSON_MAX_DEPTH) return fail(c, p, "Maximum nesting depth exceeded");
+    return end;
+}
+
+static const char *project_value(struct project_ctx *c, const char *p, const struct projection_node *node,
+                                 json_value **out);
+
+/* Adds the member whose raw key is [key, key_end). A repeated key keeps
+ * its first value, as with json_parse. */
+static int add_member(json_value *object, struct json_key_index *index, const char *key, const char *key_end,
+                      json_value *value) {
+    char *name = json_malloc((size_t)(key_end - key) + 1);
+    if (!name) return 0;
+    size_t len = unescape(key, key_end, name);
+    int ok = json_object_add_member(object, index, name, len, value, JSON_DUPLICATE_KEEP_FIRST);
+    json_mfree(name);
+    return ok;
+}
+
+/* Builds the string, number or literal at p */
+static const char *build_scalar(struct project_ctx *c, const char *p, json_value **out) {
+    const char *end = c->end;
+    const char *error = NULL;
+    const char *start = p;
+
+    if (p == end) return fail(c, p, "Unexpected end of input");
+    if (*p == '"') {
+        p = json_scan_string_with(p + 1, end, &error, json_scan_string_plain_kernel);
+        if (error) return fail(c, p, error);
+
+        /* short strings are decoded on the stack, json_new_string copies them */
+        char small[256];
+        size_t len = (size_t)(p - start) - 2;
+        char *text = len < sizeof(small) ? small : json_malloc(len + 1);
+        if (!text) return fail_memory(c, start, "Failed to allocate string");
+        unescape(start + 1, p - 1, text);
+        *out = json_new_string(text);
+        if (text != small) json_mfree(text);
+    } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        p = json_scan_number(p, end, &error);
+        if (error) return fail(c, p, error);
+
+        /* the input may end right after the number, without a NUL */
+        char digits[64];
+        size_t len = (size_t)(p - start);
+        char *text = len < sizeof(digits) ? digits : json_malloc(len + 1);
+        if (!text) return fail_memory(c, start, "Failed to allocate number");
+        memcpy(text, start, len);
+        text[len] = '\0';
+        *out = json_new_number(strtod(text, NULL));
+        if (text != digits) json_mfree(text);
+    } else {
+        size_t n = json_scan_literal(p, end);
+        if (!n) {
+            int scalar = json_grammar_classes[(unsigned char)*p] == JSON_CLASS_SCALAR;
+            return fail(c, p, scalar ? "Unexpected character" : "Expected a value");
+        }
+        p += n;
+        *out = *start == 'n' ? json_new_null() : json_new_boolean(*start == 't');
+    }
+    if (!*out) return fail_memory(c, start, "Failed to allocate value");
+    return p;
+}
+
+static const char *project_object(struct project_ctx *c, const char *p, const struct projection_node *node,
+                                  json_value **out) {
+    const char *end = c->end;
+    json_value *object = json_new_object();
+    if (!object) return fail_memory(c, p, "Failed to allocate object");
+    struct json_key_index index = JSON_KEY_INDEX_INIT;
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == '}') {
+        *out = object;
+        return p + 1;
+    }
+
+    for (;;) {
+        if (p == end || *p != '"') {
+            fail(c, p, p == end ? "Unexpected end of input" : "Expected a string key");
+            break;
+        }
+        const char *key = p + 1;
+        const char *error = NULL;
+        p = json_scan_string(key, end, &error);
+        if (error) {
+            fail(c, p, error);
+            break;
+        }
+        const char *key_end = p - 1;
+
+        p = json_skip_whitespace(p, end);
+        if (p == end || *p != ':') {
+            fail(c, p, p == end ? "Unexpected end of input" : "Expected ':' after key");
+            break;
+        }
+        p = json_skip_whitespace(p + 1, end);
+
+        const struct projection_node *child = find_child(node, key, key_end);
+        json_value *value = NULL;
+        p = child ? project_value(c, p, child, &value) : skip_value(c, p);
+        if (!p) break;
+        if (value && !add_member(object, &index, key, key_end, value)) {
+            json_free(value);
+            fail_memory(c, key, "Failed to allocate member");
+            break;
+        }
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == '}') {
+            json_key_index_free(&index);
+            *out = object;
+            return p + 1;
+        } else {
+            fail(c, p, p == end ? "Unexpected end of input" : "Expected ',' or '}'");
+            break;
+        }
+    }
+    json_key_index_free(&index);
+    json_free(object);
+    return NULL;
+}
+
+/* Every item of an array is projected with the node that reached it */
+static const char *project_array(struct project_ctx *c, const char *p, const struct projection_node *node,
+                                 json_value **out) {
+    const char *end = c->end;
+    json_value *array = json_new_array();
+    if (!array) return fail_memory(c, p, "Failed to allocate array");
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == ']') {
+        *out = array;
+        return p + 1;
+    }
+
+    for (;;) {
+        json_value *item = NULL;
+        p = project_value(c, p, node, &item);
+        if (!p) break;
+        if (item && !json_array_append(array, item)) {
+            json_free(item);
+            fail_memory(c, p, "Failed to allocate item");
+            break;
+        }
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == ']') {
+            *out = array;
+            return p + 1;
+        } else {
+            fail(c, p, p == end ? "Unexpected end of input" : "Expected ',' or ']'");
+            break;
+        }
+    }
+    json_free(array);
+    return NULL;
+}
+
+/* Projects the value at p on the children of node, or builds all of it
+ * below a leaf. Elsewhere *out is left NULL for a scalar: nothing in it
+ * can be selected. */
+static const char *project_value(struct project_ctx *c, const char *p, const struct projection_node *node,
+                                 json_value **out) {
+    *out = NULL;
+    p = json_skip_whitespace(p, c->end);
+    if (p == c->end || (*p != '{' && *p != '['))
+        return node->leaf ? build_scalar(c, p, out) : skip_value(c, p);
+
+    if (c->depth == JSON_MAX_DEPTH) return fail(c, p, "Maximum nesting depth exceeded");
+    c->depth++;
+    p = *p == '{' ? project_object(c, p, node, out) : project_array(c, p, node, out);
+    c->depth--;
+    return p;
+}
+
+json_value *json_parse_projected(const char *json_text, const json_projection *projection) {
+    if (!json_text || !projection) {
+        json_set_last_error("json_parse_projected: NULL argument\n");
+        return NULL;
+    }
+    return json_parse_projected_n(json_text, strlen(json_text), projection);
+}
+
+json_value *json_parse_projected_n(const char *json_text, size_t len, const json_projection *projection) {
+    if (!json_text || !projection) {
+        json_set_last_error("json_parse_projected: NULL argument\n");
+        return NULL;
+    }
+    struct project_ctx c = {json_text + len, NULL, NULL, 0, JSON_ERROR_NONE};
+    json_value *v = NULL;
+    const char *p = project_value(&c, json_text, &projection->root, &v);
+    if (p) {
+        p = json_skip_whitespace(p, c.end);
+        if (p != c.end) p = fail(&c, p, "Unexpected data after the document");
+        else if (!v) p = fail(&c, json_text, "The document is not an object or an array");
+    }
+    if (!p) {
+        json_set_error(c.code, (size_t)(c.at - json_text), c.error);
+        json_free(v);
+        return NULL;
+    }
+    return v;
+}
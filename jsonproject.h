@@ -0,0 +1,46 @@
+#ifndef JSONPROJECT_H
+#define JSONPROJECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/* Projection parsing: building only the members a caller asks for.
+ *
+ * A projection is a set of JSON Pointers (RFC 6901) compiled once and
+ * applied to any number of documents. Members outside of it are checked
+ * and skipped in place, without allocating, copying strings or converting
+ * numbers, so memory and time per document follow the size of the
+ * projection rather than the size of the document.
+ *
+ * "/user/id" keeps member id of member user. Segments always name object
+ * members: a path that reaches an array applies to each of its items, so
+ * "/items/sku" on {"items":[{"sku":1,"qty":2},{"qty":3},7]} gives
+ * {"items":[{"sku":1},{}]}. Items that are not objects or arrays are
+ * dropped, as are members that are not containers but would need to be
+ * for the rest of a path. A path that is a prefix of another one wins:
+ * "/user" keeps the whole member, and "" the whole document. A repeated
+ * key keeps its first value, as with json_parse. */
+
+typedef struct json_projection json_projection;
+
+/* Compiles count paths; returns NULL if one of them is not a valid JSON
+ * Pointer */
+json_projection *json_projection_new(const char *const *paths, size_t count);
+void json_projection_free(json_projection *projection);
+
+/* Parses json_text keeping only what projection selects. The whole text is
+ * still checked: NULL is returned if any part of it is invalid JSON, or if
+ * the document is a scalar and the projection does not hold "". */
+json_value *json_parse_projected(const char *json_text, const json_projection *projection);
+
+/* Same for the len bytes at json_text, which need not end with a NUL */
+json_value *json_parse_projected_n(const char *json_text, size_t len, const json_projection *projection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONPROJECT_H */
@@ -0,0 +1,222 @@
+#include "jsonpublish.h"
+#include "jsoninternal.h"
+
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PUBLISH_SPINS 64    /* yields before sleeping in json_published_synchronize */
+
+/* A replaced version, freed once every reader is outside sections begun
+ * before epoch */
+struct retired {
+    json_value *doc;
+    uint64_t epoch;
+    struct retired *next;
+};
+
+/* Versions are numbered by epochs. Publishing stores the new version, then
+ * the next epoch. A reader records the epoch it sees before it loads the
+ * version, so a reader recording an older epoch than a replacement's may
+ * hold what it replaced; one recording that epoch or a later one cannot. */
+struct json_published {
+    json_value *current;
+    uint64_t epoch;              /* from 1 on: 0 marks a reader outside a section */
+    int fence;                   /* readers fence their own stores */
+    pthread_mutex_t lock;        /* writers; guards the fields below */
+    json_reader *readers;
+    struct retired *retired;
+    size_t pending;
+};
+
+struct json_reader {
+    json_published *published;
+    json_reader *next;
+    /* epoch is written by its thread on every section and read by writers:
+     * the padding keeps it off the cache lines of other readers */
+    char before[64];
+    uint64_t epoch;
+    char after[64 - sizeof(uint64_t)];
+};
+
+/*====================BARRIERS============================*/
+
+static int expedited;
+static pthread_once_t expedited_once = PTHREAD_ONCE_INIT;
+
+/* Registers the process for expedited membarrier, through which the
+ * writer orders the stores of every reader thread for them */
+static void expedited_init(void) {
+#ifdef __NR_membarrier
+    long commands = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    expedited = commands > 0 && (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+                syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#endif
+}
+
+/* Between publishing a version and reading the epochs of the readers: a
+ * full barrier on this thread and, without reader fences, on all of them */
+static void writer_barrier(const json_published *p) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#ifdef __NR_membarrier
+    if (!p->fence) syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+#else
+    (void)p;
+#endif
+}
+
+/*====================WRITERS=============================*/
+
+json_published *json_published_new(json_value *doc) {
+    pthread_once(&expedited_once, expedited_init);
+    json_published *p = json_calloc(1, sizeof(json_published));
+    if (!p) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate a published document");
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    p->current = doc;
+    p->epoch = 1;
+    p->fence = !expedited;
+    return p;
+}
+
+/* Frees the retired versions no reader can hold. Called with the lock
+ * held, after a writer barrier following the last publish. */
+static void reclaim(json_published *p) {
+    uint64_t oldest = UINT64_MAX;
+    for (json_reader *r = p->readers; r; r = r->next) {
+        uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        if (e && e < oldest) oldest = e;
+    }
+    /* newest first: everything after the first freeable one is older */
+    struct retired **link = &p->retired;
+    while (*link && (*link)->epoch > oldest) link = &(*link)->next;
+    struct retired *r = *link;
+    *link = NULL;
+    while (r) {
+        struct retired *next = r->next;
+        json_free(r->doc);
+        json_mfree(r);
+        p->pending--;
+        r = next;
+    }
+}
+
+void json_publish(json_published *p, json_value *doc) {
+    /* allocated outside the lock; without it, the old version is freed
+     * here once its readers have left */
+    struct retired *r = json_malloc(sizeof(struct retired));
+    pthread_mutex_lock(&p->lock);
+    json_value *old = p->current;
+    __atomic_store_n(&p->current, doc, __ATOMIC_RELEASE);
+    uint64_t epoch = p->epoch + 1;
+    __atomic_store_n(&p->epoch, epoch, __ATOMIC_RELEASE);
+    writer_barrier(p);
+
+    if (old && r) {
+        r->doc = old;
+        r->epoch = epoch;
+        r->next = p->retired;
+        p->retired = r;
+        p->pending++;
+        r = NULL;
+    } else if (old) {
+        /* no memory to defer the free: wait for the readers instead */
+        for (;;) {
+            int held = 0;
+            for (json_reader *reader = p->readers; reader; reader = reader->next) {
+                uint64_t e = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+                held |= e && e < epoch;
+            }
+            if (!held) break;
+            sched_yield();
+        }
+        json_free(old);
+    }
+    reclaim(p);
+    pthread_mutex_unlock(&p->lock);
+    json_mfree(r);
+}
+
+void json_published_synchronize(json_published *p) {
+    for (unsigned spins = 0;; spins++) {
+        pthread_mutex_lock(&p->lock);
+        reclaim(p);
+        size_t pending = p->pending;
+        pthread_mutex_unlock(&p->lock);
+        if (!pending) return;
+        if (spins < PUBLISH_SPINS) {
+            sched_yield();
+        } else {
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+        }
+    }
+}
+
+size_t json_published_pending(const json_published *p) {
+    pthread_mutex_t *lock = (pthread_mutex_t *)&p->lock;
+    pthread_mutex_lock(lock);
+    size_t pending = p->pending;
+    pthread_mutex_unlock(lock);
+    return pending;
+}
+
+void json_published_free(json_published *p) {
+    if (!p) return;
+    for (struct retired *r = p->retired, *next; r; r = next) {
+        next = r->next;
+        json_free(r->doc);
+        json_mfree(r);
+    }
+    json_free(p->current);
+    pthread_mutex_destroy(&p->lock);
+    json_mfree(p);
+}
+
+/*====================READERS=============================*/
+
+json_reader *json_reader_new(json_published *p) {
+    json_reader *r = json_calloc(1, sizeof(json_reader));
+    if (!r) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate a reader");
+        return NULL;
+    }
+    r->published = p;
+    pthread_mutex_lock(&p->lock);
+    r->next = p->readers;
+    p->readers = r;
+    pthread_mutex_unlock(&p->lock);
+    return r;
+}
+
+void json_reader_free(json_reader *r) {
+    if (!r) return;
+    json_published *p = r->published;
+    pthread_mutex_lock(&p->lock);
+    json_reader **link = &p->readers;
+    while (*link != r) link = &(*link)->next;
+    *link = r->next;
+    pthread_mutex_unlock(&p->lock);
+    json_mfree(r);
+}
+
+const json_value *json_read_begin(json_reader *r) {
+    json_published *p = r->published;
+    uint64_t epoch = __atomic_load_n(&p->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&r->epoch, epoch, __ATOMIC_RELAXED);
+    /* the epoch must be visible before the version is loaded: either a
+     * fence here or the writer's membarrier, which only needs the
+     * compiler to keep the order */
+    if (p->fence) __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    else __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&p->current, __ATOMIC_ACQUIRE);
+}
+
+void json_read_end(json_reader *r) {
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,67 @@
+#ifndef JSONPUBLISH_H
+#define JSONPUBLISH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/* A document many threads read while another replaces it, such as a
+ * configuration reloaded every few seconds.
+ *
+ * The new version is parsed off to the side and swapped in with one
+ * pointer store. The old one is freed once every reader that could still
+ * see it has left its read section (epoch-based reclamation). Readers take
+ * no lock and do no atomic read-modify-write: entering a section is a load
+ * and a store to a slot of their own, leaving it is a store. The writer
+ * makes their stores visible with membarrier(2) where the kernel has it,
+ * otherwise readers add a fence.
+ *
+ *     json_reader *r = json_reader_new(config);    once per thread
+ *     const json_value *doc = json_read_begin(r);
+ *     ... json_object_get(doc, "timeout") ...
+ *     json_read_end(r);
+ *
+ * Everything reached from doc stays valid until json_read_end. Read
+ * sections do not nest and must not be held for long: documents replaced
+ * meanwhile are not freed before it ends. The document is shared by all
+ * readers, so it must not be modified once published; clones of it need
+ * the library built with THREADSAFE=1. */
+
+typedef struct json_published json_published;
+typedef struct json_reader json_reader;
+
+/* Takes ownership of doc, the first version, which may be NULL */
+json_published *json_published_new(json_value *doc);
+
+/* Frees the handle and every version still held. No reader may be left. */
+void json_published_free(json_published *published);
+
+/* Makes doc, owned from now on, the version read sections begin with.
+ * The version it replaces is freed once no reader can hold it, here or in
+ * a later call. Writers may call this from several threads, outside read
+ * sections. */
+void json_publish(json_published *published, json_value *doc);
+
+/* Waits until the versions replaced so far are freed, then returns.
+ * Must not be called from inside a read section. */
+void json_published_synchronize(json_published *published);
+
+/* Versions replaced but not freed yet, because readers may hold them */
+size_t json_published_pending(const json_published *published);
+
+/* A reader slot, for one thread at a time. Returns NULL with the error
+ * recorded if it cannot be allocated. */
+json_reader *json_reader_new(json_published *published);
+void json_reader_free(json_reader *reader);
+
+/* The current version, valid until json_read_end */
+const json_value *json_read_begin(json_reader *reader);
+void json_read_end(json_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONPUBLISH_H */
@@ -0,0 +1,1098 @@
+#include "jsonquery.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+#include <math.h>
+#include <stdio.h>
+
+/* Deepest nesting of parentheses and not in a condition */
+#define MAX_NESTING 256
+
+/*====================PATHS===============================*/
+
+/* The paths of a query form a tree, walked along each record. A node is
+ * a member name or an item index below its parent; the value found there
+ * is kept in the slot of the node's id, the root's being the record. */
+struct path_node {
+    char *name;         /* decoded, NULL for an index */
+    size_t len;
+    size_t index;
+    size_t id;
+    struct path_node *children;
+    size_t count;
+};
+
+/* Values are ordered by type first, in this order */
+enum rank { RANK_NULL, RANK_FALSE, RANK_TRUE, RANK_NUMBER, RANK_STRING, RANK_ARRAY, RANK_OBJECT };
+
+/* A value: the text of one in a record or the query, or a boolean
+ * computed by the query (no text) */
+struct value {
+    enum rank rank;
+    const char *p;
+    const char *end;
+    double number;      /* of a literal, parsed when compiled */
+};
+
+/* The bytecode of the conditions runs on a stack of values. An and or an
+ * or decides on the value on top, leaving false or true and jumping over
+ * its right side when that is enough, otherwise dropping it and going on
+ * to the right side, which OP_BOOL turns into a boolean. */
+enum opcode {
+    OP_PATH,    /* push the value of node arg */
+    OP_CONST,   /* push literal arg */
+    OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_NOT,
+    OP_BOOL,
+    OP_AND,     /* arg: where to jump with false */
+    OP_OR       /* arg: where to jump with true */
+};
+
+struct insn {
+    enum opcode op;
+    size_t arg;
+};
+
+enum aggregate { AGG_NONE, AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX };
+
+enum output { OUTPUT_RECORD, OUTPUT_PATH, OUTPUT_OBJECT, OUTPUT_ARRAY, OUTPUT_AGGREGATE, OUTPUT_AGGREGATES };
+
+/* A value of the output: a member of an object (key is its JSON text,
+ * quotes included), an item of an array, or the whole output */
+struct output_item {
+    char *key;
+    size_t key_len;
+    size_t node;
+    enum aggregate aggregate;
+};
+
+struct json_query {
+    char *text;                 /* copy of the expression, literals point into it */
+    struct path_node root;
+    size_t nodes;
+    struct insn *code;
+    size_t code_len;
+    size_t code_cap;
+    size_t stack_size;
+    struct value *consts;
+    size_t const_count;
+    enum output output;
+    struct output_item *items;
+    size_t item_count;
+};
+
+static void node_clear(struct path_node *node) {
+    for (size_t i = 0; i < node->count; i++) node_clear(&node->children[i]);
+    json_mfree(node->children);
+    json_mfree(node->name);
+}
+
+/* The child of node with name (if not NULL) or index, added if needed */
+static struct path_node *node_child(json_query *q, struct path_node *node, const char *name, size_t len,
+                                    size_t index) {
+    for (size_t i = 0; i < node->count; i++) {
+        struct path_node *child = &node->children[i];
+        if (name ? child->name && child->len == len && memcmp(child->name, name, len) == 0
+                 : !child->name && child->index == index)
+            return child;
+    }
+    struct path_node *children = json_realloc(node->children, (node->count + 1) * sizeof(*children));
+    if (!children) return NULL;
+    node->children = children;
+
+    struct path_node *child = &children[node->count];
+    memset(child, 0, sizeof(*child));
+    if (name) {
+        child->name = json_malloc(len + 1);
+        if (!child->name) return NULL;
+        memcpy(child->name, name, len);
+        child->name[len] = '\0';
+        child->len = len;
+    }
+    child->index = index;
+    child->id = q->nodes++;
+    node->count++;
+    return child;
+}
+
+/*====================COMPILING===========================*/
+
+/* Value of the checked number [p, end) */
+static double number_value(const char *p, const char *end) {
+    /* integers of up to 15 digits are exact in a double */
+    const char *d = p + (*p == '-');
+    if (end - d <= 15) {
+        int64_t v = 0;
+        const char *s = d;
+        while (s < end && *s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+        if (s == end) return *p == '-' ? (double)-v : (double)v;
+    }
+    char buf[64];
+    size_t len = (size_t)(end - p);
+    char *text = len < sizeof(buf) ? buf : json_malloc(len + 1);
+    if (!text) return NAN;
+    memcpy(text, p, len);
+    text[len] = '\0';
+    double number = strtod(text, NULL);
+    if (text != buf) json_mfree(text);
+    return number;
+}
+
+struct parser {
+    json_query *q;
+    const char *start;
+    const char *p;
+    const char *error;  /* static description of the first error */
+    const char *at;
+    size_t depth;       /* of the stack when the code so far has run */
+    size_t nesting;
+};
+
+static int parse_fail(struct parser *ps, const char *at, const char *error) {
+    if (!ps->error) {
+        ps->error = error;
+        ps->at = at;
+    }
+    return 0;
+}
+
+static void skip_space(struct parser *ps) {
+    while (json_scan_is_whitespace(*ps->p)) ps->p++;
+}
+
+static int is_ident_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_ident(char c) {
+    return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+/* Length of the identifier at p, 0 if there is none */
+static size_t ident_length(const char *p) {
+    size_t n = 0;
+    if (!is_ident_start(*p)) return 0;
+    while (is_ident(p[n])) n++;
+    return n;
+}
+
+/* Whether the keyword word comes next, as a whole identifier; skips it */
+static int accept_keyword(struct parser *ps, const char *word) {
+    skip_space(ps);
+    size_t n = strlen(word);
+    if (ident_length(ps->p) != n || memcmp(ps->p, word, n) != 0) return 0;
+    ps->p += n;
+    return 1;
+}
+
+static int accept(struct parser *ps, char c) {
+    skip_space(ps);
+    if (*ps->p != c) return 0;
+    ps->p++;
+    return 1;
+}
+
+static int expect(struct parser *ps, char c, const char *error) {
+    return accept(ps, c) || parse_fail(ps, ps->p, error);
+}
+
+static int emit(struct parser *ps, enum opcode op, size_t arg) {
+    json_query *q = ps->q;
+    if (q->code_len == q->code_cap) {
+        size_t cap = q->code_cap ? q->code_cap * 2 : 32;
+        struct insn *code = json_realloc(q->code, cap * sizeof(*code));
+        if (!code) return parse_fail(ps, ps->p, "Out of memory");
+        q->code = code;
+        q->code_cap = cap;
+    }
+    q->code[q->code_len++] = (struct insn){op, arg};
+
+    /* track how deep the stack gets */
+    if (op == OP_PATH || op == OP_CONST) ps->depth++;
+    else if (op >= OP_EQ && op <= OP_GE) ps->depth--;
+    else if (op == OP_AND || op == OP_OR) ps->depth--;
+    if (ps->depth > q->stack_size) q->stack_size = ps->depth;
+    return 1;
+}
+
+/* Scans the string literal at ps->p, leaving [*raw, *raw_end) its body */
+static int parse_string(struct parser *ps, const char **raw, const char **raw_end) {
+    const char *error = NULL;
+    const char *end = ps->p + strlen(ps->p);
+    const char *q = json_scan_string(ps->p + 1, end, &error);
+    if (error) return parse_fail(ps, q, error);
+    *raw = ps->p + 1;
+    *raw_end = q - 1;
+    ps->p = q;
+    return 1;
+}
+
+/* A member name from the body of a string literal, decoded */
+static struct path_node *string_child(struct parser *ps, struct path_node *node, const char *raw, const char *raw_end) {
+    char small[256] = "";
+    size_t len = (size_t)(raw_end - raw);
+    char *name = len < sizeof(small) ? small : json_malloc(len + 1);
+    if (!name) return parse_fail(ps, raw, "Out of memory"), NULL;
+    len = json_scan_decode(raw, raw_end, name);
+    struct path_node *child = node_child(ps->q, node, name, len, 0);
+    if (name != small) json_mfree(name);
+    if (!child) parse_fail(ps, raw, "Out of memory");
+    return child;
+}
+
+/* A path at ps->p, which is a '.'. *node is set to where it leads. */
+static int parse_path(struct parser *ps, struct path_node **node) {
+    struct path_node *n = &ps->q->root;
+    const char *p = ps->p + 1;
+    int dot = 1;    /* a name may follow */
+    for (;;) {
+        size_t len = dot ? ident_length(p) : 0;
+        if (len) {
+            n = node_child(ps->q, n, p, len, 0);
+            p += len;
+        } else if (dot && *p == '"') {
+            const char *raw, *raw_end;
+            ps->p = p;
+            if (!parse_string(ps, &raw, &raw_end)) return 0;
+            n = string_child(ps, n, raw, raw_end);
+            p = ps->p;
+        } else if (*p == '[') {
+            ps->p = p + 1;
+            skip_space(ps);
+            if (*ps->p == '"') {
+                const char *raw, *raw_end;
+                if (!parse_string(ps, &raw, &raw_end)) return 0;
+                n = string_child(ps, n, raw, raw_end);
+            } else if (*ps->p >= '0' && *ps->p <= '9') {
+                size_t index = 0;
+                for (; *ps->p >= '0' && *ps->p <= '9'; ps->p++) {
+                    if (index > (SIZE_MAX - 9) / 10) return parse_fail(ps, ps->p, "Index too large");
+                    index = index * 10 + (size_t)(*ps->p - '0');
+                }
+                n = node_child(ps->q, n, NULL, 0, index);
+            } else {
+                return parse_fail(ps, ps->p, "Expected an index or a string in brackets");
+            }
+            if (!expect(ps, ']', "Expected ']'")) return 0;
+            p = ps->p;
+        } else if (!dot && *p == '.') {
+            p++;
+            dot = 1;
+            continue;
+        } else {
+            break;
+        }
+        if (!n) return parse_fail(ps, p, "Out of memory");
+        dot = 0;
+    }
+    ps->p = p;
+    *node = n;
+    return 1;
+}
+
+static int add_const(struct parser *ps, struct value v) {
+    json_query *q = ps->q;
+    struct value *consts = json_realloc(q->consts, (q->const_count + 1) * sizeof(*consts));
+    if (!consts) return parse_fail(ps, ps->p, "Out of memory");
+    q->consts = consts;
+    q->consts[q->const_count] = v;
+    return emit(ps, OP_CONST, q->const_count++);
+}
+
+static int parse_or(struct parser *ps);
+
+static int parse_operand(struct parser *ps) {
+    skip_space(ps);
+    const char *p = ps->p;
+    if (*p == '.') {
+        struct path_node *node;
+        return parse_path(ps, &node) && emit(ps, OP_PATH, node->id);
+    }
+    if (*p == '(') {
+        ps->p++;
+        return parse_or(ps) && expect(ps, ')', "Expected ')'");
+    }
+    if (*p == '"') {
+        const char *raw, *raw_end;
+        if (!parse_string(ps, &raw, &raw_end)) return 0;
+        return add_const(ps, (struct value){RANK_STRING, p, ps->p, 0});
+    }
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        const char *error = NULL;
+        const char *end = json_scan_number(p, p + strlen(p), &error);
+        if (error) return parse_fail(ps, end, error);
+        ps->p = end;
+        return add_const(ps, (struct value){RANK_NUMBER, p, end, number_value(p, end)});
+    }
+    if (accept_keyword(ps, "true")) return add_const(ps, (struct value){RANK_TRUE, p, ps->p, 0});
+    if (accept_keyword(ps, "false")) return add_const(ps, (struct value){RANK_FALSE, p, ps->p, 0});
+    if (accept_keyword(ps, "null")) return add_const(ps, (struct value){RANK_NULL, p, ps->p, 0});
+    return parse_fail(ps, p, "Expected a path, a literal or '('");
+}
+
+static int parse_comparison(struct parser *ps) {
+    if (!parse_operand(ps)) return 0;
+    skip_space(ps);
+    const char *p = ps->p;
+    enum opcode op;
+    if (p[0] == '=' && p[1] == '=') op = OP_EQ;
+    else if (p[0] == '!' && p[1] == '=') op = OP_NE;
+    else if (p[0] == '<') op = p[1] == '=' ? OP_LE : OP_LT;
+    else if (p[0] == '>') op = p[1] == '=' ? OP_GE : OP_GT;
+    else return 1;
+    ps->p += op == OP_LT || op == OP_GT ? 1 : 2;
+    return parse_operand(ps) && emit(ps, op, 0);
+}
+
+static int parse_not(struct parser *ps) {
+    if (!accept_keyword(ps, "not")) return parse_comparison(ps);
+    if (++ps->nesting > MAX_NESTING) return parse_fail(ps, ps->p, "Condition nested too deeply");
+    int ok = parse_not(ps) && emit(ps, OP_NOT, 0);
+    ps->nesting--;
+    return ok;
+}
+
+/* and binds tighter than or; jumps are patched once their target is known */
+static int parse_and(struct parser *ps) {
+    if (!parse_not(ps)) return 0;
+    while (accept_keyword(ps, "and")) {
+        size_t jump = ps->q->code_len;
+        if (!emit(ps, OP_AND, 0) || !parse_not(ps) || !emit(ps, OP_BOOL, 0)) return 0;
+        ps->q->code[jump].arg = ps->q->code_len;
+    }
+    return 1;
+}
+
+static int parse_or(struct parser *ps) {
+    if (++ps->nesting > MAX_NESTING) return parse_fail(ps, ps->p, "Condition nested too deeply");
+    if (!parse_and(ps)) return 0;
+    while (accept_keyword(ps, "or")) {
+        size_t jump = ps->q->code_len;
+        if (!emit(ps, OP_OR, 0) || !parse_and(ps) || !emit(ps, OP_BOOL, 0)) return 0;
+        ps->q->code[jump].arg = ps->q->code_len;
+    }
+    ps->nesting--;
+    return 1;
+}
+
+static int add_item(struct parser *ps, const char *key, size_t key_len, size_t node, enum aggregate aggregate) {
+    json_query *q = ps->q;
+    struct output_item *items = json_realloc(q->items, (q->item_count + 1) * sizeof(*items));
+    if (!items) return parse_fail(ps, ps->p, "Out of memory");
+    q->items = items;
+    struct output_item *item = &items[q->item_count++];
+    memset(item, 0, sizeof(*item));
+    item->node = node;
+    item->aggregate = aggregate;
+    if (key) {
+        item->key = json_malloc(key_len + 1);
+        if (!item->key) return parse_fail(ps, ps->p, "Out of memory");
+        memcpy(item->key, key, key_len);
+        item->key[key_len] = '\0';
+        item->key_len = key_len;
+    }
+    return 1;
+}
+
+/* A path or an aggregate as a value of the output. Sets *aggregate to
+ * what it is. */
+static int parse_output_value(struct parser *ps, const char *key, size_t key_len, enum aggregate *aggregate) {
+    skip_space(ps);
+    enum aggregate a = AGG_NONE;
+    if (accept_keyword(ps, "count")) a = AGG_COUNT;
+    else if (accept_keyword(ps, "sum")) a = AGG_SUM;
+    else if (accept_keyword(ps, "min")) a = AGG_MIN;
+    else if (accept_keyword(ps, "max")) a = AGG_MAX;
+    *aggregate = a;
+
+    struct path_node *node = &ps->q->root;
+    if (a == AGG_COUNT) return add_item(ps, key, key_len, 0, a);
+    if (a != AGG_NONE && !expect(ps, '(', "Expected '(' after the aggregate")) return 0;
+    skip_space(ps);
+    if (*ps->p != '.') return parse_fail(ps, ps->p, "Expected a path");
+    if (!parse_path(ps, &node)) return 0;
+    if (a != AGG_NONE && !expect(ps, ')', "Expected ')'")) return 0;
+    return add_item(ps, key, key_len, node->id, a);
+}
+
+/* {name: value, "name": value, name, ...} */
+static int parse_object_output(struct parser *ps) {
+    int aggregates = -1;    /* whether the members are aggregates, once known */
+    if (accept(ps, '}')) return parse_fail(ps, ps->p, "Expected a member");
+    do {
+        skip_space(ps);
+        const char *name = ps->p;
+        const char *raw = NULL, *raw_end = NULL;
+        size_t len = ident_length(name);
+        if (len) {
+            ps->p += len;
+        } else if (*name == '"') {
+            if (!parse_string(ps, &raw, &raw_end)) return 0;
+        } else {
+            return parse_fail(ps, name, "Expected a member name");
+        }
+
+        /* the key as written out: a string literal as it is, a name quoted */
+        char quoted[256];
+        const char *key = name;
+        size_t key_len = (size_t)(ps->p - name);
+        if (len) {
+            if (len + 2 > sizeof(quoted)) return parse_fail(ps, name, "Member name too long");
+            quoted[0] = '"';
+            memcpy(quoted + 1, name, len);
+            quoted[len + 1] = '"';
+            key = quoted;
+            key_len = len + 2;
+        }
+
+        enum aggregate a = AGG_NONE;
+        const char *value_at = ps->p;
+        if (accept(ps, ':')) {
+            value_at = ps->p;
+            if (!parse_output_value(ps, key, key_len, &a)) return 0;
+        } else {
+            /* {name} is {name: .name} */
+            struct path_node *node = len ? node_child(ps->q, &ps->q->root, name, len, 0)
+                                         : string_child(ps, &ps->q->root, raw, raw_end);
+            if (!node) return parse_fail(ps, name, "Out of memory");
+            if (!add_item(ps, key, key_len, node->id, AGG_NONE)) return 0;
+        }
+        if (aggregates >= 0 && aggregates != (a != AGG_NONE))
+            return parse_fail(ps, value_at, "Aggregates and paths cannot be mixed");
+        aggregates = a != AGG_NONE;
+    } while (accept(ps, ','));
+    if (!expect(ps, '}', "Expected ',' or '}'")) return 0;
+    ps->q->output = aggregates ? OUTPUT_AGGREGATES : OUTPUT_OBJECT;
+    return 1;
+}
+
+/* [path, ...] */
+static int parse_array_output(struct parser *ps) {
+    do {
+        skip_space(ps);
+        if (*ps->p != '.') return parse_fail(ps, ps->p, "Expected a path");
+        struct path_node *node;
+        if (!parse_path(ps, &node) || !add_item(ps, NULL, 0, node->id, AGG_NONE)) return 0;
+    } while (accept(ps, ','));
+    if (!expect(ps, ']', "Expected ',' or ']'")) return 0;
+    ps->q->output = OUTPUT_ARRAY;
+    return 1;
+}
+
+static int parse_output(struct parser *ps) {
+    if (accept(ps, '{')) return parse_object_output(ps);
+    if (accept(ps, '[')) return parse_array_output(ps);
+    enum aggregate a;
+    if (!parse_output_value(ps, NULL, 0, &a)) return 0;
+    if (a != AGG_NONE) ps->q->output = OUTPUT_AGGREGATE;
+    else ps->q->output = ps->q->items[0].node == 0 ? OUTPUT_RECORD : OUTPUT_PATH;
+    return 1;
+}
+
+/* Stages: select(...) | select(...) | output. The conditions of all the
+ * selects are joined with and. */
+static int parse_query(struct parser *ps) {
+    size_t selects = 0;
+    do {
+        if (accept_keyword(ps, "select")) {
+            size_t jump = ps->q->code_len;
+            if (selects && !emit(ps, OP_AND, 0)) return 0;
+            if (!expect(ps, '(', "Expected '(' after select") || !parse_or(ps) ||
+                !expect(ps, ')', "Expected ')'"))
+                return 0;
+            if (selects) {
+                if (!emit(ps, OP_BOOL, 0)) return 0;
+                ps->q->code[jump].arg = ps->q->code_len;
+            }
+            selects++;
+        } else {
+            if (!parse_output(ps)) return 0;
+            skip_space(ps);
+            if (*ps->p == '|') return parse_fail(ps, ps->p, "Nothing can follow the output");
+            break;
+        }
+    } while (accept(ps, '|'));
+    skip_space(ps);
+    if (*ps->p) return parse_fail(ps, ps->p, "Unexpected character");
+    return 1;
+}
+
+json_query *json_query_compile(const char *expression) {
+    if (!expression) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL expression");
+        return NULL;
+    }
+    json_query *q = json_calloc(1, sizeof(*q));
+    size_t len = strlen(expression);
+    char *text = q ? json_malloc(len + 1) : NULL;
+    if (!text) {
+        json_mfree(q);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return NULL;
+    }
+    memcpy(text, expression, len + 1);
+    q->text = text;
+    q->nodes = 1;
+    q->output = OUTPUT_RECORD;
+
+    struct parser ps = {q, text, text, NULL, NULL, 0, 0};
+    if (!parse_query(&ps)) {
+        size_t offset = (size_t)(ps.at - text);
+        json_query_free(q);
+        json_set_error(ps.error && strcmp(ps.error, "Out of memory") == 0 ? JSON_ERROR_OUT_OF_MEMORY
+                                                                          : JSON_ERROR_SYNTAX,
+                       offset, ps.error);
+        return NULL;
+    }
+    return q;
+}
+
+void json_query_free(json_query *q) {
+    if (!q) return;
+    node_clear(&q->root);
+    for (size_t i = 0; i < q->item_count; i++) json_mfree(q->items[i].key);
+    json_mfree(q->items);
+    json_mfree(q->code);
+    json_mfree(q->consts);
+    json_mfree(q->text);
+    json_mfree(q);
+}
+
+int json_query_is_aggregate(const json_query *q) {
+    return q->output == OUTPUT_AGGREGATE || q->output == OUTPUT_AGGREGATES;
+}
+
+/*====================OUTPUT BUFFERS======================*/
+
+struct text {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static int text_put(struct text *t, const char *s, size_t len) {
+    if (!len) return 1;
+    if (len > t->cap - t->len) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        while (cap - t->len < len) cap *= 2;
+        char *data = json_realloc(t->data, cap);
+        if (!data) return 0;
+        t->data = data;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, s, len);
+    t->len += len;
+    return 1;
+}
+
+/* Running result of an aggregate */
+struct acc {
+    uint64_t count;
+    double value;
+    int has_value;
+};
+
+static void acc_merge(struct acc *dst, const struct acc *src, enum aggregate a) {
+    dst->count += src->count;
+    if (!src->has_value) return;
+    if (!dst->has_value) dst->value = src->value;
+    else if (a == AGG_SUM) dst->value += src->value;
+    else if (a == AGG_MIN) dst->value = (src->value < dst->value ? src->value : dst->value);
+    else if (a == AGG_MAX) dst->value = (src->value > dst->value ? src->value : dst->value);
+    dst->has_value = 1;
+}
+
+/*====================EVALUATION==========================*/
+
+/* The state of one thread: the values found in the record being read,
+ * what the query has output and aggregated */
+struct range {
+    struct json_scan_range span;
+    const json_query *q;
+    struct text *out;
+    struct text own;
+    struct acc *accs;
+    uint64_t records;
+    uint64_t matched;
+    const char **values;    /* start of the value of each node in the record */
+    const char **ends;
+    uint64_t *seen;         /* record in which each node was last found */
+    uint64_t record;
+    struct value *stack;
+    const char *end;        /* of the record */
+    const char *error;
+    const char *at;
+};
+
+static const char *scan_fail(struct range *r, const char *at, const char *error) {
+    r->error = error;
+    r->at = at;
+    return NULL;
+}
+
+static const char *skip_value(struct range *r, const char *p, size_t depth) {
+    size_t value_depth;
+    const char *error = NULL;
+    const char *end = json_scan_value(p, r->end, &value_depth, &error);
+    if (error) return scan_fail(r, end, error);
+    if (depth + value_depth > JSON_MAX_DEPTH) return scan_fail(r, p, "Maximum nesting depth exceeded");
+    return end;
+}
+
+/* The member child of node named by the raw key [raw, raw_end), or NULL */
+static const struct path_node *find_member(const struct path_node *node, const char *raw, const char *raw_end) {
+    size_t len = (size_t)(raw_end - raw);
+    int escaped = memchr(raw, '\\', len) != NULL;
+    for (size_t i = 0; i < node->count; i++) {
+        const struct path_node *child = &node->children[i];
+        if (!child->name) continue;
+        if (escaped ? json_scan_key_equals(raw, raw_end, child->name, child->len)
+                    : child->len == len && memcmp(child->name, raw, len) == 0)
+            return child;
+    }
+    return NULL;
+}
+
+static const struct path_node *find_item(const struct path_node *node, size_t index) {
+    for (size_t i = 0; i < node->count; i++) {
+        const struct path_node *child = &node->children[i];
+        if (!child->name && child->index == index) return child;
+    }
+    return NULL;
+}
+
+static const char *scan_value(struct range *r, const char *p, const struct path_node *node, size_t depth);
+
+static const char *scan_object(struct range *r, const char *p, const struct path_node *node, size_t depth) {
+    const char *end = r->end;
+    if (depth > JSON_MAX_DEPTH) return scan_fail(r, p, "Maximum nesting depth exceeded");
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == '}') return p + 1;
+    for (;;) {
+        if (p == end || *p != '"') return scan_fail(r, p, "Expected a string key");
+        const char *error = NULL;
+        const char *key = p + 1;
+        p = json_scan_string(key, end, &error);
+        if (error) return scan_fail(r, p, error);
+        const char *key_end = p - 1;
+
+        p = json_skip_whitespace(p, end);
+        if (p == end || *p != ':') return scan_fail(r, p, "Expected ':' after key");
+        p = json_skip_whitespace(p + 1, end);
+        if (p == end) return scan_fail(r, p, "Expected a value");
+
+        const struct path_node *child = find_member(node, key, key_end);
+        p = child ? scan_value(r, p, child, depth) : skip_value(r, p, depth);
+        if (!p) return NULL;
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == '}') {
+            return p + 1;
+        } else {
+            return scan_fail(r, p, "Expected ',' or '}'");
+        }
+    }
+}
+
+static const char *scan_array(struct range *r, const char *p, const struct path_node *node, size_t depth) {
+    const char *end = r->end;
+    if (depth > JSON_MAX_DEPTH) return scan_fail(r, p, "Maximum nesting depth exceeded");
+
+    p = json_skip_whitespace(p + 1, end);
+    if (p < end && *p == ']') return p + 1;
+    for (size_t index = 0;; index++) {
+        if (p == end) return scan_fail(r, p, "Expected a value");
+        const struct path_node *child = find_item(node, index);
+        p = child ? scan_value(r, p, child, depth) : skip_value(r, p, depth);
+        if (!p) return NULL;
+
+        p = json_skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_whitespace(p + 1, end);
+        } else if (p < end && *p == ']') {
+            return p + 1;
+        } else {
+            return scan_fail(r, p, "Expected ',' or ']'");
+        }
+    }
+}
+
+/* Steps over the value at p, keeping where it is for node and going into
+ * it for the children of node. A repeated key keeps its first value. */
+static const char *scan_value(struct range *r, const char *p, const struct path_node *node, size_t depth) {
+    if (r->seen[node->id] == r->record) return skip_value(r, p, depth);
+    const char *q;
+    if (node->count && *p == '{') q = scan_object(r, p, node, depth + 1);
+    else if (node->count && *p == '[') q = scan_array(r, p, node, depth + 1);
+    else q = skip_value(r, p, depth);
+    if (!q) return NULL;
+    r->seen[node->id] = r->record;
+    r->values[node->id] = p;
+    r->ends[node->id] = q;
+    return q;
+}
+
+/* The value of node in the record being read; null if it is missing */
+static struct value node_value(const struct range *r, size_t id) {
+    struct value v = {RANK_NULL, NULL, NULL, 0};
+    if (r->seen[id] != r->record) return v;
+    v.p = r->values[id];
+    v.end = r->ends[id];
+    switch (*v.p) {
+        case 'n': v.rank = RANK_NULL; break;
+        case 'f': v.rank = RANK_FALSE; break;
+        case 't': v.rank = RANK_TRUE; break;
+        case '"': v.rank = RANK_STRING; break;
+        case '[': v.rank = RANK_ARRAY; break;
+        case '{': v.rank = RANK_OBJECT; break;
+        default:
+            v.rank = RANK_NUMBER;
+            v.number = number_value(v.p, v.end);
+    }
+    return v;
+}
+
+static int compare_bytes(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return c ? c : (a_len > b_len) - (a_len < b_len);
+}
+
+/* Compares the bodies of two strings, decoding those with escapes */
+static int compare_strings(const struct value *a, const struct value *b) {
+    const char *ap = a->p + 1, *bp = b->p + 1;
+    size_t a_len = (size_t)(a->end - ap) - 1, b_len = (size_t)(b->end - bp) - 1;
+    if (!memchr(ap, '\\', a_len) && !memchr(bp, '\\', b_len)) return compare_bytes(ap, a_len, bp, b_len);
+
+    char a_small[256], b_small[256];
+    char *ad = a_len < sizeof(a_small) ? a_small : json_malloc(a_len + 1);
+    char *bd = b_len < sizeof(b_small) ? b_small : json_malloc(b_len + 1);
+    int c = 0;
+    if (ad && bd) c = compare_bytes(ad, json_scan_decode(ap, ap + a_len, ad), bd, json_scan_decode(bp, bp + b_len, bd));
+    if (ad != a_small) json_mfree(ad);
+    if (bd != b_small) json_mfree(bd);
+    return c;
+}
+
+static int compare(const struct value *a, const struct value *b) {
+    if (a->rank != b->rank) return a->rank < b->rank ? -1 : 1;
+    switch (a->rank) {
+        case RANK_NUMBER:
+            return (a->number > b->number) - (a->number < b->number);
+        case RANK_STRING:
+            return compare_strings(a, b);
+        case RANK_ARRAY:
+        case RANK_OBJECT:
+            return compare_bytes(a->p, (size_t)(a->end - a->p), b->p, (size_t)(b->end - b->p));
+        default:
+            return 0;
+    }
+}
+
+static int truthy(const struct value *v) {
+    return v->rank != RANK_NULL && v->rank != RANK_FALSE;
+}
+
+static struct value boolean(int b) {
+    return (struct value){b ? RANK_TRUE : RANK_FALSE, NULL, NULL, 0};
+}
+
+/* Runs the conditions on the record just read */
+static int selected(const struct range *r) {
+    const json_query *q = r->q;
+    struct value *stack = r->stack;
+    size_t top = 0;
+    for (size_t pc = 0; pc < q->code_len; pc++) {
+        const struct insn *in = &q->code[pc];
+        switch (in->op) {
+            case OP_PATH:
+                stack[top++] = node_value(r, in->arg);
+                break;
+            case OP_CONST:
+                stack[top++] = q->consts[in->arg];
+                break;
+            case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+                int c = compare(&stack[top - 2], &stack[top - 1]);
+                int b = in->op == OP_EQ ? c == 0 : in->op == OP_NE ? c != 0 : in->op == OP_LT ? c < 0
+                      : in->op == OP_LE ? c <= 0 : in->op == OP_GT ? c > 0 : c >= 0;
+                stack[--top - 1] = boolean(b);
+                break;
+            }
+            case OP_NOT:
+                stack[top - 1] = boolean(!truthy(&stack[top - 1]));
+                break;
+            case OP_BOOL:
+                stack[top - 1] = boolean(truthy(&stack[top - 1]));
+                break;
+            case OP_AND:
+                if (!truthy(&stack[top - 1])) {
+                    stack[top - 1] = boolean(0);
+                    pc = in->arg - 1;
+                } else {
+                    top--;
+                }
+                break;
+            case OP_OR:
+                if (truthy(&stack[top - 1])) {
+                    stack[top - 1] = boolean(1);
+                    pc = in->arg - 1;
+                } else {
+                    top--;
+                }
+                break;
+        }
+    }
+    return !top || truthy(&stack[0]);
+}
+
+/* Text of the value of node, null if it is missing */
+static int put_value(struct range *r, size_t id) {
+    if (r->seen[id] != r->record) return text_put(r->out, "null", 4);
+    return text_put(r->out, r->values[id], (size_t)(r->ends[id] - r->values[id]));
+}
+
+static int output_record(struct range *r) {
+    const json_query *q = r->q;
+    struct text *out = r->out;
+    int ok = 1;
+    switch (q->output) {
+        case OUTPUT_RECORD:
+        case OUTPUT_PATH:
+            ok = put_value(r, q->items ? q->items[0].node : 0);
+            break;
+        case OUTPUT_OBJECT:
+        case OUTPUT_ARRAY: {
+            int object = q->output == OUTPUT_OBJECT;
+            ok = text_put(out, object ? "{" : "[", 1);
+            for (size_t i = 0; ok && i < q->item_count; i++) {
+                if (i) ok = text_put(out, ",", 1);
+                if (ok && object) ok = text_put(out, q->items[i].key, q->items[i].key_len) && text_put(out, ":", 1);
+                if (ok) ok = put_value(r, q->items[i].node);
+            }
+            if (ok) ok = text_put(out, object ? "}" : "]", 1);
+            break;
+        }
+        case OUTPUT_AGGREGATE:
+        case OUTPUT_AGGREGATES:
+            for (size_t i = 0; i < q->item_count; i++) {
+                const struct output_item *item = &q->items[i];
+                struct acc *acc = &r->accs[i];
+                acc->count++;
+                if (item->aggregate == AGG_COUNT) continue;
+                struct value v = node_value(r, item->node);
+                if (v.rank != RANK_NUMBER) continue;
+                if (!acc->has_value) acc->value = v.number;
+                else if (item->aggregate == AGG_SUM) acc->value += v.number;
+                else if (item->aggregate == AGG_MIN) acc->value = (v.number < acc->value ? v.number : acc->value);
+                else acc->value = (v.number > acc->value ? v.number : acc->value);
+                acc->has_value = 1;
+            }
+            return 1;
+    }
+    return ok && text_put(out, "\n", 1);
+}
+
+/* Reads the record [p, end), p being its first non-blank byte */
+static int eval_record(struct range *r, const char *p, const char *end) {
+    r->end = end;
+    r->record++;
+    r->records++;
+    if (!scan_value(r, p, &r->q->root, 0)) return 0;
+    p = json_skip_whitespace(r->ends[0], end);
+    if (p != end) return scan_fail(r, p, "Unexpected data after the document"), 0;
+
+    if (!selected(r)) return 1;
+    r->matched++;
+    if (!output_record(r)) return scan_fail(r, p, "Out of memory"), 0;
+    return 1;
+}
+
+static void *range_run(void *arg) {
+    struct range *r = arg;
+    const char *p = r->span.buf;
+    const char *end = r->span.buf + r->span.len;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = newline ? newline : end;
+        const char *first = json_skip_whitespace(p, line_end);
+        if (first < line_end && !eval_record(r, first, line_end)) return NULL;
+        p = newline ? newline + 1 : end;
+    }
+    return NULL;
+}
+
+/*====================RUNS================================*/
+
+struct json_query_run {
+    const json_query *q;
+    struct text out;
+    struct acc *accs;
+    uint64_t records;
+    uint64_t matched;
+};
+
+json_query_run *json_query_start(const json_query *q) {
+    if (!q) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL query");
+        return NULL;
+    }
+    json_query_run *run = json_calloc(1, sizeof(*run));
+    if (run) run->accs = json_calloc(q->item_count ? q->item_count : 1, sizeof(struct acc));
+    if (!run || !run->accs) {
+        json_mfree(run);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return NULL;
+    }
+    run->q = q;
+    return run;
+}
+
+void json_query_run_free(json_query_run *run) {
+    if (!run) return;
+    json_mfree(run->out.data);
+    json_mfree(run->accs);
+    json_mfree(run);
+}
+
+static void range_free(struct range *r) {
+    json_mfree(r->own.data);
+    json_mfree(r->accs);
+    json_mfree(r->values);
+    json_mfree(r->ends);
+    json_mfree(r->seen);
+    json_mfree(r->stack);
+}
+
+static int range_init(struct range *r, const json_query *q) {
+    size_t items = q->item_count ? q->item_count : 1;
+    r->q = q;
+    r->out = &r->own;
+    r->accs = json_calloc(items, sizeof(struct acc));
+    r->values = json_malloc(q->nodes * sizeof(const char *));
+    r->ends = json_malloc(q->nodes * sizeof(const char *));
+    r->seen = json_calloc(q->nodes, sizeof(uint64_t));
+    r->stack = json_malloc((q->stack_size ? q->stack_size : 1) * sizeof(struct value));
+    return r->accs && r->values && r->ends && r->seen && r->stack;
+}
+
+int json_query_feed(json_query_run *run, const char *buf, size_t len, unsigned threads) {
+    if (!run || (!buf && len)) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL argument");
+        return 0;
+    }
+    const json_query *q = run->q;
+    size_t n = json_scan_range_count(len, threads);
+    struct range *ranges = json_calloc(n, sizeof(*ranges));
+    if (!ranges) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+        return 0;
+    }
+
+    /* the first range writes to the output of the run directly, the
+     * others to text of their own appended after it */
+    size_t out_len = run->out.len;
+    json_scan_split_lines(buf, len, ranges, sizeof(*ranges), n);
+    int ok = 1;
+    for (size_t k = 0; k < n; k++) {
+        if (!range_init(&ranges[k], q)) ok = 0;
+    }
+    ranges[0].out = &run->out;
+    if (ok) json_scan_run_ranges(range_run, ranges, sizeof(*ranges), n);
+
+    /* output and aggregates are kept only when no range failed; the
+     * error reported is that of the earliest failing one */
+    const char *error = ok ? NULL : "out of memory";
+    const char *at = NULL;
+    for (size_t k = 0; ok && k < n; k++) {
+        if (ranges[k].error) {
+            error = ranges[k].error;
+            at = ranges[k].at;
+            ok = 0;
+        } else if (k && !text_put(&run->out, ranges[k].own.data, ranges[k].own.len)) {
+            error = "out of memory";
+            ok = 0;
+        }
+    }
+    if (ok) {
+        for (size_t k = 0; k < n; k++) {
+            for (size_t i = 0; i < q->item_count; i++) acc_merge(&run->accs[i], &ranges[k].accs[i], q->items[i].aggregate);
+            run->records += ranges[k].records;
+            run->matched += ranges[k].matched;
+        }
+    } else {
+        run->out.len = out_len;
+    }
+    for (size_t k = 0; k < n; k++) range_free(&ranges[k]);
+    json_mfree(ranges);
+
+    if (!ok) {
+        if (at) json_set_error(JSON_ERROR_SYNTAX, (size_t)(at - buf), error);
+        else json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, error);
+    }
+    return ok;
+}
+
+/* Writes the finite number as the JSON writer does: the shorter of the
+ * two precisions that round-trips */
+static int put_number(struct text *out, double number) {
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.15g", number);
+    if (strtod(tmp, NULL) != number) n = snprintf(tmp, sizeof(tmp), "%.17g", number);
+    return text_put(out, tmp, (size_t)n);
+}
+
+static int put_aggregate(struct text *out, const struct output_item *item, const struct acc *acc) {
+    if (item->aggregate == AGG_COUNT) {
+        char tmp[32];
+        int n = snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)acc->count);
+        return text_put(out, tmp, (size_t)n);
+    }
+    /* the sum of no numbers is 0, their min and max null */
+    if (!acc->has_value) return item->aggregate == AGG_SUM ? text_put(out, "0", 1) : text_put(out, "null", 4);
+    return put_number(out, acc->value);
+}
+
+int json_query_finish(json_query_run *run) {
+    const json_query *q = run->q;
+    struct text *out = &run->out;
+    int ok = 1;
+    /* like the writer, fail rather than write a number other than the result */
+    int aggregates = q->output == OUTPUT_AGGREGATE || q->output == OUTPUT_AGGREGATES;
+    for (size_t i = 0; aggregates && i < q->item_count; i++) {
+        if (run->accs[i].has_value && !isfinite(run->accs[i].value)) {
+            json_set_error(JSON_ERROR_OTHER, JSON_NO_OFFSET, "an aggregate overflows the range of a double");
+            return 0;
+        }
+    }
+    if (q->output == OUTPUT_AGGREGATE) {
+        ok = put_aggregate(out, &q->items[0], &run->accs[0]) && text_put(out, "\n", 1);
+    } else if (q->output == OUTPUT_AGGREGATES) {
+        ok = text_put(out, "{", 1);
+        for (size_t i = 0; ok && i < q->item_count; i++) {
+            ok = (!i || text_put(out, ",", 1)) && text_put(out, q->items[i].key, q->items[i].key_len) &&
+                 text_put(out, ":", 1) && put_aggregate(out, &q->items[i], &run->accs[i]);
+        }
+        ok = ok && text_put(out, "}\n", 2);
+    }
+    if (!ok) json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "out of memory");
+    return ok;
+}
+
+const char *json_query_output(const json_query_run *run, size_t *len) {
+    if (len) *len = run->out.len;
+    return run->out.data ? run->out.data : "";
+}
+
+void json_query_clear_output(json_query_run *run) {
+    run->out.len = 0;
+}
+
+uint64_t json_query_records(const json_query_run *run) {
+    return run->records;
+}
+
+uint64_t json_query_matched(const json_query_run *run) {
+    return run->matched;
+}
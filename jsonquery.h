@@ -0,0 +1,87 @@
+#ifndef JSONQUERY_H
+#define JSONQUERY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Filtering and aggregation of NDJSON records without building trees.
+ *
+ * A query is written in a small subset of jq:
+ *
+ *     select(.status >= 500 and .method == "GET") | {path: .req.path, status}
+ *     select(.user.country == "NZ" or not .active) | .user.id
+ *     select(.price > 10) | {n: count, total: sum(.price), top: max(.price)}
+ *
+ * It is a pipe of select(condition) stages, all of which a record must
+ * pass, and at most one output at the end:
+ *   - a path: .a.b, ."any key", .items[0], or . for the whole record;
+ *   - an object of paths {name: path, ...}, where {name} stands for
+ *     {name: .name}, or an array of paths [path, ...];
+ *   - aggregates over the records selected: count, sum(path), min(path)
+ *     and max(path), alone or as the members of an object.
+ * Without an output the record is written as it is.
+ *
+ * Conditions compare paths and literals (numbers, strings, true, false,
+ * null) with == != < <= > >= and combine them with and, or, not and
+ * parentheses. As in jq, a missing member is null, values of different
+ * types are ordered null < false < true < numbers < strings < arrays <
+ * objects, and only false and null are false. Arrays and objects compare
+ * by their text. sum, min and max take the numbers among their values and
+ * ignore the rest.
+ *
+ * The query is compiled once: its paths into a tree walked by a scanner
+ * that checks each record and only keeps where the values it needs are,
+ * its conditions into a bytecode run on those values. Output is copied
+ * from the record as it is written there. */
+
+typedef struct json_query json_query;
+
+/* An evaluation of a query over any number of buffers: its output and,
+ * for aggregates, the running results */
+typedef struct json_query_run json_query_run;
+
+/* Returns NULL if the expression is not a valid query, with a
+ * JSON_ERROR_SYNTAX error at its offset in expression */
+json_query *json_query_compile(const char *expression);
+void json_query_free(json_query *query);
+
+/* Whether the query outputs aggregates, written by json_query_finish,
+ * instead of a line per record */
+int json_query_is_aggregate(const json_query *query);
+
+/* The query must outlive the runs started from it */
+json_query_run *json_query_start(const json_query *query);
+void json_query_run_free(json_query_run *run);
+
+/* Evaluates the query on every non-blank line of buf[0..len), each a
+ * JSON document, appending a line to the output per record selected. With
+ * threads > 1 the buffer is split at line boundaries into ranges evaluated
+ * in parallel, whose output is joined in order. The buffer is made of
+ * whole lines; a stream is fed in consecutive chunks.
+ *
+ * Returns 0 if a line is not valid JSON, with the error at its offset in
+ * buf; nothing of the buffer is then output or aggregated. */
+int json_query_feed(json_query_run *run, const char *buf, size_t len, unsigned threads);
+
+/* Writes the line of aggregates to the output; once, after the last feed.
+ * Returns 0, writing nothing, if a sum, min or max is not finite, as when
+ * it overflows or a record holds 1e400: JSON has no text for it. */
+int json_query_finish(json_query_run *run);
+
+/* The output not cleared yet: lines, each ending in '\n' */
+const char *json_query_output(const json_query_run *run, size_t *len);
+void json_query_clear_output(json_query_run *run);
+
+/* Records read and records selected so far */
+uint64_t json_query_records(const json_query_run *run);
+uint64_t json_query_matched(const json_query_run *run);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONQUERY_H */
@@ -0,0 +1,758 @@
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+/* Scanning primitives shared by the tokenizer and json_validate.
+ *
+ * The scanners work on [p, end) and never read past end. Those that can
+ * fail return a pointer to the offending byte and set *error to a static
+ * description; on success *error is left untouched.
+ *
+ * Strings are scanned eight bytes at a time (SWAR): a single 64-bit word
+ * tells whether any of its bytes is a quote, a backslash, a control
+ * character or non-ASCII, which is all a string scanner has to stop for.
+ * Whole documents can also be classified 64 bytes at a time into bitmasks
+ * (with SSE2 where available), from which the positions of every token
+ * follow without looking at the bytes in between.
+ *
+ * Wider versions of both, for AVX2 and AVX-512, live alongside; jsoncpu.c
+ * picks the ones the CPU runs at startup (see jsoncpu.h).
+ *
+ * Last, the splitting of NDJSON buffers into ranges of lines for threads,
+ * which json_columns_extract and json_query_feed both do. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "jsontokenizer.h"
+
+#define JSON_SCAN_ONES  0x0101010101010101ULL
+#define JSON_SCAN_HIGHS 0x8080808080808080ULL
+
+/* Deepest nesting accepted by the grammar. One bit per level records
+ * whether it is an object or an array, so the whole stack fits in 128 bytes. */
+#define JSON_MAX_DEPTH 1024
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define JSON_SCAN_SWAR 1
+#endif
+
+/* The grammar is fed a constant token type at every call site; inlining
+ * lets the compiler drop the cases that cannot happen there */
+#if defined(__GNUC__)
+#define JSON_SCAN_INLINE static inline __attribute__((always_inline))
+#else
+#define JSON_SCAN_INLINE static inline
+#endif
+
+static inline int json_scan_is_whitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline const char *json_skip_whitespace(const char *p, const char *end) {
+    /* indentation of pretty-printed documents comes in long runs of spaces */
+    while (end - p >= 8 && p[0] == ' ') {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        if (w != JSON_SCAN_ONES * ' ') break;
+        p += 8;
+    }
+    while (p < end && json_scan_is_whitespace(*p)) p++;
+    return p;
+}
+
+/* Returns the first byte that is '"', '\\', a control character or not
+ * ASCII, or end */
+static inline const char *json_scan_string_plain(const char *p, const char *end) {
+#ifdef JSON_SCAN_SWAR
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        uint64_t quote = w ^ (JSON_SCAN_ONES * '"');
+        uint64_t backslash = w ^ (JSON_SCAN_ONES * '\\');
+        /* high bit of each byte that is zero in quote/backslash, below
+         * 0x20 or at least 0x80 in w. Borrows only make bytes above the
+         * first real match look like matches, so the lowest one is exact. */
+        uint64_t special = ((quote - JSON_SCAN_ONES) & ~quote) |
+                           ((backslash - JSON_SCAN_ONES) & ~backslash) |
+                           ((w - JSON_SCAN_ONES * 0x20) & ~w) | w;
+        special &= JSON_SCAN_HIGHS;
+        if (special) return p + (__builtin_ctzll(special) >> 3);
+        p += 8;
+    }
+#endif
+    while (p < end) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x80) break;
+        p++;
+    }
+    return p;
+}
+
+/* Length of the well-formed UTF-8 sequence starting at p (which is not
+ * ASCII), 0 if it is invalid: overlong forms, surrogates and code points
+ * above U+10FFFF are rejected */
+static inline size_t json_scan_utf8(const char *s, const char *end) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t avail = (size_t)(end - s);
+    unsigned char c = p[0];
+
+    if (c < 0xC2) return 0;
+    if (c < 0xE0) return avail >= 2 && (p[1] & 0xC0) == 0x80 ? 2 : 0;
+    if (c < 0xF0) {
+        if (avail < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80) return 0;
+        if (c == 0xE0 && p[1] < 0xA0) return 0;
+        if (c == 0xED && p[1] > 0x9F) return 0;
+        return 3;
+    }
+    if (c < 0xF5) {
+        if (avail < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+            return 0;
+        if (c == 0xF0 && p[1] < 0x90) return 0;
+        if (c == 0xF4 && p[1] > 0x8F) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+static inline int json_scan_is_hex(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/* Length of the escape sequence at p (a backslash), 0 if it is invalid */
+static inline size_t json_scan_escape(const char *p, const char *end, const char **error) {
+    if (end - p < 2) {
+        *error = "Unterminated string: unexpected end after escape character";
+        return 0;
+    }
+    switch (p[1]) {
+        case '"': case '\\': case '/': case 'b':
+        case 'f': case 'n': case 'r': case 't':
+            return 2;
+        case 'u':
+            if (end - p < 6 || !json_scan_is_hex(p[2]) || !json_scan_is_hex(p[3]) ||
+                !json_scan_is_hex(p[4]) || !json_scan_is_hex(p[5])) {
+                *error = "Invalid \\u escape";
+                return 0;
+            }
+            /* strings are NUL-terminated once decoded: one would cut them */
+            if (p[2] == '0' && p[3] == '0' && p[4] == '0' && p[5] == '0') {
+                *error = "\\u0000 is not supported in strings";
+                return 0;
+            }
+            return 6;
+    }
+    *error = "Invalid escape sequence";
+    return 0;
+}
+
+/* Value of the 4 hex digits at p, which have been checked already */
+static inline unsigned long json_scan_hex4(const char *p) {
+    unsigned long cp = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        cp = (cp << 4) | (unsigned long)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return cp;
+}
+
+/* Writes a code point as UTF-8, returns the number of bytes written.
+ * Lone surrogates are replaced with U+FFFD. */
+static inline size_t json_scan_encode_utf8(char *out, unsigned long cp) {
+    if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0xFFFD;
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/* Decodes the escape sequence at p, in a string already checked by
+ * json_scan_string, into at most 4 bytes at out. Returns the length of the
+ * sequence and sets *written. A UTF-16 surrogate pair is one sequence. */
+static inline size_t json_scan_unescape(const char *p, const char *end, char *out, size_t *written) {
+    char c = p[1];
+    *written = 1;
+    switch (c) {
+        case 'b': *out = '\b'; return 2;
+        case 'f': *out = '\f'; return 2;
+        case 'n': *out = '\n'; return 2;
+        case 'r': *out = '\r'; return 2;
+        case 't': *out = '\t'; return 2;
+        case 'u': break;
+        default:  *out = c; return 2;
+    }
+    unsigned long cp = json_scan_hex4(p + 2);
+    size_t n = 6;
+    if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 12 && p[6] == '\\' && p[7] == 'u' &&
+        json_scan_is_hex(p[8]) && json_scan_is_hex(p[9]) && json_scan_is_hex(p[10]) && json_scan_is_hex(p[11])) {
+        unsigned long low = json_scan_hex4(p + 8);
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            n = 12;
+        }
+    }
+    *written = json_scan_encode_utf8(out, cp);
+    return n;
+}
+
+/* Decodes the raw body [raw, raw_end) of a string checked by
+ * json_scan_string into out, which needs raw_end - raw bytes at most.
+ * Returns the decoded length; nothing is appended. */
+static inline size_t json_scan_decode(const char *raw, const char *raw_end, char *out) {
+    char *start = out;
+    while (raw < raw_end) {
+        const char *escape = memchr(raw, '\\', (size_t)(raw_end - raw));
+        size_t n = (size_t)((escape ? escape : raw_end) - raw);
+        memcpy(out, raw, n);
+        out += n;
+        if (!escape) break;
+        raw = escape + json_scan_unescape(escape, raw_end, out, &n);
+        out += n;
+    }
+    return (size_t)(out - start);
+}
+
+/* Compares the raw body [raw, raw_end) of a checked string with the
+ * decoded key of length len */
+static inline int json_scan_key_equals(const char *raw, const char *raw_end, const char *key, size_t len) {
+    const char *key_end = key + len;
+    while (raw < raw_end) {
+        const char *escape = memchr(raw, '\\', (size_t)(raw_end - raw));
+        size_t n = (size_t)((escape ? escape : raw_end) - raw);
+        if ((size_t)(key_end - key) < n || memcmp(raw, key, n) != 0) return 0;
+        key += n;
+        if (!escape) break;
+
+        char decoded[4];
+        raw = escape + json_scan_unescape(escape, raw_end, decoded, &n);
+        if ((size_t)(key_end - key) < n || memcmp(decoded, key, n) != 0) return 0;
+        key += n;
+    }
+    return key == key_end;
+}
+
+/* json_scan_string_plain for the kernel in use. Reached through a call,
+ * so worth it for strings that may be long: values rather than keys. */
+extern const char *(*json_scan_string_plain_kernel)(const char *p, const char *end);
+
+/* Scans the body of a string, p being just past the opening quote, with
+ * plain skipping the bytes that need no check. Returns a pointer past the
+ * closing quote. */
+JSON_SCAN_INLINE const char *json_scan_string_with(const char *p, const char *end, const char **error,
+                                                   const char *(*plain)(const char *, const char *)) {
+    for (;;) {
+        p = plain(p, end);
+        if (p == end) {
+            *error = "Unterminated string";
+            return p;
+        }
+        unsigned char c = (unsigned char)*p;
+        if (c == '"') return p + 1;
+
+        if (c == '\\') {
+            size_t n = json_scan_escape(p, end, error);
+            if (!n) return p;
+            p += n;
+        } else if (c < 0x20) {
+            *error = "Unescaped control character in string";
+            return p;
+        } else {
+            size_t n = json_scan_utf8(p, end);
+            if (!n) {
+                *error = "Invalid UTF-8 in string";
+                return p;
+            }
+            p += n;
+        }
+    }
+}
+
+JSON_SCAN_INLINE const char *json_scan_string(const char *p, const char *end, const char **error) {
+    return json_scan_string_with(p, end, error, json_scan_string_plain);
+}
+
+static inline const char *json_scan_digits(const char *p, const char *end) {
+    while (p < end && (unsigned char)(*p - '0') < 10) p++;
+    return p;
+}
+
+/* Scans a number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ * Returns a pointer past it. */
+static inline const char *json_scan_number(const char *p, const char *end, const char **error) {
+    if (*p == '-') p++;
+    if (p == end || (unsigned char)(*p - '0') >= 10) {
+        *error = "- must be followed by digits";
+        return p;
+    }
+    if (*p == '0') {
+        p++;
+        if (p < end && (unsigned char)(*p - '0') < 10) {
+            *error = "leading zero must not be followed by another digit";
+            return p;
+        }
+    } else {
+        p = json_scan_digits(p, end);
+    }
+
+    if (p < end && *p == '.') {
+        const char *digits = ++p;
+        p = json_scan_digits(p, end);
+        if (p == digits) {
+            *error = "no digits after decimal point";
+            return p;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        const char *digits = p;
+        p = json_scan_digits(p, end);
+        if (p == digits) {
+            *error = "no digits in exponent";
+            return p;
+        }
+    }
+    return p;
+}
+
+/* Length of the literal true, false or null at p, 0 if there is none */
+static inline size_t json_scan_literal(const char *p, const char *end) {
+    size_t avail = (size_t)(end - p);
+    if (avail >= 4 && memcmp(p, "true", 4) == 0) return 4;
+    if (avail >= 4 && memcmp(p, "null", 4) == 0) return 4;
+    if (avail >= 5 && memcmp(p, "false", 5) == 0) return 5;
+    return 0;
+}
+
+/* Anything that can continue a number or a literal */
+static inline int json_scan_is_scalar_char(char c) {
+    switch (c) {
+        case ' ': case '\t': case '\n': case '\r':
+        case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+            return 0;
+    }
+    return 1;
+}
+
+/*====================BLOCK CLASSIFICATION================*/
+
+/* One bit per byte of a 64-byte block, bit i standing for byte i */
+struct json_scan_block {
+    uint64_t quote;       /* '"' */
+    uint64_t backslash;   /* '\\' */
+    uint64_t whitespace;  /* ' ', '\t', '\n', '\r' */
+    uint64_t structural;  /* '{', '}', '[', ']', ':', ',' */
+    uint64_t control;     /* below 0x20 */
+    uint64_t non_ascii;   /* 0x80 and above */
+};
+
+static inline void json_scan_classify_scalar(const char *p, struct json_scan_block *b) {
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = (unsigned char)p[i];
+        uint64_t bit = 1ULL << i;
+        if (c == '"') b->quote |= bit;
+        else if (c == '\\') b->backslash |= bit;
+        else if (json_scan_is_whitespace((char)c)) b->whitespace |= bit;
+        else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') b->structural |= bit;
+        if (c < 0x20) b->control |= bit;
+        if (c >= 0x80) b->non_ascii |= bit;
+    }
+}
+
+#if defined(__SSE2__)
+#define JSON_SCAN_HAVE_SSE2 1
+#include <emmintrin.h>
+
+static inline void json_scan_classify_sse2(const char *p, struct json_scan_block *b) {
+    uint64_t m[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        /* '[' and ']' differ from '{' and '}' only in bit 0x20 */
+        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                               _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                               _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        __m128i st = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                               _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                               _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        /* signed compare: bytes from 0x80 are negative and also below 0x20 */
+        __m128i low = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+        int shift = 16 * i;
+        m[0] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+        m[1] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+        m[2] |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << shift;
+        m[3] |= (uint64_t)(uint16_t)_mm_movemask_epi8(st) << shift;
+        m[4] |= (uint64_t)(uint16_t)_mm_movemask_epi8(low) << shift;
+        m[5] |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << shift;
+    }
+    b->quote = m[0];
+    b->backslash = m[1];
+    b->whitespace = m[2];
+    b->structural = m[3];
+    b->non_ascii = m[5];
+    b->control = m[4] & ~m[5];
+}
+#endif
+
+/* The best classifier every CPU of the target has */
+static inline void json_scan_classify(const char *p, struct json_scan_block *b) {
+#ifdef JSON_SCAN_HAVE_SSE2
+    json_scan_classify_sse2(p, b);
+#else
+    json_scan_classify_scalar(p, b);
+#endif
+}
+
+/* AVX2 and AVX-512 versions, for callers compiled with
+ * __attribute__((target(...))) that checked the CPU supports it (see
+ * jsoncpu.h). Whitespace and structural characters are found with a table
+ * lookup on the low nibble of each byte. Only brackets are looked up with
+ * bit 0x20 set: folded, ':' and ',' would also match 0x1a and 0x0c. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_SCAN_HAVE_AVX2 1
+#define JSON_SCAN_HAVE_AVX512 1
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline void json_scan_classify_avx2(const char *p, struct json_scan_block *b) {
+    /* table[c & 15] == c only for the characters looked for; entry 0 of
+     * op_table is 1 so that a NUL byte does not match */
+    const __m256i ws_table = _mm256_setr_epi8(' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100,
+                                              ' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100);
+    const __m256i op_table = _mm256_setr_epi8(1, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', 0, ',', 0, 0, 0,
+                                              1, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', 0, ',', 0, 0, 0);
+    const __m256i bracket_table = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '{', 0, '}', 0, 0,
+                                                   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '{', 0, '}', 0, 0);
+    uint64_t m[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        int shift = 32 * i;
+        m[0] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << shift;
+        m[1] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << shift;
+        m[2] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_shuffle_epi8(ws_table, v))) << shift;
+        __m256i st = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_shuffle_epi8(op_table, v)),
+                                     _mm256_cmpeq_epi8(folded, _mm256_shuffle_epi8(bracket_table, v)));
+        m[3] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(st) << shift;
+        m[4] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v)) << shift;
+        m[5] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << shift;
+    }
+    b->quote = m[0];
+    b->backslash = m[1];
+    b->whitespace = m[2];
+    b->structural = m[3];
+    b->non_ascii = m[5];
+    b->control = m[4] & ~m[5];
+}
+
+/* The whole block in one register; comparisons give the masks directly */
+__attribute__((target("avx512bw")))
+static inline void json_scan_classify_avx512(const char *p, struct json_scan_block *b) {
+    const __m512i ws_table = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100));
+    const __m512i op_table = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(1, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', 0, ',', 0, 0, 0));
+    const __m512i bracket_table = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '{', 0, '}', 0, 0));
+    __m512i v = _mm512_loadu_si512((const void *)p);
+    __m512i folded = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    uint64_t low = _mm512_cmplt_epi8_mask(v, _mm512_set1_epi8(0x20));
+    b->quote = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"'));
+    b->backslash = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\\'));
+    b->whitespace = _mm512_cmpeq_epi8_mask(v, _mm512_shuffle_epi8(ws_table, v));
+    b->structural = _mm512_cmpeq_epi8_mask(v, _mm512_shuffle_epi8(op_table, v)) |
+                    _mm512_cmpeq_epi8_mask(folded, _mm512_shuffle_epi8(bracket_table, v));
+    b->non_ascii = _mm512_movepi8_mask(v);
+    b->control = low & ~b->non_ascii;
+}
+#endif
+
+/* Bit i of the result is the parity of bits 0..i of x: applied to the
+ * unescaped quotes it marks every byte from an opening quote up to, but
+ * not including, the closing one */
+static inline uint64_t json_scan_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/*====================GRAMMAR=============================*/
+
+/* Tokens as far as the grammar is concerned. Numbers and literals are
+ * checked by their scanners, the grammar only sees that a scalar is there. */
+enum json_grammar_class {
+    JSON_CLASS_SCALAR,
+    JSON_CLASS_STRING,
+    JSON_CLASS_COLON,
+    JSON_CLASS_COMMA,
+    JSON_CLASS_OPEN_OBJECT,   /* the brackets come last, see json_grammar_feed */
+    JSON_CLASS_CLOSE_OBJECT,
+    JSON_CLASS_OPEN_ARRAY,
+    JSON_CLASS_CLOSE_ARRAY
+};
+
+/* Class of the token starting with a byte; anything not listed starts a
+ * scalar (or is an error the scalar scanners report) */
+static const uint8_t json_grammar_classes[256] = {
+    ['"'] = JSON_CLASS_STRING,
+    [':'] = JSON_CLASS_COLON,
+    [','] = JSON_CLASS_COMMA,
+    ['{'] = JSON_CLASS_OPEN_OBJECT,
+    ['}'] = JSON_CLASS_CLOSE_OBJECT,
+    ['['] = JSON_CLASS_OPEN_ARRAY,
+    [']'] = JSON_CLASS_CLOSE_ARRAY
+};
+
+/* What may come next. The states name the innermost container, so only
+ * closing one needs to look at the stack. */
+enum json_grammar_state {
+    JSON_GRAMMAR_VALUE,         /* start of the document */
+    JSON_GRAMMAR_DONE,          /* after the top-level value */
+    JSON_GRAMMAR_ARRAY_FIRST,   /* after '[' */
+    JSON_GRAMMAR_ARRAY_VALUE,   /* after ',' in an array */
+    JSON_GRAMMAR_ARRAY_AFTER,   /* after a value in an array */
+    JSON_GRAMMAR_OBJECT_FIRST,  /* after '{' */
+    JSON_GRAMMAR_OBJECT_KEY,    /* after ',' in an object */
+    JSON_GRAMMAR_OBJECT_COLON,  /* after a key */
+    JSON_GRAMMAR_OBJECT_VALUE,  /* after ':' */
+    JSON_GRAMMAR_OBJECT_AFTER,  /* after a value in an object */
+    JSON_GRAMMAR_CLOSE,         /* transition only: back to the enclosing container */
+    JSON_GRAMMAR_ERROR          /* transition only */
+};
+
+#define JSON_GRAMMAR_COUNTS_VALUE 0x10
+
+/* json_grammar_table[state][class]: the next state, flagged when the token
+ * starts a value */
+#define JG_V(s) (JSON_GRAMMAR_##s | JSON_GRAMMAR_COUNTS_VALUE)
+#define JG_S(s) JSON_GRAMMAR_##s
+#define JG_E    JSON_GRAMMAR_ERROR
+static const uint8_t json_grammar_table[JSON_GRAMMAR_CLOSE][8] = {
+    /*                            scalar              string              colon               comma               {                   }          [                  ]         */
+    [JSON_GRAMMAR_VALUE] =        {JG_V(DONE),         JG_V(DONE),         JG_E,               JG_E,               JG_V(OBJECT_FIRST), JG_E,      JG_V(ARRAY_FIRST), JG_E},
+    [JSON_GRAMMAR_DONE] =         {JG_E,               JG_E,               JG_E,               JG_E,               JG_E,               JG_E,      JG_E,              JG_E},
+    [JSON_GRAMMAR_ARRAY_FIRST] =  {JG_V(ARRAY_AFTER),  JG_V(ARRAY_AFTER),  JG_E,               JG_E,               JG_V(OBJECT_FIRST), JG_E,      JG_V(ARRAY_FIRST), JG_S(CLOSE)},
+    [JSON_GRAMMAR_ARRAY_VALUE] =  {JG_V(ARRAY_AFTER),  JG_V(ARRAY_AFTER),  JG_E,               JG_E,               JG_V(OBJECT_FIRST), JG_E,      JG_V(ARRAY_FIRST), JG_E},
+    [JSON_GRAMMAR_ARRAY_AFTER] =  {JG_E,               JG_E,               JG_E,               JG_S(ARRAY_VALUE),  JG_E,               JG_E,      JG_E,              JG_S(CLOSE)},
+    [JSON_GRAMMAR_OBJECT_FIRST] = {JG_E,               JG_S(OBJECT_COLON), JG_E,               JG_E,               JG_E,               JG_S(CLOSE), JG_E,            JG_E},
+    [JSON_GRAMMAR_OBJECT_KEY] =   {JG_E,               JG_S(OBJECT_COLON), JG_E,               JG_E,               JG_E,               JG_E,      JG_E,              JG_E},
+    [JSON_GRAMMAR_OBJECT_COLON] = {JG_E,               JG_E,               JG_S(OBJECT_VALUE), JG_E,               JG_E,               JG_E,      JG_E,              JG_E},
+    [JSON_GRAMMAR_OBJECT_VALUE] = {JG_V(OBJECT_AFTER), JG_V(OBJECT_AFTER), JG_E,               JG_E,               JG_V(OBJECT_FIRST), JG_E,      JG_V(ARRAY_FIRST), JG_E},
+    [JSON_GRAMMAR_OBJECT_AFTER] = {JG_E,               JG_E,               JG_E,               JG_S(OBJECT_KEY),   JG_E,               JG_S(CLOSE), JG_E,            JG_E}
+};
+#undef JG_S
+#undef JG_V
+#undef JG_E
+
+/* Checks a token sequence against the RFC 8259 grammar without
+ * allocating: the open containers are a stack of bits, 1 for an object */
+struct json_grammar {
+    unsigned state;
+    size_t depth;
+    size_t max_depth;
+    size_t values;
+    uint64_t stack[JSON_MAX_DEPTH / 64];
+};
+
+static inline void json_grammar_init(struct json_grammar *g) {
+    g->state = JSON_GRAMMAR_VALUE;
+    g->depth = 0;
+    g->max_depth = 0;
+    g->values = 0;
+}
+
+/* Describes why a token of class cls cannot follow in state */
+static inline const char *json_grammar_error(unsigned state, unsigned cls) {
+    switch (state) {
+        case JSON_GRAMMAR_OBJECT_FIRST:
+        case JSON_GRAMMAR_OBJECT_KEY:
+            return "Expected a string key";
+        case JSON_GRAMMAR_OBJECT_COLON:
+            return "Expected ':' after key";
+        case JSON_GRAMMAR_OBJECT_AFTER:
+            return "Expected ',' or '}'";
+        case JSON_GRAMMAR_ARRAY_AFTER:
+            return "Expected ',' or ']'";
+        case JSON_GRAMMAR_DONE:
+            return "Unexpected data after the document";
+    }
+    if (cls == JSON_CLASS_OPEN_OBJECT || cls == JSON_CLASS_OPEN_ARRAY)
+        return "Maximum nesting depth exceeded";
+    return "Expected a value";
+}
+
+/* Feeds the next token; returns NULL if it may appear here, otherwise
+ * a static description of the error and the state is left unchanged */
+JSON_SCAN_INLINE const char *json_grammar_feed(struct json_grammar *g, unsigned cls) {
+    unsigned next = json_grammar_table[g->state][cls];
+    if (next == JSON_GRAMMAR_ERROR) return json_grammar_error(g->state, cls);
+    g->values += next >> 4;
+    next &= 0xF;
+
+    /* only brackets touch the stack */
+    if (cls >= JSON_CLASS_OPEN_OBJECT) {
+        if (next == JSON_GRAMMAR_CLOSE) {
+            g->depth--;
+            if (!g->depth) {
+                next = JSON_GRAMMAR_DONE;
+            } else {
+                size_t top = g->depth - 1;
+                next = (g->stack[top >> 6] >> (top & 63)) & 1 ? JSON_GRAMMAR_OBJECT_AFTER : JSON_GRAMMAR_ARRAY_AFTER;
+            }
+        } else {
+            if (g->depth == JSON_MAX_DEPTH) {
+                g->values--;
+                return json_grammar_error(JSON_GRAMMAR_VALUE, cls);
+            }
+            uint64_t bit = 1ULL << (g->depth & 63);
+            if (cls == JSON_CLASS_OPEN_OBJECT) g->stack[g->depth >> 6] |= bit;
+            else g->stack[g->depth >> 6] &= ~bit;
+            if (++g->depth > g->max_depth) g->max_depth = g->depth;
+        }
+    }
+    g->state = next;
+    return NULL;
+}
+
+/* The classes of token that may come next, as bits 1 << class. Nothing
+ * may once the document is complete. */
+static inline unsigned json_grammar_expected(const struct json_grammar *g) {
+    unsigned bits = 0;
+    if (g->state == JSON_GRAMMAR_DONE) return 0;
+    for (unsigned cls = 0; cls <= JSON_CLASS_CLOSE_ARRAY; cls++) {
+        if (json_grammar_table[g->state][cls] != JSON_GRAMMAR_ERROR) bits |= 1u << cls;
+    }
+    return bits;
+}
+
+/* Checks that the document is complete */
+static inline const char *json_grammar_end(const struct json_grammar *g) {
+    return g->state == JSON_GRAMMAR_DONE ? NULL : "Unexpected end of input";
+}
+
+/* Steps over the value at p, checking it without building anything.
+ * Returns a pointer past it and sets *depth to its nesting depth, or
+ * returns the offending byte and sets *error. */
+static inline const char *json_scan_value(const char *p, const char *end, size_t *depth, const char **error) {
+    *depth = 0;
+    /* most values skipped are strings, no grammar needed for those */
+    if (p < end && *p == '"') return json_scan_string(p + 1, end, error);
+
+    struct json_grammar g;
+    json_grammar_init(&g);
+    do {
+        p = json_skip_whitespace(p, end);
+        if (p == end) {
+            *error = "Unexpected end of input";
+            return p;
+        }
+        unsigned cls = json_grammar_classes[(unsigned char)*p];
+        const char *e = json_grammar_feed(&g, cls);
+        if (!e) {
+            if (cls == JSON_CLASS_STRING) {
+                p = json_scan_string(p + 1, end, &e);
+            } else if (cls != JSON_CLASS_SCALAR) {
+                p++;
+            } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+                p = json_scan_number(p, end, &e);
+            } else {
+                size_t n = json_scan_literal(p, end);
+                if (!n) e = "Unexpected character";
+                p += n;
+            }
+        }
+        if (e) {
+            *error = e;
+            return p;
+        }
+    } while (g.state != JSON_GRAMMAR_DONE);
+
+    *depth = g.max_depth;
+    return p;
+}
+
+/*====================LINE RANGES=========================*/
+
+/* Buffers of lines (NDJSON) are worked on by threads, each given a range
+ * of whole lines. The ranges of a caller are structs of its own, size
+ * bytes apart, each starting with this. */
+struct json_scan_range {
+    const char *buf;
+    size_t len;
+    pthread_t thread;
+    int started;
+};
+
+/* Ranges shorter than this are not worth a thread */
+#define JSON_SCAN_MIN_RANGE ((size_t)64 << 10)
+
+static inline struct json_scan_range *json_scan_range_at(void *ranges, size_t size, size_t k) {
+    return (struct json_scan_range *)((char *)ranges + k * size);
+}
+
+/* How many ranges len bytes are split into for at most threads threads */
+static inline size_t json_scan_range_count(size_t len, unsigned threads) {
+    size_t n = threads ? threads : 1;
+    size_t most = len / JSON_SCAN_MIN_RANGE;
+    return n > most ? (most ? most : 1) : n;
+}
+
+/* Splits buf[0..len) between the n ranges, each but the last ending just
+ * past a newline (some may be left empty) */
+static inline void json_scan_split_lines(const char *buf, size_t len, void *ranges, size_t size, size_t n) {
+    size_t start = 0;
+    for (size_t k = 0; k < n; k++) {
+        size_t stop = len * (k + 1) / n;
+        if (stop < start) stop = start;
+        if (k + 1 < n && stop < len) {
+            const char *newline = memchr(buf + stop, '\n', len - stop);
+            stop = newline ? (size_t)(newline - buf) + 1 : len;
+        } else {
+            stop = len;
+        }
+        struct json_scan_range *r = json_scan_range_at(ranges, size, k);
+        r->buf = buf + start;
+        r->len = stop - start;
+        start = stop;
+    }
+}
+
+/* Calls run on each of the n ranges: the first in the calling thread, the
+ * others on threads of their own, or in the calling thread when one cannot
+ * be started. Returns once they are all done. */
+static inline void json_scan_run_ranges(void *(*run)(void *), void *ranges, size_t size, size_t n) {
+    for (size_t k = 1; k < n; k++) {
+        struct json_scan_range *r = json_scan_range_at(ranges, size, k);
+        r->started = pthread_create(&r->thread, NULL, run, r) == 0;
+        if (!r->started) run(r);
+    }
+    run(ranges);
+    for (size_t k = 1; k < n; k++) {
+        struct json_scan_range *r = json_scan_range_at(ranges, size, k);
+        if (r->started) pthread_join(r->thread, NULL);
+    }
+}
+
+#endif  /* JSONSCAN_H */
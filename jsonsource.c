@@ -0,0 +1,389 @@
+#include "jsonsource.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The containers of the tree form a tree of spans of their own. A span
+ * starts where its parent starts plus its start field, so an edit shifts
+ * the spans after it on the path from the top only. */
+struct span {
+    json_value *value;
+    size_t start;           /* of the opening bracket, from the start of the parent (of the text for the top) */
+    size_t length;          /* through the closing bracket */
+    size_t position;        /* of value among the items or members of the parent */
+    struct span *children;  /* the containers among them, by start */
+    size_t count;
+};
+
+struct json_source {
+    char *text;             /* a gap buffer: text[0, gap) then text[gap_end, size) */
+    size_t size;
+    size_t gap;
+    size_t gap_end;
+    json_parse_options options;
+    int limited;            /* limits are set: every edit parses everything */
+    json_value *root;
+    struct span top;        /* span of root, if root is a container */
+};
+
+/*====================TEXT================================*/
+
+static size_t text_length(const json_source *s) {
+    return s->size - (s->gap_end - s->gap);
+}
+
+/* Moves the gap to offset in the text */
+static void move_gap(json_source *s, size_t offset) {
+    if (offset < s->gap) {
+        size_t n = s->gap - offset;
+        memmove(s->text + s->gap_end - n, s->text + offset, n);
+        s->gap -= n;
+        s->gap_end -= n;
+    } else if (offset > s->gap) {
+        size_t n = offset - s->gap;
+        memmove(s->text + s->gap, s->text + s->gap_end, n);
+        s->gap += n;
+        s->gap_end += n;
+    }
+}
+
+/* Makes the gap at least n bytes, with room to spare */
+static int reserve_gap(json_source *s, size_t n) {
+    if (s->gap_end - s->gap >= n) return 1;
+    size_t tail = s->size - s->gap_end;
+    size_t size = text_length(s) + n;
+    size += size / 8 + 4096;
+    char *text = json_realloc(s->text, size);
+    if (!text) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to grow the source text");
+        return 0;
+    }
+    memmove(text + size - tail, text + s->gap_end, tail);
+    s->text = text;
+    s->gap_end = size - tail;
+    s->size = size;
+    return 1;
+}
+
+/* Replaces removed bytes at offset with len bytes of text; the gap must
+ * hold len bytes already */
+static void replace_text(json_source *s, size_t offset, size_t removed, const char *text, size_t len) {
+    move_gap(s, offset);
+    if (len) memcpy(s->text + s->gap, text, len);
+    s->gap += len;
+    s->gap_end += removed;
+}
+
+/*====================SPANS===============================*/
+
+/* Containers reported by the parser: open addressing on the node address */
+struct span_entry {
+    const json_value *node;
+    size_t start;
+    size_t end;
+};
+
+struct span_map {
+    struct span_entry *entries;
+    size_t mask;
+    size_t count;
+};
+
+static size_t map_slot(const struct span_map *map, const json_value *node) {
+    uint64_t h = (uint64_t)(uintptr_t)node;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & map->mask;
+}
+
+static struct span_entry *map_find(const struct span_map *map, const json_value *node) {
+    for (size_t i = map_slot(map, node);; i = (i + 1) & map->mask) {
+        struct span_entry *e = &map->entries[i];
+        if (!e->node || e->node == node) return e;
+    }
+}
+
+static int map_grow(struct span_map *map) {
+    struct span_map bigger = {NULL, map->mask ? map->mask * 2 + 1 : 63, map->count};
+    bigger.entries = json_calloc(bigger.mask + 1, sizeof(struct span_entry));
+    if (!bigger.entries) return 0;
+    for (size_t i = 0; map->mask && i <= map->mask; i++) {
+        if (map->entries[i].node) *map_find(&bigger, map->entries[i].node) = map->entries[i];
+    }
+    json_mfree(map->entries);
+    *map = bigger;
+    return 1;
+}
+
+/* json_span_fn: the last report for a node holds */
+static int map_put(void *ctx, const json_value *node, size_t start, size_t end) {
+    struct span_map *map = ctx;
+    if ((map->count + 1) * 2 > map->mask + 1 && !map_grow(map)) return 0;
+    struct span_entry *e = map_find(map, node);
+    if (!e->node) map->count++;
+    e->node = node;
+    e->start = start;
+    e->end = end;
+    return 1;
+}
+
+static void spans_free(struct span *sp) {
+    for (size_t i = 0; i < sp->count; i++) spans_free(&sp->children[i]);
+    json_mfree(sp->children);
+    sp->children = NULL;
+    sp->count = 0;
+}
+
+static int span_compare(const void *a, const void *b) {
+    const struct span *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int is_container(const json_value *v) {
+    return v->type == JSON_ARRAY || v->type == JSON_OBJECT;
+}
+
+/* Fills sp for the container v, a child of the container starting at
+ * base, and the spans below it, from the offsets the parser reported */
+static int span_build(struct span *sp, json_value *v, size_t base, size_t position, const struct span_map *map) {
+    const struct span_entry *e = map_find(map, v);
+    sp->value = v;
+    sp->start = e->start - base;
+    sp->length = e->end - e->start;
+    sp->position = position;
+    sp->children = NULL;
+    sp->count = 0;
+
+    /* packed arrays hold numbers only */
+    size_t n = v->type == JSON_OBJECT ? v->u.object.count : v->u.array.numbers ? 0 : v->u.array.count;
+    size_t containers = 0;
+    for (size_t i = 0; i < n; i++) {
+        json_value *child = v->type == JSON_OBJECT ? v->u.object.members[i].value : v->u.array.items[i];
+        containers += is_container(child);
+    }
+    if (!containers) return 1;
+
+    sp->children = json_malloc(containers * sizeof(struct span));
+    if (!sp->children) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate container spans");
+        return 0;
+    }
+    int sorted = 1;
+    for (size_t i = 0; i < n; i++) {
+        json_value *child = v->type == JSON_OBJECT ? v->u.object.members[i].value : v->u.array.items[i];
+        if (!is_container(child)) continue;
+        struct span *c = &sp->children[sp->count++];
+        if (!span_build(c, child, e->start, i, map)) {
+            sp->count--;
+            spans_free(sp);
+            return 0;
+        }
+        sorted = sorted && (sp->count == 1 || c[-1].start < c->start);
+    }
+    /* a value kept from a later repeated key sits at the first one's position */
+    if (!sorted) qsort(sp->children, sp->count, sizeof(struct span), span_compare);
+    return 1;
+}
+
+/* Parses len bytes at text into *out, with the span of its top container
+ * in *top (count 0 and no children for a scalar) */
+static int parse_spans(json_source *s, const char *text, size_t len, json_value **out, struct span *top) {
+    struct span_map map = {NULL, 0, 0};
+    json_value *v = json_parse_spans(text, len, &s->options, map_put, &map);
+    int ok = v != NULL;
+    memset(top, 0, sizeof(*top));
+    if (ok && is_container(v)) ok = span_build(top, v, 0, 0, &map);
+    json_mfree(map.entries);
+    if (!ok) {
+        json_free(v);
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+/*====================SOURCE==============================*/
+
+json_source *json_source_parse(const char *text, size_t len, const json_parse_options *options) {
+    if (!text) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL input string provided");
+        return NULL;
+    }
+    json_source *s = json_calloc(1, sizeof(json_source));
+    if (!s) {
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to allocate the source");
+        return NULL;
+    }
+    if (options) s->options = *options;
+    s->limited = s->options.max_depth || s->options.max_bytes || s->options.max_nodes ||
+                 s->options.max_string_length || s->options.max_container_size;
+
+    if (!reserve_gap(s, len + 1)) {
+        json_mfree(s);
+        return NULL;
+    }
+    replace_text(s, 0, 0, text, len);
+    if (!parse_spans(s, s->text, len, &s->root, &s->top)) {
+        json_mfree(s->text);
+        json_mfree(s);
+        return NULL;
+    }
+    return s;
+}
+
+void json_source_free(json_source *s) {
+    if (!s) return;
+    spans_free(&s->top);
+    json_free(s->root);
+    json_mfree(s->text);
+    json_mfree(s);
+}
+
+const json_value *json_source_root(const json_source *s) {
+    return s->root;
+}
+
+const char *json_source_text(json_source *s, size_t *len) {
+    size_t n = text_length(s);
+    move_gap(s, n);
+    s->text[n] = '\0';  /* the gap always has a byte left */
+    if (len) *len = n;
+    return s->text;
+}
+
+/* Parses the whole text again, replacing tree and spans */
+static int reparse_all(json_source *s) {
+    size_t len = text_length(s);
+    move_gap(s, len);
+    json_value *root;
+    struct span top;
+    if (!parse_spans(s, s->text, len, &root, &top)) return 0;
+    spans_free(&s->top);
+    json_free(s->root);
+    s->root = root;
+    s->top = top;
+    return 1;
+}
+
+/* Parses the container at the end of path again, delta bytes longer than
+ * before; starts holds the start of each span of path in the text */
+static int reparse_container(json_source *s, struct span **path, const size_t *starts, size_t depth,
+                             ptrdiff_t delta) {
+    struct span *target = path[depth - 1];
+    size_t start = starts[depth - 1];
+    size_t length = (size_t)((ptrdiff_t)target->length + delta);
+
+    /* the container is parsed in place, in one piece before the gap */
+    move_gap(s, start + length);
+    json_value *v;
+    struct span fresh;
+    /* the brackets are untouched, so this is a container of the same kind */
+    if (!parse_spans(s, s->text + start, length, &v, &fresh)) return 0;
+
+    /* the nodes on the way down may be shared with clones of the tree:
+     * mutable access gives the path its own nodes */
+    for (size_t i = 1; i + 1 < depth; i++) {
+        json_value *parent = path[i - 1]->value;
+        json_value *child = parent->type == JSON_OBJECT ? json_object_get_mut_at(parent, path[i]->position)
+                                                        : json_array_get_mut(parent, path[i]->position);
+        if (!child) {
+            spans_free(&fresh);
+            json_free(v);
+            return 0;
+        }
+        path[i]->value = child;
+    }
+    json_value *old;
+    if (depth == 1) {
+        old = s->root;
+        s->root = v;
+    } else {
+        json_value *parent = path[depth - 2]->value;
+        old = parent->type == JSON_OBJECT ? json_object_exchange_at(parent, target->position, v)
+                                          : json_array_exchange(parent, target->position, v);
+        if (!old) {
+            spans_free(&fresh);
+            json_free(v);
+            return 0;
+        }
+    }
+    json_free(old);
+
+    spans_free(target);
+    target->value = v;
+    target->length = length;
+    target->children = fresh.children;
+    target->count = fresh.count;
+
+    /* the enclosing containers grow and the ones after the edit move */
+    for (size_t i = 0; i + 1 < depth; i++) {
+        path[i]->length = (size_t)((ptrdiff_t)path[i]->length + delta);
+        struct span *last = path[i]->children + path[i]->count;
+        for (struct span *c = path[i + 1] + 1; c < last; c++) c->start = (size_t)((ptrdiff_t)c->start + delta);
+    }
+    return 1;
+}
+
+int json_source_edit(json_source *s, size_t offset, size_t removed, const char *text, size_t len) {
+    size_t total = s ? text_length(s) : 0;
+    if (!s || offset > total || removed > total - offset || (!text && len)) {
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "edit out of the source text");
+        return 0;
+    }
+
+    /* the path from the top to the smallest container holding the whole
+     * edit inside its brackets */
+    struct span *path[JSON_MAX_DEPTH];
+    size_t starts[JSON_MAX_DEPTH];
+    size_t depth = 0;
+    size_t end = offset + removed;
+    if (!s->limited && s->top.value && s->top.start < offset && end < s->top.start + s->top.length) {
+        struct span *sp = &s->top;
+        size_t base = sp->start;
+        for (;;) {
+            path[depth] = sp;
+            starts[depth++] = base;
+            /* the last child starting before the edit */
+            size_t lo = 0, hi = sp->count;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (base + sp->children[mid].start < offset) lo = mid + 1;
+                else hi = mid;
+            }
+            if (!lo) break;
+            struct span *c = &sp->children[lo - 1];
+            if (end >= base + c->start + c->length) break;
+            sp = c;
+            base += c->start;
+        }
+    }
+
+    /* what the edit removes, to put it back if the result does not parse */
+    char *saved = NULL;
+    if (removed) {
+        saved = json_malloc(removed);
+        if (!saved) {
+            json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, "failed to save the edited text");
+            return 0;
+        }
+        move_gap(s, offset);
+        memcpy(saved, s->text + s->gap_end, removed);
+    }
+    if (!reserve_gap(s, len + 1)) {
+        json_mfree(saved);
+        return 0;
+    }
+    replace_text(s, offset, removed, text, len);
+
+    ptrdiff_t delta = (ptrdiff_t)len - (ptrdiff_t)removed;
+    int ok = depth && reparse_container(s, path, starts, depth, delta);
+    /* an edit that splits or joins containers shows in the whole text only */
+    if (!ok) ok = reparse_all(s);
+    if (!ok) replace_text(s, offset, len, saved, removed);
+    json_mfree(saved);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef JSONSOURCE_H
+#define JSONSOURCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jsonparser.h"
+
+/* Parsed documents that follow edits of their text.
+ *
+ * A json_source keeps the text of a document with its tree, and where in
+ * the text every container of the tree starts and ends. An edit replaces
+ * a range of bytes; only the smallest container enclosing it, brackets
+ * untouched, is parsed again and takes the place of the old one. The rest
+ * of the tree is kept as it is, nodes included, and the containers after
+ * the edit are shifted. If the container alone no longer parses (the edit
+ * split or merged containers), the whole text is parsed.
+ *
+ * Container offsets are kept relative to the enclosing container, so an
+ * edit updates the path down to it and the later siblings along that
+ * path, not every container after it. The text is held in a gap buffer
+ * moved to each edit: edits near one another cost what they change, not
+ * the size of the document. */
+
+typedef struct json_source json_source;
+
+/* Parses the len bytes at text, which are copied. options may be NULL;
+ * they apply to every later parse. With any limit set, edits parse the
+ * whole text again, as limits are meant for whole documents. Returns NULL
+ * if text is not valid JSON. */
+json_source *json_source_parse(const char *text, size_t len, const json_parse_options *options);
+void json_source_free(json_source *source);
+
+/* Replaces the removed bytes at offset with the len bytes at text. Returns
+ * 1 once the tree matches the new text. If the new text is not valid
+ * JSON, returns 0 with the error recorded (offsets are those of the new
+ * text) and leaves the source as it was. */
+int json_source_edit(json_source *source, size_t offset, size_t removed, const char *text, size_t len);
+
+/* The tree, owned by the source. An edit frees the nodes of the container
+ * it re-parses; all other nodes stay where they are. Clone it to keep a
+ * copy across edits. */
+const json_value *json_source_root(const json_source *source);
+
+/* The text, NUL-terminated, valid until the next edit. *len may be NULL. */
+const char *json_source_text(json_source *source, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONSOURCE_H */
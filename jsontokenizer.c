@@ -1,51 +1,63 @@
 #include "jsontokenizer.h"
+#include "jsonscan.h"
+#include "jsonalloc.h"
+#include "jsonerror.h"
 
-/* Global error message buffer */
-static char error_buffer[256] = {0};
+/* Records an error of the input at offset and returns 0 (error code).
+ * Nothing is formatted until the message is asked for. */
+static int syntax_error(size_t offset, const char *detail) {
+    json_set_error(JSON_ERROR_SYNTAX, offset, detail);
+    return 0;
+}
 
-/* Sets the current error message and returns 0 (error code) */
-static int set_error(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    vsnprintf(error_buffer, sizeof(error_buffer) - 1, format, args);
-    va_end(args);
+/* Records that the input goes over a limit at offset and returns 0 */
+static int limit_error(size_t offset, const char *detail) {
+    json_set_error(JSON_ERROR_LIMIT, offset, detail);
     return 0;
 }
 
+/* The tokens that could have come, as JSON_TOKEN_* bits, which follow the
+ * grammar classes of jsonscan.h */
+static unsigned expected_tokens(const struct json_grammar *g) {
+    return g->state == JSON_GRAMMAR_DONE ? JSON_TOKEN_END : json_grammar_expected(g);
+}
+
 /* Gets the last error message */
 const char* get_tokenizer_error() {
-    return error_buffer;
+    return json_get_last_error();
 }
 
 /* Safe memory allocation with error handling */
-static void* safe_malloc(size_t size, const char *error_context) {
-    void *ptr = malloc(size);
+static void* safe_malloc(size_t size, const char *error_detail) {
+    void *ptr = json_malloc(size);
     if (!ptr) {
-        set_error("Memory allocation failed for %s", error_context);
+        json_set_error(JSON_ERROR_OUT_OF_MEMORY, JSON_NO_OFFSET, error_detail);
     }
     return ptr;
 }
 
 /* Creates a new token node representing the end of file */
 static struct JSONTokenNode* createEofNode() {
-    struct JSONTokenNode *n = safe_malloc(sizeof(struct JSONTokenNode), "EOF token node");
+    struct JSONTokenNode *n = safe_malloc(sizeof(struct JSONTokenNode), "failed to allocate the EOF token");
     if (!n) return NULL;
     
     n->token.type = END;
     n->token.value = NULL; /* No value needed for EOF token */
+    n->token.offset = 0;
+    n->token.count = 0;
     n->next = NULL;
     return n;
 }
 
 /* Creates a new token node with the specified value and type */
 struct JSONTokenNode* createNode(char *value, enum JSONTokenType t) {
-    struct JSONTokenNode *n = safe_malloc(sizeof(struct JSONTokenNode), "token node");
+    struct JSONTokenNode *n = safe_malloc(sizeof(struct JSONTokenNode), "failed to allocate a token");
     if (!n) return NULL;
     
     if (value) {
-        n->token.value = safe_malloc(strlen(value) + 1, "token value");
+        n->token.value = safe_malloc(strlen(value) + 1, "failed to allocate a token value");
         if (!n->token.value) {
-            free(n);
+            json_mfree(n);
             return NULL;
         }
         strcpy(n->token.value, value);
@@ -54,13 +66,21 @@ struct JSONTokenNode* createNode(char *value, enum JSONTokenType t) {
     }
     
     n->token.type = t;
+    n->token.offset = 0;
+    n->token.count = 0;
     n->next = NULL;
     return n;
 }
 
 /* Initializes a new, empty token list */
 struct JSONTokenList* initTokenList() {
-    return safe_malloc(sizeof(struct JSONTokenList), "token list");
+    struct JSONTokenList *l = safe_malloc(sizeof(struct JSONTokenList), "failed to allocate the token list");
+    if (!l) return NULL;
+
+    l->head = NULL;
+    l->tail = NULL;
+    l->bytes = sizeof(struct JSONTokenList);
+    return l;
 }
 
 struct JSONTokenNode* nextToken(struct JSONTokenNode *n) {
@@ -69,58 +89,52 @@ struct JSONTokenNode* nextToken(struct JSONTokenNode *n) {
 }
 
 /* Parses a JSON string token from the input */
-int readTokenString(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len) {
+int readTokenString(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len) {
     if (*curPos >= len) {
-        return set_error("Unexpected end of input while reading string");
-    }
-    
-    int start = *curPos + 1;  /* Skip opening quotation mark */
-    (*curPos)++;
-    
-    /* Find end of string */
-    while (*curPos < len && jsonString[*curPos] != '"') {
-        /* Handle escape sequences */
-        if (jsonString[*curPos] == '\\') {
-            (*curPos)++;
-            if (*curPos >= len) {
-                return set_error("Unterminated string: unexpected end after escape character");
-            }
-        }
-        (*curPos)++;
+        return syntax_error(*curPos, "Unexpected end of input while reading string");
     }
     
-    if (*curPos >= len) {
-        return set_error("Unterminated string: reached end of input");
+    size_t start = *curPos + 1;  /* Skip opening quotation mark */
+
+    /* Find end of string, validating escapes and UTF-8 on the way */
+    const char *error = NULL;
+    const char *stop = json_scan_string_with(jsonString + start, jsonString + len, &error, json_scan_string_plain_kernel);
+    if (error) {
+        return syntax_error((size_t)(stop - jsonString), error);
     }
-    
-    int end = *curPos - 1;
-    (*curPos)++;  /* Skip closing quotation mark */
 
-    /* Create string token */
-    int length = end - start + 1;
-    char *valueString = NULL;
-    
-    if (length > 0) {
-        valueString = safe_malloc(length + 1, "string token value");
-        if (!valueString) return 0;
-        
-        strncpy(valueString, jsonString + start, length);
-        valueString[length] = '\0';
-    } else {
-        /* Empty string */
-        valueString = safe_malloc(1, "empty string token");
-        if (!valueString) return 0;
-        
-        valueString[0] = '\0';
+    *curPos = (size_t)(stop - jsonString);  /* past the closing quotation mark */
+
+    /* Create string token, decoding the escape sequences. The decoded
+     * text is never longer than the raw one. */
+    size_t length = *curPos - 1 - start;
+    char *valueString = safe_malloc(length + 1, "failed to allocate a string");
+    if (!valueString) return 0;
+
+    size_t out = 0;
+    const char *raw = jsonString + start;
+    const char *rawEnd = raw + length;
+    while (raw < rawEnd) {
+        const char *plain = raw;
+        while (raw < rawEnd && *raw != '\\') raw++;
+        memcpy(valueString + out, plain, (size_t)(raw - plain));
+        out += (size_t)(raw - plain);
+        if (raw < rawEnd) {
+            size_t written;
+            raw += json_scan_unescape(raw, rawEnd, valueString + out, &written);
+            out += written;
+        }
     }
+    valueString[out] = '\0';
     
     struct JSONTokenNode *node = createNode(valueString, STRING);
-    free(valueString); /* createNode makes a copy */
+    json_mfree(valueString); /* createNode makes a copy */
     
     if (!node) return 0;
+    node->token.offset = start - 1;
     if (!appendTokenToList(l, node)) {
-        free(node->token.value);
-        free(node);
+        json_mfree(node->token.value);
+        json_mfree(node);
         return 0;
     }
     
@@ -128,136 +142,77 @@ int readTokenString(struct JSONTokenList *l, char *jsonString, int *curPos, size
 }
 
 /* Parses a JSON number token from the input */
-int readTokenNumber(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len) {
+int readTokenNumber(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len) {
     if (*curPos >= len) {
-        return set_error("Unexpected end of input while reading number");
-    }
-    
-    int start = *curPos;
-    int hasDecimal = 0;
-    int hasExponent = 0;
-    int hasDigits = 0;
-    
-    /* Handle negative sign */
-    if (jsonString[*curPos] == '-') {
-        (*curPos)++;
-        if (*curPos >= len || !isdigit(jsonString[*curPos])) {
-            return set_error("Invalid number format: - must be followed by digits");
-        }
-    }
-    
-    /* Read integer part */
-    if (*curPos < len && jsonString[*curPos] == '0') {
-        hasDigits = 1;
-        (*curPos)++;
-        /* Leading zero must not be followed by another digit */
-        if (*curPos < len && isdigit(jsonString[*curPos])) {
-            return set_error("Invalid number format: leading zero must not be followed by another digit");
-        }
-    } else {
-        /* Read 1-9 followed by optional digits */
-        while (*curPos < len && isdigit(jsonString[*curPos])) {
-            hasDigits = 1;
-            (*curPos)++;
-        }
-    }
-    
-    if (!hasDigits) {
-        return set_error("Invalid number format: no digits found");
-    }
-    
-    /* Read decimal part */
-    if (*curPos < len && jsonString[*curPos] == '.') {
-        hasDecimal = 1;
-        (*curPos)++;
-        
-        /* Must have at least one digit after decimal */
-        hasDigits = 0;
-        while (*curPos < len && isdigit(jsonString[*curPos])) {
-            hasDigits = 1;
-            (*curPos)++;
-        }
-        
-        if (!hasDigits) {
-            return set_error("Invalid number format: no digits after decimal point");
-        }
+        return syntax_error(*curPos, "Unexpected end of input while reading number");
     }
     
-    /* Read exponent part */
-    if (*curPos < len && (jsonString[*curPos] == 'e' || jsonString[*curPos] == 'E')) {
-        hasExponent = 1;
-        (*curPos)++;
-        
-        /* Handle optional sign in exponent */
-        if (*curPos < len && (jsonString[*curPos] == '+' || jsonString[*curPos] == '-')) {
-            (*curPos)++;
-        }
-        
-        /* Must have at least one digit in exponent */
-        hasDigits = 0;
-        while (*curPos < len && isdigit(jsonString[*curPos])) {
-            hasDigits = 1;
-            (*curPos)++;
-        }
-        
-        if (!hasDigits) {
-            return set_error("Invalid number format: no digits in exponent");
-        }
+    size_t start = *curPos;
+
+    const char *error = NULL;
+    const char *stop = json_scan_number(jsonString + start, jsonString + len, &error);
+    if (error) {
+        return syntax_error((size_t)(stop - jsonString), error);
     }
+    *curPos = (size_t)(stop - jsonString);
     
     /* Extract and create the token */
-    int length = *curPos - start;
-    char *valueNumber = safe_malloc(length + 1, "number token value");
+    size_t length = *curPos - start;
+    char *valueNumber = safe_malloc(length + 1, "failed to allocate a number");
     if (!valueNumber) return 0;
     
     strncpy(valueNumber, jsonString + start, length);
     valueNumber[length] = '\0';
     
     struct JSONTokenNode *node = createNode(valueNumber, NUMBER);
-    free(valueNumber); /* createNode makes a copy */
+    json_mfree(valueNumber); /* createNode makes a copy */
     
     if (!node) return 0;
+    node->token.offset = start;
     if (!appendTokenToList(l, node)) {
-        free(node->token.value);
-        free(node);
+        json_mfree(node->token.value);
+        json_mfree(node);
         return 0;
     }
     
     return 1;
 }
 
-int readTokenKeyword(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len) {
-	int start = *curPos;
+int readTokenKeyword(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len) {
+	size_t start = *curPos;
 	(*curPos)++;
-	while(jsonString[*curPos] >= 'a' && jsonString[*curPos] <= 'z') {
+	while(*curPos < len && jsonString[*curPos] >= 'a' && jsonString[*curPos] <= 'z') {
 		(*curPos)++;
 	}
-	int end = *curPos - 1;
-	char valueKeyword[end-start+2];
-	strncpy(valueKeyword,jsonString+start,end-start+1);
-	appendTokenToList(l,createNode(valueKeyword,KEYWORD));
+	size_t length = *curPos - start;
+	/* only true, false and null are keywords */
+	if (json_scan_literal(jsonString + start, jsonString + len) != length) {
+		return syntax_error(start, "Invalid keyword");
+	}
+	char valueKeyword[length+1];
+	strncpy(valueKeyword,jsonString+start,length);
+	valueKeyword[length] = '\0';
+	struct JSONTokenNode *node = createNode(valueKeyword,KEYWORD);
+	if (!node) return 0;
+	node->token.offset = start;
+	return appendTokenToList(l,node);
 }
 
 /* Adds a token to the end of the list */
 int appendTokenToList(struct JSONTokenList *l, struct JSONTokenNode *t) {
     if (!l) {
-        return set_error("NULL token list provided");
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL token list provided");
+        return 0;
     }
     
     if (!t) {
-        return set_error("NULL token node provided");
-    }
-    
-    if (!l->head) {
-        l->head = t;
-        return 1;
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL token node provided");
+        return 0;
     }
     
-    struct JSONTokenNode *tmp = l->head;
-    while (tmp->next) {
-        tmp = tmp->next;
-    }
-    tmp->next = t;
+    if (!l->head) l->head = t;
+    else l->tail->next = t;
+    l->tail = t;
     return 1;
 }
 
@@ -271,34 +226,79 @@ void printTokenList(struct JSONTokenList *l) {
 	}
 }
 
+/* Counts the token read from start to current and checks it against the
+ * limits, which may be NULL. Returns 0 with the error recorded if one is
+ * exceeded. */
+static int checkToken(struct JSONTokenList *l, const struct json_grammar *g, const struct JSONTokenLimits *limits,
+                      const char *f, size_t start, size_t current) {
+    /* the node and a copy of the token, which is never longer than its text */
+    l->bytes += sizeof(struct JSONTokenNode) + current - start + 1;
+    if (!limits) return 1;
+
+    if (limits->maxDepth && g->depth > limits->maxDepth) {
+        return limit_error(start, "Nesting depth limit exceeded");
+    }
+    if (limits->maxValues && g->values > limits->maxValues) {
+        return limit_error(start, "Value count limit exceeded");
+    }
+    if (limits->maxStringLength && f[start] == '"' && current - start - 2 > limits->maxStringLength) {
+        return limit_error(start, "String length limit exceeded");
+    }
+    if (limits->maxBytes && l->bytes > limits->maxBytes) {
+        return limit_error(start, "Memory limit exceeded");
+    }
+    return 1;
+}
+
 struct JSONTokenList* buildTokenList(const char *f, size_t len) {
+    return buildTokenListWithLimits(f, len, NULL);
+}
+
+struct JSONTokenList* buildTokenListWithLimits(const char *f, size_t len, const struct JSONTokenLimits *limits) {
     if (!f) {
-        set_error("NULL input string provided");
+        json_set_error(JSON_ERROR_INVALID_ARGUMENT, JSON_NO_OFFSET, "NULL input string provided");
         return NULL;
     }
     
     struct JSONTokenList *l = initTokenList();
     if (!l) return NULL;
+
+    /* every token is checked against the grammar as it is read, so only
+     * well-formed documents produce a token list */
+    struct json_grammar grammar;
+    json_grammar_init(&grammar);
+
+    /* the containers open at the current token, whose children are
+     * counted for the parser to allocate them at their size */
+    struct JSONTokenNode *open[JSON_MAX_DEPTH];
+    size_t depth = 0;
     
-    int current = 0;
+    size_t current = 0;
     while (current < len) {
         char c = f[current];
 
+        if (json_scan_is_whitespace(c)) {
+            current = (size_t)(json_skip_whitespace(f + current, f + len) - f);
+            continue;
+        }
+
+        unsigned cls = json_grammar_classes[(unsigned char)c];
+        const char *grammarError = json_grammar_feed(&grammar, cls);
+        if (grammarError) {
+            syntax_error(current, grammarError);
+            json_set_error_tokens(expected_tokens(&grammar), 1u << cls);
+            freeTokenList(l);
+            return NULL;
+        }
+
+        size_t start = current;
         switch(c) {
-            case ' ':
-            case '\n':
-            case '\t':
-            case '\r':
-                current++;
-                break;
-                
             case '{':
             case '}':
             case '[':
             case ']':
             case ',':
-            case ':':
-            case '.': {
+            case ':': {
                 enum JSONTokenType type;
                 char token_str[2] = {c, '\0'};
                 
@@ -309,15 +309,26 @@ struct JSONTokenList* buildTokenList(const char *f, size_t len) {
                     case ']': type = CLOSE_SQUARE_BRACKET; break;
                     case ',': type = COMMA; break;
                     case ':': type = COLON; break;
-                    case '.': type = PERIOD; break;
                 }
                 
+                struct JSONTokenNode *prev = l->tail;
                 struct JSONTokenNode *node = createNode(token_str, type);
                 if (!node || !appendTokenToList(l, node)) {
-                    set_error("Failed to create token for '%c'", c);
                     freeTokenList(l);
                     return NULL;
                 }
+                node->token.offset = current;
+
+                /* the grammar has checked the nesting and the depth */
+                if (type == OPEN_CURLY_BRACKET || type == OPEN_SQUARE_BRACKET) {
+                    open[depth++] = node;
+                } else if (type == COMMA) {
+                    open[depth - 1]->token.count++;
+                } else if (type != COLON) {
+                    depth--;
+                    /* n children are separated by n - 1 commas */
+                    if (prev != open[depth]) open[depth]->token.count++;
+                }
                 current++;
                 break;
             }
@@ -353,24 +364,90 @@ struct JSONTokenList* buildTokenList(const char *f, size_t len) {
                         return NULL;
                     }
                 } else {
-                    set_error("Unexpected character '%c' at position %d", c, current);
+                    syntax_error(current, "Unexpected character");
                     freeTokenList(l);
                     return NULL;
                 }
                 break;
         }
+
+        if (!checkToken(l, &grammar, limits, f, start, current)) {
+            freeTokenList(l);
+            return NULL;
+        }
     }
     
+    const char *grammarError = json_grammar_end(&grammar);
+    if (grammarError) {
+        syntax_error(current, grammarError);
+        json_set_error_tokens(expected_tokens(&grammar), JSON_TOKEN_END);
+        freeTokenList(l);
+        return NULL;
+    }
+
     struct JSONTokenNode *eofNode = createEofNode();
     if (!eofNode || !appendTokenToList(l, eofNode)) {
-        set_error("Failed to create EOF token");
         freeTokenList(l);
         return NULL;
     }
+    eofNode->token.offset = current;
     
     return l;
 }
 
+/* Returns the token following the value starting at n */
+static struct JSONTokenNode *skipTokenValue(struct JSONTokenNode *n) {
+    if (n->token.type != OPEN_CURLY_BRACKET && n->token.type != OPEN_SQUARE_BRACKET) return n->next;
+
+    size_t depth = 0;
+    do {
+        switch (n->token.type) {
+            case OPEN_CURLY_BRACKET: case OPEN_SQUARE_BRACKET: depth++; break;
+            case CLOSE_CURLY_BRACKET: case CLOSE_SQUARE_BRACKET: depth--; break;
+            default: break;
+        }
+        n = n->next;
+    } while (depth);
+    return n;
+}
+
+/* Moves the cursor past the child starting at n and the comma after it */
+static void advanceTokenIter(json_token_iter *it, struct JSONTokenNode *n) {
+    n = skipTokenValue(n);
+    it->next = n->token.type == COMMA ? n->next : n;
+}
+
+json_token_iter json_token_array_iter_begin(struct JSONTokenNode *container) {
+    json_token_iter it = {NULL, {NULL, 0, NULL}};
+    if (container && container->token.type == OPEN_SQUARE_BRACKET) it.next = container->next;
+    return it;
+}
+
+json_token_iter json_token_object_iter_begin(struct JSONTokenNode *container) {
+    json_token_iter it = {NULL, {NULL, 0, NULL}};
+    if (container && container->token.type == OPEN_CURLY_BRACKET) it.next = container->next;
+    return it;
+}
+
+struct JSONTokenNode *json_token_array_iter_next(json_token_iter *it) {
+    struct JSONTokenNode *n = it->next;
+    if (!n || n->token.type == CLOSE_SQUARE_BRACKET) return NULL;
+    advanceTokenIter(it, n);
+    return n;
+}
+
+const json_token_member *json_token_object_iter_next(json_token_iter *it) {
+    struct JSONTokenNode *key = it->next;
+    if (!key || key->token.type != STRING) return NULL;
+
+    /* key, colon, value */
+    it->member.key = key->token.value;
+    it->member.key_len = strlen(key->token.value);
+    it->member.value = key->next->next;
+    advanceTokenIter(it, it->member.value);
+    return &it->member;
+}
+
 /* Free all resources used by a token list */
 void freeTokenList(struct JSONTokenList *l) {
     if (!l) return;
@@ -381,11 +458,11 @@ void freeTokenList(struct JSONTokenList *l) {
     while (current) {
         next = current->next;
         if (current->token.type != END && current->token.value) {
-            free(current->token.value);
+            json_mfree(current->token.value);
         }
-        free(current);
+        json_mfree(current);
         current = next;
     }
     
-    free(l);
+    json_mfree(l);
 }
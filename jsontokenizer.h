@@ -26,6 +26,8 @@ enum JSONTokenType{
 struct JSONToken{
     char *value;
     enum JSONTokenType type;
+    size_t offset; /* of its first byte in the input */
+    size_t count;  /* for '{' and '[': members or items of the container */
 };
 
 struct JSONTokenNode{
@@ -35,20 +37,55 @@ struct JSONTokenNode{
 
 struct JSONTokenList{
     struct JSONTokenNode *head;
+    struct JSONTokenNode *tail;
+    size_t bytes;    /* allocated for the tokens, at most */
 };
 
-/* Error handling function */
+/* What buildTokenListWithLimits accepts, 0 meaning no limit. Going over
+ * one stops the tokenizer at that token with JSON_ERROR_LIMIT. */
+struct JSONTokenLimits{
+    size_t maxDepth;
+    size_t maxStringLength;    /* bytes between the quotes, as written */
+    size_t maxValues;
+    size_t maxBytes;           /* allocated for the tokens */
+};
+
+/* Error handling function. The error is recorded as the last error of the
+ * thread (see jsonerror.h); this returns its message. */
 const char* get_tokenizer_error();
 
 struct JSONTokenNode* createNode(char *value, enum JSONTokenType t);
 struct JSONTokenList* initTokenList();
 struct JSONTokenNode* nextToken(struct JSONTokenNode *n);
-int readTokenString(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len);
-int readTokenNumber(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len);
-int readTokenKeyword(struct JSONTokenList *l, char *jsonString, int *curPos, size_t len);
+int readTokenString(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len);
+int readTokenNumber(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len);
+int readTokenKeyword(struct JSONTokenList *l, char *jsonString, size_t *curPos, size_t len);
 int appendTokenToList(struct JSONTokenList *l, struct JSONTokenNode *t);
 void freeTokenList(struct JSONTokenList *l);
 void printTokenList(struct JSONTokenList *l);
 struct JSONTokenList* buildTokenList(const char *f, size_t len);
+struct JSONTokenList* buildTokenListWithLimits(const char *f, size_t len, const struct JSONTokenLimits *limits);
+
+/* Cursors over the children of a container in a token list, shaped like
+ * json_array_iter and json_object_iter of jsonparser.h. container is the
+ * token opening it; any other token gives an empty cursor. A child is
+ * yielded as its first token, so a nested container can be walked with a
+ * cursor of its own. Token lists are checked against the grammar when
+ * they are built, so stepping does not check the structure again. */
+typedef struct {
+    const char *key;
+    size_t key_len;
+    struct JSONTokenNode *value;
+} json_token_member;
+
+typedef struct {
+    struct JSONTokenNode *next;
+    json_token_member member;
+} json_token_iter;
+
+json_token_iter json_token_array_iter_begin(struct JSONTokenNode *container);
+json_token_iter json_token_object_iter_begin(struct JSONTokenNode *container);
+struct JSONTokenNode *json_token_array_iter_next(json_token_iter *it);
+const json_token_member *json_token_object_iter_next(json_token_iter *it);
 
 #endif
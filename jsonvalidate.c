@@ -0,0 +1,253 @@
+#include "jsonvalidate.h"
+#include "jsoncpu.h"
+#include "jsoninternal.h"
+#include "jsonscan.h"
+
+/* The input is validated in 64-byte blocks, in two steps per block:
+ *
+ *  1. A classifier of jsonscan.h turns the block into bitmasks. Escapes, the bytes
+ *     inside strings and the first byte of every token are derived from
+ *     them with a few integer operations, carrying state from one block to
+ *     the next. String contents are checked here too: control characters
+ *     straight from the masks, escapes and UTF-8 only where a backslash or
+ *     a non-ASCII byte is present.
+ *  2. The class of every token is fed to the same grammar the tokenizer
+ *     uses, then numbers and literals are checked by the tokenizer's
+ *     scanners.
+ *
+ * Bytes in between tokens, most of them inside strings, are never looked
+ * at one by one. */
+
+/* Validates the number or literal starting at p; returns NULL or the
+ * error, *at being set to the offending byte */
+static const char *check_scalar(const char *p, const char *end, const char **at) {
+    const char *error = NULL;
+    const char *q;
+
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        q = json_scan_number(p, end, &error);
+        if (!error && q < end && json_scan_is_scalar_char(*q)) error = "Invalid number";
+    } else {
+        size_t n = json_scan_literal(p, end);
+        if (!n) return "Unexpected character";
+        q = p + n;
+        if (q < end && json_scan_is_scalar_char(*q)) error = "Invalid literal";
+    }
+    if (error) *at = q;
+    return error;
+}
+
+/* Scans buf[0..len), leaving the first error in *error and *error_offset.
+ * Inlined into one copy per instruction set: kernel is a constant. */
+JSON_SCAN_INLINE const char *validate_blocks(struct json_grammar *g, const char *buf, size_t len, json_kernel kernel,
+                                             size_t *error_offset_out) {
+    const char *error = NULL;
+    size_t error_offset = 0;
+
+    /* state carried from one block to the next */
+    uint64_t prev_inside = 0;   /* all ones when a block starts inside a string */
+    uint64_t prev_scalar = 0;   /* 1 when it starts in the middle of a number or literal */
+    uint64_t escape_carry = 0;  /* 1 when its first byte is escaped */
+    size_t utf8_next = 0;       /* first byte not covered by a UTF-8 sequence checked already */
+    size_t last_quote = 0;      /* offset of the last opening quote */
+
+    const char *end = buf + len;
+    char tail[64];
+
+    for (size_t base = 0; base < len && !error; base += 64) {
+        const char *block = buf + base;
+        if (len - base < 64) {
+            /* padding with whitespace changes nothing */
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, len - base);
+            block = tail;
+        }
+
+        struct json_scan_block b;
+        switch (kernel) {
+#ifdef JSON_SCAN_HAVE_AVX2
+            case JSON_KERNEL_AVX512:
+                json_scan_classify_avx512(block, &b);
+                break;
+            case JSON_KERNEL_AVX2:
+                json_scan_classify_avx2(block, &b);
+                break;
+#endif
+#ifdef JSON_SCAN_HAVE_SSE2
+            case JSON_KERNEL_SSE2:
+                json_scan_classify_sse2(block, &b);
+                break;
+#endif
+            default:
+                json_scan_classify_scalar(block, &b);
+                break;
+        }
+
+        /* every backslash that is not escaped itself escapes the next byte */
+        uint64_t escaped = escape_carry;
+        escape_carry = 0;
+        uint64_t backslashes = b.backslash & ~escaped;
+        uint64_t escapes = backslashes;
+        while (backslashes) {
+            unsigned i = (unsigned)__builtin_ctzll(backslashes);
+            if (i == 63) {
+                escape_carry = 1;
+                break;
+            }
+            escaped |= 2ULL << i;
+            backslashes &= ~(3ULL << i);
+        }
+        escapes &= ~escaped;
+
+        uint64_t quote = b.quote & ~escaped;
+        uint64_t inside = json_scan_prefix_xor(quote) ^ prev_inside;
+        prev_inside = (uint64_t)((int64_t)inside >> 63);
+        if (quote & inside) last_quote = base + 63 - (unsigned)__builtin_clzll(quote & inside);
+
+        uint64_t scalar = ~(inside | quote | b.whitespace | b.structural);
+        uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+        prev_scalar = scalar >> 63;
+
+        /* first invalid byte inside a string; tokens after it are not looked at */
+        unsigned limit = 64;
+        const char *content_error = NULL;
+
+        uint64_t bad = b.control & inside;
+        if (bad) {
+            limit = (unsigned)__builtin_ctzll(bad);
+            content_error = "Unescaped control character in string";
+        }
+        for (uint64_t m = escapes & inside; m; m &= m - 1) {
+            unsigned i = (unsigned)__builtin_ctzll(m);
+            if (i >= limit) break;
+            /* an escape cut short by the end of the input is reported
+             * as an unterminated string once everything has been seen */
+            const char *e = NULL;
+            if (end - (buf + base + i) >= 2 && !json_scan_escape(buf + base + i, end, &e)) {
+                limit = i;
+                content_error = e;
+            }
+        }
+        for (uint64_t m = b.non_ascii & inside; m; m &= m - 1) {
+            unsigned i = (unsigned)__builtin_ctzll(m);
+            if (i >= limit) break;
+            if (base + i < utf8_next) continue;
+            size_t n = json_scan_utf8(buf + base + i, end);
+            if (!n) {
+                limit = i;
+                content_error = "Invalid UTF-8 in string";
+                break;
+            }
+            utf8_next = base + i + n;
+        }
+
+        uint64_t tokens = (b.structural & ~inside) | (quote & inside) | scalar_start;
+        if (limit < 64) {
+            tokens &= (1ULL << limit) - 1;
+            scalar_start &= (1ULL << limit) - 1;
+        }
+
+        /* the grammar only needs the class of each token... */
+        for (; tokens; tokens &= tokens - 1) {
+            unsigned i = (unsigned)__builtin_ctzll(tokens);
+            error = json_grammar_feed(g, json_grammar_classes[(unsigned char)block[i]]);
+            if (error) {
+                error_offset = base + i;
+                break;
+            }
+        }
+        /* ...numbers and literals are checked on their own, keeping the
+         * loop above free of hard to predict branches */
+        for (; scalar_start; scalar_start &= scalar_start - 1) {
+            unsigned i = (unsigned)__builtin_ctzll(scalar_start);
+            if (error && base + i >= error_offset) break;
+            const char *p = buf + base + i;
+            const char *at = p;
+            const char *e = check_scalar(p, end, &at);
+            if (e && (!error || (size_t)(at - buf) < error_offset)) {
+                error = e;
+                error_offset = (size_t)(at - buf);
+            }
+            if (e) break;
+        }
+        if (!error && content_error) {
+            error = content_error;
+            error_offset = base + limit;
+        }
+    }
+
+    if (!error && prev_inside) {
+        error = "Unterminated string";
+        error_offset = last_quote;
+    } else if (!error) {
+        error = json_grammar_end(g);
+        error_offset = len;
+    }
+
+    *error_offset_out = error_offset;
+    return error;
+}
+
+static const char *validate_scalar(struct json_grammar *g, const char *buf, size_t len, size_t *error_offset) {
+    return validate_blocks(g, buf, len, JSON_KERNEL_SCALAR, error_offset);
+}
+
+#ifdef JSON_SCAN_HAVE_SSE2
+static const char *validate_sse2(struct json_grammar *g, const char *buf, size_t len, size_t *error_offset) {
+    return validate_blocks(g, buf, len, JSON_KERNEL_SSE2, error_offset);
+}
+#endif
+
+#ifdef JSON_SCAN_HAVE_AVX2
+__attribute__((target("avx2")))
+static const char *validate_avx2(struct json_grammar *g, const char *buf, size_t len, size_t *error_offset) {
+    return validate_blocks(g, buf, len, JSON_KERNEL_AVX2, error_offset);
+}
+
+__attribute__((target("avx512bw")))
+static const char *validate_avx512(struct json_grammar *g, const char *buf, size_t len, size_t *error_offset) {
+    return validate_blocks(g, buf, len, JSON_KERNEL_AVX512, error_offset);
+}
+#endif
+
+int json_validate(const char *buf, size_t len, json_validate_info *info) {
+    struct json_grammar g;
+    json_grammar_init(&g);
+
+    const char *error;
+    size_t error_offset = 0;
+    if (!buf) {
+        error = "NULL input";
+    } else {
+        switch (json_get_kernel()) {
+#ifdef JSON_SCAN_HAVE_AVX2
+            case JSON_KERNEL_AVX512:
+                error = validate_avx512(&g, buf, len, &error_offset);
+                break;
+            case JSON_KERNEL_AVX2:
+                error = validate_avx2(&g, buf, len, &error_offset);
+                break;
+#endif
+#ifdef JSON_SCAN_HAVE_SSE2
+            case JSON_KERNEL_SSE2:
+                error = validate_sse2(&g, buf, len, &error_offset);
+                break;
+#endif
+            default:
+                error = validate_scalar(&g, buf, len, &error_offset);
+                break;
+        }
+    }
+
+    if (info) {
+        info->values = g.values;
+        info->max_depth = g.max_depth;
+        info->error_offset = error ? error_offset : 0;
+        info->error = error;
+    }
+    if (error) {
+        json_set_error(buf ? JSON_ERROR_SYNTAX : JSON_ERROR_INVALID_ARGUMENT, buf ? error_offset : JSON_NO_OFFSET, error);
+        return 0;
+    }
+    return 1;
+}
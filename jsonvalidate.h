@@ -0,0 +1,35 @@
+#ifndef JSONVALIDATE_H
+#define JSONVALIDATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include<stdlib.h>
+
+/* Validation without building anything.
+ *
+ * json_validate checks a buffer against the complete RFC 8259 grammar:
+ * structure, string escapes, UTF-8, control characters in strings, number
+ * syntax and literals. It reads the input once, never allocates and never
+ * writes to stderr, so it is cheap enough to run on every request body. It
+ * uses the same scanners and grammar as the tokenizer, so a buffer it
+ * accepts is also accepted by json_parse. */
+
+typedef struct {
+    size_t values;        /* number of values, containers included */
+    size_t max_depth;     /* deepest nesting, 0 for a scalar document */
+    size_t error_offset;  /* byte offset of the first error */
+    const char *error;    /* static description of the error, NULL if valid */
+} json_validate_info;
+
+/* Returns 1 if buf[0..len) holds exactly one JSON document, optionally
+ * surrounded by whitespace, and 0 otherwise. info may be NULL. Nesting
+ * deeper than 1024 levels is rejected. */
+int json_validate(const char *buf, size_t len, json_validate_info *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONVALIDATE_H */
@@ -0,0 +1,441 @@
+#include "jsonwriter.h"
+#include "jsoninternal.h"
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+enum writer_sink {
+    SINK_FD,
+    SINK_FILE,
+    SINK_CALLBACK
+};
+
+/* Flags kept for every open container on the nesting stack */
+#define FRAME_OBJECT    0x1   /* container is an object (array otherwise) */
+#define FRAME_HAS_ITEMS 0x2   /* at least one member was written */
+#define FRAME_AFTER_KEY 0x4   /* a key was written, its value is pending */
+
+struct json_writer {
+    enum writer_sink sink;
+    int fd;
+    FILE *fp;
+    json_write_fn fn;
+    void *ctx;
+
+    /* fixed-size output buffer */
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t written;
+
+    /* nesting stack, one byte of FRAME_* flags per open container */
+    unsigned char *stack;
+    size_t depth;
+    size_t stack_capacity;
+
+    int done;    /* the top-level value is complete */
+    int failed;  /* sticky error flag */
+};
+
+/* Marks the writer as failed and records the reason */
+static int writer_fail(json_writer *w, const char *msg) {
+    w->failed = 1;
+    json_set_last_error(msg);
+    return 0;
+}
+
+static json_writer *writer_new(enum writer_sink sink, size_t buffer_size) {
+    json_writer *w = json_calloc(1, sizeof(json_writer));
+    if (!w) {
+        json_set_last_error("json_writer: failed to allocate writer\n");
+        return NULL;
+    }
+    w->sink = sink;
+    w->fd = -1;
+    w->capacity = buffer_size ? buffer_size : JSON_WRITER_DEFAULT_BUFFER;
+    w->buf = json_malloc(w->capacity);
+    if (!w->buf) {
+        json_mfree(w);
+        json_set_last_error("json_writer: failed to allocate output buffer\n");
+        return NULL;
+    }
+    return w;
+}
+
+json_writer *json_writer_new_fd(int fd, size_t buffer_size) {
+    if (fd < 0) {
+        json_set_last_error("json_writer: invalid file descriptor\n");
+        return NULL;
+    }
+    json_writer *w = writer_new(SINK_FD, buffer_size);
+    if (w) w->fd = fd;
+    return w;
+}
+
+json_writer *json_writer_new_file(FILE *fp, size_t buffer_size) {
+    if (!fp) {
+        json_set_last_error("json_writer: NULL FILE provided\n");
+        return NULL;
+    }
+    json_writer *w = writer_new(SINK_FILE, buffer_size);
+    if (w) w->fp = fp;
+    return w;
+}
+
+json_writer *json_writer_new_callback(json_write_fn fn, void *ctx, size_t buffer_size) {
+    if (!fn) {
+        json_set_last_error("json_writer: NULL write callback provided\n");
+        return NULL;
+    }
+    json_writer *w = writer_new(SINK_CALLBACK, buffer_size);
+    if (!w) return NULL;
+    w->fn = fn;
+    w->ctx = ctx;
+    return w;
+}
+
+/* Writes all the given segments to the fd with as few writev calls as
+ * possible, resuming after short writes and EINTR */
+static int fd_writev(json_writer *w, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(w->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return writer_fail(w, "json_writer: writev to file descriptor failed\n");
+        }
+        w->written += (size_t)n;
+
+        /* drop the segments that were fully written */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+/* Hands len bytes to the sink, bypassing the buffer */
+static int sink_write(json_writer *w, const char *data, size_t len) {
+    if (len == 0) return 1;
+
+    switch (w->sink) {
+        case SINK_FD: {
+            struct iovec iov = { (void *)data, len };
+            return fd_writev(w, &iov, 1);
+        }
+        case SINK_FILE:
+            if (fwrite(data, 1, len, w->fp) != len)
+                return writer_fail(w, "json_writer: fwrite failed\n");
+            break;
+        case SINK_CALLBACK:
+            if (!w->fn(w->ctx, data, len))
+                return writer_fail(w, "json_writer: write callback failed\n");
+            break;
+    }
+    w->written += len;
+    return 1;
+}
+
+int json_writer_flush(json_writer *w) {
+    if (!w || w->failed) return 0;
+    if (!sink_write(w, w->buf, w->len)) return 0;
+    w->len = 0;
+    if (w->sink == SINK_FILE && fflush(w->fp) != 0)
+        return writer_fail(w, "json_writer: fflush failed\n");
+    return 1;
+}
+
+/* Appends a fragment to the output buffer, flushing it whenever it fills.
+ * Fragments at least as large as the buffer are not copied: for fd sinks
+ * they go out together with the buffered bytes in a single writev. */
+static int writer_put(json_writer *w, const char *data, size_t len) {
+    if (len <= w->capacity - w->len) {
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+        return 1;
+    }
+
+    if (len >= w->capacity) {
+        if (w->sink == SINK_FD) {
+            struct iovec iov[2] = {
+                { w->buf, w->len },
+                { (void *)data, len }
+            };
+            if (!fd_writev(w, iov, 2)) return 0;
+            w->len = 0;
+            return 1;
+        }
+        if (!sink_write(w, w->buf, w->len)) return 0;
+        w->len = 0;
+        return sink_write(w, data, len);
+    }
+
+    /* fill up the buffer, flush it and keep the rest */
+    size_t space = w->capacity - w->len;
+    memcpy(w->buf + w->len, data, space);
+    w->len = w->capacity;
+    if (!sink_write(w, w->buf, w->len)) return 0;
+    memcpy(w->buf, data + space, len - space);
+    w->len = len - space;
+    return 1;
+}
+
+static int writer_putc(json_writer *w, char c) {
+    if (w->len == w->capacity) {
+        if (!sink_write(w, w->buf, w->len)) return 0;
+        w->len = 0;
+    }
+    w->buf[w->len++] = c;
+    return 1;
+}
+
+/* Emits a quoted, escaped string. Runs of characters that need no escaping
+ * are passed to writer_put in one piece. */
+static int writer_put_string(json_writer *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    if (!writer_putc(w, '"')) return 0;
+
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        if (!writer_put(w, s + run, i - run)) return 0;
+        run = i + 1;
+
+        char esc[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t esc_len = 2;
+        switch (c) {
+            case '"':  esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xf];
+                esc_len = 6;
+                break;
+        }
+        if (!writer_put(w, esc, esc_len)) return 0;
+    }
+    if (!writer_put(w, s + run, len - run)) return 0;
+
+    return writer_putc(w, '"');
+}
+
+/* Checks that a value may be written here and emits the separator */
+static int writer_before_value(json_writer *w) {
+    if (w->failed) return 0;
+
+    if (w->depth == 0) {
+        if (w->done)
+            return writer_fail(w, "json_writer: document already has a top-level value\n");
+        return 1;
+    }
+
+    unsigned char *top = &w->stack[w->depth - 1];
+    if (*top & FRAME_OBJECT) {
+        if (!(*top & FRAME_AFTER_KEY))
+            return writer_fail(w, "json_writer: object member written without a key\n");
+        *top &= ~FRAME_AFTER_KEY;
+        return 1;
+    }
+
+    if ((*top & FRAME_HAS_ITEMS) && !writer_putc(w, ',')) return 0;
+    *top |= FRAME_HAS_ITEMS;
+    return 1;
+}
+
+/* Marks the top-level document complete once its value has been written */
+static int writer_after_value(json_writer *w) {
+    if (w->depth == 0) w->done = 1;
+    return 1;
+}
+
+static int writer_push(json_writer *w, unsigned char flags, char open) {
+    if (!writer_before_value(w)) return 0;
+
+    if (w->depth == w->stack_capacity) {
+        size_t capacity = w->stack_capacity ? w->stack_capacity * 2 : 32;
+        unsigned char *tmp = json_realloc(w->stack, capacity);
+        if (!tmp) return writer_fail(w, "json_writer: failed to grow nesting stack\n");
+        w->stack = tmp;
+        w->stack_capacity = capacity;
+    }
+    w->stack[w->depth++] = flags;
+    return writer_putc(w, open);
+}
+
+static int writer_pop(json_writer *w, unsigned char flags, char close) {
+    if (w->failed) return 0;
+    if (w->depth == 0 || (w->stack[w->depth - 1] & FRAME_OBJECT) != flags)
+        return writer_fail(w, "json_writer: mismatched end of container\n");
+    if (w->stack[w->depth - 1] & FRAME_AFTER_KEY)
+        return writer_fail(w, "json_writer: object closed after a key without value\n");
+
+    w->depth--;
+    if (!writer_putc(w, close)) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_begin_object(json_writer *w) {
+    return writer_push(w, FRAME_OBJECT, '{');
+}
+
+int json_writer_end_object(json_writer *w) {
+    return writer_pop(w, FRAME_OBJECT, '}');
+}
+
+int json_writer_begin_array(json_writer *w) {
+    return writer_push(w, 0, '[');
+}
+
+int json_writer_end_array(json_writer *w) {
+    return writer_pop(w, 0, ']');
+}
+
+int json_writer_key_n(json_writer *w, const char *key, size_t len) {
+    if (w->failed) return 0;
+    if (!key) return writer_fail(w, "json_writer: NULL key provided\n");
+
+    unsigned char *top = w->depth ? &w->stack[w->depth - 1] : NULL;
+    if (!top || !(*top & FRAME_OBJECT) || (*top & FRAME_AFTER_KEY))
+        return writer_fail(w, "json_writer: key written outside of an object\n");
+
+    if ((*top & FRAME_HAS_ITEMS) && !writer_putc(w, ',')) return 0;
+    *top |= FRAME_HAS_ITEMS | FRAME_AFTER_KEY;
+
+    if (!writer_put_string(w, key, len)) return 0;
+    return writer_putc(w, ':');
+}
+
+int json_writer_key(json_writer *w, const char *key) {
+    return json_writer_key_n(w, key, key ? strlen(key) : 0);
+}
+
+int json_writer_string_n(json_writer *w, const char *string, size_t len) {
+    if (!string) return writer_fail(w, "json_writer: NULL string provided\n");
+    if (!writer_before_value(w)) return 0;
+    if (!writer_put_string(w, string, len)) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_string(json_writer *w, const char *string) {
+    return json_writer_string_n(w, string, string ? strlen(string) : 0);
+}
+
+int json_writer_number(json_writer *w, double number) {
+    if (!isfinite(number))
+        return writer_fail(w, "json_writer: NaN and Infinity cannot be represented in JSON\n");
+    if (!writer_before_value(w)) return 0;
+
+    /* shortest of the two precisions that still round-trips */
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.15g", number);
+    if (strtod(tmp, NULL) != number)
+        n = snprintf(tmp, sizeof(tmp), "%.17g", number);
+
+    if (!writer_put(w, tmp, (size_t)n)) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_boolean(json_writer *w, int boolean) {
+    if (!writer_before_value(w)) return 0;
+    if (!(boolean ? writer_put(w, "true", 4) : writer_put(w, "false", 5))) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_null(json_writer *w) {
+    if (!writer_before_value(w)) return 0;
+    if (!writer_put(w, "null", 4)) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_raw(json_writer *w, const char *json, size_t len) {
+    if (!json) return writer_fail(w, "json_writer: NULL fragment provided\n");
+    if (!writer_before_value(w)) return 0;
+    if (!writer_put(w, json, len)) return 0;
+    return writer_after_value(w);
+}
+
+int json_writer_value(json_writer *w, const json_value *v) {
+    if (!v) return writer_fail(w, "json_writer: NULL value provided\n");
+
+    switch (v->type) {
+        case JSON_NULL:
+            return json_writer_null(w);
+        case JSON_BOOLEAN:
+            return json_writer_boolean(w, v->u.boolean);
+        case JSON_NUMBER: {
+            /* numbers parsed with lazy_numbers are written as they were */
+            size_t len;
+            const char *text = json_number_text(v, &len);
+            return text ? json_writer_raw(w, text, len) : json_writer_number(w, v->u.number);
+        }
+        case JSON_STRING:
+            return json_writer_string(w, v->u.string);
+        case JSON_ARRAY: {
+            if (!json_writer_begin_array(w)) return 0;
+            size_t count;
+            const double *numbers = json_array_get_doubles(v, &count);
+            if (numbers) {
+                for (size_t i = 0; i < count; i++) {
+                    if (!json_writer_number(w, numbers[i])) return 0;
+                }
+                return json_writer_end_array(w);
+            }
+            json_array_iter it = json_array_iter_begin(v);
+            for (json_value *item; (item = json_array_iter_next(&it));) {
+                if (!json_writer_value(w, item)) return 0;
+            }
+            return json_writer_end_array(w);
+        }
+        case JSON_OBJECT: {
+            if (!json_writer_begin_object(w)) return 0;
+            json_object_iter it = json_object_iter_begin(v);
+            for (const json_member *m; (m = json_object_iter_next(&it));) {
+                if (!json_writer_key_n(w, m->key, m->key_len)) return 0;
+                if (!json_writer_value(w, m->value)) return 0;
+            }
+            return json_writer_end_object(w);
+        }
+    }
+    return writer_fail(w, "json_writer: value has an unknown type\n");
+}
+
+void json_writer_reset(json_writer *w) {
+    if (!w) return;
+    w->depth = 0;
+    w->done = 0;
+}
+
+int json_writer_complete(const json_writer *w) {
+    return w && w->done && !w->failed;
+}
+
+size_t json_writer_bytes_written(const json_writer *w) {
+    return w ? w->written : 0;
+}
+
+int json_writer_free(json_writer *w) {
+    if (!w) return 0;
+    int ok = json_writer_flush(w);
+    json_mfree(w->buf);
+    json_mfree(w->stack);
+    json_mfree(w);
+    return ok;
+}
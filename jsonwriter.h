@@ -0,0 +1,82 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include<stdio.h>
+#include<stdlib.h>
+#include "jsonparser.h"
+
+/* Streaming serializer.
+ *
+ * A json_writer owns a single fixed-size output buffer. Values are encoded
+ * straight into it and the buffer is handed to the sink every time it fills
+ * up, so memory stays bounded no matter how large the emitted document is.
+ * Documents can be produced either from a json_value tree or from events
+ * pushed by the caller (begin/end object, key, string, ...), and both can be
+ * mixed: json_writer_value() is valid anywhere a scalar event is.
+ *
+ * All functions return 1 on success and 0 on failure. Errors are sticky: once
+ * a write fails every following call fails too, and json_get_last_error()
+ * describes the first failure. */
+
+typedef struct json_writer json_writer;
+
+/* User sink: must consume all len bytes, returns 1 on success, 0 on error */
+typedef int (*json_write_fn)(void *ctx, const char *data, size_t len);
+
+/* Used when a buffer_size of 0 is requested */
+#define JSON_WRITER_DEFAULT_BUFFER 65536
+
+/*====================CREATE WRITERS======================*/
+
+/* Writes to a file descriptor; large fragments are batched with writev */
+json_writer *json_writer_new_fd(int fd, size_t buffer_size);
+json_writer *json_writer_new_file(FILE *fp, size_t buffer_size);
+json_writer *json_writer_new_callback(json_write_fn fn, void *ctx, size_t buffer_size);
+
+/* Hands every buffered byte to the sink */
+int json_writer_flush(json_writer *w);
+
+/* Flushes pending output and releases the writer. The sink (fd, FILE*) is
+ * not closed. Returns the result of the final flush. */
+int json_writer_free(json_writer *w);
+
+/* Restarts the writer for a new top-level document, keeping its buffer.
+ * Pending output is not discarded. */
+void json_writer_reset(json_writer *w);
+
+/*====================EVENTS==============================*/
+
+int json_writer_begin_object(json_writer *w);
+int json_writer_end_object(json_writer *w);
+int json_writer_begin_array(json_writer *w);
+int json_writer_end_array(json_writer *w);
+int json_writer_key(json_writer *w, const char *key);
+int json_writer_key_n(json_writer *w, const char *key, size_t len);
+int json_writer_string(json_writer *w, const char *string);
+int json_writer_string_n(json_writer *w, const char *string, size_t len);
+/* Numbers must be finite: NaN and the infinities fail the write, as JSON
+ * has no text for them. That includes numbers of a tree too large for a
+ * double, such as 1e400, which parse to an infinity; parsed with
+ * lazy_numbers, they are written as they were. */
+int json_writer_number(json_writer *w, double number);
+int json_writer_boolean(json_writer *w, int boolean);
+int json_writer_null(json_writer *w);
+
+/* Writes a raw, already encoded JSON fragment as a single value */
+int json_writer_raw(json_writer *w, const char *json, size_t len);
+
+/* Serializes a whole json_value tree */
+int json_writer_value(json_writer *w, const json_value *value);
+
+/* Total number of bytes handed to the sink so far */
+size_t json_writer_bytes_written(const json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* JSONWRITER_H */
@@ -0,0 +1,96 @@
+/* Benchmark of logging JSON records from many threads.
+ *
+ * Each thread builds a small log record and writes it many times, to a
+ * temporary file:
+ *   mutex   json_serialize, then write() under a lock shared by all threads
+ *   lines   json_lines_write: thread buffers, a lock-free ring and one
+ *           flusher batching records into writev
+ * Reported per thread count, in records per second over all threads.
+ *
+ * Usage: ./lines_bench [records per thread] [most threads] */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jsonparser.h"
+#include "jsonwriter.h"
+#include "jsonlines.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const char *record_text =
+    "{\"level\": \"info\", \"logger\": \"http\", \"message\": \"request served\", \"status\": 200,"
+    " \"path\": \"/v1/orders\", \"duration_ms\": 12.5, \"trace_id\": \"5f2c9a\"}";
+
+struct producer {
+    const json_value *record;
+    long count;
+    int fd;
+    pthread_mutex_t *lock;
+    json_lines *lines;
+};
+
+static void *log_mutex(void *arg) {
+    struct producer *p = arg;
+    for (long i = 0; i < p->count; i++) {
+        char *text = json_serialize(p->record);
+        size_t len = strlen(text);
+        text[len] = '\n';  /* the terminator becomes the newline */
+        pthread_mutex_lock(p->lock);
+        ssize_t n = write(p->fd, text, len + 1);
+        pthread_mutex_unlock(p->lock);
+        free(text);
+        if (n < 0) break;
+    }
+    return NULL;
+}
+
+static void *log_lines(void *arg) {
+    struct producer *p = arg;
+    for (long i = 0; i < p->count; i++) json_lines_write(p->lines, p->record);
+    return NULL;
+}
+
+/* Runs threads producers of fn, returns records per second */
+static double run(void *(*fn)(void *), int threads, long count, const json_value *record, int fd) {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    json_lines *lines = fn == log_lines ? json_lines_new(fd, NULL) : NULL;
+    pthread_t *ids = malloc((size_t)threads * sizeof(pthread_t));
+    struct producer p = {record, count, fd, &lock, lines};
+
+    double t = now();
+    for (int i = 0; i < threads; i++) pthread_create(&ids[i], NULL, fn, &p);
+    for (int i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+    if (lines) json_lines_close(lines);
+    t = now() - t;
+    free(ids);
+    return (double)threads * (double)count / t;
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? strtol(argv[1], NULL, 10) : 200000;
+    int most = argc > 2 ? atoi(argv[2]) : 8;
+    char path[] = "/tmp/lines_bench_XXXXXX";
+    int fd = mkstemp(path);
+    json_value *record = json_parse(record_text);
+    if (fd < 0 || !record || count <= 0) return 1;
+    unlink(path);
+
+    printf("threads   mutex rec/s    lines rec/s\n");
+    for (int threads = 1; threads <= most; threads *= 2) {
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) return 1;
+        double mutex = run(log_mutex, threads, count, record, fd);
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) return 1;
+        double lines = run(log_lines, threads, count, record, fd);
+        printf("%7d %14.0f %14.0f (%.2fx)\n", threads, mutex, lines, lines / mutex);
+    }
+    json_free(record);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/* Benchmark of member lookups through the C++ binding against the C API.
+ *
+ * A request-like document is parsed once, then the same fields are read
+ * repeatedly:
+ *   c      json_object_get and json_get_string, then strlen for the length
+ *   c++    json::value lookups with "..."_key literals, as string_view
+ * Both sides are built with optimization (see the Makefile).
+ *
+ * Usage: ./lookup_bench [rounds] */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "jsonparser.hpp"
+
+using namespace json::literals;
+
+static const char *request =
+    "{\"method\": \"POST\", \"path\": \"/v1/orders\", \"version\": 2, \"trace_id\": \"5f2c9a\","
+    " \"client\": {\"ip\": \"10.0.0.1\", \"agent\": \"curl/8.0\", \"region\": \"eu\"},"
+    " \"headers\": {\"accept\": \"*/*\", \"content_type\": \"application/json\", \"content_length\": 512},"
+    " \"timestamp\": 1700000000, \"retries\": 0, \"priority\": \"high\", \"dry_run\": false,"
+    " \"user\": {\"id\": 42, \"name\": \"ann\", \"roles\": [\"admin\", \"ops\"], \"session_token\": \"abc\"},"
+    " \"order\": {\"sku\": \"X-1\", \"quantity\": 3, \"price\": 9.99, \"currency\": \"EUR\"}}";
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Keeps the compiler from dropping the loops */
+static volatile std::size_t sink;
+
+int main(int argc, char **argv) {
+    long rounds = argc > 1 ? std::strtol(argv[1], nullptr, 10) : 2000000;
+    json::document doc = json::document::parse(request);
+    if (!doc || rounds <= 0) return 1;
+    const json_value *root = doc.get();
+    const int lookups = 6;
+
+    double t = now();
+    std::size_t total = 0;
+    for (long r = 0; r < rounds; r++) {
+        const json_value *user = json_object_get(root, "user");
+        const char *name = json_get_string(json_object_get(user, "name"));
+        const char *token = json_get_string(json_object_get(user, "session_token"));
+        const json_value *order = json_object_get(root, "order");
+        const char *currency = json_get_string(json_object_get(order, "currency"));
+        double quantity = json_get_number(json_object_get(order, "quantity"));
+        total += std::strlen(name) + std::strlen(token) + std::strlen(currency) + (std::size_t)quantity;
+    }
+    double t_c = now() - t;
+    sink = total;
+
+    t = now();
+    total = 0;
+    for (long r = 0; r < rounds; r++) {
+        json::value user = doc["user"_key];
+        std::string_view name = user["name"_key].as_string();
+        std::string_view token = user["session_token"_key].as_string();
+        json::value order = doc["order"_key];
+        std::string_view currency = order["currency"_key].as_string();
+        double quantity = order["quantity"_key].as_number();
+        total += name.size() + token.size() + currency.size() + (std::size_t)quantity;
+    }
+    double t_cpp = now() - t;
+    sink = total;
+
+    std::printf("c    %6.1f ns per lookup\n", t_c * 1e9 / ((double)rounds * lookups));
+    std::printf("c++  %6.1f ns per lookup (%.2fx)\n", t_cpp * 1e9 / ((double)rounds * lookups), t_c / t_cpp);
+    return 0;
+}
@@ -0,0 +1,159 @@
+/* Benchmark of json_query against parsing every record.
+ *
+ * Writes an NDJSON file of web server log records, then counts the server
+ * errors of GET requests and sums their durations, in three ways:
+ *   parse     json_parse of each line and the accessors, one thread
+ *   query     json_query_feed, one thread
+ *   threads   json_query_feed on every CPU
+ * The file is read from the page cache in 64 MB chunks by all of them.
+ * Reported in MB of input per second.
+ *
+ * Usage: ./query_bench [megabytes] [file] (default 2048 MB, written to a
+ * temporary file; an existing file is used as it is) */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "jsonparser.h"
+#include "jsonquery.h"
+
+#define CHUNK ((size_t)64 << 20)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const char *methods[] = {"GET", "GET", "GET", "POST", "PUT", "DELETE"};
+static const int statuses[] = {200, 200, 200, 200, 201, 204, 301, 304, 400, 404, 500, 503};
+
+static int write_records(const char *path, size_t megabytes) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    unsigned long seed = 42;
+    size_t target = megabytes << 20, written = 0;
+    for (unsigned long i = 0; written < target; i++) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        unsigned r = (unsigned)(seed >> 33);
+        int n = fprintf(f,
+                        "{\"ts\": \"2024-05-%02uT%02u:%02u:%02uZ\", \"method\": \"%s\", \"path\": \"/api/v1/orders/%lu\","
+                        " \"status\": %d, \"bytes\": %u, \"duration_ms\": %.3f, \"user\": {\"id\": %u, \"country\": \"%s\","
+                        " \"tags\": [\"beta\", \"mobile\"]}, \"ua\": \"Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\"}\n",
+                        r % 28 + 1, r % 24, r % 60, (r >> 6) % 60, methods[r % 6], i, statuses[(r >> 3) % 12],
+                        (r >> 4) % 100000, (double)((r >> 5) % 50000) / 100.0, (r >> 7) % 1000000,
+                        (r >> 9) % 3 ? "US" : "NZ");
+        if (n < 0) break;
+        written += (size_t)n;
+    }
+    return fclose(f) == 0 && written >= target;
+}
+
+/* What the query below outputs */
+struct answer {
+    double count;
+    double total;
+};
+
+static void parse_line(char *line, struct answer *a) {
+    json_value *v = json_parse(line);
+    if (!v) return;
+    json_value *status = json_object_get(v, "status");
+    json_value *method = json_object_get(v, "method");
+    json_value *duration = json_object_get(v, "duration_ms");
+    if (status && method && json_get_type(status) == JSON_NUMBER && json_get_number(status) >= 500 &&
+        json_get_type(method) == JSON_STRING && strcmp(json_get_string(method), "GET") == 0) {
+        a->count++;
+        if (duration && json_get_type(duration) == JSON_NUMBER) a->total += json_get_number(duration);
+    }
+    json_free(v);
+}
+
+/* Runs over the file in chunks of whole lines: by parsing each line if
+ * query is NULL, otherwise with query on threads */
+static double run(const char *path, const json_query *query, unsigned threads, struct answer *a, size_t *bytes) {
+    int fd = open(path, O_RDONLY);
+    char *buf = malloc(CHUNK + 1);
+    json_query_run *qr = query ? json_query_start(query) : NULL;
+    size_t len = 0;
+    *bytes = 0;
+    memset(a, 0, sizeof(*a));
+    double t = now();
+    for (;;) {
+        ssize_t n = read(fd, buf + len, CHUNK - len);
+        if (n <= 0) break;
+        len += (size_t)n;
+        *bytes += (size_t)n;
+        size_t whole = len;
+        while (whole && buf[whole - 1] != '\n') whole--;
+        if (qr) {
+            json_query_feed(qr, buf, whole, threads);
+            json_query_clear_output(qr);
+        } else {
+            for (char *p = buf, *end = buf + whole; p < end;) {
+                char *newline = memchr(p, '\n', (size_t)(end - p));
+                *newline = '\0';
+                parse_line(p, a);
+                p = newline + 1;
+            }
+        }
+        memmove(buf, buf + whole, len - whole);
+        len -= whole;
+    }
+    t = now() - t;
+    if (qr) {
+        json_query_finish(qr);
+        size_t out_len;
+        const char *out = json_query_output(qr, &out_len);
+        sscanf(out, "{\"n\":%lf,\"total\":%lf}", &a->count, &a->total);
+        json_query_run_free(qr);
+    }
+    free(buf);
+    close(fd);
+    return t;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 2048;
+    char tmp[] = "/tmp/query_bench_XXXXXX";
+    const char *path = argc > 2 ? argv[2] : tmp;
+    struct stat st;
+    int made = 0;
+    if (stat(path, &st) != 0 || path == tmp) {
+        if (path == tmp) close(mkstemp(tmp));
+        printf("writing %zu MB of records to %s\n", megabytes, path);
+        if (!write_records(path, megabytes)) return 1;
+        made = path == tmp;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? (unsigned)cpus : 1;
+    json_query *query =
+        json_query_compile("select(.status >= 500 and .method == \"GET\") | {n: count, total: sum(.duration_ms)}");
+    if (!query) return 1;
+
+    /* once to bring the file into the page cache */
+    struct answer warm, parsed, queried, parallel;
+    size_t bytes;
+    run(path, query, threads, &warm, &bytes);
+
+    double t_parse = run(path, NULL, 1, &parsed, &bytes);
+    double t_query = run(path, query, 1, &queried, &bytes);
+    double t_threads = run(path, query, threads, &parallel, &bytes);
+    double mb = (double)bytes / (1 << 20);
+
+    printf("select(.status >= 500 and .method == \"GET\") | {n: count, total: sum(.duration_ms)}\n");
+    printf("%-8s %10s %12s\n", "", "MB/s", "matched");
+    printf("%-8s %10.0f %12.0f\n", "parse", mb / t_parse, parsed.count);
+    printf("%-8s %10.0f %12.0f (%.1fx)\n", "query", mb / t_query, queried.count, t_parse / t_query);
+    printf("%-8s %10.0f %12.0f (%.1fx, %u threads)\n", "threads", mb / t_threads, parallel.count,
+           t_parse / t_threads, threads);
+    if (parsed.count != queried.count || queried.count != parallel.count) printf("answers differ\n");
+
+    json_query_free(query);
+    if (made) unlink(tmp);
+    return 0;
+}
@@ -1,7 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "jsonparser.h"
+#include "jsonwriter.h"
+#include "jsonpatch.h"
+#include "jsonvalidate.h"
+#include "jsonproject.h"
+#include "jsonindex.h"
+#include "jsoncolumns.h"
+#include "jsoningest.h"
+#include "jsonsource.h"
+#include "jsonlines.h"
+#include "jsondecompress.h"
+#include "jsonimage.h"
+#include "jsonquery.h"
+#include "jsonpublish.h"
+#include "jsonalloc.h"
+#include "jsoncpu.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
 
 /* Extended Test 1: Complex JSON Object */
 void test_complex_object(void) {
@@ -116,6 +138,1944 @@ void test_varied_valid_json(void) {
     }
 }
 
+/* Write callback collecting the output and counting how often it is called */
+struct collect_sink {
+    char data[4096];
+    size_t len;
+    int calls;
+};
+
+static int collect_write(void *ctx, const char *data, size_t len) {
+    struct collect_sink *sink = ctx;
+    if (sink->len + len >= sizeof(sink->data)) return 0;
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    sink->data[sink->len] = '\0';
+    sink->calls++;
+    return 1;
+}
+
+/* Extended Test 5: Serialization round trip */
+void test_serialize_round_trip(void) {
+    printf("Test: Serialize a parsed document and parse it back\n");
+    const char *json_str =
+        "{\"name\":\"Al\\\"ice\\n\",\"age\":30,\"pi\":3.14159,"
+        "\"tags\":[true,false,null,[]],\"empty\":{}}";
+    const char *expected = json_str;
+    json_value *v = json_parse(json_str);
+    if (!v) {
+        printf("  FAIL: Failed to parse document. Error: %s\n", json_get_last_error());
+        return;
+    }
+    char *out = json_serialize(v);
+    if (!out || strcmp(out, expected) != 0) {
+        printf("  FAIL: Unexpected serialization: %s\n", out ? out : "(null)");
+    } else {
+        json_value *again = json_parse(out);
+        char *out2 = again ? json_serialize(again) : NULL;
+        if (!out2 || strcmp(out, out2) != 0)
+            printf("  FAIL: Serialization did not round-trip: %s\n", out2 ? out2 : "(null)");
+        else
+            printf("  PASS: Serialized and re-parsed: %s\n", out);
+        free(out2);
+        json_free(again);
+    }
+    free(out);
+    json_free(v);
+
+    /* Exponents past the double range parse to infinity, which has no
+     * JSON text, in packed arrays and in nodes; lazy numbers keep theirs */
+    const char *overflow[] = {"[1e400,-1e400]", "{\"a\":1e400}"};
+    json_parse_options lazy = {.lazy_numbers = 1};
+    for (size_t i = 0; i < sizeof(overflow) / sizeof(overflow[0]); i++) {
+        v = json_parse(overflow[i]);
+        out = v ? json_serialize(v) : NULL;
+        json_value *kept = json_parse_with_options(overflow[i], &lazy);
+        char *written = kept ? json_serialize(kept) : NULL;
+        if (!v || out)
+            printf("  FAIL: %s serialized as %s\n", overflow[i], out ? out : "(null)");
+        else if (!written || strcmp(written, overflow[i]) != 0)
+            printf("  FAIL: %s with lazy numbers serialized as %s\n", overflow[i], written ? written : "(null)");
+        else
+            printf("  PASS: %s refused, kept as written with lazy numbers\n", overflow[i]);
+        free(out);
+        free(written);
+        json_free(v);
+        json_free(kept);
+    }
+
+    /* a NUL would cut the decoded string short, so it is refused */
+    const char *nul = "[\"a\\u0000b\"]";
+    v = json_parse(nul);
+    if (v || json_get_error()->code != JSON_ERROR_SYNTAX || json_get_error()->offset != 3 ||
+        json_validate(nul, strlen(nul), NULL))
+        printf("  FAIL: %s was not rejected at offset 3\n", nul);
+    else
+        printf("  PASS: %s rejected: %s", nul, json_get_last_error());
+    json_free(v);
+}
+
+/* Extended Test 6:Streaming writer with a small buffer and pushed events */
+void test_streaming_writer(void) {
+    printf("Test: Stream events through a writer with an 8 byte buffer\n");
+    struct collect_sink sink = {{0}, 0, 0};
+    json_writer *w = json_writer_new_callback(collect_write, &sink, 8);
+    json_value *tree = json_parse("[1,\"two\",{\"three\":3}]");
+
+    int ok = w && tree &&
+        json_writer_begin_object(w) &&
+        json_writer_key(w, "id") && json_writer_number(w, 12345678) &&
+        json_writer_key(w, "ratio") && json_writer_number(w, 0.1) &&
+        json_writer_key(w, "text") && json_writer_string(w, "tab\there, a longer string") &&
+        json_writer_key(w, "tree") && json_writer_value(w, tree) &&
+        json_writer_key(w, "list") && json_writer_begin_array(w) &&
+        json_writer_boolean(w, 1) && json_writer_null(w) &&
+        json_writer_end_array(w) &&
+        json_writer_end_object(w);
+    ok = json_writer_free(w) && ok;
+
+    const char *expected =
+        "{\"id\":12345678,\"ratio\":0.1,\"text\":\"tab\\there, a longer string\","
+        "\"tree\":[1,\"two\",{\"three\":3}],\"list\":[true,null]}";
+    if (!ok || strcmp(sink.data, expected) != 0) {
+        printf("  FAIL: Unexpected writer output: %s; Error: %s\n", sink.data, json_get_last_error());
+    } else if (sink.calls < 2) {
+        printf("  FAIL: Expected the 8 byte buffer to be flushed several times\n");
+    } else {
+        printf("  PASS: Streamed %zu bytes in %d flushes\n", sink.len, sink.calls);
+    }
+    json_free(tree);
+}
+
+/* Extended Test 7: Writer misuse is reported instead of producing bad JSON */
+void test_writer_misuse(void) {
+    printf("Test: Reject out of order writer events\n");
+    struct collect_sink sink = {{0}, 0, 0};
+    json_writer *w = json_writer_new_callback(collect_write, &sink, 0);
+    if (!w) {
+        printf("  FAIL: Failed to create writer. Error: %s\n", json_get_last_error());
+        return;
+    }
+    if (json_writer_begin_object(w) && !json_writer_number(w, 1)) {
+        printf("  PASS: Value without key rejected; Error: %s", json_get_last_error());
+    } else {
+        printf("  FAIL: Value without key was accepted\n");
+    }
+    if (!json_writer_end_object(w)) {
+        printf("  PASS: Errors are sticky\n");
+    } else {
+        printf("  FAIL: Writer accepted events after an error\n");
+    }
+    json_writer_free(w);
+}
+
+/* Extended Test 8: Streaming into a file descriptor */
+void test_writer_fd(void) {
+    printf("Test: Stream a document with large strings into a pipe\n");
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("  FAIL: pipe() failed\n");
+        return;
+    }
+    char big[1024];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    json_writer *w = json_writer_new_fd(fds[1], 64);
+    int ok = w && json_writer_begin_array(w) && json_writer_string(w, big) &&
+             json_writer_number(w, -2.5) && json_writer_end_array(w);
+    ok = json_writer_free(w) && ok;
+    close(fds[1]);
+
+    char out[2048];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], out + len, sizeof(out) - 1 - len)) > 0) len += (size_t)n;
+    out[len] = '\0';
+    close(fds[0]);
+
+    if (!ok || len != sizeof(big) + 8 || strcmp(out + len - 6, ",-2.5]") != 0) {
+        printf("  FAIL: Unexpected fd output (%zu bytes); Error: %s\n", len, json_get_last_error());
+    } else {
+        printf("  PASS: Wrote %zu bytes through the fd sink\n", len);
+    }
+}
+
+/* Extended Test 9: O(1) clones sharing subtrees with copy-on-write */
+void test_clone_copy_on_write(void) {
+    printf("Test: Share a cached fragment between documents and modify a clone\n");
+    json_value *fragment = json_parse("{\"list\":[1,2,3],\"name\":\"cached\"}");
+    json_value *doc1 = json_new_object();
+    json_value *doc2 = json_new_object();
+    if (!fragment || !doc1 || !doc2) {
+        printf("  FAIL: Setup failed. Error: %s\n", json_get_last_error());
+        return;
+    }
+    json_object_set(doc1, "data", json_clone(fragment));
+    json_object_set(doc2, "data", json_clone(fragment));
+
+    /* modify the fragment as seen from doc2 only */
+    json_value *list = json_object_get_mut(json_object_get_mut(doc2, "data"), "list");
+    json_array_append(list, json_new_number(4));
+    json_object_set(json_object_get_mut(doc2, "data"), "extra", json_new_boolean(1));
+
+    char *s1 = json_serialize(doc1);
+    char *s2 = json_serialize(doc2);
+    char *sf = json_serialize(fragment);
+    const char *expected1 = "{\"data\":{\"list\":[1,2,3],\"name\":\"cached\"}}";
+    const char *expected2 = "{\"data\":{\"list\":[1,2,3,4],\"name\":\"cached\",\"extra\":true}}";
+    const char *expected_fragment = "{\"list\":[1,2,3],\"name\":\"cached\"}";
+    if (!s1 || !s2 || !sf || strcmp(s1, expected1) != 0 || strcmp(s2, expected2) != 0 ||
+        strcmp(sf, expected_fragment) != 0) {
+        printf("  FAIL: Unexpected documents:\n    %s\n    %s\n    %s\n", s1, s2, sf);
+    } else {
+        printf("  PASS: Clone modified without touching the original: %s\n", s2);
+    }
+    free(s1);
+    free(s2);
+    free(sf);
+
+    /* the fragment outlives both documents and can still be used */
+    json_free(doc1);
+    json_free(doc2);
+    json_value *name = json_object_get(fragment, "name");
+    if (!name || strcmp(json_get_string(name), "cached") != 0) {
+        printf("  FAIL: Fragment damaged after freeing the documents\n");
+    } else {
+        printf("  PASS: Fragment intact after freeing the documents\n");
+    }
+    json_free(fragment);
+}
+
+/* Parses doc and patch, applies the patch and compares the serialization */
+static void check_patch(const char *doc_text, const char *patch_text, int merge, const char *expected) {
+    json_value *doc = json_parse(doc_text);
+    json_value *patch = json_parse(patch_text);
+    if (!doc || !patch) {
+        printf("  FAIL: Failed to parse test input. Error: %s\n", json_get_last_error());
+        json_free(doc);
+        json_free(patch);
+        return;
+    }
+    char *before = json_serialize(doc);
+    int ok = merge ? json_merge_patch(&doc, patch) : json_patch_apply(&doc, patch);
+    char *after = json_serialize(doc);
+
+    if (expected && (!ok || strcmp(after, expected) != 0)) {
+        printf("  FAIL: %s => %s; Error: %s\n", patch_text, after, ok ? "" : json_get_last_error());
+    } else if (!expected && (ok || strcmp(after, before) != 0)) {
+        printf("  FAIL: %s should fail and leave the document unchanged, got %s\n", patch_text, after);
+    } else if (expected) {
+        printf("  PASS: %s => %s\n", patch_text, after);
+    } else {
+        printf("  PASS: Rolled back %s; Error: %s", patch_text, json_get_last_error());
+    }
+    free(before);
+    free(after);
+    json_free(doc);
+    json_free(patch);
+}
+
+/* Extended Test 10: JSON Patch (RFC 6902) */
+void test_json_patch(void) {
+    printf("Test: Apply JSON Patch operations in place\n");
+    check_patch("{\"foo\":\"bar\"}",
+                "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", 0,
+                "{\"foo\":\"bar\",\"baz\":\"qux\"}");
+    check_patch("{\"foo\":[\"bar\",\"baz\"]}",
+                "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"},"
+                "{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":\"end\"}]", 0,
+                "{\"foo\":[\"bar\",\"qux\",\"baz\",\"end\"]}");
+    check_patch("{\"baz\":\"qux\",\"foo\":\"bar\"}",
+                "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"},"
+                "{\"op\":\"remove\",\"path\":\"/foo\"}]", 0,
+                "{\"baz\":\"boo\"}");
+    check_patch("{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+                "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]", 0,
+                "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}");
+    check_patch("{\"a/b\":[1,2,3],\"m~n\":true}",
+                "[{\"op\":\"copy\",\"from\":\"/a~1b\",\"path\":\"/c\"},"
+                "{\"op\":\"remove\",\"path\":\"/c/0\"},"
+                "{\"op\":\"test\",\"path\":\"/m~0n\",\"value\":true},"
+                "{\"op\":\"test\",\"path\":\"/a~1b\",\"value\":[1,2,3]}]", 0,
+                "{\"a/b\":[1,2,3],\"m~n\":true,\"c\":[2,3]}");
+    check_patch("{\"x\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[true]}]", 0, "[true]");
+
+    /* failures roll back everything applied before them */
+    check_patch("{\"list\":[1,2],\"obj\":{\"k\":\"v\"}}",
+                "[{\"op\":\"add\",\"path\":\"/list/0\",\"value\":0},"
+                "{\"op\":\"remove\",\"path\":\"/obj/k\"},"
+                "{\"op\":\"copy\",\"from\":\"/list\",\"path\":\"/copy\"},"
+                "{\"op\":\"move\",\"from\":\"/list\",\"path\":\"/obj/moved\"},"
+                "{\"op\":\"replace\",\"path\":\"\",\"value\":null},"
+                "{\"op\":\"test\",\"path\":\"/copy/0\",\"value\":42}]", 0, NULL);
+    check_patch("{\"a\":{\"b\":1}}",
+                "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"},"
+                "{\"op\":\"add\",\"path\":\"/a/x\",\"value\":2},"
+                "{\"op\":\"remove\",\"path\":\"/missing\"}]", 0, NULL);
+    check_patch("{\"a\":[1]}", "[{\"op\":\"add\",\"path\":\"/a/5\",\"value\":2}]", 0, NULL);
+    check_patch("{\"a\":{}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]", 0, NULL);
+}
+
+/* Extended Test 11: JSON Merge Patch (RFC 7386) */
+void test_merge_patch(void) {
+    printf("Test: Apply JSON Merge Patches\n");
+    check_patch("{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},"
+                "\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}",
+                "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\","
+                "\"author\":{\"familyName\":null},\"tags\":[\"example\"]}", 1,
+                "{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],"
+                "\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\"}");
+    check_patch("{\"a\":\"b\"}", "{\"a\":{\"bb\":{\"ccc\":null}}}", 1, "{\"a\":{\"bb\":{}}}");
+    check_patch("[1,2]", "{\"a\":\"b\",\"c\":null}", 1, "{\"a\":\"b\"}");
+    check_patch("{\"a\":\"foo\"}", "\"bar\"", 1, "\"bar\"");
+}
+
+/* Extended Test 12: Array element insert and remove */
+void test_array_insert_remove(void) {
+    printf("Test: Insert and remove array elements and object members\n");
+    json_value *v = json_parse("{\"list\":[\"b\",\"d\"],\"gone\":1}");
+    json_value *list = v ? json_object_get(v, "list") : NULL;
+    if (!list) {
+        printf("  FAIL: Failed to parse document. Error: %s\n", json_get_last_error());
+        json_free(v);
+        return;
+    }
+    json_array_insert(list, 0, json_new_string("a"));
+    json_array_insert(list, 2, json_new_string("c"));
+    json_free(json_array_remove(list, 3));
+    json_free(json_object_remove(v, "gone"));
+    json_value *extra = json_new_null();
+    int out_of_bounds = json_array_insert(list, 10, extra) == 0 && json_array_remove(list, 3) == NULL;
+    json_free(extra);
+
+    char *out = json_serialize(v);
+    if (!out_of_bounds || !out || strcmp(out, "{\"list\":[\"a\",\"b\",\"c\"]}") != 0) {
+        printf("  FAIL: Unexpected result: %s\n", out ? out : "(null)");
+    } else {
+        printf("  PASS: %s\n", out);
+    }
+    free(out);
+    json_free(v);
+}
+
+/* Extended Test 13: Structural equality and hashing */
+void test_equal_hash(void) {
+    printf("Test: Compare documents by value and by hash\n");
+    json_value *a = json_parse("{\"name\":\"svc\",\"ports\":[80,443],\"tls\":{\"on\":true,\"v\":-0}}");
+    json_value *b = json_parse("{\"tls\":{\"v\":0,\"on\":true},\"ports\":[80,443],\"name\":\"svc\"}");
+    json_value *c = json_parse("{\"name\":\"svc\",\"ports\":[443,80],\"tls\":{\"on\":true,\"v\":0}}");
+    if (!a || !b || !c) {
+        printf("  FAIL: Failed to parse documents. Error: %s\n", json_get_last_error());
+    } else if (!json_equal(a, b) || json_hash(a) != json_hash(b)) {
+        printf("  FAIL: Member order should not matter\n");
+    } else if (json_equal(a, c) || json_hash(a) == json_hash(c)) {
+        printf("  FAIL: Item order should matter\n");
+    } else {
+        /* a cached hash must follow modifications made through _mut */
+        uint64_t before = json_hash(b);
+        json_value *tls = json_object_get_mut(b, "tls");
+        json_object_set(tls, "ciphers", json_new_array());
+        /* and modifications of a child reached through the plain getter,
+         * which cannot clear the hashes of its parents */
+        json_value *x = json_parse("{\"x\":{\"y\":1}}");
+        json_value *y = json_parse("{\"x\":{\"y\":1,\"z\":2}}");
+        uint64_t stale = json_hash(x);
+        json_hash(y);
+        json_object_set(json_object_get(x, "x"), "z", json_new_number(2));
+        json_value *old = json_parse("{\"x\":{\"y\":1}}");
+        json_value *patch = json_diff(old, x);
+        char *text = patch ? json_serialize(patch) : NULL;
+        int tracked = json_equal(x, y) && json_hash(x) == json_hash(y) && json_hash(x) != stale && text &&
+                      strcmp(text, "[{\"op\":\"add\",\"path\":\"/x/z\",\"value\":2}]") == 0;
+        free(text);
+        json_free(patch);
+        json_free(old);
+        json_free(x);
+        json_free(y);
+        if (json_hash(b) == before || json_equal(a, b)) {
+            printf("  FAIL: Hash not updated after modification\n");
+        } else if (!tracked) {
+            printf("  FAIL: Hash of a parent not updated after modifying its child\n");
+        } else {
+            printf("  PASS: Equality and hash ignore member order and track changes\n");
+        }
+    }
+    json_free(a);
+    json_free(b);
+    json_free(c);
+}
+
+/* Checks that json_diff(from, to) is the expected patch and turns from into to */
+static void check_diff(const char *from_text, const char *to_text, const char *expected) {
+    json_value *from = json_parse(from_text);
+    json_value *to = json_parse(to_text);
+    json_value *patch = from && to ? json_diff(from, to) : NULL;
+    char *out = patch ? json_serialize(patch) : NULL;
+
+    if (!out) {
+        printf("  FAIL: %s -> %s; Error: %s\n", from_text, to_text, json_get_last_error());
+    } else if (strcmp(out, expected) != 0) {
+        printf("  FAIL: %s -> %s gave %s, expected %s\n", from_text, to_text, out, expected);
+    } else if (!json_patch_apply(&from, patch) || !json_equal(from, to)) {
+        printf("  FAIL: %s does not turn %s into %s\n", out, from_text, to_text);
+    } else {
+        printf("  PASS: %s\n", out);
+    }
+    free(out);
+    json_free(patch);
+    json_free(from);
+    json_free(to);
+}
+
+/* Extended Test 14: Diff two documents into a JSON Patch */
+void test_json_diff(void) {
+    printf("Test: Produce JSON Patches with json_diff\n");
+    check_diff("{\"a\":1,\"b\":[1,2]}", "{\"b\":[1,2],\"a\":1}", "[]");
+    check_diff("{\"a\":1,\"b\":{\"c\":\"x\",\"d\":2}}", "{\"b\":{\"c\":\"y\",\"d\":2},\"e\":null}",
+               "[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"replace\",\"path\":\"/b/c\",\"value\":\"y\"},"
+               "{\"op\":\"add\",\"path\":\"/e\",\"value\":null}]");
+    check_diff("[1,2,3,4,5]", "[0,1,2,4,5,6]",
+               "[{\"op\":\"add\",\"path\":\"/0\",\"value\":0},{\"op\":\"remove\",\"path\":\"/3\"},"
+               "{\"op\":\"add\",\"path\":\"/5\",\"value\":6}]");
+    check_diff("[{\"id\":1,\"on\":true},{\"id\":2}]", "[{\"id\":1,\"on\":false},{\"id\":2}]",
+               "[{\"op\":\"replace\",\"path\":\"/0/on\",\"value\":false}]");
+    check_diff("{\"a/b\":[1],\"m~n\":1}", "{\"a/b\":[],\"m~n\":2}",
+               "[{\"op\":\"remove\",\"path\":\"/a~1b/0\"},{\"op\":\"replace\",\"path\":\"/m~0n\",\"value\":2}]");
+    check_diff("{\"a\":1}", "[1]", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]");
+}
+
+/* Checks json_validate on text; error_offset is only compared for invalid documents */
+static void check_validate(const char *text, int expect_valid, size_t expect_offset) {
+    json_validate_info info;
+    int ok = json_validate(text, strlen(text), &info);
+
+    if (ok != expect_valid) {
+        printf("  FAIL: %.40s should be %s\n", text, expect_valid ? "valid" : "invalid");
+    } else if (!ok && info.error_offset != expect_offset) {
+        printf("  FAIL: %.40s reported at offset %zu, expected %zu (%s)\n", text, info.error_offset,
+               expect_offset, info.error);
+    } else if (ok) {
+        printf("  PASS: %.40s (%zu values, depth %zu)\n", text, info.values, info.max_depth);
+    } else {
+        printf("  PASS: %.40s rejected at %zu: %s\n", text, info.error_offset, info.error);
+    }
+}
+
+/* Extended Test 15: Validation without building a tree */
+void test_json_validate(void) {
+    printf("Test: Validate documents with json_validate\n");
+    check_validate("{\"a\":[1,2.5e3,-0,true,null],\"b\":{\"c\":\"\\u00e9\\n\"}}", 1, 0);
+    check_validate("  \"caf\xc3\xa9\"  ", 1, 0);
+    check_validate("[[[[[]]]]]", 1, 0);
+    /* strings and escapes crossing the 64-byte blocks */
+    check_validate("[\"0123456789012345678901234567890123456789012345678901234567890\\\\\","
+                   "\"012345678901234567890123456789012345678901234567890123456789\\\"\"]", 1, 0);
+    check_validate("{\"a\":1,}", 0, 7);
+    check_validate("[1 2]", 0, 3);
+    check_validate("[01]", 0, 2);
+    check_validate("{\"a\" 1}", 0, 5);
+    check_validate("[\"tab\there\"]", 0, 5);
+    check_validate("[\"\\x\"]", 0, 2);
+    check_validate("[\"\xff\"]", 0, 2);
+    check_validate("[tru]", 0, 1);
+    check_validate("[1]]", 0, 3);
+    check_validate("{\"a\":[", 0, 6);
+    check_validate("[\"0123456789012345678901234567890123456789012345678901234567890123456789", 0, 1);
+
+    json_validate_info info;
+    char deep[1100];
+    memset(deep, '[', sizeof(deep));
+    if (json_validate(deep, sizeof(deep), &info) || info.error_offset != 1024) {
+        printf("  FAIL: Nesting deeper than the limit should be rejected at offset 1024\n");
+    } else {
+        printf("  PASS: %s\n", info.error);
+    }
+}
+
+/* Checks that projecting text on paths serializes to expected, NULL
+ * meaning the document must be rejected */
+static void check_projection(const char *text, const char *const *paths, size_t count, const char *expected) {
+    json_projection *projection = json_projection_new(paths, count);
+    json_value *v = projection ? json_parse_projected(text, projection) : NULL;
+    char *out = v ? json_serialize(v) : NULL;
+
+    if (!expected) {
+        if (v) printf("  FAIL: %s should be rejected, got %s\n", text, out);
+        else printf("  PASS: rejected, %s", json_get_last_error());
+    } else if (!out) {
+        printf("  FAIL: %s; Error: %s\n", text, json_get_last_error());
+    } else if (strcmp(out, expected) != 0) {
+        printf("  FAIL: %s gave %s, expected %s\n", text, out, expected);
+    } else {
+        printf("  PASS: %s\n", out);
+    }
+    free(out);
+    json_free(v);
+    json_projection_free(projection);
+}
+
+/* Extended Test 16: Parse only selected fields */
+void test_projected_parse(void) {
+    printf("Test: Materialize a projection of a document\n");
+    const char *event =
+        "{\"id\":7,\"user\":{\"name\":\"ann\",\"tags\":[1,2],\"geo\":{\"lat\":1.5,\"lon\":2}},"
+        "\"payload\":{\"big\":[[1,2],{\"x\":\"\\u00e9\"}],\"s\":\"a\\\"b\"},"
+        "\"items\":[{\"sku\":\"a\",\"qty\":1},{\"qty\":2},3,[{\"sku\":\"b\"}]],\"t\\u0079pe\":\"click\"}";
+    const char *fields[] = {"/id", "/user/name", "/user/geo", "/type", "/missing/x"};
+    check_projection(event, fields, 5,
+                     "{\"id\":7,\"user\":{\"name\":\"ann\",\"geo\":{\"lat\":1.5,\"lon\":2}},\"type\":\"click\"}");
+
+    const char *items[] = {"/items/sku", "/user/geo/lat", "/user"};
+    check_projection(event, items, 3,
+                     "{\"user\":{\"name\":\"ann\",\"tags\":[1,2],\"geo\":{\"lat\":1.5,\"lon\":2}},"
+                     "\"items\":[{\"sku\":\"a\"},{},[{\"sku\":\"b\"}]]}");
+
+    const char *escaped[] = {"/a~1b", "/m~0n"};
+    check_projection("[{\"a/b\":1,\"m~n\":2,\"c\":3},{\"c\":4}]", escaped, 2, "[{\"a/b\":1,\"m~n\":2},{}]");
+
+    const char *whole[] = {"/id", ""};
+    check_projection("{\"id\":1,\"x\":[true,null]}", whole, 2, "{\"id\":1,\"x\":[true,null]}");
+
+    /* members that are skipped are still checked */
+    const char *id[] = {"/id"};
+    check_projection("{\"id\":1,\"x\":[1,]}", id, 1, NULL);
+    check_projection("{\"id\":1,\"x\":\"\\q\"}", id, 1, NULL);
+    check_projection("{\"id\":1,\"x\":01}", id, 1, NULL);
+    check_projection("{\"id\":1} x", id, 1, NULL);
+    check_projection("42", id, 1, NULL);
+
+    /* a length that ends inside a number ends the number */
+    const char *all[] = {""};
+    json_projection *whole_doc = json_projection_new(all, 1);
+    json_value *cut = whole_doc ? json_parse_projected_n("12", 1, whole_doc) : NULL;
+    if (!cut || json_get_number(cut) != 1) {
+        printf("  FAIL: \"12\" cut at 1 byte did not give 1\n");
+    } else {
+        printf("  PASS: \"12\" cut at 1 byte gives 1\n");
+    }
+    json_free(cut);
+    json_projection_free(whole_doc);
+
+    const char *bad[] = {"id"};
+    if (json_projection_new(bad, 1)) {
+        printf("  FAIL: A path without a leading '/' should be rejected\n");
+    } else {
+        printf("  PASS: %s", json_get_last_error());
+    }
+}
+
+/* Extended Test 17: Walk containers with iterators */
+void test_iterators(void) {
+    printf("Test: Iterate over arrays and objects\n");
+    json_value *v = json_parse("{\"name\":\"x\",\"tags\":[\"a\",\"b\",\"c\"],\"empty\":{},\"n\":1}");
+    if (!v) {
+        printf("  FAIL: Failed to parse document. Error: %s\n", json_get_last_error());
+        return;
+    }
+
+    char keys[64] = "";
+    json_object_iter it = json_object_iter_begin(v);
+    size_t remaining = json_object_iter_remaining(&it);
+    for (const json_member *m; (m = json_object_iter_next(&it));) {
+        if (m->key_len != strlen(m->key)) printf("  FAIL: Wrong length for key %s\n", m->key);
+        strcat(keys, m->key);
+        strcat(keys, ",");
+    }
+
+    char items[16] = "";
+    json_array_iter ai = json_array_iter_begin(json_object_get(v, "tags"));
+    for (json_value *item; (item = json_array_iter_next(&ai));) strcat(items, json_get_string(item));
+
+    json_object_iter empty = json_object_iter_begin(json_object_get(v, "empty"));
+    json_array_iter wrong = json_array_iter_begin(v);
+    if (remaining != 4 || strcmp(keys, "name,tags,empty,n,") != 0 || strcmp(items, "abc") != 0) {
+        printf("  FAIL: Visited %s and %s\n", keys, items);
+    } else if (json_object_iter_next(&empty) || json_array_iter_next(&wrong)) {
+        printf("  FAIL: Empty containers and other types should give empty iterators\n");
+    } else {
+        printf("  PASS: Visited %s and %s\n", keys, items);
+    }
+    json_free(v);
+}
+
+/* Extended Test 18: Repeated keys under each duplicate policy */
+void test_duplicate_keys(void) {
+    printf("Test: Apply a policy to repeated keys\n");
+    /* enough members for the hashed index to be used */
+    char text[40000];
+    size_t n = (size_t)sprintf(text, "{");
+    for (int i = 0; i < 40; i++) n += (size_t)sprintf(text + n, "\"k%d\":%d,", i, i);
+    for (int i = 0; i < 2000; i++) n += (size_t)sprintf(text + n, "\"k7\":%d,", 100 + i);
+    sprintf(text + n, "\"k0\":\"last\"}");
+
+    json_parse_options options = {.duplicate_keys = JSON_DUPLICATE_KEEP_FIRST};
+    json_value *first = json_parse_with_options(text, &options);
+    options.duplicate_keys = JSON_DUPLICATE_KEEP_LAST;
+    json_value *last = json_parse_with_options(text, &options);
+    options.duplicate_keys = JSON_DUPLICATE_REJECT;
+    json_value *rejected = json_parse_with_options(text, &options);
+    json_value *small = json_parse_with_options("{\"a\":1,\"b\":2,\"a\":3}", &options);
+
+    json_object_iter it = json_object_iter_begin(first);
+    size_t members = json_object_iter_remaining(&it);
+    if (!first || !last) {
+        printf("  FAIL: Failed to parse. Error: %s\n", json_get_last_error());
+    } else if (members != 40 || json_get_number(json_object_get(first, "k7")) != 7 ||
+               json_get_type(json_object_get(first, "k0")) != JSON_NUMBER) {
+        printf("  FAIL: keep-first kept %zu members\n", members);
+    } else if (json_get_number(json_object_get(last, "k7")) != 2099 ||
+               json_get_type(json_object_get(last, "k0")) != JSON_STRING) {
+        printf("  FAIL: keep-last did not keep the last values\n");
+    } else if (rejected || small) {
+        printf("  FAIL: Duplicates should be rejected\n");
+    } else {
+        printf("  PASS: Duplicates collapsed to %zu members, or rejected: %s", members, json_get_last_error());
+    }
+    json_free(first);
+    json_free(last);
+}
+
+/* Extended Test 19: Look values up in a file through an on-disk index */
+static ino_t file_inode(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+void test_json_index(void) {
+    printf("Test: Query a file through a saved structural index\n");
+    char json_path[] = "/tmp/jsonindex_test_XXXXXX";
+    int fd = mkstemp(json_path);
+    if (fd < 0) {
+        printf("  FAIL: mkstemp() failed\n");
+        return;
+    }
+    char index_path[sizeof(json_path) + 4];
+    snprintf(index_path, sizeof(index_path), "%s.idx", json_path);
+
+    /* small containers are scanned, the others go through the index */
+    static char text[64000];
+    size_t n = (size_t)sprintf(text, "{\"items\": [");
+    for (int i = 0; i < 300; i++)
+        n += (size_t)sprintf(text + n, "%s{\"id\": %d, \"tags\": [\"t%d\", [%d]]}", i ? ", " : "", i, i, i);
+    n += (size_t)sprintf(text + n, "], \"names\": {\"a\\/b\": 1, \"\\u00e9\": 2, \"dup\": 3, \"dup\": 4");
+    for (int i = 0; i < 200; i++) n += (size_t)sprintf(text + n, ", \"n%d\": {\"v\": \"%d\"}", i, i);
+    n += (size_t)sprintf(text + n, "}, \"empty\": [], \"scalar\": null}");
+    int ok = write(fd, text, n) == (ssize_t)n;
+    close(fd);
+
+    const char *pointers[] = {"", "/items/0", "/items/3/id", "/items/299/tags/1/0", "/items/150/tags",
+                              "/names/a~1b", "/names/\xc3\xa9", "/names/dup", "/names/n123/v", "/names/n199",
+                              "/scalar", "/empty", "/items/300", "/items/01", "/names/missing", "/empty/0",
+                              "/scalar/x", "/items/-"};
+    size_t count = sizeof(pointers) / sizeof(pointers[0]);
+    json_value *tree = json_parse(text);
+    json_index_options options = {64, 4};
+
+    size_t found = 0;
+    ino_t built = 0;
+    for (int round = 0; ok && round < 2; round++) {
+        json_index *index = json_index_open(json_path, index_path, &options);
+        ok = index != NULL;
+        for (size_t i = 0; ok && i < count; i++) {
+            json_value *expected = json_pointer_get(tree, pointers[i]);
+            json_value *v = json_index_get(index, pointers[i]);
+            ok = expected ? json_equal(v, expected) : v == NULL;
+            if (!ok) printf("  FAIL: Wrong value at \"%s\"\n", pointers[i]);
+            found += v != NULL;
+            json_free(v);
+        }
+        json_index_close(index);
+        /* the second round maps the saved index instead of writing it again */
+        if (round == 0) built = file_inode(index_path);
+        else ok = ok && built == file_inode(index_path);
+    }
+
+    /* once the file changes the index is built again */
+    FILE *f = fopen(json_path, "w");
+    int rewritten = f && fputs("{\"items\": [7]}", f) >= 0;
+    if (f) fclose(f);
+    json_index *index = rewritten ? json_index_open(json_path, index_path, &options) : NULL;
+    json_value *item = json_index_get(index, "/items/0");
+    int updated = item && json_get_number(item) == 7;
+    json_free(item);
+    json_index_close(index);
+
+    f = fopen(json_path, "w");
+    if (f) {
+        fputs("{\"items\": [7,]}", f);
+        fclose(f);
+    }
+    json_index *invalid = json_index_open(json_path, NULL, &options);
+
+    if (!tree || !ok) {
+        printf("  FAIL: Index lookups disagree with the parsed tree. Error: %s\n", json_get_last_error());
+    } else if (!updated) {
+        printf("  FAIL: A stale index was used after the file changed\n");
+    } else if (invalid) {
+        printf("  FAIL: An invalid file was indexed\n");
+    } else {
+        printf("  PASS: %zu of %zu pointers found twice, stale index rebuilt, invalid file rejected: %s",
+               found / 2, count, json_get_last_error());
+    }
+    json_index_close(invalid);
+    json_free(tree);
+    unlink(json_path);
+    unlink(index_path);
+}
+
+/* Extended Test 20: Arrays of numbers stored packed */
+void test_packed_arrays(void) {
+    printf("Test: Store arrays of numbers packed and read them in bulk\n");
+    static char text[20000];
+    size_t n = (size_t)sprintf(text, "{\"samples\": [");
+    for (int i = 0; i < 1000; i++) n += (size_t)sprintf(text + n, "%s%.1f", i ? ", " : "", i - 500 + 0.5);
+    sprintf(text + n, "], \"mixed\": [1, 2, \"three\"], \"nested\": [[1e3], []]}");
+
+    json_value *root = json_parse(text);
+    const json_value *samples = json_object_get(root, "samples");
+    const json_value *mixed = json_object_get(root, "mixed");
+    size_t count = 0, mixed_count = 0;
+    const double *numbers = json_array_get_doubles(samples, &count);
+    double copy[4] = {0}, last[4] = {0};
+    size_t copied = json_array_copy_doubles(mixed, 0, copy, 4);
+
+    /* the same array built node by node is equal and hashes alike */
+    json_value *boxed = json_new_array();
+    for (int i = 0; i < 1000; i++) json_array_append(boxed, json_new_number(i - 500 + 0.5));
+    int same = json_equal(samples, boxed) && json_equal(boxed, samples) && json_hash(samples) == json_hash(boxed);
+
+    /* items are still reachable one by one, and writes go to a clone only */
+    json_value *clone = json_clone(samples);
+    json_value *item = json_array_get(samples, 10);
+    int edited = json_array_append(clone, json_new_string("x")) && json_array_get_doubles(clone, NULL) == NULL;
+    size_t tail = json_array_copy_doubles(clone, 998, last, 4);
+
+    char *serialized = json_serialize(root);
+    json_value *reparsed = serialized ? json_parse(serialized) : NULL;
+
+    if (!root || !numbers || count != 1000) {
+        printf("  FAIL: The array of numbers was not packed. Error: %s\n", json_get_last_error());
+    } else if (numbers[0] != -499.5 || numbers[999] != 499.5 || !item || json_get_number(item) != -489.5) {
+        printf("  FAIL: Wrong packed values\n");
+    } else if (json_array_get_doubles(mixed, &mixed_count) || copied != 2 || copy[1] != 2) {
+        printf("  FAIL: A mixed array was packed or copied %zu numbers\n", copied);
+    } else if (!json_array_get_doubles(json_array_get(json_object_get(root, "nested"), 0), NULL)) {
+        printf("  FAIL: A nested array of numbers was not packed\n");
+    } else if (!same) {
+        printf("  FAIL: Packed and boxed arrays differ\n");
+    } else if (!edited || tail != 2 || last[1] != 499.5 || json_array_get_doubles(samples, NULL) != numbers) {
+        printf("  FAIL: Writing to a clone affected the packed original\n");
+    } else if (!reparsed || !json_equal(root, reparsed)) {
+        printf("  FAIL: Serialization round trip changed the document\n");
+    } else {
+        printf("  PASS: %zu numbers packed, read in bulk and through nodes\n", count);
+    }
+    free(serialized);
+    json_free(reparsed);
+    json_free(clone);
+    json_free(boxed);
+    json_free(root);
+}
+
+/* Same rows in every column of a and b */
+static int columns_same(const json_columns *a, const json_columns *b) {
+    for (size_t i = 0; i < json_columns_count(a); i++) {
+        const json_column *x = json_columns_get(a, i), *y = json_columns_get(b, i);
+        if (x->rows != y->rows || x->nulls != y->nulls || x->mismatches != y->mismatches) return 0;
+        if (memcmp(x->validity, y->validity, x->rows / 8) != 0) return 0;
+        for (size_t r = 0; r < x->rows; r++) {
+            if (((x->validity[r / 8] ^ y->validity[r / 8]) >> (r % 8)) & 1) return 0;
+            if (x->type == JSON_COLUMN_DOUBLE && x->doubles[r] != y->doubles[r]) return 0;
+            if (x->type == JSON_COLUMN_INT64 && x->int64s[r] != y->int64s[r]) return 0;
+            if (x->type == JSON_COLUMN_STRING && x->offsets[r + 1] != y->offsets[r + 1]) return 0;
+        }
+        if (x->type == JSON_COLUMN_STRING && memcmp(x->bytes, y->bytes, x->offsets[x->rows]) != 0) return 0;
+    }
+    return 1;
+}
+
+/* Extended Test 21: Columnar extraction from NDJSON */
+void test_columns(void) {
+    printf("Test: Extract typed columns from NDJSON lines\n");
+    const json_column_spec specs[] = {
+        {"/id", JSON_COLUMN_INT64},
+        {"/user/name", JSON_COLUMN_STRING},
+        {"/score", JSON_COLUMN_DOUBLE},
+        {"/ok", JSON_COLUMN_BOOLEAN},
+    };
+    const char *lines =
+        "{\"id\": 1, \"user\": {\"name\": \"ann\", \"tags\": [1, {}]}, \"score\": 2.5, \"ok\": true}\n"
+        "\n"
+        "{\"score\": -1e2, \"id\": 9223372036854775807, \"ok\": false, \"user\": {\"n\\u0061me\": \"b\\nob\"}}\r\n"
+        "{\"id\": 1.5, \"user\": null, \"score\": \"x\", \"extra\": [[[]]], \"user\": {\"name\": \"z\"}, \"id\": 7}\n"
+        "{\"id\": 9223372036854775808, \"user\": {\"name\": null}, \"ok\": null}";
+
+    json_columns *cols = json_columns_new(specs, 4);
+    int extracted = cols && json_columns_extract(cols, lines, strlen(lines), 1);
+    const json_column *id = json_columns_get(cols, 0), *name = json_columns_get(cols, 1);
+    const json_column *score = json_columns_get(cols, 2), *ok = json_columns_get(cols, 3);
+
+    /* a failing chunk adds no row */
+    const char *bad = "{\"id\": 5}\n[1]\n";
+    int rejected = cols && !json_columns_extract(cols, bad, strlen(bad), 1) && id->rows == 4 &&
+                   strstr(json_get_last_error(), "line 2") != NULL;
+    const json_column_spec repeated[] = {{"/a", JSON_COLUMN_INT64}, {"/a", JSON_COLUMN_DOUBLE}};
+    json_columns *invalid = json_columns_new(repeated, 2);
+
+    /* index tokens step into arrays; on objects they are member names */
+    const json_column_spec indexed[] = {{"/arr/1", JSON_COLUMN_INT64}, {"/m/0/k", JSON_COLUMN_STRING}};
+    const char *items = "{\"arr\": [5, 6, 7], \"m\": [{\"k\": \"a\"}, {\"k\": \"b\"}]}\n"
+                        "{\"arr\": [5]}\n{\"arr\": {\"1\": 8}, \"m\": [[], {\"k\": \"c\"}]}\n{\"arr\": [0, \"x\"]}\n";
+    json_columns *by_index = json_columns_new(indexed, 2);
+    const json_column *second = json_columns_get(by_index, 0), *k = json_columns_get(by_index, 1);
+    int stepped = by_index && json_columns_extract(by_index, items, strlen(items), 1) && second->rows == 4 &&
+                  second->int64s[0] == 6 && second->int64s[2] == 8 && (second->validity[0] & 0xf) == 0x5 &&
+                  second->mismatches == 1 && k->nulls == 3 && k->offsets[1] == 1 && k->bytes[0] == 'a';
+    json_columns_free(by_index);
+
+    /* threads split the buffer at line boundaries and give the same rows */
+    size_t size = 400000, n = 0;
+    char *big = malloc(size + 200);
+    for (int i = 0; n < size; i++) {
+        n += (size_t)sprintf(big + n, "{\"id\": %d, \"score\": %d.25, \"user\": {\"name\": \"u%d\"}, \"ok\": %s}\n",
+                             i, i % 100, i, i % 3 ? "true" : "null");
+    }
+    json_columns *single = json_columns_new(specs, 4), *parallel = json_columns_new(specs, 4);
+    /* in two chunks of whole lines, as a stream would be read */
+    const char *cut = big + n / 2;
+    while (cut[-1] != '\n') cut--;
+    int same = single && parallel && json_columns_extract(single, big, n, 1) &&
+               json_columns_extract(parallel, big, (size_t)(cut - big), 4) &&
+               json_columns_extract(parallel, cut, (size_t)(big + n - cut), 3) && columns_same(single, parallel);
+
+    if (!extracted) {
+        printf("  FAIL: Extraction failed. Error: %s\n", json_get_last_error());
+    } else if (id->rows != 4 || id->int64s[0] != 1 || id->int64s[1] != INT64_MAX || id->nulls != 2 ||
+               id->mismatches != 2 || (id->validity[0] & 0xf) != 0x3) {
+        printf("  FAIL: Wrong int64 column\n");
+    } else if (name->nulls != 2 || name->offsets[1] != 3 || name->offsets[2] != 7 ||
+               memcmp(name->bytes, "annb\nob", 7) != 0 || name->offsets[4] != 7) {
+        printf("  FAIL: Wrong string column\n");
+    } else if (score->doubles[0] != 2.5 || score->doubles[1] != -100 || score->nulls != 2 || score->mismatches != 1) {
+        printf("  FAIL: Wrong double column\n");
+    } else if (ok->booleans[0] != 1 || ok->booleans[1] != 0 || (ok->validity[0] & 0xf) != 0x3) {
+        printf("  FAIL: Wrong boolean column\n");
+    } else if (!rejected || invalid) {
+        printf("  FAIL: An invalid line or a repeated field was accepted\n");
+    } else if (!stepped) {
+        printf("  FAIL: Wrong columns of array items\n");
+    } else if (!same) {
+        printf("  FAIL: Extraction in parallel differs. Error: %s\n", json_get_last_error());
+    } else {
+        printf("  PASS: %zu rows extracted in 4 threads as in one\n", json_columns_get(single, 0)->rows);
+    }
+    json_columns_free(single);
+    json_columns_free(parallel);
+    json_columns_free(cols);
+    free(big);
+}
+
+struct ingest_result {
+    int calls[48];
+    double ids[48];
+};
+
+static void ingest_record(void *user, size_t i, const char *path, json_value *value, const char *error) {
+    struct ingest_result *r = user;
+    (void)path;
+    r->calls[i]++;
+    r->ids[i] = value ? json_get_number(json_object_get(value, "id")) : (error && *error ? -1 : -2);
+    json_free(value);
+}
+
+/* Extended Test 22: Bulk ingestion of files */
+void test_ingest(void) {
+    printf("Test: Read and parse many files with overlapped I/O\n");
+    char dir[] = "/tmp/json_ingest_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("  FAIL: Cannot create a directory\n");
+        return;
+    }
+    /* 40 files: documents up to 20 KB, invalid ones, an empty one, then a
+     * missing file and a directory */
+    char names[48][64];
+    const char *paths[48];
+    size_t count = 42;
+    for (size_t i = 0; i < count; i++) {
+        snprintf(names[i], sizeof(names[i]), "%s/%zu.json", dir, i);
+        paths[i] = names[i];
+        if (i >= 40) continue;
+        FILE *f = fopen(names[i], "w");
+        if (i % 8 == 7) {
+            fprintf(f, "{\"id\": %zu,", i);
+        } else if (i != 39) {
+            fprintf(f, "{\"id\": %zu, \"pad\": [", i);
+            for (size_t k = 0; k < i * 100; k++) fprintf(f, "%s\"xxxxxxxxxxxxxxxxxxxx\"", k ? "," : "");
+            fprintf(f, "]}");
+        }
+        fclose(f);
+    }
+    snprintf(names[41], sizeof(names[41]), "%s", dir);
+
+    int ok = 1;
+    const char *backend = "io_uring";
+    json_ingest_options options = {2, 4, 16384, JSON_INGEST_AUTO};
+    for (int run = 0; run < 3 && ok; run++) {
+        struct ingest_result r;
+        memset(&r, 0, sizeof(r));
+        options.backend = run == 0 ? JSON_INGEST_AUTO : run == 1 ? JSON_INGEST_THREADS : JSON_INGEST_IO_URING;
+        long parsed = json_ingest(paths, count, &options, ingest_record, &r);
+        if (parsed < 0 && run == 2) {
+            backend = "threads only";
+            break;
+        }
+        ok = parsed == 35;
+        for (size_t i = 0; i < count; i++) {
+            int valid = i < 39 && i % 8 != 7;
+            ok = ok && r.calls[i] == 1 && r.ids[i] == (valid ? (double)i : -1);
+        }
+        if (!ok) printf("  FAIL: Backend %d parsed %ld files. Error: %s\n", run, parsed, json_get_last_error());
+    }
+    if (ok) printf("  PASS: 35 of 42 files parsed, errors reported for the rest (%s)\n", backend);
+
+    for (size_t i = 0; i < 40; i++) unlink(names[i]);
+    rmdir(dir);
+}
+
+/* Allocator counting live blocks, failing once its budget is spent */
+struct counting_alloc {
+    long live;
+    long budget;
+};
+
+static void *counting_alloc(void *ctx, size_t size) {
+    struct counting_alloc *c = ctx;
+    if (c->budget == 0) return NULL;
+    if (c->budget > 0) c->budget--;
+    void *ptr = malloc(size);
+    if (ptr) c->live++;
+    return ptr;
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t size) {
+    struct counting_alloc *c = ctx;
+    if (!ptr) return counting_alloc(ctx, size);
+    if (c->budget == 0) return NULL;
+    if (c->budget > 0) c->budget--;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void *ctx, void *ptr) {
+    ((struct counting_alloc *)ctx)->live--;
+    free(ptr);
+}
+
+static void *pool_parse(void *arg) {
+    return json_parse(arg);
+}
+
+/* Extended Test 23: Custom and pooled allocators */
+void test_allocators(void) {
+    printf("Test: Allocate through a custom allocator and the pool\n");
+    const char *doc = "{\"name\": \"pool\", \"list\": [1, 2.5, \"three\", {\"four\": [true, null]}], "
+                      "\"nested\": {\"a\": {\"b\": {\"c\": \"a string long enough to need its own block\"}}}}";
+
+    struct counting_alloc counter = {0, -1};
+    json_allocator custom = {counting_alloc, counting_realloc, counting_free, &counter};
+    json_set_allocator(&custom);
+    json_value *v = json_parse(doc);
+    int used = v && counter.live > 0 && json_get_allocator()->ctx == &counter;
+    json_free(v);
+    int balanced = counter.live == 0;
+
+    /* every allocation failing in turn gives NULL and leaks nothing */
+    int failures = 0, clean = 1;
+    for (long budget = 0; budget < 10000; budget++) {
+        counter.budget = budget;
+        v = json_parse(doc);
+        if (v) {
+            json_free(v);
+            break;
+        }
+        failures++;
+        clean = clean && counter.live == 0;
+    }
+    json_set_allocator(NULL);
+
+    /* values made in one thread and freed in another share the pool */
+    json_set_allocator(json_pool_allocator());
+    int pooled = 1;
+    for (int round = 0; round < 4 && pooled; round++) {
+        pthread_t thread;
+        void *result = NULL;
+        if (pthread_create(&thread, NULL, pool_parse, (void *)doc) != 0 || pthread_join(thread, &result) != 0) {
+            pooled = 0;
+            break;
+        }
+        json_value *mine = json_parse(doc);
+        pooled = result && mine && json_equal(result, mine);
+        json_free(result);
+        json_free(mine);
+    }
+    json_set_allocator(NULL);
+
+    if (!used || !balanced) {
+        printf("  FAIL: Custom allocator not used or blocks left (%ld)\n", counter.live);
+    } else if (!failures || !clean) {
+        printf("  FAIL: Blocks leaked after a failed allocation (%ld)\n", counter.live);
+    } else if (!pooled) {
+        printf("  FAIL: Pooled values differ across threads\n");
+    } else {
+        printf("  PASS: %d allocation failures reported without leaks, pool shared by threads\n", failures);
+    }
+}
+
+/* Extended Test 24: Structured errors */
+void test_structured_errors(void) {
+    printf("Test: Report errors as codes and offsets, without writing to stderr\n");
+    /* anything written to stderr lands in a file */
+    char path[] = "/tmp/json_stderr_XXXXXX";
+    int fd = mkstemp(path);
+    int saved = dup(2);
+    fflush(stderr);
+    dup2(fd, 2);
+
+    const char *text = "{\n  \"a\": 1,\n  \"b\" 2\n}";
+    json_value *v = json_parse(text);
+    json_error e = *json_get_error();
+    size_t line = 0, column = 0;
+    int located = json_error_location(&e, text, strlen(text), &line, &column);
+    char message[128];
+    json_error_format(&e, text, strlen(text), message, sizeof(message));
+    int missing_colon = !v && e.code == JSON_ERROR_SYNTAX && e.offset == 18 && e.expected == JSON_TOKEN_COLON &&
+                        e.found == JSON_TOKEN_LITERAL && located && line == 3 && column == 7 &&
+                        strcmp(message, "Expected ':' after key at line 3, column 7\n") == 0 &&
+                        strcmp(json_get_last_error(), "Expected ':' after key at offset 18\n") == 0;
+
+    v = json_parse("[1, 2");
+    e = *json_get_error();
+    int truncated = !v && e.code == JSON_ERROR_SYNTAX && e.offset == 5 && e.found == JSON_TOKEN_END &&
+                    e.expected == (JSON_TOKEN_COMMA | JSON_TOKEN_ARRAY_END);
+
+    json_parse_options options = {.duplicate_keys = JSON_DUPLICATE_REJECT};
+    v = json_parse_with_options("{\"k\": 1, \"k\": 2}", &options);
+    e = *json_get_error();
+    int duplicate = !v && e.code == JSON_ERROR_DUPLICATE_KEY && e.offset == 9;
+
+    json_value *object = json_parse("{}");
+    int missing = object && !json_object_get(object, "x") && json_get_error()->code == JSON_ERROR_NOT_FOUND &&
+                  json_get_error()->offset == JSON_NO_OFFSET;
+    json_free(object);
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    struct stat st;
+    int quiet = fstat(fd, &st) == 0 && st.st_size == 0;
+    close(fd);
+    unlink(path);
+
+    if (!missing_colon) {
+        printf("  FAIL: Wrong error for a missing colon: %s", json_get_last_error());
+    } else if (!truncated || !duplicate || !missing) {
+        printf("  FAIL: Wrong code, offset or tokens (%d %d %d)\n", truncated, duplicate, missing);
+    } else if (!quiet) {
+        printf("  FAIL: %lld bytes written to stderr\n", (long long)st.st_size);
+    } else {
+        printf("  PASS: %s", message);
+    }
+}
+
+/* Extended Test 25: Kernels */
+void test_kernels(void) {
+    printf("Test: Give the same results with every kernel the CPU supports\n");
+    /* strings with the byte a kernel has to stop at in every position of
+     * a vector, and past the last whole vector */
+    static const char *stops[] = {"", "\\n", "\\u00e9", "\x01", "\xc3\xa9", "\xff", "\\x"};
+    const size_t nstops = sizeof(stops) / sizeof(stops[0]);
+    const size_t lengths = 140;
+    char text[256];
+    char *expected[sizeof(stops) / sizeof(stops[0])][140];
+    json_kernel original = json_get_kernel();
+    int mismatches = 0;
+    int kernels = 0;
+
+    for (int k = JSON_KERNEL_SCALAR; k <= JSON_KERNEL_AVX512; k++) {
+        if (!json_set_kernel((json_kernel)k)) continue;
+        kernels++;
+        for (size_t s = 0; s < nstops; s++) {
+            for (size_t n = 0; n < lengths; n++) {
+                snprintf(text, sizeof(text), "[\"%.*s%s\", \"%s\"]", (int)n,
+                         "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+                         "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                         stops[s], stops[s]);
+                json_validate_info info;
+                int valid = json_validate(text, strlen(text), &info);
+                json_value *v = json_parse(text);
+                char *out = v ? json_serialize(v) : NULL;
+                char result[400];
+                snprintf(result, sizeof(result), "%d %zu %s %zu", valid, info.error_offset, out ? out : "-",
+                         v ? 0 : json_get_error()->offset);
+                free(out);
+                json_free(v);
+                if (k == JSON_KERNEL_SCALAR) {
+                    expected[s][n] = strdup(result);
+                } else if (strcmp(expected[s][n], result) != 0) {
+                    if (!mismatches) printf("  FAIL: %s differs on %s: %s\n", json_kernel_name((json_kernel)k), text, result);
+                    mismatches++;
+                }
+            }
+        }
+    }
+    json_set_kernel(original);
+    for (size_t s = 0; s < nstops; s++) {
+        for (size_t n = 0; n < lengths; n++) free(expected[s][n]);
+    }
+
+    /* control bytes outside strings, after padding that moves them through
+     * every position of a vector: valid only where they are whitespace,
+     * which the parser decides without the kernels */
+    static const char *shapes[] = {"%*s[%c]", "%*s[1,%c]", "%*s%c", "%*s{\"a\"%c:1}", "%*s[1%c2]"};
+    for (int k = JSON_KERNEL_SCALAR; k <= JSON_KERNEL_AVX512; k++) {
+        if (!json_set_kernel((json_kernel)k)) continue;
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+            for (int c = 0x01; c < 0x20; c++) {
+                for (int pad = 0; pad < 70; pad++) {
+                    snprintf(text, sizeof(text), shapes[s], pad, "", c);
+                    json_value *v = json_parse(text);
+                    int valid = json_validate(text, strlen(text), NULL);
+                    if (valid != (v != NULL)) {
+                        if (!mismatches)
+                            printf("  FAIL: %s %s byte 0x%02x at %d of shape %zu\n", json_kernel_name((json_kernel)k),
+                                   valid ? "accepts" : "rejects", c, pad, s);
+                        mismatches++;
+                    }
+                    json_free(v);
+                }
+            }
+        }
+    }
+    json_set_kernel(original);
+
+    if (!mismatches) printf("  PASS: %d kernels agree, %s in use\n", kernels, json_kernel_name(original));
+}
+
+/* Allocator counting the bytes of live blocks, kept in front of each */
+static void *sized_alloc(void *ctx, size_t size) {
+    size_t *block = malloc(sizeof(size_t) * 2 + size);
+    if (!block) return NULL;
+    *block = size;
+    *(size_t *)ctx += size;
+    return block + 2;
+}
+
+static void *sized_realloc(void *ctx, void *ptr, size_t size) {
+    if (!ptr) return sized_alloc(ctx, size);
+    size_t *block = (size_t *)ptr - 2;
+    size_t old = *block;
+    block = realloc(block, sizeof(size_t) * 2 + size);
+    if (!block) return NULL;
+    *block = size;
+    *(size_t *)ctx += size - old;
+    return block + 2;
+}
+
+static void sized_free(void *ctx, void *ptr) {
+    size_t *block = (size_t *)ptr - 2;
+    *(size_t *)ctx -= *block;
+    free(block);
+}
+
+/* Parses text under options, returning 1 if it is rejected with
+ * JSON_ERROR_LIMIT at offset */
+static int over_limit(const char *text, json_parse_options options, size_t offset) {
+    json_value *v = json_parse_with_options(text, &options);
+    json_free(v);
+    return !v && json_get_error()->code == JSON_ERROR_LIMIT && json_get_error()->offset == offset;
+}
+
+/* Extended Test 26: Parse limits and memory usage */
+void test_parse_limits(void) {
+    printf("Test: Reject input over the parse limits, report memory usage\n");
+    int depth = over_limit("[[[1]]]", (json_parse_options){.max_depth = 2}, 2);
+    int nodes = over_limit("[1, 2, 3]", (json_parse_options){.max_nodes = 3}, 7);
+    int strings = over_limit("{\"k\": \"abcdef\"}", (json_parse_options){.max_string_length = 5}, 6) &&
+                  over_limit("{\"abcdefgh\": 1}", (json_parse_options){.max_string_length = 5}, 1);
+    int containers = over_limit("[1, 2, 3, 4]", (json_parse_options){.max_container_size = 3}, 10) &&
+                     over_limit("{\"a\": 1, \"b\": [\"x\"]}", (json_parse_options){.max_container_size = 1}, 9);
+
+    const char *doc = "{\"name\": \"limits\", \"list\": [1, 2.5, \"three\", {\"four\": [true, null]}], "
+                      "\"numbers\": [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12], \"nested\": {\"a\": {\"b\": \"c\"}}}";
+    /* everything the tree holds once the tokens are gone */
+    size_t live = 0;
+    json_allocator sized = {sized_alloc, sized_realloc, sized_free, &live};
+    json_set_allocator(&sized);
+    json_value *v = json_parse(doc);
+    size_t held = live;
+    size_t usage = json_memory_usage(v);
+    json_free(v);
+    json_set_allocator(NULL);
+
+    /* within a budget the size of the tree, the tokens do not fit */
+    json_parse_options limited = {.max_bytes = usage};
+    json_value *over = json_parse_with_options(doc, &limited);
+    int tight = !over && json_get_error()->code == JSON_ERROR_LIMIT;
+    limited.max_bytes = usage * 20;
+    json_value *fits = json_parse_with_options(doc, &limited);
+    int roomy = fits && json_memory_usage(fits) == usage;
+    json_free(fits);
+    json_parse_options unlimited = {0};
+    fits = json_parse_with_options(doc, &unlimited);
+    roomy = roomy && fits;
+    json_free(fits);
+
+    if (!depth || !nodes || !strings || !containers) {
+        printf("  FAIL: Limit not enforced (%d %d %d %d): %s", depth, nodes, strings, containers,
+               json_get_last_error());
+    } else if (!held || usage != held) {
+        printf("  FAIL: Memory usage %zu for %zu bytes held\n", usage, held);
+    } else if (!tight || !roomy) {
+        printf("  FAIL: Memory limit applied wrongly (%d %d)\n", tight, roomy);
+    } else {
+        printf("  PASS: Limits enforced, %zu bytes held by the tree\n", usage);
+    }
+}
+
+/* Extended Test 27: Incremental re-parse */
+/* Applies one edit to the source and to a copy of its text, then checks
+ * the tree against a full parse of the copy; counts accepted edits */
+static int edits_accepted;
+
+static int edit_matches(json_source *src, char *shadow, size_t offset, size_t removed, const char *text) {
+    size_t len = strlen(text), total = strlen(shadow);
+    char *next = malloc(total - removed + len + 1);
+    memcpy(next, shadow, offset);
+    memcpy(next + offset, text, len);
+    strcpy(next + offset + len, shadow + offset + removed);
+
+    json_value *expected = json_parse(next);
+    int edited = json_source_edit(src, offset, removed, text, len);
+    edits_accepted += edited;
+    size_t n;
+    const char *now = json_source_text(src, &n);
+    int ok;
+    if (expected) {
+        ok = edited && strcmp(now, next) == 0 && json_equal(json_source_root(src), expected);
+        strcpy(shadow, next);
+    } else {
+        ok = !edited && strcmp(now, shadow) == 0;
+    }
+    json_free(expected);
+    free(next);
+    return ok;
+}
+
+void test_source_edits(void) {
+    printf("Test: Re-parse edited text, locally where possible\n");
+    char shadow[4096] = "{\"a\": [1, 2, {\"x\": true}], \"b\": {\"c\": [null, \"s\"]}, \"d\": [[1], [2]]}";
+    json_source *src = json_source_parse(shadow, strlen(shadow), NULL);
+    const json_value *root = json_source_root(src);
+    const json_value *b = json_object_get(root, "b");
+    const json_value *d0 = json_array_get(json_object_get(root, "d"), 0);
+
+    /* 1 -> 10 inside "a": "b" and "d" keep their nodes and move */
+    int local = edit_matches(src, shadow, 7, 1, "10") && json_source_root(src) == root &&
+                json_object_get(root, "b") == b && json_array_get(json_object_get(root, "d"), 0) == d0;
+    /* within "c" once "a" has grown: "b", not shared, is updated in place */
+    const char *c = strstr(shadow, "null");
+    local = local && edit_matches(src, shadow, (size_t)(c - shadow), 4, "false") && json_object_get(root, "b") == b &&
+            json_array_get(json_object_get(root, "d"), 0) == d0;
+    /* a clone shares "b", which the next edit copies: the clone keeps the old values */
+    json_value *copy = json_clone(root);
+    json_value *before = json_parse(shadow);
+    c = strstr(shadow, "\"s\"");
+    local = local && edit_matches(src, shadow, (size_t)(c - shadow) + 1, 1, "t") && json_object_get(root, "b") != b &&
+            json_equal(copy, before) && !json_equal(copy, json_source_root(src));
+    json_free(before);
+    json_free(copy);
+    /* splitting "a" takes a full parse; breaking the text is undone */
+    c = strstr(shadow, "2, {");
+    int whole = edit_matches(src, shadow, (size_t)(c - shadow) + 1, 2, "], \"e\": [") &&
+                json_object_get(json_source_root(src), "e");
+    int undone = edit_matches(src, shadow, 5, 0, "}") && edit_matches(src, shadow, strlen(shadow) - 1, 1, "");
+
+    /* random edits from fragments, most of them invalid */
+    static const char *fragments[] = {"", "1", "-2.5", "\"k\"", "[]", "{}", "[3, [4]]", "{\"k\": [5]}",
+                                      ",", ":", " ", "[", "]", "{", "}", "\"", "null", "\"q\": 0, "};
+    const size_t nfragments = sizeof(fragments) / sizeof(fragments[0]);
+    unsigned seed = 27;
+    int random = 1;
+    edits_accepted = 0;
+    for (int i = 0; i < 5000 && random; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t total = strlen(shadow);
+        size_t offset = (seed >> 8) % (total + 1);
+        size_t removed = (seed >> 20) % 4;
+        if (removed > total - offset) removed = total - offset;
+        const char *text = fragments[(seed >> 4) % nfragments];
+        if (total + strlen(text) >= sizeof(shadow)) removed = total - offset;
+        random = edit_matches(src, shadow, offset, removed, text);
+    }
+    json_source_free(src);
+
+    if (!local) {
+        printf("  FAIL: Local edit replaced untouched nodes\n");
+    } else if (!whole || !undone) {
+        printf("  FAIL: Structural or invalid edit mishandled (%d %d)\n", whole, undone);
+    } else if (!random) {
+        printf("  FAIL: Random edit diverged from a full parse: %s\n", shadow);
+    } else {
+        printf("  PASS: Edits re-parsed in place, %d random edits accepted\n", edits_accepted);
+    }
+}
+
+/* Extended Test 28: JSON Lines from many threads */
+struct lines_producer {
+    json_lines *lines;
+    int thread;
+    int count;
+};
+
+/* Writes records {"thread": t, "seq": i}, as trees and as events in turn */
+static void *produce_lines(void *arg) {
+    struct lines_producer *p = arg;
+    for (int i = 0; i < p->count; i++) {
+        if (i % 2) {
+            json_writer *w = json_lines_begin(p->lines);
+            json_writer_begin_object(w);
+            json_writer_key(w, "thread");
+            json_writer_number(w, p->thread);
+            json_writer_key(w, "seq");
+            json_writer_number(w, i);
+            json_writer_end_object(w);
+            json_lines_commit(p->lines);
+        } else {
+            json_value *v = json_new_object();
+            json_object_set(v, "thread", json_new_number(p->thread));
+            json_object_set(v, "seq", json_new_number(i));
+            json_lines_write(p->lines, v);
+            json_free(v);
+        }
+    }
+    return NULL;
+}
+
+void test_json_lines(void) {
+    printf("Test: Write JSON Lines from several threads\n");
+    enum { THREADS = 4, COUNT = 5000 };
+    char path[] = "/tmp/json_lines_XXXXXX";
+    int fd = mkstemp(path);
+    json_lines_options small = {.ring_size = 64, .batch_bytes = 4096};
+    json_lines *lines = json_lines_new(fd, &small);
+    pthread_t threads[THREADS];
+    struct lines_producer producers[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        producers[t] = (struct lines_producer){lines, t, COUNT};
+        pthread_create(&threads[t], NULL, produce_lines, &producers[t]);
+    }
+    for (int t = 0; t < THREADS; t++) pthread_join(threads[t], NULL);
+
+    /* an incomplete record is refused and leaves nothing behind */
+    json_writer *w = json_lines_begin(lines);
+    json_writer_begin_array(w);
+    int refused = !json_lines_commit(lines);
+    int flushed = json_lines_flush(lines);
+    json_lines_stats stats = json_lines_get_stats(lines);
+    int closed = json_lines_close(lines);
+
+    /* every line parses, and the records of a thread come in order */
+    struct stat st;
+    fstat(fd, &st);
+    char *text = malloc((size_t)st.st_size + 1);
+    ssize_t got = pread(fd, text, (size_t)st.st_size, 0);
+    text[got > 0 ? got : 0] = '\0';
+    int next[THREADS] = {0};
+    int ordered = got == st.st_size && (size_t)st.st_size == stats.bytes;
+    for (char *line = text, *eol; ordered && (eol = strchr(line, '\n')); line = eol + 1) {
+        *eol = '\0';
+        json_value *v = json_parse(line);
+        int t = v ? (int)json_get_number(json_object_get(v, "thread")) : -1;
+        ordered = t >= 0 && t < THREADS && json_get_number(json_object_get(v, "seq")) == next[t]++;
+        json_free(v);
+    }
+    for (int t = 0; t < THREADS; t++) ordered = ordered && next[t] == COUNT;
+    free(text);
+    close(fd);
+    unlink(path);
+
+    /* with the flusher stuck on a full pipe, the ring fills and records are dropped */
+    int pipefd[2];
+    size_t junk = 0;
+    char block[4096] = {0};
+    if (pipe(pipefd) != 0) return;
+    fcntl(pipefd[1], F_SETFL, O_NONBLOCK);
+    for (ssize_t n; (n = write(pipefd[1], block, sizeof(block))) > 0;) junk += (size_t)n;
+    fcntl(pipefd[1], F_SETFL, 0);
+    json_lines_options dropping = {.ring_size = 8, .drop_when_full = 1};
+    lines = json_lines_new(pipefd[1], &dropping);
+    json_value *record = json_parse("{\"k\": 1}");
+    int accepted = 0;
+    for (int i = 0; i < 100; i++) accepted += json_lines_write(lines, record);
+    json_free(record);
+    json_lines_stats full = json_lines_get_stats(lines);
+    for (ssize_t n; junk && (n = read(pipefd[0], block, junk < sizeof(block) ? junk : sizeof(block))) > 0;) {
+        junk -= (size_t)n;
+    }
+    json_lines_close(lines);
+    close(pipefd[1]);
+    int delivered = 0;
+    for (ssize_t n; (n = read(pipefd[0], block, sizeof(block))) > 0;) {
+        for (ssize_t i = 0; i < n; i++) delivered += block[i] == '\n';
+    }
+    close(pipefd[0]);
+
+    if (!lines || !refused || !flushed || !closed) {
+        printf("  FAIL: Writer misbehaved (%d %d %d): %s", refused, flushed, closed, json_get_last_error());
+    } else if (!ordered || stats.records != THREADS * COUNT || stats.dropped) {
+        printf("  FAIL: Records lost or out of order (%zu published, %zu dropped)\n", stats.records, stats.dropped);
+    } else if (accepted == 100 || full.dropped != (size_t)(100 - accepted) || delivered != accepted) {
+        printf("  FAIL: Dropping went wrong: %d accepted, %zu dropped, %d delivered\n", accepted, full.dropped,
+               delivered);
+    } else {
+        printf("  PASS: %d records in %zu writes, %d of 100 dropped on a full ring\n", THREADS * COUNT,
+               stats.writes, 100 - accepted);
+    }
+}
+
+/* Extended Test 29: Compressed input */
+struct compressed_documents {
+    long count;
+    int ordered;
+    size_t stop_at;  /* index after which to stop, 0 for never */
+};
+
+/* Checks that document i has member "i" equal to i */
+static int check_document(void *user, size_t index, json_value *value) {
+    struct compressed_documents *d = user;
+    d->ordered = d->ordered && json_get_number(json_object_get(value, "i")) == (double)index;
+    d->count++;
+    json_free(value);
+    return index + 1 != d->stop_at;
+}
+
+static int count_document(void *user, size_t index, json_value *value) {
+    (void)index;
+    json_value **last = user;
+    json_free(*last);
+    *last = value;
+    return 1;
+}
+
+void test_compressed_input(void) {
+    printf("Test: Parse gzip-compressed NDJSON while it is decompressed\n");
+    enum { LINES = 20000 };
+    char gz[] = "/tmp/json_gz_XXXXXX";
+    close(mkstemp(gz));
+    /* two gzip members, brackets and newlines inside strings, blank lines */
+    for (int member = 0; member < 2; member++) {
+        gzFile f = gzopen(gz, member ? "ab" : "wb");
+        for (int i = member * LINES / 2; i < (member + 1) * LINES / 2; i++) {
+            gzprintf(f, "{\"i\": %d, \"s\": \"a\\\"b\\\\n{[\\n\", \"list\": [%d, {\"x\": \"}]\"}]}\n%s", i, i,
+                     i % 1000 ? "" : "\n  \n");
+        }
+        gzclose(f);
+    }
+    /* small buffers: documents straddle them */
+    json_decompress_options small = {.buffer_size = 4096, .buffers = 2};
+    struct compressed_documents all = {0, 1, 0};
+    long parsed = json_parse_compressed_file(gz, &small, check_document, &all);
+    struct compressed_documents some = {0, 1, 10};
+    long stopped = json_parse_compressed_file(gz, NULL, check_document, &some);
+
+    /* a truncated file is an error */
+    char cut[] = "/tmp/json_gz_cut_XXXXXX";
+    int out = mkstemp(cut), in = open(gz, O_RDONLY);
+    struct stat st;
+    fstat(in, &st);
+    char *bytes = malloc((size_t)st.st_size);
+    int copied = read(in, bytes, (size_t)st.st_size) == st.st_size &&
+                 write(out, bytes, (size_t)st.st_size / 2) == st.st_size / 2;
+    free(bytes);
+    close(in);
+    close(out);
+    struct compressed_documents partial = {0, 1, 0};
+    int truncated = copied && json_parse_compressed_file(cut, NULL, check_document, &partial) == -1 &&
+                    partial.count > 0 && partial.ordered;
+    unlink(cut);
+    unlink(gz);
+
+    /* plain text: one document over many lines, then an error at a known offset */
+    const char *pretty = "{\n  \"a\": [\n    1,\n    \"x\\ny\"\n  ],\n  \"b\": {\n    \"c\": null\n  }\n}\n";
+    int fds[2];
+    json_value *last = NULL;
+    long single = -1;
+    if (pipe(fds) == 0) {
+        int written = write(fds[1], pretty, strlen(pretty)) == (ssize_t)strlen(pretty);
+        close(fds[1]);
+        json_decompress_options tiny = {.buffer_size = 7};
+        if (written) single = json_parse_compressed_fd(fds[0], &tiny, count_document, &last);
+        close(fds[0]);
+    }
+    json_value *expected = json_parse(pretty);
+    int same = single == 1 && json_equal(last, expected);
+    json_free(expected);
+    json_free(last);
+    last = NULL;
+
+    const char *broken = "[1]\n[2]\n[3,]\n[4]\n";
+    long failed = 0;
+    if (pipe(fds) == 0) {
+        int written = write(fds[1], broken, strlen(broken)) == (ssize_t)strlen(broken);
+        close(fds[1]);
+        if (written) failed = json_parse_compressed_fd(fds[0], NULL, count_document, &last);
+        close(fds[0]);
+    }
+    int located = failed == -1 && json_get_error()->offset == 11 && last && json_array_get(last, 0) &&
+                  json_get_number(json_array_get(last, 0)) == 2;
+    json_free(last);
+
+    if (parsed != LINES || all.count != LINES || !all.ordered) {
+        printf("  FAIL: %ld documents parsed of %d: %s", parsed, LINES, json_get_last_error());
+    } else if (stopped != 10 || some.count != 10) {
+        printf("  FAIL: Callback could not stop the reading (%ld)\n", stopped);
+    } else if (!truncated) {
+        printf("  FAIL: Truncated input not reported\n");
+    } else if (!same || !located) {
+        printf("  FAIL: Plain input mishandled (%d %d)\n", same, located);
+    } else {
+        printf("  PASS: %d documents from two gzip members through 4 KB buffers\n", LINES);
+    }
+}
+
+/* Extended Test 30: Images shared between processes */
+
+/* Whether image holds the document built below for version */
+static int check_image(const json_image *image, int version) {
+    const json_image_value *root = json_image_root(image);
+    const json_image_value *records = json_image_object_get(root, "records");
+    const json_image_value *third = records ? json_image_array_get(records, 3) : NULL;
+    const json_image_value *name = third ? json_image_object_get(third, "name") : NULL;
+    const json_image_value *wide = json_image_object_get(root, "wide");
+    const json_image_value *k17 = wide ? json_image_object_get(wide, "k17") : NULL;
+    const json_image_value *samples = json_image_object_get(root, "samples");
+    const json_image_value *last = samples ? json_image_array_get(samples, 99) : NULL;
+    json_image_member first;
+    return json_image_get_type(root) == JSON_OBJECT && records && json_image_size(records) == 50 && name &&
+           strcmp(json_image_get_string(name), "user3") == 0 && json_image_get_string_length(name) == 5 &&
+           json_image_get_boolean(json_image_object_get(third, "active")) == 0 &&
+           json_image_get_number(json_image_object_get(root, "version")) == version && k17 &&
+           json_image_get_number(k17) == 17 && !json_image_object_get(wide, "k99") &&
+           json_get_error()->code == JSON_ERROR_NOT_FOUND && last && json_image_get_number(last) == 99.5 &&
+           !json_image_array_get(samples, 100) && json_image_object_at(wide, 0, &first) &&
+           strcmp(first.key, "k29") == 0 && json_image_get_number(first.value) == 29;
+}
+
+static json_value *image_document(int version) {
+    json_value *doc = json_new_object();
+    json_object_set(doc, "version", json_new_number(version));
+    json_value *records = json_new_array();
+    for (int i = 0; i < 50; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "user%d", i);
+        json_value *r = json_new_object();
+        json_object_set(r, "name", json_new_string(name));
+        json_object_set(r, "active", json_new_boolean(i % 2 == 0));
+        json_object_set(r, "note", json_new_null());
+        json_array_append(records, r);
+    }
+    json_object_set(doc, "records", records);
+    /* members out of order, more than are scanned */
+    json_value *wide = json_new_object();
+    for (int i = 29; i >= 0; i--) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        json_object_set(wide, key, json_new_number(i));
+    }
+    json_object_set(doc, "wide", wide);
+    return doc;
+}
+
+void test_shared_images(void) {
+    printf("Test: Publish a document as an image and read it from another process\n");
+    char path[] = "/tmp/json_image_XXXXXX";
+    close(mkstemp(path));
+    unlink(path);
+
+    /* a packed array of numbers among the rest */
+    json_value *doc = image_document(1);
+    char samples[1024] = "[";
+    for (int i = 0; i < 100; i++)
+        snprintf(samples + strlen(samples), sizeof(samples) - strlen(samples), "%s%d.5", i ? "," : "", i);
+    strcat(samples, "]");
+    json_object_set(doc, "samples", json_parse(samples));
+
+    uint64_t first = json_image_publish(doc, path);
+    json_image *image = json_image_attach(path);
+    int read = first == 1 && image && json_image_generation(image) == 1 && check_image(image, 1) &&
+               !json_image_stale(image);
+
+    /* a child attaches the same file */
+    pid_t child = fork();
+    if (child == 0) {
+        json_image *mine = json_image_attach(path);
+        _exit(mine && check_image(mine, 1) ? 0 : 1);
+    }
+    int status = -1;
+    int shared = child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    /* a copy is an ordinary tree */
+    json_value *copy = image ? json_image_copy(json_image_root(image)) : NULL;
+    int copied = copy && json_equal(copy, doc);
+    json_free(copy);
+
+    /* the next generation replaces the file; the attached one is unchanged */
+    json_value *next = image_document(2);
+    json_object_set(next, "samples", json_parse(samples));
+    uint64_t second = json_image_publish(next, path);
+    json_image *newer = json_image_attach(path);
+    int swapped = second == 2 && image && json_image_stale(image) && check_image(image, 1) && newer &&
+                  json_image_generation(newer) == 2 && check_image(newer, 2) && !json_image_stale(newer);
+    json_free(next);
+    json_free(doc);
+    json_image_detach(image);
+    json_image_detach(newer);
+
+    /* anything else is refused */
+    int refused = json_image_attach("/dev/null") == NULL && json_image_attach(path + 1) == NULL;
+    unlink(path);
+
+    if (!read) {
+        printf("  FAIL: Image not read back: %s", json_get_last_error());
+    } else if (!shared) {
+        printf("  FAIL: Image not read by another process\n");
+    } else if (!copied) {
+        printf("  FAIL: Copy of the image differs from the document\n");
+    } else if (!swapped) {
+        printf("  FAIL: Generations not swapped\n");
+    } else if (!refused) {
+        printf("  FAIL: A file that is not an image was attached\n");
+    } else {
+        printf("  PASS: Image read in place by two processes across two generations\n");
+    }
+}
+
+/* Extended Test 31: Queries over NDJSON */
+
+/* Output of query on text, fed in one go with threads; NULL on failure.
+ * The caller frees it. */
+static char *query_output(const char *query, const char *text, size_t len, unsigned threads) {
+    json_query *q = json_query_compile(query);
+    json_query_run *run = q ? json_query_start(q) : NULL;
+    char *copy = NULL;
+    if (run && json_query_feed(run, text, len, threads) && json_query_finish(run)) {
+        size_t out_len;
+        const char *out = json_query_output(run, &out_len);
+        copy = malloc(out_len + 1);
+        memcpy(copy, out, out_len);
+        copy[out_len] = '\0';
+    }
+    json_query_run_free(run);
+    json_query_free(q);
+    return copy;
+}
+
+static int query_gives(const char *query, const char *text, const char *expected) {
+    char *out = query_output(query, text, strlen(text), 1);
+    int same = out && strcmp(out, expected) == 0;
+    if (!same) printf("  %s gave %s", query, out ? out : "nothing\n");
+    free(out);
+    return same;
+}
+
+void test_queries(void) {
+    printf("Test: Filter and aggregate NDJSON records without parsing them into trees\n");
+    const char *logs =
+        "{\"id\": 1, \"method\": \"GET\", \"status\": 200, \"ms\": 12.5, \"user\": {\"name\": \"ann\", \"tags\": [\"a\", \"b\"]}}\n"
+        "\n"
+        "{\"id\": 2, \"method\": \"POST\", \"status\": 503, \"ms\": 80, \"user\": {\"name\": \"b\\u00e9a\"}}\n"
+        "  {\"id\": 3, \"method\": \"GET\", \"status\": 500, \"ms\": 3, \"user\": null, \"status\": 200}\n"
+        "{\"id\": 4, \"method\": \"G\\u0045T\", \"status\": \"504\", \"note\": [1, {\"x\": 2}]}\n";
+    int ok = query_gives("select(.status >= 500) | .id", logs, "2\n3\n4\n") &&
+             query_gives("select(.method == \"GET\" and .status != 200) | {id, who: .user.name}", logs,
+                         "{\"id\":3,\"who\":null}\n{\"id\":4,\"who\":null}\n") &&
+             query_gives("select(.user.name == \"béa\" or .user.tags[1] == \"b\") | [.id, .user.tags[0]]", logs,
+                         "[1,\"a\"]\n[2,null]\n") &&
+             query_gives("select(not .user) | .note", logs, "null\n[1, {\"x\": 2}]\n") &&
+             query_gives("select(.note[1].x == 2 or .id == 2) | .[\"id\"]", logs, "2\n4\n") &&
+             query_gives("select(.id > 1) | select(.ms) | .", logs,
+                         "{\"id\": 2, \"method\": \"POST\", \"status\": 503, \"ms\": 80, \"user\": {\"name\": \"b\\u00e9a\"}}\n"
+                         "{\"id\": 3, \"method\": \"GET\", \"status\": 500, \"ms\": 3, \"user\": null, \"status\": 200}\n") &&
+             query_gives("{n: count, total: sum(.ms), low: min(.ms), high: max(.ms), none: max(.missing)}", logs,
+                         "{\"n\":4,\"total\":95.5,\"low\":3,\"high\":80,\"none\":null}\n") &&
+             query_gives("select(.id == 9) | count", logs, "0\n");
+
+    /* errors: in the query at its offset, in a record at its offset with
+     * nothing of the buffer output */
+    json_query *bad = json_query_compile("select(.a >) | .b");
+    int rejected = !bad && json_get_error()->code == JSON_ERROR_SYNTAX && json_get_error()->offset == 11 &&
+                   !json_query_compile("{a, n: count}") && !json_query_compile("select(.a) | .b | .c");
+    json_query *q = json_query_compile(".id");
+    json_query_run *run = json_query_start(q);
+    const char *broken = "{\"id\": 1}\n{\"id\": 2,}\n";
+    size_t out_len = 1;
+    int failed = !json_query_feed(run, broken, strlen(broken), 1) && json_get_error()->offset == 19 &&
+                 json_query_output(run, &out_len) && out_len == 0 && json_query_records(run) == 0;
+    json_query_run_free(run);
+    json_query_free(q);
+    /* and aggregates past the range of a double, which have no text */
+    const char *huge = "{\"x\": 1e308}\n{\"x\": 1e308}\n{\"y\": -1e400}\n";
+    failed = failed && !query_output("{total: sum(.x)}", huge, strlen(huge), 1) &&
+             json_get_error()->code == JSON_ERROR_OTHER && !query_output("min(.y)", huge, strlen(huge), 1);
+    char *finite = query_output("{n: count, low: min(.x)}", huge, strlen(huge), 1);
+    failed = failed && finite && strcmp(finite, "{\"n\":3,\"low\":1e+308}\n") == 0;
+    free(finite);
+
+    /* the same answers from several threads, in the same order */
+    size_t cap = 1 << 20, len = 0;
+    char *big = malloc(cap);
+    for (int i = 0; len + 100 < cap; i++)
+        len += (size_t)snprintf(big + len, cap - len, "{\"i\": %d, \"v\": %d, \"s\": \"x%d\"}\n", i, i % 7, i % 3);
+    char *one = query_output("select(.v > 2 and .s != \"x1\") | {i, s}", big, len, 1);
+    char *four = query_output("select(.v > 2 and .s != \"x1\") | {i, s}", big, len, 4);
+    char *sum1 = query_output("{n: count, total: sum(.i)}", big, len, 1);
+    char *sum4 = query_output("{n: count, total: sum(.i)}", big, len, 4);
+    int parallel = one && four && strlen(one) > 1000 && strcmp(one, four) == 0 && sum1 && sum4 && strcmp(sum1, sum4) == 0;
+    free(one);
+    free(four);
+    free(sum1);
+    free(sum4);
+    free(big);
+
+    if (!ok) {
+        printf("  FAIL: Wrong output\n");
+    } else if (!rejected || !failed) {
+        printf("  FAIL: Errors not reported (%d %d)\n", rejected, failed);
+    } else if (!parallel) {
+        printf("  FAIL: Threads changed the output\n");
+    } else {
+        printf("  PASS: Paths, comparisons, projections and aggregates, on one thread or four\n");
+    }
+}
+
+/* Extended Test 32: Numbers kept as written */
+void test_lazy_numbers(void) {
+    printf("Test: Convert numbers on first access and write them back as written\n");
+    const char *doc = "{\"id\":9007199254740993,\"price\":19.90,\"huge\":12345678901234567891,"
+                      "\"tiny\":1.2345678901234567890123e-300,\"list\":[1,2.50,-0,1E2],\"min\":-9223372036854775808}";
+    json_parse_options lazy = {.lazy_numbers = 1};
+    /* texts too long for the node are counted */
+    size_t live = 0;
+    json_allocator sized = {sized_alloc, sized_realloc, sized_free, &live};
+    json_set_allocator(&sized);
+    json_value *v = json_parse_with_options(doc, &lazy);
+    size_t held = live;
+    size_t usage = json_memory_usage(v);
+    json_free(v);
+    json_set_allocator(NULL);
+
+    v = json_parse_with_options(doc, &lazy);
+    json_value *eager = json_parse(doc);
+    if (!v || !eager) {
+        printf("  FAIL: Parse failed: %s", json_get_last_error());
+        json_free(v);
+        json_free(eager);
+        return;
+    }
+
+    char *out = json_serialize(v);
+    size_t len = 0;
+    json_value *price = json_object_get(v, "price");
+    const char *text = json_get_number_text(price, &len);
+    int texts = text && len == 5 && strcmp(text, "19.90") == 0 &&
+                !json_get_number_text(json_object_get(eager, "price"), NULL);
+    int converted = json_get_number(price) == 19.9 && json_get_number(price) == 19.9 &&
+                    json_get_number(json_object_get(v, "tiny")) == 1.2345678901234567890123e-300;
+
+    int64_t id = 0, min = 0, rounded = 0, hundred = 0, none = 0;
+    int integers = json_get_int64(json_object_get(v, "id"), &id) && id == 9007199254740993LL &&
+                   json_get_int64(json_object_get(eager, "id"), &rounded) && rounded == 9007199254740992LL &&
+                   json_get_int64(json_object_get(v, "min"), &min) && min == INT64_MIN &&
+                   json_get_int64(json_array_get(json_object_get(v, "list"), 3), &hundred) && hundred == 100 &&
+                   !json_get_int64(json_object_get(v, "huge"), &none) &&
+                   !json_get_int64(json_array_get(json_object_get(v, "list"), 1), &none);
+    int same = json_equal(v, eager) && json_hash(v) == json_hash(eager);
+
+    if (!out || strcmp(out, doc) != 0) {
+        printf("  FAIL: Written back as %s\n", out ? out : "(null)");
+    } else if (!texts || !converted) {
+        printf("  FAIL: Number text or conversion wrong (%d %d)\n", texts, converted);
+    } else if (!integers) {
+        printf("  FAIL: Integers read wrongly: %lld %lld %lld\n", (long long)id, (long long)min, (long long)rounded);
+    } else if (!same) {
+        printf("  FAIL: Not equal to the same document parsed eagerly\n");
+    } else if (!held || usage != held) {
+        printf("  FAIL: Memory usage %zu for %zu bytes held\n", usage, held);
+    } else {
+        printf("  PASS: Numbers written back byte for byte, integers exact past 2^53\n");
+    }
+    free(out);
+    json_free(v);
+    json_free(eager);
+}
+
+/* Extended Test 33: Containers allocated at their size */
+
+static void *growth_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+/* counts the blocks that grow */
+static void *growth_realloc(void *ctx, void *ptr, size_t size) {
+    if (ptr) (*(size_t *)ctx)++;
+    return realloc(ptr, size);
+}
+
+static void growth_free(void *ctx, void *ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+void test_container_reserve(void) {
+    printf("Test: Allocate containers once, at their size\n");
+    /* a wide array, objects small and large, and empty containers */
+    size_t cap = 64 * 1024, len = 0;
+    char *doc = malloc(cap);
+    len += (size_t)snprintf(doc + len, cap - len, "{\"empty\": [], \"none\": {}, \"wide\": [");
+    for (int i = 0; i < 2000; i++) len += (size_t)snprintf(doc + len, cap - len, "%s\"s%d\"", i ? ", " : "", i);
+    len += (size_t)snprintf(doc + len, cap - len, "], \"big\": {");
+    for (int i = 0; i < 40; i++) len += (size_t)snprintf(doc + len, cap - len, "%s\"k%d\": [%d, true]", i ? ", " : "", i, i);
+    snprintf(doc + len, cap - len, "}, \"small\": {\"a\": null}}");
+
+    size_t reallocs = 0;
+    json_allocator growth = {growth_alloc, growth_realloc, growth_free, &reallocs};
+    json_set_allocator(&growth);
+    json_value *v = json_parse(doc);
+    size_t parse_reallocs = reallocs;
+    json_free(v);
+
+    /* the same three strings parsed and built with a reservation */
+    json_value *parsed = json_parse("[\"x\", \"y\", \"z\"]");
+    json_value *built = json_new_array();
+    int reserved = json_array_reserve(built, 3);
+    for (int i = 0; i < 3; i++) json_array_append(built, json_new_string(i == 0 ? "x" : i == 1 ? "y" : "z"));
+    int exact = parsed && json_equal(parsed, built) && json_memory_usage(parsed) == json_memory_usage(built);
+
+    reallocs = 0;
+    json_value *object = json_new_object();
+    reserved = reserved && json_object_reserve(object, 20);
+    char key[8];
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        json_object_set(object, key, json_new_number(i));
+    }
+    size_t build_reallocs = reallocs;
+    int wrong_type = !json_array_reserve(object, 4) && json_get_error()->code == JSON_ERROR_TYPE;
+    json_free(parsed);
+    json_free(built);
+    json_free(object);
+    json_set_allocator(NULL);
+    free(doc);
+
+    if (!v) {
+        printf("  FAIL: Parse failed\n");
+    } else if (parse_reallocs || build_reallocs) {
+        printf("  FAIL: %zu blocks grown while parsing, %zu while building\n", parse_reallocs, build_reallocs);
+    } else if (!reserved || !exact || !wrong_type) {
+        printf("  FAIL: Reservation wrong (%d %d %d)\n", reserved, exact, wrong_type);
+    } else {
+        printf("  PASS: No container grown while parsing or after a reservation\n");
+    }
+}
+
+/* Extended Test 34: Hot reload of a published document */
+
+#define RELOAD_VERSIONS 300
+
+static json_value *config_version(int version) {
+    char text[128];
+    snprintf(text, sizeof(text), "{\"version\": %d, \"check\": %d, \"name\": \"v%d\", \"list\": [%d]}", version,
+             version * 3, version, version);
+    return json_parse(text);
+}
+
+/* Reads versions until the last one, counting those found inconsistent
+ * or older than one read before */
+static void *reload_reader(void *arg) {
+    json_published *published = arg;
+    json_reader *reader = json_reader_new(published);
+    size_t bad = 0;
+    int last = 0;
+    char name[16];
+    while (last < RELOAD_VERSIONS) {
+        const json_value *doc = json_read_begin(reader);
+        int version = (int)json_get_number(json_object_get(doc, "version"));
+        snprintf(name, sizeof(name), "v%d", version);
+        if (version < last || json_get_number(json_object_get(doc, "check")) != version * 3 ||
+            strcmp(json_get_string(json_object_get(doc, "name")), name) != 0 ||
+            json_get_number(json_array_get(json_object_get(doc, "list"), 0)) != version) {
+            bad++;
+        }
+        json_read_end(reader);
+        last = version;
+    }
+    json_reader_free(reader);
+    return (void *)bad;
+}
+
+static void *reload_publish(void *arg) {
+    json_publish(arg, config_version(RELOAD_VERSIONS + 1));
+    return NULL;
+}
+
+void test_hot_reload(void) {
+    printf("Test: Replace a document while threads read it\n");
+    json_published *published = json_published_new(config_version(0));
+    pthread_t readers[4];
+    for (int i = 0; i < 4; i++) pthread_create(&readers[i], NULL, reload_reader, published);
+    for (int v = 1; v <= RELOAD_VERSIONS; v++) {
+        json_publish(published, config_version(v));
+        if (v % 16 == 0) sched_yield();
+    }
+    size_t bad = 0;
+    for (int i = 0; i < 4; i++) {
+        void *result;
+        pthread_join(readers[i], &result);
+        bad += (size_t)result;
+    }
+    json_published_synchronize(published);
+    size_t left = json_published_pending(published);
+
+    /* a version replaced during a section stays until the section ends */
+    json_reader *reader = json_reader_new(published);
+    const json_value *held = json_read_begin(reader);
+    pthread_t writer;
+    pthread_create(&writer, NULL, reload_publish, published);
+    pthread_join(writer, NULL);
+    size_t kept = json_published_pending(published);
+    int intact = json_get_number(json_object_get(held, "version")) == RELOAD_VERSIONS;
+    json_read_end(reader);
+    json_published_synchronize(published);
+    const json_value *now = json_read_begin(reader);
+    int current = json_get_number(json_object_get(now, "version")) == RELOAD_VERSIONS + 1;
+    json_read_end(reader);
+    json_reader_free(reader);
+    size_t freed = json_published_pending(published);
+    json_published_free(published);
+
+    if (bad) {
+        printf("  FAIL: %zu reads saw an inconsistent or older version\n", bad);
+    } else if (left || freed) {
+        printf("  FAIL: Versions left after synchronizing (%zu %zu)\n", left, freed);
+    } else if (kept != 1 || !intact || !current) {
+        printf("  FAIL: Version held by a reader freed or replaced wrongly (%zu %d %d)\n", kept, intact, current);
+    } else {
+        printf("  PASS: %d versions published under 4 readers, each freed after its readers left\n",
+               RELOAD_VERSIONS);
+    }
+}
+
 /* Main: Run all extended tests */
 int main(void) {
     printf("Running Extended JSON Library Tests...\n\n");
@@ -130,6 +2090,96 @@ int main(void) {
     printf("\n-------------------------\n\n");
     
     test_varied_valid_json();
+    printf("\n-------------------------\n\n");
+
+    test_serialize_round_trip();
+    printf("\n-------------------------\n\n");
+
+    test_streaming_writer();
+    printf("\n-------------------------\n\n");
+
+    test_writer_misuse();
+    printf("\n-------------------------\n\n");
+
+    test_writer_fd();
+    printf("\n-------------------------\n\n");
+
+    test_clone_copy_on_write();
+    printf("\n-------------------------\n\n");
+
+    test_json_patch();
+    printf("\n-------------------------\n\n");
+
+    test_merge_patch();
+    printf("\n-------------------------\n\n");
+
+    test_array_insert_remove();
+    printf("\n-------------------------\n\n");
+
+    test_equal_hash();
+    printf("\n-------------------------\n\n");
+
+    test_json_diff();
+    printf("\n-------------------------\n\n");
+
+    test_json_validate();
+    printf("\n-------------------------\n\n");
+
+    test_projected_parse();
+    printf("\n-------------------------\n\n");
+
+    test_iterators();
+    printf("\n-------------------------\n\n");
+
+    test_duplicate_keys();
+    printf("\n-------------------------\n\n");
+
+    test_json_index();
+    printf("\n-------------------------\n\n");
+
+    test_packed_arrays();
+    printf("\n-------------------------\n\n");
+
+    test_columns();
+    printf("\n-------------------------\n\n");
+
+    test_ingest();
+    printf("\n-------------------------\n\n");
+
+    test_allocators();
+    printf("\n-------------------------\n\n");
+
+    test_structured_errors();
+    printf("\n-------------------------\n\n");
+
+    test_kernels();
+    printf("\n-------------------------\n\n");
+
+    test_parse_limits();
+    printf("\n-------------------------\n\n");
+
+    test_source_edits();
+    printf("\n-------------------------\n\n");
+
+    test_json_lines();
+    printf("\n-------------------------\n\n");
+
+    test_compressed_input();
+    printf("\n-------------------------\n\n");
+
+    test_shared_images();
+    printf("\n-------------------------\n\n");
+
+    test_queries();
+    printf("\n-------------------------\n\n");
+
+    test_lazy_numbers();
+    printf("\n-------------------------\n\n");
+
+    test_container_reserve();
+    printf("\n-------------------------\n\n");
+
+    test_hot_reload();
     printf("\nAll extended tests completed.\n");
     
     return 0;
@@ -120,6 +120,47 @@ void assert_token_values(const char* json, const char* expected_values[], int nu
     freeTokenList(list);
 }
 
+/* Walks an object and a nested array with the token cursors */
+void assert_token_iterators(const char* test_name) {
+    printf("Running test: %s\n", test_name);
+
+    const char *json = "{\"a\":1,\"list\":[[1,2],{\"x\":[]},\"s\"],\"b\":{}}";
+    const char *keys[] = {"a", "list", "b"};
+    enum JSONTokenType items[] = {OPEN_SQUARE_BRACKET, OPEN_CURLY_BRACKET, STRING};
+    struct JSONTokenList* list = buildTokenList(json, strlen(json));
+    assert(list);
+
+    int n = 0;
+    struct JSONTokenNode *array = NULL;
+    json_token_iter it = json_token_object_iter_begin(list->head);
+    for (const json_token_member *m; (m = json_token_object_iter_next(&it)); n++) {
+        if (n >= 3 || m->key_len != strlen(keys[n]) || strcmp(m->key, keys[n]) != 0) {
+            printf("ERROR: Unexpected member %d\n", n);
+            printf("TEST FAILED: %s\n\n", test_name);
+            exit(EXIT_FAILURE);
+        }
+        if (n == 1) array = m->value;
+    }
+
+    int i = 0;
+    it = json_token_array_iter_begin(array);
+    for (struct JSONTokenNode *item; (item = json_token_array_iter_next(&it)); i++) {
+        if (i >= 3 || item->token.type != items[i]) {
+            printf("ERROR: Unexpected item %d\n", i);
+            printf("TEST FAILED: %s\n\n", test_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n != 3 || i != 3 || json_token_array_iter_next(&it) || json_token_array_iter_begin(list->head).next) {
+        printf("ERROR: Cursors did not stop where expected\n");
+        printf("TEST FAILED: %s\n\n", test_name);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("TEST PASSED: %s\n\n", test_name);
+    freeTokenList(list);
+}
+
 int main() {
     printf("=== JSON Tokenizer Tests ===\n\n");
     
@@ -198,7 +239,7 @@ int main() {
     assert_tokenize_success("{\"key\":\"\"}", "Empty String Value");
     
     /* Test 13: Very Long String */
-    char* long_string = malloc(10002); // 10000 chars + quotes + null terminator
+    char* long_string = malloc(10012); // {"long":" + 10000 chars + "} + null terminator
     if (!long_string) {
         printf("Failed to allocate memory for long string test\n");
         exit(EXIT_FAILURE);
@@ -303,6 +344,9 @@ int main() {
         "Invalid Escape Sequence"
     );
     
+    /* Test 29: Cursors over the token list */
+    assert_token_iterators("Token Cursors");
+    
     printf("All tests completed successfully!\n");
     return 0;
 }